@@ -1,5 +1,4 @@
-#pragma once
-
+#include <sdk-crypto/types.h>
 #include <sdk-meta/array.h>
 #include <sdk-meta/slice.h>
 #include <sdk-meta/types.h>
@@ -60,7 +59,7 @@ static Array<dword, 256> const CRC32_TABLE
         0x5d68'1b02L, 0x2a6f'2b94L, 0xb40b'be37L, 0xc30c'8ea1L, 0x5a05'df1bL,
         0x2d02'ef8dL };
 
-u32 crc32(Bytes data, u32 seed = 0xFFFF'FFFF) {
+u32 crc32(Bytes data, u32 seed) {
     u32 crc         = seed ^ 0xFFFF'FFFF;
     auto [buf, len] = data;
 
@@ -0,0 +1,43 @@
+#include <sdk-crypto/types.h>
+#include <sdk-meta/array.h>
+#include <sdk-meta/slice.h>
+#include <sdk-meta/types.h>
+
+namespace Sdk::Crypto {
+
+// The Fletcher sums of ZFS, over the data as host-order words. A trailing
+// partial word is ignored.
+
+Array<u64, 4> fletcher2(Bytes data) {
+    auto [buf, len] = data;
+    auto* words     = (u64 const*) buf;
+
+    u64 a0 = 0, a1 = 0, b0 = 0, b1 = 0;
+
+    for (usize i = 0; i + 1 < len / 8; i += 2) {
+        a0 += words[i];
+        a1 += words[i + 1];
+        b0 += a0;
+        b1 += a1;
+    }
+
+    return { a0, a1, b0, b1 };
+}
+
+Array<u64, 4> fletcher4(Bytes data) {
+    auto [buf, len] = data;
+    auto* words     = (u32 const*) buf;
+
+    u64 a = 0, b = 0, c = 0, d = 0;
+
+    for (usize i = 0; i < len / 4; i++) {
+        a += words[i];
+        b += a;
+        c += b;
+        d += c;
+    }
+
+    return { a, b, c, d };
+}
+
+} // namespace Sdk::Crypto
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <sdk-meta/array.h>
 #include <sdk-meta/slice.h>
 #include <sdk-meta/types.h>
 
@@ -7,6 +8,10 @@ namespace Sdk::Crypto {
 
 extern u32 crc32(Bytes data, u32 seed = 0xFFFF'FFFF);
 
+extern Array<u64, 4> fletcher2(Bytes data);
+
+extern Array<u64, 4> fletcher4(Bytes data);
+
 enum _ {
     Aes,
     Sha256,
@@ -22,7 +27,7 @@ template <_>
 u32 encode(Bytes data, u32 seed = 0);
 
 template <>
-u32 encode<Crc32>(Bytes data, u32 seed) {
+inline u32 encode<Crc32>(Bytes data, u32 seed) {
     return crc32(data, seed);
 }
 
@@ -0,0 +1,182 @@
+module;
+
+export module sdk.io:iobuf;
+
+import sdk;
+
+export namespace Realms::Io {
+
+/// Memory `IoBuf` segments point into. Kernel pages report their physical
+/// address so devices can transfer straight to and from them.
+struct IoPage {
+    static constexpr usize SIZE = 4096;
+
+    virtual ~IoPage() = default;
+
+    virtual byte* buf() = 0;
+
+    virtual usize len() const = 0;
+
+    /// Physical address of the first byte, zero when there is none.
+    virtual uflat phys() const { return 0; }
+};
+
+/// A page from the heap, for buffers nothing else provides memory for.
+struct HeapPage : IoPage {
+    byte _buf[SIZE] {};
+
+    byte* buf() override { return _buf; }
+
+    usize len() const override { return SIZE; }
+};
+
+/// Bytes spread over shared pages, as a chain of views into them. Slicing,
+/// splitting and appending only move views around, the bytes themselves are
+/// never copied. Views of one page may overlap, whoever writes through one
+/// must know nobody else reads it.
+struct IoBuf {
+    struct Seg {
+        Rc<IoPage> page;
+        usize      off;
+        usize      len;
+
+        byte* buf() const { return page->buf() + off; }
+
+        Bytes bytes() const { return { buf(), len }; }
+    };
+
+    Vec<Seg> _segs;
+    usize    _len = 0;
+
+    IoBuf() = default;
+
+    /// `len` zeroed bytes over fresh heap pages.
+    static IoBuf alloc(usize len) {
+        IoBuf buf;
+        while (buf._len < len) {
+            usize n = min(len - buf._len, IoPage::SIZE);
+            buf.append(makeRc<HeapPage>(), 0, n);
+        }
+        return buf;
+    }
+
+    usize len() const { return _len; }
+
+    explicit operator bool() const { return _len != 0; }
+
+    Slice<Seg> segs() const { return _segs; }
+
+    /// Add `[off, off + len)` of `page` at the end, growing the last view
+    /// when it ends where this one starts.
+    void append(Rc<IoPage> page, usize off, usize len) {
+        if (not len)
+            return;
+        if (off + len > page->len()) [[unlikely]]
+            panic("IoBuf::append: view past the end of its page");
+
+        _len += len;
+        if (_segs.len()) {
+            auto& last = _segs[_segs.len() - 1];
+            if (&*last.page == &*page and last.off + last.len == off) {
+                last.len += len;
+                return;
+            }
+        }
+        _segs.pushBack({ .page = page, .off = off, .len = len });
+    }
+
+    /// Add the views of `other` at the end, sharing its pages.
+    void append(IoBuf const& other) {
+        for (auto& seg : other._segs)
+            append(seg.page, seg.off, seg.len);
+    }
+
+    /// Bytes `[start, end)` as a buffer of their own, sharing the pages.
+    IoBuf slice(usize start, usize end) const {
+        if (start > end or end > _len) [[unlikely]]
+            panic("IoBuf::slice: out of bounds");
+
+        IoBuf out;
+        usize pos = 0;
+        for (auto& seg : _segs) {
+            usize lo = max(start, pos);
+            usize hi = min(end, pos + seg.len);
+            if (lo < hi)
+                out.append(seg.page, seg.off + lo - pos, hi - lo);
+            pos += seg.len;
+            if (pos >= end)
+                break;
+        }
+        return out;
+    }
+
+    /// Keep the first `at` bytes and return the rest. A view straddling
+    /// `at` ends up on both sides.
+    IoBuf split(usize at) {
+        if (at > _len) [[unlikely]]
+            panic("IoBuf::split: out of bounds");
+
+        IoBuf    tail;
+        Vec<Seg> head;
+        usize    pos = 0;
+        for (auto& seg : _segs) {
+            if (pos + seg.len <= at) {
+                head.pushBack(seg);
+            } else if (pos >= at) {
+                tail.append(seg.page, seg.off, seg.len);
+            } else {
+                usize n = at - pos;
+                head.pushBack({ .page = seg.page, .off = seg.off, .len = n });
+                tail.append(seg.page, seg.off + n, seg.len - n);
+            }
+            pos += seg.len;
+        }
+        _segs = ::move(head);
+        _len  = at;
+        return tail;
+    }
+
+    void clear() {
+        _segs.clear();
+        _len = 0;
+    }
+
+    /// Copy up to `len` bytes from `off` into `dst`, for consumers that need
+    /// them flat.
+    usize copyOut(usize off, byte* dst, usize len) const {
+        usize done = 0;
+        usize pos  = 0;
+        for (auto& seg : _segs) {
+            if (done == len)
+                break;
+            if (pos + seg.len > off) {
+                usize from = max(off, pos) - pos;
+                usize n    = min(seg.len - from, len - done);
+                memcpy(dst + done, seg.buf() + from, n);
+                done += n;
+            }
+            pos += seg.len;
+        }
+        return done;
+    }
+
+    /// Copy `src` over the bytes from `off`, as far as the buffer goes.
+    usize copyIn(usize off, Bytes src) {
+        usize done = 0;
+        usize pos  = 0;
+        for (auto& seg : _segs) {
+            if (done == src.len())
+                break;
+            if (pos + seg.len > off) {
+                usize from = max(off, pos) - pos;
+                usize n    = min(seg.len - from, src.len() - done);
+                memcpy(seg.buf() + from, src.buf() + done, n);
+                done += n;
+            }
+            pos += seg.len;
+        }
+        return done;
+    }
+};
+
+} // namespace Realms::Io
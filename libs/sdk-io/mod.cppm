@@ -3,6 +3,7 @@ module;
 export module sdk.io;
 
 export import :buf;
+export import :iobuf;
 export import :path;
 export import :seek;
 export import :text;
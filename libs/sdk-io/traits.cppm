@@ -3,6 +3,7 @@ module;
 export module sdk.io:traits;
 
 import sdk;
+import :iobuf;
 import :seek;
 
 export namespace Realms::Io {
@@ -45,6 +46,19 @@ struct Writer {
     virtual Res<> write(byte) = 0;
 
     virtual Res<usize> write(Bytes) = 0;
+
+    /// Write every segment of `buf` in order, stopping at a short write.
+    /// Writers that can take a scatter list whole should do so.
+    virtual Res<usize> writev(IoBuf const& buf) {
+        usize done = 0;
+        for (auto& seg : buf.segs()) {
+            usize n = try$(write(seg.bytes()));
+            done += n;
+            if (n < seg.len)
+                break;
+        }
+        return Ok(done);
+    }
 };
 
 static_assert(Writable<Writer>);
@@ -55,6 +69,19 @@ struct Reader {
     virtual Res<byte> read() = 0;
 
     virtual Res<usize> read(Bytes) = 0;
+
+    /// Fill the segments of `buf` in order, stopping at a short read.
+    /// Readers that can fill a scatter list whole should do so.
+    virtual Res<usize> readv(IoBuf& buf) {
+        usize done = 0;
+        for (auto& seg : buf.segs()) {
+            usize n = try$(read(seg.bytes()));
+            done += n;
+            if (n < seg.len)
+                break;
+        }
+        return Ok(done);
+    }
 };
 
 static_assert(Readable<Reader>);
@@ -18,4 +18,8 @@ void enterCritical();
 
 void leaveCritical();
 
+// Index of the current processor, stable inside a critical section. Used to
+// spread contended counters over cache lines.
+unsigned cpuIndex();
+
 } // namespace _Embed
@@ -5,7 +5,7 @@ export module sdk:atomic;
 import :types;
 import :utility;
 
-enum MemoryOrder : u8 {
+export enum MemoryOrder : u8 {
     Relaxed                = __ATOMIC_RELAXED,
     Acquire                = __ATOMIC_ACQUIRE,
     Release                = __ATOMIC_RELEASE,
@@ -62,6 +62,18 @@ struct Atomic {
         return __atomic_fetch_sub(&_val, desired, order);
     }
 
+    [[gnu::always_inline]] T fetchOr(T           desired,
+                                     MemoryOrder order
+                                     = SequentiallyConsistent) {
+        return __atomic_fetch_or(&_val, desired, order);
+    }
+
+    [[gnu::always_inline]] T fetchAnd(T           desired,
+                                      MemoryOrder order
+                                      = SequentiallyConsistent) {
+        return __atomic_fetch_and(&_val, desired, order);
+    }
+
     [[gnu::always_inline]] T fetchInc(MemoryOrder order
                                       = SequentiallyConsistent) {
         return __atomic_fetch_add(&_val, 1, order);
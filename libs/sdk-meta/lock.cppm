@@ -4,8 +4,11 @@ module;
 
 export module sdk:lock;
 
+import :array;
 import :atomic;
+import :defer;
 import :traits;
+import :types;
 
 export template <typename T>
 concept Lockable = requires(T& t) {
@@ -89,74 +92,93 @@ struct LockProtected {
 export template <typename T, Lockable L = Lock>
 LockProtected(T, L&) -> LockProtected<T, L>;
 
+// Readers announce themselves on a per-CPU slot instead of a shared counter,
+// so concurrent readers on different processors never bounce a cache line.
+// A writer first raises `_writer`, which stops new readers (writer
+// preference), then waits for every slot to drain.
 export struct ReadWriteLock : Pinned {
-    Atomic<i32> _state { 0 };
+    static constexpr usize SLOTS = 64;
 
-    Lock          _lock;
-    Atomic<isize> _pendings {};
-    isize         _readers {};
-    isize         _writers {};
+    struct alignas(64) _Slot {
+        Atomic<isize> readers {};
+    };
+
+    Atomic<bool>        _writer { false };
+    Array<_Slot, SLOTS> _slots {};
+
+    _Slot& _slot() { return _slots[_Embed::cpuIndex() % SLOTS]; }
+
+    bool _drained() {
+        for (auto& slot : _slots)
+            if (slot.readers.load(Acquire))
+                return false;
+        return true;
+    }
 
     void acquireRead() {
         _Embed::enterCritical();
 
-        while (not tryAcquireRead()) {
-            _Embed::relaxe();
-            threadfence();
+        while (not _tryAcquireRead()) {
+            while (_writer.load(Relaxed))
+                _Embed::relaxe();
         }
     }
 
-    bool tryAcquireRead() {
-        LockScoped scope(_lock);
-
-        if (_pendings.load())
-            return false;
+    bool _tryAcquireRead() {
+        auto& slot = _slot();
 
-        if (_writers)
-            return false;
+        slot.readers.inc();
+        if (not _writer.load()) [[likely]]
+            return true;
 
-        ++_readers;
+        // A writer is pending or active, back off so it can make progress.
+        slot.readers.dec(Release);
+        return false;
+    }
 
+    bool tryAcquireRead() {
         _Embed::enterCritical();
-        return true;
+
+        if (_tryAcquireRead())
+            return true;
+
+        _Embed::leaveCritical();
+        return false;
     }
 
     void releaseRead() {
-        LockScoped scope(_lock);
-        --_readers;
+        _slot().readers.dec(Release);
         _Embed::leaveCritical();
     }
 
     void acquireWrite() {
         _Embed::enterCritical();
 
-        _pendings.inc();
-
-        while (not tryAcquireWrite()) {
+        while (not _writer.cmpxchg(false, true))
             _Embed::relaxe();
-            threadfence();
-        }
 
-        _pendings.dec();
+        while (not _drained())
+            _Embed::relaxe();
     }
 
     bool tryAcquireWrite() {
-        LockScoped scope(_lock);
+        _Embed::enterCritical();
 
-        if (_readers)
+        if (not _writer.cmpxchg(false, true)) {
+            _Embed::leaveCritical();
             return false;
+        }
 
-        if (_writers)
+        if (not _drained()) {
+            _writer.store(false, Release);
+            _Embed::leaveCritical();
             return false;
-
-        ++_writers;
-        _Embed::enterCritical();
+        }
         return true;
     }
 
     void releaseWrite() {
-        LockScoped scope(_lock);
-        --_writers;
+        _writer.store(false, Release);
         _Embed::leaveCritical();
     }
 };
@@ -178,3 +200,71 @@ export struct [[nodiscard]] WriteLockScope : Pinned {
 
     ~WriteLockScope() { _lock.releaseWrite(); }
 };
+
+// Readers take a snapshot without writing shared memory and retry when the
+// sequence was odd (update in progress) or moved while they were copying.
+// Writers are serialized by `_lock`. With `Irq` set the write side also
+// disables interrupts, so a handler reading the value on the same processor
+// cannot spin forever on a half-finished update.
+export template <typename T, bool Irq = false>
+struct SeqLock : Pinned {
+    mutable Atomic<usize> _seq { 0 };
+    Lock                  _lock;
+    T                     _val;
+
+    SeqLock() = default;
+
+    SeqLock(T const& val) : _val(val) { }
+
+    usize readBegin() const {
+        usize seq;
+        while ((seq = _seq.load(Acquire)) & 1)
+            _Embed::relaxe();
+        return seq;
+    }
+
+    bool readRetry(usize seq) const {
+        threadfence(Acquire);
+        return _seq.load(Relaxed) != seq;
+    }
+
+    T read() const {
+        T     val;
+        usize seq;
+        do {
+            seq = readBegin();
+            val = _val;
+        } while (readRetry(seq));
+        return val;
+    }
+
+    void writeBegin() {
+        if constexpr (Irq)
+            _Embed::enterCritical();
+        _lock.acquire();
+        _seq.inc(Relaxed);
+        threadfence(Release);
+    }
+
+    void writeEnd() {
+        _seq.inc(Release);
+        _lock.release();
+        if constexpr (Irq)
+            _Embed::leaveCritical();
+    }
+
+    void write(T const& val) {
+        writeBegin();
+        _val = val;
+        writeEnd();
+    }
+
+    auto with(auto&& f) {
+        writeBegin();
+        Defer end { [&] { writeEnd(); } };
+        return f(_val);
+    }
+};
+
+export template <typename T>
+using IrqSeqLock = SeqLock<T, true>;
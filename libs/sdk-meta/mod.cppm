@@ -40,6 +40,7 @@ export import :buf;
 export import :dict;
 export import :flags;
 export import :list;
+export import :radix;
 export import :range;
 export import :vec;
 export import :range;
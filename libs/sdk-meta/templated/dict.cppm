@@ -299,13 +299,37 @@ struct Dict {
     }
 
     bool remove(K const& key) {
-        // TODO: implement
+        i32 hashCode = ::hash(key) & 0x7FFF'FFFF;
+        u32 bucketId = hashCode % _buckets.len();
+
+        i32 last = -1;
+        for (i32 i = _buckets[bucketId]; i >= 0;
+             last = i, i = _entries[i]._next) {
+            if ((_entries[i]._hashCode != hashCode)
+                or not(key == _entries[i]._key))
+                continue;
+
+            if (last < 0)
+                _buckets[bucketId] = _entries[i]._next;
+            else
+                _entries[last]._next = _entries[i]._next;
+
+            _entries[i]._hashCode = -1;
+            _entries[i]._next     = _releaseIndex;
+            _releaseIndex         = i;
+            _released++;
+            _version++;
+            return true;
+        }
         return false;
     }
 
     bool remove(K const& key, V const& value) {
-        // TODO: implement
-        return false;
+        auto opt = find(key);
+        if (not opt or not(_entries[*opt]._value == value))
+            return false;
+
+        return remove(key);
     }
 
     usize count() const { return _count - _released; }
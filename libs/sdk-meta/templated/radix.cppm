@@ -0,0 +1,191 @@
+module;
+
+export module sdk:radix;
+
+import :traits;
+import :types;
+
+export namespace Meta {
+
+/// Sparse map from a 64-bit index to `T*`, as a tree of 64-way nodes.
+/// The tree only grows as tall as the largest index needs, so dense low
+/// indices (page numbers of a file) stay one or two lookups deep.
+template <typename T>
+struct Radix : Pinned {
+    static constexpr usize BITS      = 6;
+    static constexpr usize FANOUT    = 1 << BITS;
+    static constexpr usize MASK      = FANOUT - 1;
+    static constexpr usize MAX_DEPTH = (64 + BITS - 1) / BITS;
+
+    struct Node {
+        void* slots[FANOUT] {};
+        usize count = 0;
+    };
+
+    Node* _root   = nullptr;
+    usize _height = 0;
+    usize _len    = 0;
+
+    Radix() = default;
+
+    ~Radix() { clear(); }
+
+    usize len() const { return _len; }
+
+    static constexpr bool _fits(u64 index, usize height) {
+        return height >= MAX_DEPTH or (index >> (height * BITS)) == 0;
+    }
+
+    static constexpr usize _slot(u64 index, usize level) {
+        return (index >> (level * BITS)) & MASK;
+    }
+
+    T* get(u64 index) const {
+        if (not _root or not _fits(index, _height))
+            return nullptr;
+
+        Node* node = _root;
+        for (usize level = _height - 1; level > 0; level--) {
+            node = (Node*) node->slots[_slot(index, level)];
+            if (not node)
+                return nullptr;
+        }
+        return (T*) node->slots[_slot(index, 0)];
+    }
+
+    /// Store `val` at `index`, returning the previous value.
+    T* put(u64 index, T* val) {
+        if (not val)
+            return remove(index);
+
+        if (not _root) {
+            _root   = new Node();
+            _height = 1;
+        }
+
+        while (not _fits(index, _height)) {
+            Node* root     = new Node();
+            root->slots[0] = _root;
+            root->count    = 1;
+            _root          = root;
+            _height++;
+        }
+
+        Node* node = _root;
+        for (usize level = _height - 1; level > 0; level--) {
+            void*& slot = node->slots[_slot(index, level)];
+            if (not slot) {
+                slot = new Node();
+                node->count++;
+            }
+            node = (Node*) slot;
+        }
+
+        void*& slot = node->slots[_slot(index, 0)];
+        T*     old  = (T*) slot;
+        slot        = val;
+        if (not old) {
+            node->count++;
+            _len++;
+        }
+        return old;
+    }
+
+    T* remove(u64 index) {
+        if (not _root or not _fits(index, _height))
+            return nullptr;
+
+        Node* path[MAX_DEPTH];
+        Node* node = _root;
+        for (usize level = _height - 1; level > 0; level--) {
+            path[level] = node;
+            node        = (Node*) node->slots[_slot(index, level)];
+            if (not node)
+                return nullptr;
+        }
+
+        void*& slot = node->slots[_slot(index, 0)];
+        T*     old  = (T*) slot;
+        if (not old)
+            return nullptr;
+
+        slot = nullptr;
+        _len--;
+
+        // Free the nodes emptied on the way back up.
+        for (usize level = 0; level < _height and --node->count == 0;
+             level++) {
+            delete node;
+            if (level + 1 == _height) {
+                _root   = nullptr;
+                _height = 0;
+                break;
+            }
+            node = path[level + 1];
+
+            node->slots[_slot(index, level + 1)] = nullptr;
+        }
+        return old;
+    }
+
+    /// First entry at or after `index`, which is updated to its position.
+    T* ceil(u64& index) const {
+        if (not _root or not _fits(index, _height))
+            return nullptr;
+        return _ceil(_root, _height - 1, 0, index);
+    }
+
+    T* _ceil(Node* node, usize level, u64 base, u64& index) const {
+        u64 shift = level * BITS;
+        for (usize i = _slot(index, level); i < FANOUT; i++) {
+            void* slot = node->slots[i];
+            u64   key  = base | ((u64) i << shift);
+            if (not slot)
+                continue;
+
+            if (level == 0) {
+                index = key;
+                return (T*) slot;
+            }
+
+            // Past the first child the search starts at its lowest index.
+            u64 from = key > index ? key : index;
+            if (T* found = _ceil((Node*) slot, level - 1, key, from)) {
+                index = from;
+                return found;
+            }
+        }
+        return nullptr;
+    }
+
+    /// Visit every entry in index order.
+    void each(auto&& f) const {
+        u64 index = 0;
+        while (T* val = ceil(index)) {
+            f(index, *val);
+            if (++index == 0)
+                break;
+        }
+    }
+
+    void _free(Node* node, usize level) {
+        if (level > 0) {
+            for (void* slot : node->slots) {
+                if (slot)
+                    _free((Node*) slot, level - 1);
+            }
+        }
+        delete node;
+    }
+
+    /// Drop every entry, the values themselves are not freed.
+    void clear() {
+        if (_root)
+            _free(_root, _height - 1);
+        _root   = nullptr;
+        _height = 0;
+        _len    = 0;
+    }
+};
+
+} // namespace Meta
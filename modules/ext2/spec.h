@@ -7,6 +7,59 @@
 
 namespace ext2 {
 
+static constexpr u16   MAGIC           = 0xEF53;
+static constexpr u32   ROOT_INODE      = 2;
+static constexpr u32   GOOD_OLD_INODE  = 11; // First usable inode, rev 0
+static constexpr usize SUPERBLK_OFFSET = 1024;
+static constexpr usize DIRECT_BLOCKS   = 12;
+static constexpr usize SINGLE_INDIRECT = 12;
+static constexpr usize DOUBLE_INDIRECT = 13;
+static constexpr usize TRIPLE_INDIRECT = 14;
+
+enum FeatureCompat : u32 {
+    DirPrealloc = 0x0001,
+    HasJournal  = 0x0004, // Ext3
+    ExtAttr     = 0x0008,
+    ResizeInode = 0x0010,
+    DirIndex    = 0x0020,
+};
+
+enum FeatureIncompat : u32 {
+    Compression = 0x0001,
+    FileType    = 0x0002, // Directory entries carry the file type
+    Recover     = 0x0004,
+    JournalDev  = 0x0008,
+    MetaBg      = 0x0010,
+};
+
+enum FeatureRoCompat : u32 {
+    SparseSuper = 0x0001,
+    LargeFile   = 0x0002,
+    BtreeDir    = 0x0004,
+};
+
+enum Mode : u16 {
+    TypeMask  = 0xF000,
+    Fifo      = 0x1000,
+    CharDev   = 0x2000,
+    Directory = 0x4000,
+    BlockDev  = 0x6000,
+    Regular   = 0x8000,
+    Symlink   = 0xA000,
+    Socket    = 0xC000,
+};
+
+enum DirType : u8 {
+    DirUnknown   = 0,
+    DirRegular   = 1,
+    DirDirectory = 2,
+    DirCharDev   = 3,
+    DirBlockDev  = 4,
+    DirFifo      = 5,
+    DirSocket    = 6,
+    DirSymlink   = 7,
+};
+
 struct Superblk {
     u32le inodes;
     u32le blocks;
@@ -35,11 +88,11 @@ struct Superblk {
     u16le gidRsrv;
 
     u32le           firstInode;
-    u32le           inodeSize;
+    u16le           inodeSize;
     u16le           blockGroupNum;
-    u16le           featureCompat;
-    u16le           featureIncompat;
-    u16le           featureRoCompat;
+    u32le           featureCompat;
+    u32le           featureIncompat;
+    u32le           featureRoCompat;
     Uuid            uuid;
     Array<char, 16> volumeName;
     Array<char, 64> lastMounted;
@@ -58,6 +111,7 @@ struct Superblk {
     u32le           firstMetaBlkGroup;
     Array<u8, 760>  __reserved__2;
 };
+static_assert(sizeof(Superblk) == 1024);
 
 struct BlockGroupDesc {
     u32le         blockBitmap;
@@ -69,6 +123,7 @@ struct BlockGroupDesc {
     u16le         pad;
     Array<u8, 12> __reserved__;
 };
+static_assert(sizeof(BlockGroupDesc) == 32);
 
 struct Inode {
     u16le mode;
@@ -80,22 +135,31 @@ struct Inode {
     u32le whenDelete;
     u16le bitsGroupId;
     u16le links;
-    u32le blocks;
+    u32le sectors; // In 512-byte units, indirect blocks included
     u32le flags;
     u32le osd1;
     u32le blocks[15];
     u32le filever;
     u32le fileacl;
-    u32le diracl;
+    u32le diracl; // High 32 bits of the size for regular files
     u32le fragAddress;
     struct {
         u8    fragNum;
         u8    fragSize;
         u16   __reserved__0;
-        u32le uidHi;
-        u32le gidHi;
+        u16le uidHi;
+        u16le gidHi;
         u32   __reserved__1;
     };
 };
+static_assert(sizeof(Inode) == 128);
+
+struct [[gnu::packed]] DirEntry {
+    u32le inode;
+    u16le recLen;
+    u8    nameLen;
+    u8    type; // Name length high byte without the file type feature
+    char  name[];
+};
 
 } // namespace ext2
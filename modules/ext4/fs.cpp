@@ -0,0 +1,1872 @@
+#include <ext4/fs.h>
+#include <realms/hal/vmm.h>
+#include <realms/io/volume.h>
+#include <sdk-logs/logger.h>
+#include <sdk-meta/array.h>
+#include <sdk-meta/atomic.h>
+#include <sdk-meta/vec.h>
+
+namespace Ext4 {
+
+namespace {
+
+static constexpr usize COPY_CHUNK = 64 * 1024;
+
+// Features the driver reads. Anything else incompatible refuses the mount.
+static constexpr u32 INCOMPAT_READ = FileType | Recover | Extents | Bit64 |
+                                     FlexBg | CsumSeed | LargeDir;
+
+// Read-only compatible features the driver keeps consistent when writing.
+static constexpr u32 RO_COMPAT_WRITE = SparseSuper | LargeFile | BtreeDir |
+                                       HugeFile | DirNlink | ExtraIsize;
+
+bool _isDir(Inode const& inode) {
+    return (inode.mode & TypeMask) == Directory;
+}
+
+usize _fileSize(Inode const& inode) {
+    return inode.sizeLo | ((usize) (u32) inode.sizeHi << 32);
+}
+
+void _setSize(Inode& inode, usize size) {
+    inode.sizeLo = (u32) size;
+    inode.sizeHi = (u32) (size >> 32);
+}
+
+u64 _freeCount(Superblk const& super) {
+    return super.blocksFreeLo | ((u64) (u32) super.blocksFreeHi << 32);
+}
+
+void _setFreeCount(Superblk& super, u64 free) {
+    super.blocksFreeLo = (u32) free;
+    super.blocksFreeHi = (u32) (free >> 32);
+}
+
+bool _indexed(Superblk const& super, Inode const& inode) {
+    return (super.featureCompat & DirIndex) and (inode.flags & IndexFl);
+}
+
+u8 _dirType(u16 mode) {
+    switch (mode & TypeMask) {
+        case Regular:   return DirRegular;
+        case Directory: return DirDirectory;
+        case Symlink:   return DirSymlink;
+        case CharDev:   return DirCharDev;
+        case BlockDev:  return DirBlockDev;
+        case Fifo:      return DirFifo;
+        case Socket:    return DirSocket;
+        default:        return DirUnknown;
+    }
+}
+
+usize _recLen(usize nameLen) { return alignUp(8 + nameLen, 4); }
+
+void _append(Vec<u8>& buf, void const* data, usize len) {
+    for (usize i = 0; i < len; i++)
+        buf.pushBack(((u8 const*) data)[i]);
+}
+
+bool _test(Vec<u8> const& bitmap, usize bit) {
+    return bitmap[bit / 8] & (1 << (bit % 8));
+}
+
+void _mark(Vec<u8>& bitmap, usize bit, bool set) {
+    if (set)
+        bitmap[bit / 8] |= (u8) (1 << (bit % 8));
+    else
+        bitmap[bit / 8] &= (u8) ~(1 << (bit % 8));
+}
+
+Opt<usize> _scan(Vec<u8> const& bitmap, usize from, usize to) {
+    for (usize bit = from; bit < to;) {
+        if (bit % 8 == 0 and bitmap[bit / 8] == 0xff) {
+            bit += 8;
+            continue;
+        }
+        if (not _test(bitmap, bit))
+            return bit;
+        bit++;
+    }
+    return NONE;
+}
+
+// Offset of the live entry called `name` in one directory block.
+Opt<usize> _entry(Bytes block, Str name) {
+    for (usize off = 0; off + sizeof(DirEntry) <= block.len();) {
+        auto& entry = *(DirEntry const*) (block.buf() + off);
+        if (entry.recLen < sizeof(DirEntry))
+            return NONE;
+        if (entry.inode and Str { entry.name, entry.nameLen } == name)
+            return off;
+        off += entry.recLen;
+    }
+    return NONE;
+}
+
+// Disk block of file block `index`, 0 for a hole.
+u64 _blockAt(ExtentMap const& map, u64 index) {
+    Vec<Run> runs;
+    map.lookup(index, 1, runs);
+    return runs[0].block;
+}
+
+// MARK: - Directory Hashes ----------------------------------------------------
+
+u32 _rol(u32 x, u32 n) { return (x << n) | (x >> (32 - n)); }
+
+// Pack up to `num` words of the name, padded with its length, the way the
+// hashes expect. Signed variants sign-extend each byte.
+void _hashBuf(u8 const* name, usize len, u32* buf, isize num, bool sign) {
+    u32 pad = (u32) len | ((u32) len << 8);
+    pad |= pad << 16;
+
+    u32 val = pad;
+    len     = min(len, (usize) num * 4);
+    for (usize i = 0; i < len; i++) {
+        u32 c = sign ? (u32) (i32) (i8) name[i] : name[i];
+        val   = c + (val << 8);
+        if (i % 4 == 3) {
+            *buf++ = val;
+            val    = pad;
+            num--;
+        }
+    }
+    if (num-- > 0)
+        *buf++ = val;
+    while (num-- > 0)
+        *buf++ = pad;
+}
+
+u32 _legacy(u8 const* name, usize len, bool sign) {
+    u32 hash0 = 0x12a3'fe2d;
+    u32 hash1 = 0x37ab'e8f9;
+    for (usize i = 0; i < len; i++) {
+        u32 c    = sign ? (u32) (i32) (i8) name[i] : name[i];
+        u32 hash = hash1 + (hash0 ^ (c * 7152373));
+        if (hash & 0x8000'0000)
+            hash -= 0x7fff'ffff;
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+void _halfMd4(u32* buf, u32 const* in) {
+    auto f = [](u32 x, u32 y, u32 z) { return z ^ (x & (y ^ z)); };
+    auto g = [](u32 x, u32 y, u32 z) { return (x & y) + ((x ^ y) & z); };
+    auto h = [](u32 x, u32 y, u32 z) { return x ^ y ^ z; };
+
+    static constexpr u32 K2 = 013240474631;
+    static constexpr u32 K3 = 015666365641;
+
+    u32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    a = _rol(a + f(b, c, d) + in[0], 3);
+    d = _rol(d + f(a, b, c) + in[1], 7);
+    c = _rol(c + f(d, a, b) + in[2], 11);
+    b = _rol(b + f(c, d, a) + in[3], 19);
+    a = _rol(a + f(b, c, d) + in[4], 3);
+    d = _rol(d + f(a, b, c) + in[5], 7);
+    c = _rol(c + f(d, a, b) + in[6], 11);
+    b = _rol(b + f(c, d, a) + in[7], 19);
+
+    a = _rol(a + g(b, c, d) + in[1] + K2, 3);
+    d = _rol(d + g(a, b, c) + in[3] + K2, 5);
+    c = _rol(c + g(d, a, b) + in[5] + K2, 9);
+    b = _rol(b + g(c, d, a) + in[7] + K2, 13);
+    a = _rol(a + g(b, c, d) + in[0] + K2, 3);
+    d = _rol(d + g(a, b, c) + in[2] + K2, 5);
+    c = _rol(c + g(d, a, b) + in[4] + K2, 9);
+    b = _rol(b + g(c, d, a) + in[6] + K2, 13);
+
+    a = _rol(a + h(b, c, d) + in[3] + K3, 3);
+    d = _rol(d + h(a, b, c) + in[7] + K3, 9);
+    c = _rol(c + h(d, a, b) + in[2] + K3, 11);
+    b = _rol(b + h(c, d, a) + in[6] + K3, 15);
+    a = _rol(a + h(b, c, d) + in[1] + K3, 3);
+    d = _rol(d + h(a, b, c) + in[5] + K3, 9);
+    c = _rol(c + h(d, a, b) + in[0] + K3, 11);
+    b = _rol(b + h(c, d, a) + in[4] + K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+void _tea(u32* buf, u32 const* in) {
+    u32 sum = 0;
+    u32 b0 = buf[0], b1 = buf[1];
+    u32 a = in[0], b = in[1], c = in[2], d = in[3];
+
+    for (usize n = 0; n < 16; n++) {
+        sum += 0x9e37'79b9;
+        b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+        b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+Res<u32> _hash(Str name, u8 version, Array<u32, 4> const& seed) {
+    auto const*   p   = (u8 const*) name.buf();
+    usize         len = name.len();
+    Array<u32, 4> buf = seed;
+    Array<u32, 8> in {};
+    u32           hash;
+
+    switch (version) {
+        case Legacy:
+        case LegacyUnsigned:
+            hash = _legacy(p, len, version == Legacy);
+            break;
+
+        case HalfMd4:
+        case HalfMd4Unsigned:
+            for (isize left = len; left > 0; left -= 32, p += 32) {
+                _hashBuf(p, left, in.buf(), 8, version == HalfMd4);
+                _halfMd4(buf.buf(), in.buf());
+            }
+            hash = buf[1];
+            break;
+
+        case Tea:
+        case TeaUnsigned:
+            for (isize left = len; left > 0; left -= 16, p += 16) {
+                _hashBuf(p, left, in.buf(), 4, version == Tea);
+                _tea(buf.buf(), in.buf());
+            }
+            hash = buf[0];
+            break;
+
+        default:
+            return Error::notSupported("Ext4::_hash: unsupported hash");
+    }
+
+    hash &= ~1u;
+    if (hash == (HTREE_EOF << 1))
+        hash = (HTREE_EOF - 1) << 1;
+    return Ok(hash);
+}
+
+// MARK: - Page I/O ------------------------------------------------------------
+
+// A batch of page I/O split in several requests, see the ext2 driver.
+struct _PageIo {
+    Atomic<usize>       pending { 1 };
+    Atomic<bool>        failed { false };
+    Vec<Io::CachePage*> pages;
+    Vec<Io::BlkRequest> reqs;
+    bool                write;
+};
+
+void _put(_PageIo* io) {
+    if (io->pending.fetchSub(1) != 1)
+        return;
+
+    Res<> res = Ok();
+    if (io->failed.load())
+        res = Error::invalidData("Ext4::Mapping: i/o failed");
+
+    for (auto* page : io->pages) {
+        if (io->write)
+            Io::cacheFlushed(*page, res);
+        else
+            Io::cacheFilled(*page, res);
+    }
+    delete io;
+}
+
+Res<> _pageIo(Fs&                   fs,
+              Slice<Io::CachePage*> pages,
+              u64                   first,
+              Slice<Run>            runs,
+              bool                  write) {
+    usize bs  = fs._blockSize;
+    usize bpp = PAGE_SIZE / bs;
+
+    Vec<Bytes> blocks;
+    for (auto* page : pages) {
+        for (usize i = 0; i < bpp; i++)
+            blocks.pushBack(Bytes { (byte*) (page->virt + i * bs), bs });
+    }
+
+    // Holes and uninitialized extents read as zeroes.
+    if (not write) {
+        for (auto& run : runs) {
+            if (run.block and not run.uninit)
+                continue;
+            for (usize i = 0; i < run.count; i++)
+                memset((void*) blocks[run.index - first + i].buf(), 0, bs);
+        }
+    }
+
+    auto* io  = new _PageIo();
+    io->write = write;
+    for (auto* page : pages)
+        io->pages.pushBack(page);
+    fs._requests(runs, first, slice(blocks), write, io->reqs);
+
+    io->pending.store(io->reqs.len() + 1);
+    {
+        Io::BlkPlug plug;
+        for (auto& req : io->reqs) {
+            req.ctx = io;
+            req.fn  = [](Io::BlkRequest& req, Res<> res) {
+                auto* io = static_cast<_PageIo*>(req.ctx);
+                if (not res)
+                    io->failed.store(true);
+                _put(io);
+            };
+            Io::blkSubmit(req);
+        }
+    }
+    _put(io);
+    return Ok();
+}
+
+} // namespace
+
+// MARK: - Extent Map ----------------------------------------------------------
+
+void ExtentMap::lookup(u64 index, usize count, Vec<Run>& out) const {
+    u64 end = index + count;
+
+    // First run ending past `index`.
+    usize lo = 0, hi = runs.len();
+    while (lo < hi) {
+        usize mid = (lo + hi) / 2;
+        if (runs[mid].index + runs[mid].count <= index)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    u64 pos = index;
+    for (usize i = lo; i < runs.len() and pos < end; i++) {
+        auto& run = runs[i];
+        if (run.index >= end)
+            break;
+        if (run.index > pos) {
+            out.pushBack({ pos, 0, run.index - pos });
+            pos = run.index;
+        }
+
+        u64 stop  = min(end, run.index + run.count);
+        u64 block = run.block + (pos - run.index);
+        out.pushBack({ pos, block, stop - pos, run.uninit });
+        pos = stop;
+    }
+    if (pos < end)
+        out.pushBack({ pos, 0, end - pos });
+}
+
+void ExtentMap::set(Run run) {
+    u64      end    = run.index + run.count;
+    bool     placed = false;
+    Vec<Run> split;
+
+    for (auto& old : runs) {
+        u64 stop = old.index + old.count;
+        if (stop <= run.index or old.index >= end) {
+            if (not placed and old.index >= end) {
+                split.pushBack(run);
+                placed = true;
+            }
+            split.pushBack(old);
+            continue;
+        }
+
+        if (old.index < run.index)
+            split.pushBack(
+                { old.index, old.block, run.index - old.index, old.uninit });
+        if (not placed) {
+            split.pushBack(run);
+            placed = true;
+        }
+        if (stop > end)
+            split.pushBack(
+                { end, old.block + (end - old.index), stop - end, old.uninit });
+    }
+    if (not placed)
+        split.pushBack(run);
+
+    runs.clear();
+    for (auto& next : split) {
+        if (not next.block)
+            continue;
+        if (runs.len()) {
+            auto& last = runs[runs.len() - 1];
+            if (last.index + last.count == next.index and
+                last.block + last.count == next.block and
+                last.uninit == next.uninit) {
+                last.count += next.count;
+                continue;
+            }
+        }
+        runs.pushBack(next);
+    }
+    dirty = true;
+}
+
+usize ExtentMap::blocks() const {
+    usize total = 0;
+    for (auto& run : runs)
+        total += run.count;
+    return total;
+}
+
+// MARK: - Mapping -------------------------------------------------------------
+
+usize Mapping::size() { return _file.size; }
+
+usize Mapping::capacity() {
+    // Extents address 2^32 blocks.
+    return (usize) _file._fs._blockSize << 32;
+}
+
+Res<> Mapping::fill(Slice<Io::CachePage*> pages) {
+    auto& fs    = _file._fs;
+    usize bs    = fs._blockSize;
+    u64   first = pages[0]->index * (PAGE_SIZE / bs);
+    usize count = pages.len() * (PAGE_SIZE / bs);
+
+    Vec<Run> runs;
+    {
+        LockScoped lk(_file._lock);
+        _file._extents.lookup(first, count, runs);
+    }
+    return _pageIo(fs, pages, first, slice(runs), false);
+}
+
+Res<> Mapping::flush(Slice<Io::CachePage*> pages) {
+    auto& fs = _file._fs;
+
+    // Whatever starts the write-back, blocks are allocated and pointed to
+    // in the same transaction.
+    Io::JournalHandle handle(fs._journal);
+
+    usize bs    = fs._blockSize;
+    u64   first = pages[0]->index * (PAGE_SIZE / bs);
+    usize count = pages.len() * (PAGE_SIZE / bs);
+
+    // Blocks of the last page past the end of the file stay unallocated.
+    usize total  = alignUp(size(), bs) / bs;
+    usize mapped = total > first ? min(count, total - first) : 0;
+
+    Vec<Run> runs;
+    Vec<Run> out;
+    auto     push = [&](Run run) {
+        if (out.len()) {
+            auto& last = out[out.len() - 1];
+            if (last.block + last.count == run.block and
+                last.index + last.count == run.index) {
+                last.count += run.count;
+                return;
+            }
+        }
+        out.pushBack(run);
+    };
+
+    LockScoped lk(_file._lock);
+    auto&      extents = _file._extents;
+    if (mapped)
+        extents.lookup(first, mapped, runs);
+
+    u64 goal = 0;
+    for (auto run : runs) {
+        if (run.block) {
+            // Written data makes an uninitialized extent initialized.
+            if (run.uninit) {
+                run.uninit = false;
+                extents.set(run);
+            }
+            push(run);
+            goal = run.block + run.count;
+            continue;
+        }
+
+        if (not goal) {
+            Vec<Run> before;
+            if (run.index)
+                extents.lookup(run.index - 1, 1, before);
+            goal = before.len() and before[0].block ? before[0].block + 1
+                                                    : fs._goal(_file._ino);
+        }
+
+        while (run.count) {
+            usize n     = run.count;
+            u64   block = try$(fs._allocBlocks(goal, n));
+            extents.set({ run.index, block, n });
+
+            push({ run.index, block, n });
+            run.index += n;
+            run.count -= n;
+            goal = block + n;
+        }
+    }
+
+    return _pageIo(fs, pages, first, slice(out), true);
+}
+
+void Mapping::poll() {
+    _file._fs._dev->poll();
+}
+
+// MARK: - File ----------------------------------------------------------------
+
+File::File(Fs&          fs,
+           u32          ino,
+           Inode const& inode,
+           ExtentMap    extents,
+           Io::Path     path)
+    : Io::File(fs._dev, path),
+      _fs(fs),
+      _ino(ino),
+      _inode(inode),
+      _extents(::move(extents)),
+      _mapping(*this) {
+    size    = _fileSize(inode);
+    name    = this->path.len() ? this->path.comp[this->path.len() - 1].str()
+                                : Str {};
+    mapping = &_mapping;
+}
+
+File::~File() {
+    if (not _orphan) {
+        (void) sync();
+        return;
+    }
+
+    // Dirty pages go with the mapping, there is nothing to write them to.
+    if (auto res = _fs._release(_ino, _inode, _extents, false); not res)
+        logError("Ext4::File: release failed: {}", res.none().msg());
+}
+
+Res<usize> File::write(Io::FileHandle& handle, Io::Seek whence, Bytes bytes) {
+    try$(_fs._writable());
+    return Io::File::write(handle, whence, bytes);
+}
+
+Res<> File::sync() {
+    Io::JournalHandle handle(_fs._journal);
+    try$(Io::cacheSync(_mapping));
+
+    LockScoped lk(_lock);
+    if (_extents.dirty) {
+        try$(_fs._storeExtents(_ino, _inode, _extents));
+        _dirty = true;
+    }
+    if (_fileSize(_inode) != size) {
+        _setSize(_inode, size);
+        _dirty = true;
+    }
+    if (not _dirty)
+        return Ok();
+
+    try$(_fs._writeInode(_ino, _inode));
+    _dirty = false;
+    return Ok();
+}
+
+// MARK: - Mount ---------------------------------------------------------------
+
+Fs::Fs(Rc<Io::StorDev> dev, usize offset)
+    : _dev(dev),
+      _offset(offset),
+      _super {},
+      _blockSize(1024),
+      _inodeSize(GOOD_OLD_INODE_SIZE),
+      _descSize(32),
+      _flexSize(1),
+      _firstInode(GOOD_OLD_INODE),
+      _seed {} {
+    name = "ext4";
+}
+
+Fs::~Fs() {
+    if (not _journal)
+        return;
+
+    // A log left behind is replayed on the next mount, here or elsewhere.
+    auto res = _journal->checkpoint();
+    delete _journal;
+    _journal = nullptr;
+    if (not res) {
+        logError("Ext4::Fs: checkpoint failed: {}", res.none().msg());
+        return;
+    }
+
+    _super.featureIncompat = _super.featureIncompat & ~Recover;
+    if (auto res = _writeSuper(); not res)
+        logError("Ext4::Fs: superblock write failed: {}", res.none().msg());
+}
+
+Res<Rc<Fs>> Fs::mount(Rc<Io::StorDev> dev, usize offset) {
+    auto  rc = makeRc<Fs>(dev, offset);
+    auto& fs = *rc;
+    try$(fs._load());
+
+    // Even read-only, metadata is only read once the journal is replayed.
+    bool recover = fs._super.featureIncompat & Recover;
+    if ((fs._super.featureCompat & HasJournal) and
+        (recover or not fs._readOnly)) {
+        if (auto res = fs._openJournal(); not res) {
+            if (recover)
+                return res.none();
+            logWarn("Ext4::Fs::mount: journal unusable: {}", res.none().msg());
+            fs._readOnly = true;
+        } else {
+            // Replay may have rewritten the superblock and descriptors.
+            // Other systems only replay a journal flagged as needing it, so
+            // the flag goes home before anything else is logged.
+            try$(fs._load());
+            fs._super.featureIncompat = fs._super.featureIncompat | Recover;
+            try$(fs._writeSuper());
+            try$(fs._journal->checkpoint());
+            recover = false;
+        }
+    }
+    if (recover)
+        return Error::notSupported("Ext4::Fs::mount: journal needs replaying");
+
+    return Ok(rc);
+}
+
+Res<> Fs::_load() {
+    usize   devBs = _dev->_blockSize;
+    usize   at    = _offset + SUPERBLK_OFFSET;
+    usize   start = alignDown(at, devBs);
+    Vec<u8> buf;
+    buf.resize(alignUp(at + sizeof(Superblk), devBs) - start, 0);
+    Bytes bytes = buf;
+    try$(_dev->read(Io::Seek::fromBegin(start), bytes));
+    memcpy(&_super, buf.buf() + (at - start), sizeof(Superblk));
+
+    auto& super = _super;
+    if (super.magic != MAGIC or super.vmajor < 1)
+        return Error::invalidData("Ext4::Fs::mount: bad superblock");
+    if (super.featureIncompat & ~INCOMPAT_READ)
+        return Error::notSupported("Ext4::Fs::mount: incompatible features");
+    if (super.featureRoCompat & Bigalloc)
+        return Error::notSupported("Ext4::Fs::mount: clusters unsupported");
+
+    _blockSize = 1024uz << super.blockSize;
+    if (_blockSize > PAGE_SIZE or _blockSize % devBs or _offset % devBs)
+        return Error::notSupported("Ext4::Fs::mount: unsupported block size");
+    if (not super.blocksPergroup or not super.inodesPergroup)
+        return Error::invalidData("Ext4::Fs::mount: bad geometry");
+
+    _inodeSize  = super.inodeSize;
+    _firstInode = super.firstInode;
+    if (super.featureIncompat & Bit64)
+        _descSize = max((usize) super.descSize, 64uz);
+    if (super.featureIncompat & FlexBg)
+        _flexSize = 1uz << super.logGroupsPerFlex;
+
+    // A zero seed means the default one.
+    for (usize i = 0; i < 4; i++)
+        _seed[i] = super.hashSeed[i];
+    if (not(_seed[0] | _seed[1] | _seed[2] | _seed[3]))
+        _seed = { 0x6745'2301, 0xefcd'ab89, 0x98ba'dcfe, 0x1032'5476 };
+
+    _readOnly = super.featureRoCompat & ~RO_COMPAT_WRITE;
+
+    usize per    = super.blocksPergroup;
+    usize span   = _blockCount() - super.firstBlock;
+    usize groups = alignUp(span, per) / per;
+
+    _table.clear();
+    _table.resize(alignUp(groups * _descSize, _blockSize), 0);
+    try$(_read(super.firstBlock + 1, _table));
+
+    _groups.clear();
+    _groups.resize(groups, {});
+    for (usize i = 0; i < groups; i++) {
+        _decode(i);
+
+        // Uninitialized groups need their bitmaps computed, leave them be.
+        if (_groups[i].flags & (BlockUninit | InodeUninit))
+            _readOnly = true;
+    }
+    return Ok();
+}
+
+Res<> Fs::_openJournal() {
+    auto      inode = try$(_readInode(_super.journalInode));
+    ExtentMap map;
+    try$(_loadExtents(inode, map));
+
+    Vec<Io::JournalExtent> extents;
+    u64                    next = 0;
+    for (auto& run : map.runs) {
+        if (run.index != next or run.uninit)
+            return Error::invalidData("Ext4::Fs::_openJournal: sparse journal");
+        extents.pushBack({ run.block, run.count });
+        next += run.count;
+    }
+
+    _journal = try$(Io::Journal::open(_dev, _offset, _blockSize,
+                                      ::move(extents)));
+    return Ok();
+}
+
+Res<> Fs::sync() {
+    Io::JournalHandle handle(_journal);
+    {
+        LockScoped lk(_lock);
+        if (_dirty)
+            try$(_writeGroups());
+    }
+
+    // Commits once the last handle closes, this one or the caller's.
+    if (_journal)
+        try$(_journal->commit());
+    return Ok();
+}
+
+Res<> Fs::_writeGroups() {
+    for (usize i = 0; i < _groups.len(); i++) {
+        auto& group = _groups[i];
+        if (not group.dirty)
+            continue;
+        try$(_write(group.blockBitmap, group.blocks));
+        try$(_write(group.inodeBitmap, group.inodes));
+        _encode(i);
+        group.dirty = false;
+    }
+    try$(_write(_super.firstBlock + 1, _table));
+    try$(_writeSuper());
+
+    _dirty = false;
+    return Ok();
+}
+
+Res<> Fs::_writeSuper() {
+    u64     block = SUPERBLK_OFFSET / _blockSize;
+    Vec<u8> buf;
+    buf.resize(_blockSize, 0);
+    try$(_read(block, buf));
+    memcpy(buf.buf() + SUPERBLK_OFFSET % _blockSize, &_super, sizeof(Superblk));
+    return _write(block, buf);
+}
+
+Res<> Fs::_writable() const {
+    if (_readOnly)
+        return Error::readOnlyFilesystem("Ext4::Fs: mounted read-only");
+    return Ok();
+}
+
+// MARK: - Blocks --------------------------------------------------------------
+
+u64 Fs::_blockCount() const {
+    u64 count = _super.blocksLo;
+    if (_super.featureIncompat & Bit64)
+        count |= (u64) (u32) _super.blocksHi << 32;
+    return count;
+}
+
+Res<> Fs::_io(u64 block, Bytes buf, bool write) {
+    usize count = buf.len() / _blockSize;
+    if (_journal and write) {
+        for (usize i = 0; i < count; i++) {
+            auto part = slice(buf, i * _blockSize, (i + 1) * _blockSize);
+            try$(_journal->write(block + i, part));
+        }
+        return Ok();
+    }
+
+    usize devBs = _dev->_blockSize;
+    usize limit = max(_dev->maxBlocks(), 1uz) * devBs;
+
+    for (usize pos = 0; pos < buf.len(); pos += limit) {
+        usize          len = min(buf.len() - pos, limit);
+        Io::BlkRequest req {
+            .dev   = &*_dev,
+            .op    = write ? Io::BlkRequest::Op::Write
+                           : Io::BlkRequest::Op::Read,
+            .lba   = _lba(block) + pos / devBs,
+            .count = len / devBs,
+            .segs  = {},
+            .fn    = nullptr,
+            .ctx   = nullptr,
+        };
+        req.segs.pushBack(slice(buf, pos, pos + len));
+        try$(Io::blkWait(req));
+    }
+
+    // Logged blocks are newer than their home copy.
+    if (_journal) {
+        for (usize i = 0; i < count; i++)
+            _journal->read(block + i,
+                           slice(buf, i * _blockSize, (i + 1) * _blockSize));
+    }
+    return Ok();
+}
+
+void Fs::_requests(Slice<Run>           runs,
+                   u64                  first,
+                   Slice<Bytes>         blocks,
+                   bool                 write,
+                   Vec<Io::BlkRequest>& out) {
+    usize devBs = _dev->_blockSize;
+    usize limit = max(_dev->maxBlocks() * devBs / _blockSize, 1uz);
+
+    for (auto& run : runs) {
+        if (not run.block or (run.uninit and not write))
+            continue;
+
+        for (usize done = 0; done < run.count; done += limit) {
+            usize          n = min(run.count - done, limit);
+            Io::BlkRequest req {
+                .dev   = &*_dev,
+                .op    = write ? Io::BlkRequest::Op::Write
+                               : Io::BlkRequest::Op::Read,
+                .lba   = _lba(run.block + done),
+                .count = n * _blockSize / devBs,
+                .segs  = {},
+                .fn    = nullptr,
+                .ctx   = nullptr,
+            };
+
+            for (usize i = 0; i < n; i++) {
+                Bytes mem  = blocks[run.index + done + i - first];
+                usize segs = req.segs.len();
+                if (segs and req.segs[segs - 1].buf() +
+                                     req.segs[segs - 1].len() ==
+                                 mem.buf()) {
+                    auto& last = req.segs[segs - 1];
+                    last       = Bytes { last.buf(), last.len() + mem.len() };
+                } else {
+                    req.segs.pushBack(mem);
+                }
+            }
+            out.pushBack(::move(req));
+        }
+    }
+}
+
+// MARK: - Inodes --------------------------------------------------------------
+
+Res<Inode> Fs::_readInode(u32 ino) {
+    if (ino == 0 or ino > _super.inodes)
+        return Error::invalidArgument("Ext4::Fs::_readInode: bad inode");
+
+    usize group = (ino - 1) / _super.inodesPergroup;
+    usize byte  = ((ino - 1) % _super.inodesPergroup) * _inodeSize;
+
+    Vec<u8> buf;
+    buf.resize(_blockSize, 0);
+    try$(_read(_groups[group].inodeTable + byte / _blockSize, buf));
+
+    Inode inode {};
+    memcpy(&inode,
+           buf.buf() + byte % _blockSize,
+           min(_inodeSize, sizeof(Inode)));
+    return Ok(inode);
+}
+
+Res<> Fs::_writeInode(u32 ino, Inode const& inode, bool fresh) {
+    if (ino == 0 or ino > _super.inodes)
+        return Error::invalidArgument("Ext4::Fs::_writeInode: bad inode");
+
+    usize group = (ino - 1) / _super.inodesPergroup;
+    usize byte  = ((ino - 1) % _super.inodesPergroup) * _inodeSize;
+    u64   block = _groups[group].inodeTable + byte / _blockSize;
+    usize len   = GOOD_OLD_INODE_SIZE;
+    if (_inodeSize > GOOD_OLD_INODE_SIZE)
+        len = min(GOOD_OLD_INODE_SIZE + inode.extraIsize, sizeof(Inode));
+    len = min(len, _inodeSize);
+
+    LockScoped lk(_lock);
+    Vec<u8>    buf;
+    buf.resize(_blockSize, 0);
+    try$(_read(block, buf));
+    if (fresh)
+        memset(buf.buf() + byte % _blockSize, 0, _inodeSize);
+    memcpy(buf.buf() + byte % _blockSize, &inode, len);
+    return _write(block, buf);
+}
+
+void Fs::_setBlocks(Inode& inode, u64 blocks) {
+    u64 count = blocks * (_blockSize / 512);
+    u32 flags = inode.flags & ~HugeFileFl;
+
+    // Past 48 bits of sectors, huge files count blocks instead.
+    if (_super.featureRoCompat & HugeFile) {
+        if (count >> 48) {
+            count = blocks;
+            flags |= HugeFileFl;
+        }
+        inode.blocksHi = (u16) (count >> 32);
+    }
+    inode.blocksLo = (u32) count;
+    inode.flags    = flags;
+}
+
+// MARK: - Extents -------------------------------------------------------------
+
+Res<> Fs::_loadExtents(Inode const& inode, ExtentMap& map) {
+    map.runs.clear();
+    map.tree.clear();
+    map.dirty = false;
+
+    if (not(inode.flags & ExtentsFl)) {
+        // Fast symlinks and empty inodes have nothing to map.
+        bool empty = true;
+        for (auto& block : inode.blocks)
+            empty = empty and not block;
+        if (empty or (inode.mode & TypeMask) == Symlink)
+            return Ok();
+
+        // Files from before extents were turned on. The indirect blocks
+        // count as the tree, so storing the map frees them.
+        u64 index = 0;
+        for (usize i = 0; i < DIRECT_BLOCKS; i++, index++) {
+            if (inode.blocks[i])
+                map.set({ index, inode.blocks[i], 1 });
+        }
+        for (usize depth = 1; depth <= 3; depth++) {
+            u64 block = inode.blocks[DIRECT_BLOCKS + depth - 1];
+            try$(_walkMapped(block, depth, index, map));
+        }
+        return Ok();
+    }
+
+    auto const& root = *(ExtentHeader const*) inode.blocks;
+    return _walk({ (byte const*) inode.blocks, sizeof(inode.blocks) },
+                 root.depth,
+                 map);
+}
+
+Res<> Fs::_walk(Bytes node, usize depth, ExtentMap& map) {
+    auto const& header = *(ExtentHeader const*) node.buf();
+    usize       count  = header.entries;
+    if (header.magic != EXTENT_MAGIC or header.depth != depth or
+        sizeof(ExtentHeader) * (count + 1) > node.len())
+        return Error::invalidData("Ext4::Fs::_walk: corrupted extent tree");
+
+    if (depth == 0) {
+        auto const* extents = (Extent const*) (node.buf() + 12);
+        for (usize i = 0; i < count; i++) {
+            auto const& extent = extents[i];
+            usize       len    = extent.len;
+            bool        uninit = len > EXTENT_MAX_LEN;
+            u64         start  = extent.startLo |
+                                 ((u64) (u16) extent.startHi << 32);
+            map.runs.pushBack({
+                extent.block,
+                start,
+                uninit ? len - EXTENT_MAX_LEN : len,
+                uninit,
+            });
+        }
+        return Ok();
+    }
+
+    auto const* index = (ExtentIdx const*) (node.buf() + 12);
+    Vec<u8>     buf;
+    buf.resize(_blockSize, 0);
+    for (usize i = 0; i < count; i++) {
+        u64 child = index[i].leafLo | ((u64) (u16) index[i].leafHi << 32);
+        map.tree.pushBack(child);
+        try$(_read(child, buf));
+        try$(_walk(buf, depth - 1, map));
+    }
+    return Ok();
+}
+
+Res<> Fs::_walkMapped(u64 block, usize depth, u64& index, ExtentMap& map) {
+    usize per  = _blockSize / sizeof(u32);
+    u64   span = 1;
+    for (usize i = 0; i < depth; i++)
+        span *= per;
+
+    if (not block) {
+        index += span;
+        return Ok();
+    }
+    if (block >= _blockCount())
+        return Error::invalidData("Ext4::Fs::_walkMapped: bad block");
+
+    map.tree.pushBack(block);
+    Vec<u8> buf;
+    buf.resize(_blockSize, 0);
+    try$(_read(block, buf));
+
+    auto const* entries = (u32le const*) buf.buf();
+    for (usize i = 0; i < per; i++) {
+        if (depth > 1) {
+            try$(_walkMapped(entries[i], depth - 1, index, map));
+            continue;
+        }
+        if (entries[i])
+            map.set({ index, entries[i], 1 });
+        index++;
+    }
+    return Ok();
+}
+
+Res<> Fs::_storeExtents(u32 ino, Inode& inode, ExtentMap& map) {
+    try$(_writable());
+
+    // The tree is rebuilt whole rather than edited in place: it is tiny next
+    // to the data it maps, and packing it keeps it as shallow as it can be.
+    for (auto block : map.tree)
+        try$(_freeBlocks(block, 1));
+    map.tree.clear();
+
+    Vec<u8>  level;
+    Vec<u32> firsts;
+    for (auto& run : map.runs) {
+        usize max = run.uninit ? EXTENT_MAX_LEN - 1 : EXTENT_MAX_LEN;
+        for (usize done = 0; done < run.count; done += max) {
+            usize  n     = min(run.count - done, max);
+            u64    start = run.block + done;
+            Extent extent {
+                .block   = (u32) (run.index + done),
+                .len     = (u16) (run.uninit ? n + EXTENT_MAX_LEN : n),
+                .startHi = (u16) (start >> 32),
+                .startLo = (u32) start,
+            };
+            _append(level, &extent, sizeof(extent));
+            firsts.pushBack((u32) (run.index + done));
+        }
+    }
+
+    usize depth = 0;
+    usize per   = (_blockSize - sizeof(ExtentHeader)) / sizeof(Extent);
+    u64   goal  = _goal(ino);
+    while (firsts.len() > ROOT_EXTENTS) {
+        Vec<u8>  next;
+        Vec<u32> nextFirsts;
+
+        for (usize from = 0; from < firsts.len(); from += per) {
+            usize n     = min(per, firsts.len() - from);
+            usize count = 1;
+            u64   block = try$(_allocBlocks(goal, count));
+            goal        = block + 1;
+            map.tree.pushBack(block);
+
+            Vec<u8> buf;
+            buf.resize(_blockSize, 0);
+            *(ExtentHeader*) buf.buf() = {
+                .magic      = EXTENT_MAGIC,
+                .entries    = (u16) n,
+                .max        = (u16) per,
+                .depth      = (u16) depth,
+                .generation = 0,
+            };
+            memcpy(buf.buf() + sizeof(ExtentHeader),
+                   level.buf() + from * sizeof(Extent),
+                   n * sizeof(Extent));
+            try$(_write(block, buf));
+
+            ExtentIdx idx {
+                .block        = firsts[from],
+                .leafLo       = (u32) block,
+                .leafHi       = (u16) (block >> 32),
+                .__reserved__ = 0,
+            };
+            _append(next, &idx, sizeof(idx));
+            nextFirsts.pushBack(firsts[from]);
+        }
+
+        level  = ::move(next);
+        firsts = ::move(nextFirsts);
+        depth++;
+    }
+
+    auto* root = (u8*) inode.blocks;
+    memset(root, 0, sizeof(inode.blocks));
+    *(ExtentHeader*) root = {
+        .magic      = EXTENT_MAGIC,
+        .entries    = (u16) firsts.len(),
+        .max        = (u16) ROOT_EXTENTS,
+        .depth      = (u16) depth,
+        .generation = 0,
+    };
+    memcpy(root + sizeof(ExtentHeader), level.buf(), level.len());
+
+    inode.flags = inode.flags | ExtentsFl;
+    _setBlocks(inode, map.blocks() + map.tree.len());
+    map.dirty = false;
+    return Ok();
+}
+
+Res<> Fs::_truncate(Inode& inode, ExtentMap& map) {
+    for (auto& run : map.runs)
+        try$(_freeBlocks(run.block, run.count));
+    for (auto block : map.tree)
+        try$(_freeBlocks(block, 1));
+
+    map.runs.clear();
+    map.tree.clear();
+    map.dirty = false;
+    memset(inode.blocks, 0, sizeof(inode.blocks));
+    _setBlocks(inode, 0);
+    _setSize(inode, 0);
+    return Ok();
+}
+
+// MARK: - Allocation ----------------------------------------------------------
+
+void Fs::_decode(usize index) {
+    GroupDesc desc {};
+    memcpy(&desc,
+           _table.buf() + index * _descSize,
+           min(_descSize, sizeof(GroupDesc)));
+
+    // The high halves are only on disk with 64-byte descriptors.
+    auto wide = [&](u32 lo, u32 hi) {
+        return lo | (_descSize >= 64 ? (u64) hi << 32 : 0);
+    };
+    auto& group = _groups[index];
+
+    group.blockBitmap = wide(desc.blockBitmapLo, desc.blockBitmapHi);
+    group.inodeBitmap = wide(desc.inodeBitmapLo, desc.inodeBitmapHi);
+    group.inodeTable  = wide(desc.inodeTableLo, desc.inodeTableHi);
+    group.freeBlocks  = (u32) wide(desc.freeBlocksLo, desc.freeBlocksHi);
+    group.freeInodes  = (u32) wide(desc.freeInodesLo, desc.freeInodesHi);
+    group.usedDirs    = (u32) wide(desc.usedDirsLo, desc.usedDirsHi);
+    group.flags       = desc.flags;
+}
+
+void Fs::_encode(usize index) {
+    GroupDesc desc {};
+    usize     len = min(_descSize, sizeof(GroupDesc));
+    memcpy(&desc, _table.buf() + index * _descSize, len);
+
+    auto& group       = _groups[index];
+    desc.freeBlocksLo = (u16) group.freeBlocks;
+    desc.freeInodesLo = (u16) group.freeInodes;
+    desc.usedDirsLo   = (u16) group.usedDirs;
+    desc.freeBlocksHi = (u16) (group.freeBlocks >> 16);
+    desc.freeInodesHi = (u16) (group.freeInodes >> 16);
+    desc.usedDirsHi   = (u16) (group.usedDirs >> 16);
+
+    memcpy(_table.buf() + index * _descSize, &desc, len);
+}
+
+Res<Fs::_Group*> Fs::_bitmaps(usize index) {
+    auto& group = _groups[index];
+    if (group.blocks.len())
+        return Ok(&group);
+
+    // With flex_bg the bitmaps of a flex group are laid out back to back,
+    // one read brings all of them in.
+    usize first = index / _flexSize * _flexSize;
+    usize count = min(_flexSize, _groups.len() - first);
+    for (usize i = 1; i < count; i++) {
+        auto& base = _groups[first];
+        auto& next = _groups[first + i];
+        if (next.blockBitmap != base.blockBitmap + i or
+            next.inodeBitmap != base.inodeBitmap + i) {
+            first = index;
+            count = 1;
+            break;
+        }
+    }
+
+    Vec<u8> blocks;
+    Vec<u8> inodes;
+    blocks.resize(count * _blockSize, 0);
+    inodes.resize(count * _blockSize, 0);
+    try$(_read(_groups[first].blockBitmap, blocks));
+    try$(_read(_groups[first].inodeBitmap, inodes));
+
+    for (usize i = 0; i < count; i++) {
+        auto& member = _groups[first + i];
+        if (member.blocks.len())
+            continue;
+        usize from    = i * _blockSize;
+        member.blocks = Vec<u8>(slice(blocks, from, from + _blockSize));
+        member.inodes = Vec<u8>(slice(inodes, from, from + _blockSize));
+    }
+    return Ok(&group);
+}
+
+Res<> Fs::_logGroup(usize index, bool inodes) {
+    if (not _journal)
+        return Ok();
+
+    auto& group = _groups[index];
+    if (inodes)
+        try$(_write(group.inodeBitmap, group.inodes));
+    else
+        try$(_write(group.blockBitmap, group.blocks));
+
+    _encode(index);
+    usize perBlock = _blockSize / _descSize;
+    usize at       = index / perBlock * _blockSize;
+    return _write(_super.firstBlock + 1 + index / perBlock,
+                  slice(_table, at, at + _blockSize));
+}
+
+Res<u64> Fs::_allocBlocks(u64 goal, usize& count) {
+    try$(_writable());
+    LockScoped lk(_lock);
+
+    u64   first  = _super.firstBlock;
+    u64   total  = _blockCount();
+    usize per    = _super.blocksPergroup;
+    usize groups = _groups.len();
+    if (goal < first or goal >= total)
+        goal = first;
+
+    usize start = (goal - first) / per;
+    usize near  = (goal - first) % per;
+    for (usize n = 0; n <= groups; n++) {
+        usize index = (start + n) % groups;
+        if (not _groups[index].freeBlocks)
+            continue;
+
+        auto& group = *try$(_bitmaps(index));
+        usize bits  = min((u64) per, total - first - index * per);
+        usize from  = n == 0 ? near : 0;
+        usize to    = n == groups ? min(near, bits) : bits;
+        auto  bit   = _scan(group.blocks, from, to);
+        if (not bit)
+            continue;
+
+        usize at  = bit.unwrap();
+        usize len = 1;
+        while (len < count and at + len < bits and
+               not _test(group.blocks, at + len))
+            len++;
+
+        for (usize i = 0; i < len; i++)
+            _mark(group.blocks, at + i, true);
+        group.freeBlocks -= len;
+        group.dirty       = true;
+        _dirty            = true;
+
+        _setFreeCount(_super, _freeCount(_super) - len);
+        try$(_logGroup(index, false));
+
+        count = len;
+        return Ok(first + index * per + at);
+    }
+
+    return Error::storageFull("Ext4::Fs::_allocBlocks: no free blocks");
+}
+
+Res<> Fs::_freeBlocks(u64 block, usize count) {
+    LockScoped lk(_lock);
+
+    usize per  = _super.blocksPergroup;
+    u64   free = _freeCount(_super);
+    usize last = ~0uz; // Group of the block before, logged once left
+    for (usize i = 0; i < count; i++) {
+        u64   rel   = block + i - _super.firstBlock;
+        auto& group = *try$(_bitmaps(rel / per));
+        if (not _test(group.blocks, rel % per))
+            return Error::invalidData("Ext4::Fs::_freeBlocks: not in use");
+
+        if (last != rel / per and last != ~0uz)
+            try$(_logGroup(last, false));
+        last = rel / per;
+
+        _mark(group.blocks, rel % per, false);
+        group.freeBlocks++;
+        group.dirty = true;
+        free++;
+
+        // The block may come back as file data, which is not logged.
+        if (_journal)
+            _journal->revoke(block + i);
+    }
+    _setFreeCount(_super, free);
+    _dirty = true;
+    return last != ~0uz ? _logGroup(last, false) : Ok();
+}
+
+Res<u32> Fs::_allocInode(u32 parent, bool dir) {
+    try$(_writable());
+    LockScoped lk(_lock);
+
+    usize per    = _super.inodesPergroup;
+    usize groups = _groups.len();
+    usize start  = parent ? (parent - 1) / per / _flexSize * _flexSize : 0;
+
+    for (usize n = 0; n < groups; n++) {
+        usize index = (start + n) % groups;
+        if (not _groups[index].freeInodes)
+            continue;
+
+        auto& group = *try$(_bitmaps(index));
+        usize from  = index == 0 ? _firstInode - 1 : 0;
+        auto  bit   = _scan(group.inodes, from, per);
+        if (not bit)
+            continue;
+
+        _mark(group.inodes, bit.unwrap(), true);
+        group.freeInodes--;
+        if (dir)
+            group.usedDirs++;
+        group.dirty       = true;
+        _super.inodesFree = (u32) (_super.inodesFree - 1);
+        _dirty            = true;
+        try$(_logGroup(index, true));
+        return Ok((u32) (index * per + bit.unwrap() + 1));
+    }
+
+    return Error::storageFull("Ext4::Fs::_allocInode: no free inodes");
+}
+
+Res<> Fs::_freeInode(u32 ino, bool dir) {
+    LockScoped lk(_lock);
+
+    usize per   = _super.inodesPergroup;
+    auto& group = *try$(_bitmaps((ino - 1) / per));
+    _mark(group.inodes, (ino - 1) % per, false);
+    group.freeInodes++;
+    if (dir)
+        group.usedDirs--;
+    group.dirty       = true;
+    _super.inodesFree = (u32) (_super.inodesFree + 1);
+    _dirty            = true;
+    return _logGroup((ino - 1) / per, true);
+}
+
+u64 Fs::_goal(u32 ino) const {
+    usize group = (ino - 1) / _super.inodesPergroup / _flexSize * _flexSize;
+    return _super.firstBlock + (u64) group * _super.blocksPergroup;
+}
+
+// MARK: - Directories ---------------------------------------------------------
+
+Res<> Fs::_dirBlock(ExtentMap const& map, u64 index, Vec<u8>& buf) {
+    buf.resize(_blockSize, 0);
+    u64 block = _blockAt(map, index);
+    if (not block)
+        return Error::invalidData("Ext4::Fs::_dirBlock: hole in directory");
+    return _read(block, buf);
+}
+
+Res<Vec<u8>> Fs::_readAll(Inode const& inode, ExtentMap const& map) {
+    usize count = alignUp(_fileSize(inode), _blockSize) / _blockSize;
+
+    Vec<u8> data;
+    data.resize(count * _blockSize, 0);
+
+    Vec<Run> runs;
+    map.lookup(0, count, runs);
+    for (auto& run : runs) {
+        if (not run.block or run.uninit)
+            continue;
+        try$(_read(run.block,
+                   slice(data,
+                         run.index * _blockSize,
+                         (run.index + run.count) * _blockSize)));
+    }
+    return Ok(::move(data));
+}
+
+Res<Vec<u64>> Fs::_dxLeaves(ExtentMap const& map, Str name) {
+    Vec<u8> buf;
+    try$(_dirBlock(map, 0, buf));
+
+    auto const& info   = *(DxRootInfo const*) (buf.buf() + DX_ROOT_INFO);
+    usize       levels = _super.featureIncompat & LargeDir ? 3 : 2;
+    if (info.infoLength != sizeof(DxRootInfo) or info.levels >= levels)
+        return Error::invalidData("Ext4::Fs::_dxLeaves: bad index root");
+
+    u8 version = info.hashVersion;
+    if (version <= Tea and (_super.flags & UnsignedHash))
+        version += LegacyUnsigned;
+    u32 hash = try$(_hash(name, version, _seed));
+
+    usize    off = DX_ROOT_INFO + info.infoLength;
+    Vec<u64> leaves;
+    for (usize level = 0;; level++) {
+        auto const& head    = *(DxCountLimit const*) (buf.buf() + off);
+        auto const* entries = (DxEntry const*) (buf.buf() + off);
+        usize       count   = head.count;
+        if (not count or count > head.limit or
+            off + count * sizeof(DxEntry) > _blockSize)
+            return Error::invalidData("Ext4::Fs::_dxLeaves: bad index node");
+
+        // The last entry starting at or below the hash, the first one
+        // covering everything before the second.
+        usize lo = 1, hi = count;
+        while (lo < hi) {
+            usize mid = (lo + hi) / 2;
+            if (entries[mid].hash > hash)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+
+        usize at = lo - 1;
+        if (level == info.levels) {
+            leaves.pushBack(entries[at].block);
+
+            // Names with the same hash spill over into the next leaves,
+            // whose hash then has the low bit set.
+            for (usize i = at + 1; i < count; i++) {
+                u32 next = entries[i].hash;
+                if (not(next & 1) or (next & ~1u) != hash)
+                    break;
+                leaves.pushBack(entries[i].block);
+            }
+            return Ok(::move(leaves));
+        }
+
+        try$(_dirBlock(map, entries[at].block, buf));
+        off = DX_NODE_HEAD;
+    }
+}
+
+Res<u32> Fs::_find(u32 dir, Str name) {
+    auto inode = try$(_readInode(dir));
+    if (not _isDir(inode))
+        return Error::notADirectory("Ext4::Fs::_find: not a directory");
+
+    ExtentMap map;
+    try$(_loadExtents(inode, map));
+
+    // Hashed directories read only the leaves the name can be in, and fall
+    // back to a scan when the index cannot be used.
+    if (_indexed(_super, inode)) {
+        if (auto leaves = _dxLeaves(map, name)) {
+            Vec<u8> buf;
+            for (auto index : leaves.unwrap()) {
+                try$(_dirBlock(map, index, buf));
+                if (auto off = _entry(buf, name))
+                    return Ok((u32) ((DirEntry*) (buf.buf() + *off))->inode);
+            }
+            return Error::notFound("Ext4::Fs::_find: no such entry");
+        }
+    }
+
+    auto data = try$(_readAll(inode, map));
+    for (usize off = 0; off < data.len(); off += _blockSize) {
+        auto block = slice(data, off, off + _blockSize);
+        if (auto at = _entry(block, name))
+            return Ok((u32) ((DirEntry*) (block.buf() + *at))->inode);
+    }
+    return Error::notFound("Ext4::Fs::_find: no such entry");
+}
+
+Res<u32> Fs::_resolve(Io::Path const& path, usize depth) {
+    u32 ino = ROOT_INODE;
+    for (usize i = 0; i < depth; i++)
+        ino = try$(_find(ino, path.comp[i].str()));
+    return Ok(ino);
+}
+
+Res<> Fs::_link(u32 dir, Str name, u32 ino, u8 type) {
+    if (not name or name.len() > 255)
+        return Error::invalidArgument("Ext4::Fs::_link: bad name");
+
+    auto inode = try$(_readInode(dir));
+    if (not(_super.featureIncompat & FileType))
+        type = 0;
+
+    ExtentMap map;
+    try$(_loadExtents(inode, map));
+
+    // Reuse the slack at the end of an entry, or an unused one.
+    usize need  = _recLen(name.len());
+    auto  place = [&](byte* block) -> Res<bool> {
+        for (usize off = 0; off + sizeof(DirEntry) <= _blockSize;) {
+            auto& entry = *(DirEntry*) (block + off);
+            usize rec   = entry.recLen;
+            if (rec < sizeof(DirEntry) or off + rec > _blockSize)
+                return Error::invalidData("Ext4::Fs::_link: bad directory");
+
+            usize used = entry.inode ? _recLen(entry.nameLen) : 0;
+            if (rec - used < need) {
+                off += rec;
+                continue;
+            }
+
+            if (used)
+                entry.recLen = (u16) used;
+            auto& added   = *(DirEntry*) (block + off + used);
+            added.inode   = ino;
+            added.recLen  = (u16) (rec - used);
+            added.nameLen = (u8) name.len();
+            added.type    = type;
+            memcpy(added.name, name.buf(), name.len());
+            return Ok(true);
+        }
+        return Ok(false);
+    };
+
+    if (_indexed(_super, inode)) {
+        if (auto leaves = _dxLeaves(map, name)) {
+            u64     index = leaves.unwrap()[0];
+            Vec<u8> buf;
+            try$(_dirBlock(map, index, buf));
+            if (try$(place(buf.buf())))
+                return _write(_blockAt(map, index), buf);
+        }
+
+        // Splitting a full leaf is left to fsck. The directory becomes a
+        // linear one, in which the index blocks read as unused entries.
+        inode.flags = inode.flags & ~IndexFl;
+        try$(_writeInode(dir, inode));
+    }
+
+    auto data = try$(_readAll(inode, map));
+    for (usize off = 0; off < data.len(); off += _blockSize) {
+        u64 block = _blockAt(map, off / _blockSize);
+        if (block and try$(place(data.buf() + off)))
+            return _write(block, slice(data, off, off + _blockSize));
+    }
+
+    // Grow the directory by a block holding only the new entry.
+    u64   index = data.len() / _blockSize;
+    u64   last  = index ? _blockAt(map, index - 1) : 0;
+    u64   goal  = last ? last + 1 : _goal(dir);
+    usize count = 1;
+    u64   block = try$(_allocBlocks(goal, count));
+
+    Vec<u8> buf;
+    buf.resize(_blockSize, 0);
+    ((DirEntry*) buf.buf())->recLen = (u16) _blockSize;
+    try$(place(buf.buf()));
+    try$(_write(block, buf));
+
+    map.set({ index, block, 1 });
+    try$(_storeExtents(dir, inode, map));
+    _setSize(inode, (index + 1) * _blockSize);
+    return _writeInode(dir, inode);
+}
+
+Res<u32> Fs::_unlink(u32 dir, Str name) {
+    auto      inode = try$(_readInode(dir));
+    ExtentMap map;
+    try$(_loadExtents(inode, map));
+
+    // Entries never cross a block, the first of a block is only marked
+    // unused, the others are folded into the one before.
+    auto drop = [&](byte* block, usize off) {
+        auto& entry = *(DirEntry*) (block + off);
+        u32   ino   = entry.inode;
+        if (off == 0) {
+            entry.inode = 0;
+            return ino;
+        }
+
+        usize prev = 0;
+        while (prev + ((DirEntry*) (block + prev))->recLen < off)
+            prev += ((DirEntry*) (block + prev))->recLen;
+        auto& before  = *(DirEntry*) (block + prev);
+        before.recLen = (u16) (before.recLen + entry.recLen);
+        return ino;
+    };
+
+    if (_indexed(_super, inode)) {
+        if (auto leaves = _dxLeaves(map, name)) {
+            Vec<u8> buf;
+            for (auto index : leaves.unwrap()) {
+                try$(_dirBlock(map, index, buf));
+                auto off = _entry(buf, name);
+                if (not off)
+                    continue;
+
+                u32 ino = drop(buf.buf(), *off);
+                try$(_write(_blockAt(map, index), buf));
+                return Ok(ino);
+            }
+            return Error::notFound("Ext4::Fs::_unlink: no such entry");
+        }
+    }
+
+    auto data = try$(_readAll(inode, map));
+    for (usize off = 0; off < data.len(); off += _blockSize) {
+        auto at = _entry(slice(data, off, off + _blockSize), name);
+        if (not at)
+            continue;
+
+        u32 ino = drop(data.buf() + off, *at);
+        try$(_write(_blockAt(map, off / _blockSize),
+                    slice(data, off, off + _blockSize)));
+        return Ok(ino);
+    }
+    return Error::notFound("Ext4::Fs::_unlink: no such entry");
+}
+
+// MARK: - Fs ------------------------------------------------------------------
+
+Res<> Fs::create(Io::Path path) {
+    if (not path.len())
+        return Error::invalidArgument("Ext4::Fs::create: empty path");
+    try$(_writable());
+
+    Io::JournalHandle handle(_journal);
+    LockScoped        lk(_nsLock);
+    u32               dir  = try$(_resolve(path, path.len() - 1));
+    Str               name = path.comp[path.len() - 1].str();
+    if (_find(dir, name))
+        return Error::alreadyExists("Ext4::Fs::create: file exists");
+
+    u32   ino = try$(_allocInode(dir, false));
+    Inode inode {};
+    inode.mode  = (u16) (Regular | 0644);
+    inode.links = 1;
+    if (_inodeSize >= sizeof(Inode))
+        inode.extraIsize = (u16) (sizeof(Inode) - GOOD_OLD_INODE_SIZE);
+
+    ExtentMap map;
+    try$(_storeExtents(ino, inode, map));
+    try$(_writeInode(ino, inode, true));
+    try$(_link(dir, name, ino, DirRegular));
+    return sync();
+}
+
+Res<Rc<Io::Node>> Fs::open(Io::Path path) {
+    u32 ino = try$(_resolve(path, path.len()));
+
+    // One file per inode, a second one would cache the same pages apart and
+    // write back a stale inode and extent tree. Each open is still listed,
+    // so the file stays listed until its last close.
+    if (auto file = _opened(ino)) {
+        opened.pushBack(*file);
+        return Ok(*file);
+    }
+
+    auto inode = try$(_readInode(ino));
+
+    if (_isDir(inode)) {
+        auto items = try$(listFiles(path));
+        auto dir   = makeRc<Io::Directory>(Io::Node { _dev, path },
+                                           ::move(items));
+        opened.pushBack(dir);
+        return Ok(dir);
+    }
+
+    ExtentMap map;
+    try$(_loadExtents(inode, map));
+    auto file = makeRc<File>(*this, ino, inode, ::move(map), path);
+    opened.pushBack(file);
+    return Ok(file);
+}
+
+Res<> Fs::close(Rc<Io::Node> node) {
+    Io::JournalHandle handle(_journal);
+    if (auto file = node.cast<File>())
+        try$((*file)->sync());
+    try$(sync());
+
+    for (usize i = 0; i < opened.len(); i++) {
+        if (&*opened[i] == &*node) {
+            opened.removeAt(i);
+            break;
+        }
+    }
+    return Ok();
+}
+
+Res<> Fs::remove(Io::Path path) {
+    if (not path.len())
+        return Error::invalidArgument("Ext4::Fs::remove: empty path");
+    try$(_writable());
+
+    Io::JournalHandle handle(_journal);
+    LockScoped        lk(_nsLock);
+    u32               dir   = try$(_resolve(path, path.len() - 1));
+    Str               name  = path.comp[path.len() - 1].str();
+    u32               ino   = try$(_find(dir, name));
+    auto              inode = try$(_readInode(ino));
+    bool              isDir = _isDir(inode);
+
+    if (isDir) {
+        auto items = try$(listFiles(path));
+        if (items.len())
+            return Error::directoryNotEmpty("Ext4::Fs::remove: not empty");
+    }
+
+    try$(_unlink(dir, name));
+
+    // A directory holds a link to itself and one from its parent's "..".
+    inode.links = (u16) (isDir ? 0 : inode.links - 1);
+    if (isDir) {
+        auto parent  = try$(_readInode(dir));
+        parent.links = (u16) (parent.links - 1);
+        try$(_writeInode(dir, parent));
+    }
+
+    // An open file keeps its blocks until its last reference goes, its own
+    // copy of the inode is what gets written back meanwhile.
+    Opt<Rc<File>> file = NONE;
+    if (not isDir)
+        file = _opened(ino);
+
+    if (file) {
+        {
+            LockScoped lk((*file)->_lock);
+            (*file)->_inode.links = inode.links;
+            (*file)->_orphan      = not inode.links;
+            (*file)->_dirty       = true;
+        }
+        try$((*file)->sync());
+    } else if (not inode.links) {
+        ExtentMap map;
+        try$(_loadExtents(inode, map));
+        try$(_release(ino, inode, map, isDir));
+    } else {
+        try$(_writeInode(ino, inode));
+    }
+    return sync();
+}
+
+Res<> Fs::_release(u32 ino, Inode& inode, ExtentMap& map, bool dir) {
+    Io::JournalHandle handle(_journal);
+    try$(_truncate(inode, map));
+    inode.whenDelete = 1;
+    try$(_writeInode(ino, inode));
+    try$(_freeInode(ino, dir));
+    return sync();
+}
+
+Opt<Rc<File>> Fs::_opened(u32 ino) {
+    for (auto& node : opened) {
+        if (auto file = node.is<File>(); file and file->_ino == ino)
+            return node.cast<File>();
+    }
+    return NONE;
+}
+
+Res<Io::Path> Fs::move(Io::Path src, Io::Path dest) {
+    if (not src.len() or not dest.len())
+        return Error::invalidArgument("Ext4::Fs::move: empty path");
+    try$(_writable());
+
+    Io::JournalHandle handle(_journal);
+    LockScoped        lk(_nsLock);
+    u32               from  = try$(_resolve(src, src.len() - 1));
+    u32               to    = try$(_resolve(dest, dest.len() - 1));
+    Str               name  = src.comp[src.len() - 1].str();
+    Str               dname = dest.comp[dest.len() - 1].str();
+    if (_find(to, dname))
+        return Error::alreadyExists("Ext4::Fs::move: destination exists");
+
+    u32  ino   = try$(_find(from, name));
+    auto inode = try$(_readInode(ino));
+    try$(_link(to, dname, ino, _dirType(inode.mode)));
+    try$(_unlink(from, name));
+
+    // A directory changing parent points its ".." at the new one, always
+    // the second entry.
+    if (_isDir(inode) and from != to) {
+        ExtentMap map;
+        Vec<u8>   buf;
+        try$(_loadExtents(inode, map));
+        try$(_dirBlock(map, 0, buf));
+        auto& self   = *(DirEntry*) buf.buf();
+        auto& dotdot = *(DirEntry*) (buf.buf() + self.recLen);
+        dotdot.inode = to;
+        try$(_write(_blockAt(map, 0), buf));
+
+        auto parent  = try$(_readInode(from));
+        parent.links = (u16) (parent.links - 1);
+        try$(_writeInode(from, parent));
+        parent       = try$(_readInode(to));
+        parent.links = (u16) (parent.links + 1);
+        try$(_writeInode(to, parent));
+    }
+
+    try$(sync());
+    return Ok(dest);
+}
+
+Res<Io::Path> Fs::copy(Io::Path src, Io::Path dest) {
+    u32  ino   = try$(_resolve(src, src.len()));
+    auto inode = try$(_readInode(ino));
+    if ((inode.mode & TypeMask) != Regular)
+        return Error::notSupported("Ext4::Fs::copy: not a regular file");
+
+    // An open source has its latest data in its own pages, not on disk.
+    auto from = _opened(ino);
+    if (not from) {
+        ExtentMap map;
+        try$(_loadExtents(inode, map));
+        from = makeRc<File>(*this, ino, inode, ::move(map), src);
+    }
+
+    // The new entry and the copy's extents commit together.
+    Io::JournalHandle handle(_journal);
+    try$(create(dest));
+    u32  destIno   = try$(_resolve(dest, dest.len()));
+    auto destInode = try$(_readInode(destIno));
+
+    // Both sides go through the page cache, the source with read-ahead and
+    // the destination allocated in long runs at write-back.
+    File               to { *this, destIno, destInode, {}, dest };
+    Io::CacheReadahead ra;
+    Vec<u8>            buf;
+    buf.resize(COPY_CHUNK, 0);
+
+    for (usize pos = 0; pos < (*from)->size;) {
+        usize n = try$(Io::cacheRead((*from)->_mapping, pos, buf, &ra));
+        if (not n)
+            break;
+
+        to.size = pos + n;
+        try$(Io::cacheWrite(to._mapping, pos, slice(buf, 0, n)));
+        pos += n;
+    }
+
+    try$(to.sync());
+    try$(sync());
+    return Ok(dest);
+}
+
+Res<Vec<String>> Fs::listFiles(Io::Path path) {
+    u32  ino   = try$(_resolve(path, path.len()));
+    auto inode = try$(_readInode(ino));
+    if (not _isDir(inode))
+        return Error::notADirectory("Ext4::Fs::listFiles: not a directory");
+
+    ExtentMap map;
+    try$(_loadExtents(inode, map));
+    Vec<u8> names = try$(_readAll(inode, map));
+
+    // Index blocks of hashed directories read as unused entries.
+    Vec<String> items;
+    for (usize off = 0; off + sizeof(DirEntry) <= names.len();) {
+        auto& entry = *(DirEntry*) (names.buf() + off);
+        if (entry.recLen < sizeof(DirEntry))
+            return Error::invalidData("Ext4::Fs::listFiles: bad directory");
+
+        Str item { entry.name, entry.nameLen };
+        if (entry.inode and item != "." and item != "..")
+            items.pushBack(String { item });
+        off += entry.recLen;
+    }
+    return Ok(::move(items));
+}
+
+// MARK: - Module --------------------------------------------------------------
+
+namespace {
+
+// Features the built-in ext2 driver lacks, it keeps the volumes without any.
+static constexpr u32 INCOMPAT_OWN = Extents | Bit64 | FlexBg | CsumSeed |
+                                    LargeDir;
+
+bool _match(Bytes head) {
+    usize    at = SUPERBLK_OFFSET;
+    Superblk super;
+    if (head.len() < at + sizeof(super))
+        return false;
+    memcpy(&super, head.buf() + at, sizeof(super));
+    return super.magic == MAGIC and (super.featureIncompat & INCOMPAT_OWN);
+}
+
+Res<Rc<Io::Fs>> _mount(Rc<Io::StorDev> dev, usize offset) {
+    return Ok(Rc<Io::Fs>(try$(Fs::mount(dev, offset))));
+}
+
+} // namespace
+
+extern "C" Res<> kmodInit() {
+    Io::volumeProbe({ "ext4", _match, _mount });
+    return Ok();
+}
+
+} // namespace Ext4
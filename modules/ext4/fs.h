@@ -0,0 +1,340 @@
+#pragma once
+
+#include <ext4/spec.h>
+#include <realms/io/cache.h>
+#include <realms/io/dev.stor.h>
+#include <realms/io/fs.h>
+#include <realms/io/journal.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/rc.h>
+#include <sdk-meta/vec.h>
+
+namespace Ext4 {
+
+using namespace Realms::Sys;
+
+struct Fs;
+struct File;
+
+/**
+ * @brief File blocks from `index` mapped to consecutive disk blocks from
+ * `block`, or a hole when `block` is 0.
+ */
+struct Run {
+    u64   index;
+    u64   block;
+    usize count;
+    bool  uninit = false; // Allocated but reads as zeroes
+};
+
+/**
+ * @brief The extent tree of an inode, flattened when the inode is opened so
+ * that mapping a block reads nothing.
+ */
+struct ExtentMap {
+    Vec<Run> runs; // Sorted, holes left out
+    Vec<u64> tree; // Index and leaf blocks below the root
+    bool     dirty = false;
+
+    /**
+     * @brief The runs covering `count` blocks from `index`, holes included.
+     */
+    void lookup(u64 index, usize count, Vec<Run>& out) const;
+
+    /**
+     * @brief Map the blocks of `run` to it, splitting what was there, and
+     * join it with its neighbours.
+     */
+    void set(Run run);
+
+    usize blocks() const;
+};
+
+struct Mapping : public Io::CacheMapping {
+    File& _file;
+
+    Mapping(File& file) : _file(file) { }
+
+    usize size() override;
+
+    usize capacity() override;
+
+    Res<> fill(Slice<Io::CachePage*> pages) override;
+
+    /**
+     * @brief Allocate the holes and uninitialized extents under the pages,
+     * then write them, one request per run.
+     */
+    Res<> flush(Slice<Io::CachePage*> pages) override;
+
+    void poll() override;
+};
+
+struct File : public Io::File {
+    Fs&       _fs;
+    u32       _ino;
+    Inode     _inode;
+    ExtentMap _extents;
+    Mapping   _mapping;
+    Lock      _lock; // Guards `_inode` and `_extents`
+    bool      _dirty  = false;
+    bool      _orphan = false; // Unlinked, freed with the last reference
+
+    File(Fs&          fs,
+         u32          ino,
+         Inode const& inode,
+         ExtentMap    extents,
+         Io::Path     path);
+
+    /**
+     * @brief Write the file back, or free its inode if it was removed.
+     */
+    ~File();
+
+    Res<usize> write(Io::FileHandle& handle,
+                     Io::Seek        whence,
+                     Bytes           bytes) override;
+
+    /**
+     * @brief Write dirty pages back, then the extent tree and the inode if
+     * they changed.
+     */
+    Res<> sync();
+};
+
+struct Fs : public Io::Fs {
+    struct _Group {
+        u64     blockBitmap;
+        u64     inodeBitmap;
+        u64     inodeTable;
+        u32     freeBlocks;
+        u32     freeInodes;
+        u32     usedDirs;
+        u16     flags;
+        Vec<u8> blocks; // Bitmaps, loaded a flex group at a time
+        Vec<u8> inodes;
+        bool    dirty = false;
+    };
+
+    Rc<Io::StorDev> _dev;
+    usize           _offset; // Of the filesystem on the device, in bytes
+    Superblk        _super;
+    usize           _blockSize;
+    usize           _inodeSize;
+    usize           _descSize;
+    usize           _flexSize; // Groups per flex group, 1 without flex_bg
+    u32             _firstInode;
+    bool            _readOnly = false;
+    Array<u32, 4>   _seed;  // Directory hash seed
+    Vec<u8>         _table; // Group descriptors as on disk
+    Vec<_Group>     _groups;
+    bool            _dirty = false;     // Superblock or descriptors changed
+    Lock            _lock;              // Guards allocation
+    Lock            _nsLock;            // Serializes directory changes
+    Io::Journal*    _journal = nullptr; // Owned, metadata goes through it
+
+    Fs(Rc<Io::StorDev> dev, usize offset);
+
+    /**
+     * @brief Checkpoint the journal and mark the filesystem clean.
+     */
+    ~Fs();
+
+    /**
+     * @brief Read the superblock and group descriptors of the filesystem at
+     * `offset` bytes into `dev`, replaying its journal first if it has one.
+     * Filesystems with features this driver cannot keep consistent,
+     * checksums among them, are mounted read-only, their journal replayed
+     * all the same.
+     *
+     * @retval Error::invalidData if there is no ext4 superblock.
+     * @retval Error::notSupported for incompatible features, or a journal
+     * that needs replaying and cannot be.
+     */
+    static Res<Rc<Fs>> mount(Rc<Io::StorDev> dev, usize offset = 0);
+
+    /**
+     * @brief Write the bitmaps, group descriptors and superblock back, as
+     * one transaction when journaled, and commit it.
+     */
+    Res<> sync();
+
+    /**
+     * @brief Write what `sync()` does. Called with the filesystem locked.
+     */
+    Res<> _writeGroups();
+
+    /**
+     * @brief Read the superblock and decode the group descriptors.
+     */
+    Res<> _load();
+
+    Res<> _writeSuper();
+
+    /**
+     * @brief Open the journal stored in the journal inode, replaying it.
+     */
+    Res<> _openJournal();
+
+    Res<> create(Io::Path path) override;
+
+    Res<Rc<Io::Node>> open(Io::Path path) override;
+
+    Res<> close(Rc<Io::Node> node) override;
+
+    Res<> remove(Io::Path path) override;
+
+    Res<Io::Path> move(Io::Path src, Io::Path dest) override;
+
+    Res<Io::Path> copy(Io::Path src, Io::Path dest) override;
+
+    /**
+     * @brief The names stay valid until the filesystem is dropped.
+     */
+    Res<Vec<String>> listFiles(Io::Path path) override;
+
+    // MARK: - Blocks ----------------------------------------------------------
+
+    u64 _lba(u64 block) const {
+        return (_offset + block * _blockSize) / _dev->_blockSize;
+    }
+
+    u64 _blockCount() const;
+
+    /**
+     * @brief Read or write `buf` from `block` on. With a journal, writes
+     * are logged and reads see what was logged.
+     */
+    Res<> _io(u64 block, Bytes buf, bool write);
+
+    Res<> _read(u64 block, Bytes buf) { return _io(block, buf, false); }
+
+    Res<> _write(u64 block, Bytes buf) { return _io(block, buf, true); }
+
+    /**
+     * @brief Build one request per run and device limit. `blocks` holds the
+     * memory of each file block from `first` on; holes get no request.
+     */
+    void _requests(Slice<Run>           runs,
+                   u64                  first,
+                   Slice<Bytes>         blocks,
+                   bool                 write,
+                   Vec<Io::BlkRequest>& out);
+
+    // MARK: - Inodes ----------------------------------------------------------
+
+    Res<Inode> _readInode(u32 ino);
+
+    /**
+     * @brief Write the inode, up to the extra fields it declares so extended
+     * attributes stored after them survive. `fresh` clears the whole slot.
+     */
+    Res<> _writeInode(u32 ino, Inode const& inode, bool fresh = false);
+
+    void _setBlocks(Inode& inode, u64 blocks);
+
+    // MARK: - Extents ---------------------------------------------------------
+
+    /**
+     * @brief Flatten the extent tree of the inode, or its block map if it
+     * has none. A block map becomes an extent tree when it is stored.
+     */
+    Res<> _loadExtents(Inode const& inode, ExtentMap& map);
+
+    Res<> _walk(Bytes node, usize depth, ExtentMap& map);
+
+    /**
+     * @brief Map the blocks listed by the indirect block `block`, `depth`
+     * levels above the data, from file block `index` on.
+     */
+    Res<> _walkMapped(u64 block, usize depth, u64& index, ExtentMap& map);
+
+    /**
+     * @brief Rebuild the extent tree of the inode from `map`, packing the
+     * extents into as few blocks as they fit in.
+     */
+    Res<> _storeExtents(u32 ino, Inode& inode, ExtentMap& map);
+
+    /**
+     * @brief Release the data and tree blocks of `map`.
+     */
+    Res<> _truncate(Inode& inode, ExtentMap& map);
+
+    // MARK: - Allocation ------------------------------------------------------
+
+    void _decode(usize index);
+
+    void _encode(usize index);
+
+    /**
+     * @brief Load the bitmaps of a group, and of the rest of its flex group
+     * with the same reads when they sit next to each other. Called with the
+     * filesystem locked.
+     */
+    Res<_Group*> _bitmaps(usize index);
+
+    /**
+     * @brief Log the block or inode bitmap of a group and the block of
+     * descriptors holding it, so they commit with what was allocated or
+     * freed. Does nothing without a journal. Called with the filesystem
+     * locked.
+     */
+    Res<> _logGroup(usize index, bool inodes);
+
+    /**
+     * @brief Allocate up to `count` contiguous blocks, starting at `goal` if
+     * it is free and as close after it as possible otherwise.
+     *
+     * @return The first block, `count` is updated to the run length.
+     * @retval Error::storageFull if the filesystem is full.
+     */
+    Res<u64> _allocBlocks(u64 goal, usize& count);
+
+    Res<> _freeBlocks(u64 block, usize count);
+
+    /**
+     * @brief Allocate an inode, in the parent's flex group when it has room.
+     */
+    Res<u32> _allocInode(u32 parent, bool dir);
+
+    Res<> _freeInode(u32 ino, bool dir);
+
+    /**
+     * @brief Free the blocks and the inode of a file without links left.
+     */
+    Res<> _release(u32 ino, Inode& inode, ExtentMap& map, bool dir);
+
+    /**
+     * @brief The open file of inode `ino`, if there is one.
+     */
+    Opt<Rc<File>> _opened(u32 ino);
+
+    /**
+     * @brief First block of the inode's flex group, where its data goes.
+     */
+    u64 _goal(u32 ino) const;
+
+    // MARK: - Directories -----------------------------------------------------
+
+    Res<> _dirBlock(ExtentMap const& map, u64 index, Vec<u8>& buf);
+
+    Res<Vec<u8>> _readAll(Inode const& inode, ExtentMap const& map);
+
+    /**
+     * @brief Leaf blocks that may hold `name` in a hashed directory, the
+     * one its hash falls in and those continuing a collision.
+     */
+    Res<Vec<u64>> _dxLeaves(ExtentMap const& map, Str name);
+
+    Res<u32> _find(u32 dir, Str name);
+
+    Res<u32> _resolve(Io::Path const& path, usize depth);
+
+    Res<> _link(u32 dir, Str name, u32 ino, u8 type);
+
+    Res<u32> _unlink(u32 dir, Str name);
+
+    Res<> _writable() const;
+};
+
+} // namespace Ext4
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <sdk-meta/array.h>
+#include <sdk-meta/endian.h>
+#include <sdk-meta/types.h>
+#include <sdk-meta/uuid.h>
+
+namespace Ext4 {
+
+static constexpr u16   MAGIC           = 0xEF53;
+static constexpr u16   EXTENT_MAGIC    = 0xF30A;
+static constexpr u32   ROOT_INODE      = 2;
+static constexpr u32   GOOD_OLD_INODE  = 11;
+static constexpr usize SUPERBLK_OFFSET = 1024;
+static constexpr usize ROOT_EXTENTS    = 4;     // In `Inode::blocks`
+static constexpr usize DIRECT_BLOCKS   = 12;    // Of a block map
+static constexpr u32   EXTENT_MAX_LEN  = 32768; // Initialized extents
+static constexpr u32   HTREE_EOF       = 0x7fff'ffff;
+
+enum FeatureCompat : u32 {
+    DirPrealloc  = 0x0001,
+    HasJournal   = 0x0004,
+    ExtAttr      = 0x0008,
+    ResizeInode  = 0x0010,
+    DirIndex     = 0x0020, // Hashed b-tree directories
+    SparseSuper2 = 0x0200,
+};
+
+enum FeatureIncompat : u32 {
+    Compression = 0x0001,
+    FileType    = 0x0002,
+    Recover     = 0x0004, // Journal needs replaying
+    JournalDev  = 0x0008,
+    MetaBg      = 0x0010,
+    Extents     = 0x0040,
+    Bit64       = 0x0080,
+    Mmp         = 0x0100,
+    FlexBg      = 0x0200,
+    EaInode     = 0x0400,
+    DirData     = 0x1000,
+    CsumSeed    = 0x2000,
+    LargeDir    = 0x4000, // Three-level htrees
+    InlineData  = 0x8000,
+    Encrypt     = 0x10000,
+    Casefold    = 0x20000,
+};
+
+enum FeatureRoCompat : u32 {
+    SparseSuper  = 0x0001,
+    LargeFile    = 0x0002,
+    BtreeDir     = 0x0004,
+    HugeFile     = 0x0008,
+    GdtCsum      = 0x0010,
+    DirNlink     = 0x0020,
+    ExtraIsize   = 0x0040,
+    Quota        = 0x0100,
+    Bigalloc     = 0x0200,
+    MetadataCsum = 0x0400,
+    ReadOnly     = 0x1000,
+    Project      = 0x2000,
+    Verity       = 0x8000,
+};
+
+enum SuperFlags : u32 {
+    SignedHash   = 0x0001,
+    UnsignedHash = 0x0002,
+};
+
+enum Mode : u16 {
+    TypeMask  = 0xF000,
+    Fifo      = 0x1000,
+    CharDev   = 0x2000,
+    Directory = 0x4000,
+    BlockDev  = 0x6000,
+    Regular   = 0x8000,
+    Symlink   = 0xA000,
+    Socket    = 0xC000,
+};
+
+enum InodeFlags : u32 {
+    IndexFl    = 0x0000'1000, // Hashed directory
+    HugeFileFl = 0x0004'0000, // `blocks` counts file system blocks
+    ExtentsFl  = 0x0008'0000,
+    InlineFl   = 0x1000'0000,
+};
+
+enum GroupFlags : u16 {
+    InodeUninit = 0x0001,
+    BlockUninit = 0x0002,
+    InodeZeroed = 0x0004,
+};
+
+enum DirType : u8 {
+    DirUnknown   = 0,
+    DirRegular   = 1,
+    DirDirectory = 2,
+    DirCharDev   = 3,
+    DirBlockDev  = 4,
+    DirFifo      = 5,
+    DirSocket    = 6,
+    DirSymlink   = 7,
+};
+
+enum HashVersion : u8 {
+    Legacy          = 0,
+    HalfMd4         = 1,
+    Tea             = 2,
+    LegacyUnsigned  = 3,
+    HalfMd4Unsigned = 4,
+    TeaUnsigned     = 5,
+    SipHash         = 6,
+};
+
+struct [[gnu::packed]] Superblk {
+    u32le inodes;
+    u32le blocksLo;
+    u32le blocksRsrvLo;
+    u32le blocksFreeLo;
+    u32le inodesFree;
+    u32le firstBlock;
+    u32le blockSize; // log2(size) - 10
+    u32le clusterSize;
+    u32le blocksPergroup;
+    u32le clustersPergroup;
+    u32le inodesPergroup;
+    u32le whenMount;
+    u32le whenLastWrite;
+    u16le mountsCount;
+    u16le mountsLimit;
+    u16le magic;
+    u16le state;
+    u16le erraction;
+    u16le vminor;
+    u32le whenLastCheck;
+    u32le checkInterval;
+    u32le osId;
+    u32le vmajor;
+    u16le uidRsrv;
+    u16le gidRsrv;
+
+    u32le            firstInode;
+    u16le            inodeSize;
+    u16le            blockGroupNum;
+    u32le            featureCompat;
+    u32le            featureIncompat;
+    u32le            featureRoCompat;
+    Uuid             uuid;
+    Array<char, 16>  volumeName;
+    Array<char, 64>  lastMounted;
+    u32le            bitmapUsage;
+    u8               preallocBlocks;
+    u8               preallocDirBlocks;
+    u16le            reservedGdtBlocks;
+    Uuid             journalUuid;
+    u32le            journalInode;
+    u32le            journalDevice;
+    u32le            orphanInodeHead;
+    Array<u32le, 4>  hashSeed;
+    u8               defHashVersion;
+    u8               journalBackupType;
+    u16le            descSize; // With the 64-bit feature
+    u32le            defaultMountOpts;
+    u32le            firstMetaBlkGroup;
+    u32le            whenCreated;
+    Array<u32le, 17> journalBlocks;
+
+    u32le          blocksHi;
+    u32le          blocksRsrvHi;
+    u32le          blocksFreeHi;
+    u16le          minExtraIsize;
+    u16le          wantExtraIsize;
+    u32le          flags;
+    u16le          raidStride;
+    u16le          mmpInterval;
+    u64le          mmpBlock;
+    u32le          raidStripeWidth;
+    u8             logGroupsPerFlex;
+    u8             checksumType;
+    u16le          __reserved__0;
+    u64le          kbytesWritten;
+    Array<u8, 636> __reserved__1;
+    u32le          checksum;
+};
+static_assert(sizeof(Superblk) == 1024);
+
+/**
+ * @brief A group descriptor. Only the first 32 bytes are on disk without
+ * the 64-bit feature.
+ */
+struct [[gnu::packed]] GroupDesc {
+    u32le blockBitmapLo;
+    u32le inodeBitmapLo;
+    u32le inodeTableLo;
+    u16le freeBlocksLo;
+    u16le freeInodesLo;
+    u16le usedDirsLo;
+    u16le flags;
+    u32le excludeBitmapLo;
+    u16le blockBitmapCsumLo;
+    u16le inodeBitmapCsumLo;
+    u16le itableUnusedLo;
+    u16le checksum;
+
+    u32le blockBitmapHi;
+    u32le inodeBitmapHi;
+    u32le inodeTableHi;
+    u16le freeBlocksHi;
+    u16le freeInodesHi;
+    u16le usedDirsHi;
+    u16le itableUnusedHi;
+    u32le excludeBitmapHi;
+    u16le blockBitmapCsumHi;
+    u16le inodeBitmapCsumHi;
+    u32le __reserved__;
+};
+static_assert(sizeof(GroupDesc) == 64);
+
+/**
+ * @brief An inode, up to the fields of the extra space used here. Inodes of
+ * 128 bytes stop at `extraIsize`.
+ */
+struct [[gnu::packed]] Inode {
+    u16le mode;
+    u16le uid;
+    u32le sizeLo;
+    u32le whenAccess;
+    u32le whenChange;
+    u32le whenModify;
+    u32le whenDelete;
+    u16le gid;
+    u16le links;
+    u32le blocksLo; // In 512-byte units unless `HugeFileFl` is set
+    u32le flags;
+    u32le version;
+    u32le blocks[15]; // Extent tree root or block map
+    u32le generation;
+    u32le fileAclLo;
+    u32le sizeHi;
+    u32le fragAddress;
+    u16le blocksHi;
+    u16le fileAclHi;
+    u16le uidHi;
+    u16le gidHi;
+    u16le checksumLo;
+    u16le __reserved__;
+
+    u16le extraIsize;
+    u16le checksumHi;
+    u32le whenChangeExtra;
+    u32le whenModifyExtra;
+    u32le whenAccessExtra;
+    u32le whenCreate;
+    u32le whenCreateExtra;
+    u32le versionHi;
+    u32le projectId;
+};
+static_assert(sizeof(Inode) == 160);
+
+static constexpr usize GOOD_OLD_INODE_SIZE = 128;
+
+struct [[gnu::packed]] ExtentHeader {
+    u16le magic;
+    u16le entries;
+    u16le max;
+    u16le depth; // 0 for leaves
+    u32le generation;
+};
+static_assert(sizeof(ExtentHeader) == 12);
+
+struct [[gnu::packed]] ExtentIdx {
+    u32le block; // First file block covered
+    u32le leafLo;
+    u16le leafHi;
+    u16le __reserved__;
+};
+static_assert(sizeof(ExtentIdx) == 12);
+
+struct [[gnu::packed]] Extent {
+    u32le block;
+    u16le len; // Above `EXTENT_MAX_LEN` for uninitialized extents
+    u16le startHi;
+    u32le startLo;
+};
+static_assert(sizeof(Extent) == 12);
+
+struct [[gnu::packed]] DirEntry {
+    u32le inode;
+    u16le recLen;
+    u8    nameLen;
+    u8    type;
+    char  name[];
+};
+
+struct [[gnu::packed]] DxRootInfo {
+    u32le __reserved__;
+    u8    hashVersion;
+    u8    infoLength;
+    u8    levels; // Index levels below the root
+    u8    flags;
+};
+
+/**
+ * @brief Overlays the hash of the first entry of an index block.
+ */
+struct [[gnu::packed]] DxCountLimit {
+    u16le limit;
+    u16le count;
+};
+
+struct [[gnu::packed]] DxEntry {
+    u32le hash;
+    u32le block; // Directory block
+};
+
+// "." and ".." come first in the root, a single empty entry in nodes.
+static constexpr usize DX_ROOT_INFO = 24;
+static constexpr usize DX_NODE_HEAD = 8;
+
+} // namespace Ext4
@@ -0,0 +1,191 @@
+#include <zfs/arc.h>
+
+namespace Zfs {
+
+ArcCache::~ArcCache() {
+    _bufs.each([](u64, ArcBuf& buf) { delete &buf; });
+    _bufs.clear();
+}
+
+bool ArcCache::lookup(u64 key, u64 birth, Vec<u8>& out) {
+    LockScoped lk(_lock);
+    auto*      buf = _hit(key, birth);
+    if (not buf)
+        return false;
+
+    out = buf->data;
+    return true;
+}
+
+bool ArcCache::lookup(u64 key, u64 birth, usize offset, Bytes out) {
+    LockScoped lk(_lock);
+    auto*      buf = _hit(key, birth);
+    if (not buf or offset > buf->data.len() or
+        out.len() > buf->data.len() - offset)
+        return false;
+
+    memcpy((byte*) out.buf(), buf->data.buf() + offset, out.len());
+    return true;
+}
+
+bool ArcCache::cached(u64 key, u64 birth) {
+    LockScoped lk(_lock);
+    auto*      buf = _bufs.get(key);
+    return buf and buf->birth == birth and
+           (buf->state == Mru or buf->state == Mfu);
+}
+
+void ArcCache::insert(u64 key, u64 birth, Vec<u8> data, bool prefetched) {
+    LockScoped lk(_lock);
+    usize      size = data.len();
+    auto*      buf  = _bufs.get(key);
+    if (buf and buf->birth != birth) {
+        _drop(buf);
+        buf = nullptr;
+    }
+
+    // Read twice by misses racing each other.
+    if (buf and (buf->state == Mru or buf->state == Mfu))
+        return;
+
+    auto& mruGhost = _lists[MruGhost];
+    auto& mfuGhost = _lists[MfuGhost];
+    State state    = Mru;
+    bool  mfuHit   = false;
+
+    // A ghost hit moves the target by the size of the block, more when the
+    // other ghost list is the longer one. Read-ahead says nothing about
+    // what the workload wants and adapts nothing.
+    if (buf and not prefetched) {
+        if (buf->state == MruGhost) {
+            usize delta = max(mfuGhost.bytes / mruGhost.bytes, 1uz) * size;
+            _target     = min(_target + delta, _capacity);
+            stats.mruGhostHits.fetchAdd(1, Relaxed);
+        } else {
+            usize delta = max(mruGhost.bytes / mfuGhost.bytes, 1uz) * size;
+            _target     = _target > delta ? _target - delta : 0;
+            mfuHit      = true;
+            stats.mfuGhostHits.fetchAdd(1, Relaxed);
+        }
+        state = Mfu;
+    }
+
+    if (buf) {
+        _unlink(buf);
+    } else {
+        buf = new ArcBuf {
+            .key        = key,
+            .birth      = birth,
+            .size       = size,
+            .data       = {},
+            .state      = Mru,
+            .prefetched = false,
+        };
+        _bufs.put(key, buf);
+    }
+
+    _replace(size, mfuHit);
+    buf->size       = size;
+    buf->data       = ::move(data);
+    buf->prefetched = prefetched;
+    _link(buf, state);
+    _trimGhosts();
+}
+
+ArcBuf* ArcCache::_hit(u64 key, u64 birth) {
+    auto* buf = _bufs.get(key);
+    if (buf and buf->birth != birth) {
+        _drop(buf);
+        buf = nullptr;
+    }
+
+    if (not buf or buf->state == MruGhost or buf->state == MfuGhost) {
+        stats.misses.fetchAdd(1, Relaxed);
+        return nullptr;
+    }
+
+    // The first use of a prefetched block is a first use, any later one
+    // makes it frequent.
+    _unlink(buf);
+    _link(buf, buf->prefetched ? Mru : Mfu);
+    buf->prefetched = false;
+    stats.hits.fetchAdd(1, Relaxed);
+    return buf;
+}
+
+void ArcCache::_link(ArcBuf* buf, State state) {
+    auto& list = _lists[state];
+    buf->state = state;
+    buf->_prev = list.tail;
+    buf->_next = nullptr;
+    if (list.tail)
+        list.tail->_next = buf;
+    else
+        list.head = buf;
+    list.tail   = buf;
+    list.bytes += buf->size;
+}
+
+void ArcCache::_unlink(ArcBuf* buf) {
+    auto& list = _lists[buf->state];
+    if (buf->_prev)
+        buf->_prev->_next = buf->_next;
+    else
+        list.head = buf->_next;
+
+    if (buf->_next)
+        buf->_next->_prev = buf->_prev;
+    else
+        list.tail = buf->_prev;
+
+    list.bytes -= buf->size;
+}
+
+void ArcCache::_drop(ArcBuf* buf) {
+    _unlink(buf);
+    _bufs.remove(buf->key);
+    delete buf;
+}
+
+void ArcCache::_replace(usize size, bool mfuGhost) {
+    auto& mru = _lists[Mru];
+    auto& mfu = _lists[Mfu];
+
+    while (mru.bytes + mfu.bytes + size > _capacity) {
+        ArcBuf* victim;
+        if (mru.head and (mru.bytes > _target or not mfu.head or
+                          (mfuGhost and mru.bytes == _target)))
+            victim = mru.head;
+        else if (mfu.head)
+            victim = mfu.head;
+        else
+            break;
+
+        State ghost = victim->state == Mru ? MruGhost : MfuGhost;
+        _unlink(victim);
+        victim->data.clear();
+        victim->data.fit();
+        _link(victim, ghost);
+        stats.evicted.fetchAdd(1, Relaxed);
+    }
+}
+
+void ArcCache::_trimGhosts() {
+    auto& mru      = _lists[Mru];
+    auto& mfu      = _lists[Mfu];
+    auto& mruGhost = _lists[MruGhost];
+    auto& mfuGhost = _lists[MfuGhost];
+    auto  total    = [&] {
+        return mru.bytes + mfu.bytes + mruGhost.bytes + mfuGhost.bytes;
+    };
+
+    // Recent blocks and their ghosts fit in the cache, everything together
+    // in twice that.
+    while (mruGhost.head and mru.bytes + mruGhost.bytes > _capacity)
+        _drop(mruGhost.head);
+
+    while (mfuGhost.head and total() > 2 * _capacity)
+        _drop(mfuGhost.head);
+}
+
+} // namespace Zfs
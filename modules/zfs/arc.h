@@ -0,0 +1,133 @@
+#pragma once
+
+#include <sdk-meta/atomic.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/radix.h>
+#include <sdk-meta/slice.h>
+#include <sdk-meta/traits.h>
+#include <sdk-meta/vec.h>
+
+namespace Zfs {
+
+/**
+ * @brief A block in the cache, or the ghost of one evicted from it, which
+ * only remembers its size.
+ */
+struct ArcBuf {
+    u64     key;
+    u64     birth; // A block rewritten in place is another block
+    usize   size;
+    Vec<u8> data; // Empty for ghosts
+    u8      state;
+    bool    prefetched; // Read ahead, not used yet
+
+    ArcBuf* _prev = nullptr;
+    ArcBuf* _next = nullptr;
+};
+
+/**
+ * @brief Blocks of one state, least recently used first.
+ */
+struct ArcList {
+    ArcBuf* head  = nullptr;
+    ArcBuf* tail  = nullptr;
+    usize   bytes = 0;
+};
+
+/**
+ * @brief Counters of the cache, updated without ordering.
+ */
+struct ArcStats {
+    Atomic<usize> hits { 0 };
+    Atomic<usize> misses { 0 };
+    Atomic<usize> mruGhostHits { 0 }; // Misses the cache should have been
+    Atomic<usize> mfuGhostHits { 0 }; // more recent or frequent to avoid
+    Atomic<usize> evicted { 0 };
+};
+
+/**
+ * @brief An adaptive replacement cache of verified blocks.
+ *
+ * Blocks used once sit in the recent list, blocks used again move to the
+ * frequent one. Both are kept within `capacity` bytes between them, and
+ * what is evicted from each is remembered as a ghost for about as much
+ * again. A miss on a recent ghost means the recent list was too short and
+ * grows its `target` share, a miss on a frequent ghost shrinks it, so the
+ * cache settles between recency and frequency for whatever the workload is.
+ *
+ * Prefetched blocks count as unused until their first hit, which leaves
+ * them in the recent list.
+ */
+struct ArcCache : Meta::Pinned {
+    static constexpr usize CAPACITY = 32 * 1024 * 1024;
+    static constexpr usize STATES   = 4;
+
+    enum State : u8 {
+        Mru,
+        Mfu,
+        MruGhost,
+        MfuGhost,
+    };
+
+    Lock          _lock;
+    Radix<ArcBuf> _bufs;
+    ArcList       _lists[STATES];
+    usize         _capacity;
+    usize         _target = 0; // Bytes of the cache wanted for Mru
+    ArcStats      stats;
+
+    ArcCache(usize capacity = CAPACITY) : _capacity(capacity) { }
+
+    ~ArcCache();
+
+    /**
+     * @brief Copy the block cached for `key` at `birth` to `out`.
+     *
+     * @return false on a miss, ghosts included.
+     */
+    bool lookup(u64 key, u64 birth, Vec<u8>& out);
+
+    /**
+     * @brief Copy `out.len()` bytes of the block cached for `key` at
+     * `birth`, from `offset`, leaving the rest of it in the cache.
+     *
+     * @return false on a miss, or when the block is too short.
+     */
+    bool lookup(u64 key, u64 birth, usize offset, Bytes out);
+
+    /**
+     * @brief Whether the block is cached, without counting as a use.
+     */
+    bool cached(u64 key, u64 birth);
+
+    /**
+     * @brief Cache `data`, just read for `key` at `birth`, adapting the
+     * target when it was a ghost.
+     */
+    void insert(u64 key, u64 birth, Vec<u8> data, bool prefetched = false);
+
+    /**
+     * @brief The block cached for `key` at `birth`, counted as a use, null
+     * on a miss. Called with the cache locked.
+     */
+    ArcBuf* _hit(u64 key, u64 birth);
+
+    void _link(ArcBuf* buf, State state);
+
+    void _unlink(ArcBuf* buf);
+
+    void _drop(ArcBuf* buf);
+
+    /**
+     * @brief Evict into the ghost lists until `size` more bytes fit, from
+     * Mru while it is over its target.
+     */
+    void _replace(usize size, bool mfuGhost);
+
+    /**
+     * @brief Forget the oldest ghosts past what the lists may remember.
+     */
+    void _trimGhosts();
+};
+
+} // namespace Zfs
@@ -0,0 +1,562 @@
+#include <realms/core/api.io.h>
+#include <sdk-crypto/types.h>
+#include <sdk-logs/logger.h>
+#include <sdk-meta/_embed.h>
+#include <sdk-meta/endian.h>
+#include <zfs/pool.h>
+
+namespace Zfs {
+
+namespace {
+
+static constexpr usize COPIES = 3;
+
+// The words of a Blkptr that do not carry an embedded block.
+static constexpr usize PROP_WORD  = 6;
+static constexpr usize BIRTH_WORD = 10;
+
+// Blocks are cached by where their first copy lives, which only changes
+// when they are rewritten, and then their birth changes too.
+u64 _key(Blkptr const& bp) {
+    return bp.dva[0].sectors();
+}
+
+Vec<u8> _payload(Blkptr const& bp) {
+    u64 words[sizeof(Blkptr) / 8];
+    memcpy(words, &bp, sizeof(Blkptr));
+
+    Vec<u8> payload;
+    for (usize i = 0; i < sizeof(Blkptr) / 8; i++) {
+        if (i == PROP_WORD or i == BIRTH_WORD)
+            continue;
+        for (usize b = 0; b < 8; b++)
+            payload.pushBack((u8) (words[i] >> (b * 8)));
+    }
+
+    payload.trunc(bp.psize());
+    return payload;
+}
+
+// LZ4 blocks as ZFS stores them: the length of the compressed stream, big
+// endian, then the stream.
+bool _lz4(Bytes src, Bytes dst) {
+    if (src.len() < 4)
+        return false;
+
+    u32be len;
+    memcpy(&len, src.buf(), sizeof(len));
+    if ((u32) len > src.len() - 4)
+        return false;
+
+    u8 const* in  = src.buf();
+    u8*       out = (u8*) dst.buf();
+    usize     ip  = 4;
+    usize     end = 4 + (u32) len;
+    usize     op  = 0;
+    usize     cap = dst.len();
+
+    // Lengths of 15 go on in the following bytes, up to one below 255.
+    auto more = [&](usize& n) {
+        u8 next;
+        do {
+            if (ip >= end)
+                return false;
+            next  = in[ip++];
+            n    += next;
+        } while (next == 255);
+        return true;
+    };
+
+    while (ip < end) {
+        u8    token = in[ip++];
+        usize lit   = token >> 4;
+        if (lit == 15 and not more(lit))
+            return false;
+        if (lit > end - ip or lit > cap - op)
+            return false;
+        memcpy(out + op, in + ip, lit);
+        ip += lit;
+        op += lit;
+
+        // The last sequence is only literals.
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return false;
+        usize dist  = in[ip] | (in[ip + 1] << 8);
+        ip         += 2;
+        if (dist == 0 or dist > op)
+            return false;
+
+        usize match = token & 15;
+        if (match == 15 and not more(match))
+            return false;
+        match += 4;
+        if (match > cap - op)
+            return false;
+
+        // Byte by byte, a match may overlap what it copies.
+        for (usize i = 0; i < match; i++, op++)
+            out[op] = out[op - dist];
+    }
+
+    return true;
+}
+
+} // namespace
+
+Pool::Pool(Io::StorDev& dev, usize offset, usize size)
+    : _dev(dev), _offset(offset), _size(size), _uber {}, _mos {} { }
+
+Res<Pool*> Pool::open(Io::StorDev& dev, usize offset, usize size) {
+    if (not size)
+        size = dev._blockCount * dev._blockSize - offset;
+
+    auto* pool = new Pool(dev, offset, size);
+    auto  res  = pool->_uberblocks();
+    if (not res) {
+        delete pool;
+        return res.none();
+    }
+
+    // The newest uberblock may have been torn while being written, or
+    // point at blocks that never made it. Fall back to older ones, whose
+    // trees copy-on-write left alone.
+    for (auto& uber : res.unwrap()) {
+        pool->_uber = uber;
+        auto mos    = pool->objset(uber.rootbp);
+        if (mos) {
+            pool->_mos = mos.take();
+            logInfo("Zfs::Pool::open: at txg {}", uber.txg);
+            return Ok(pool);
+        }
+        logWarn("Zfs::Pool::open: txg {} unusable: {}",
+                uber.txg,
+                mos.none().msg());
+    }
+
+    delete pool;
+    return Error::invalidData("Zfs::Pool::open: no usable uberblock");
+}
+
+Res<Vec<u8>> Pool::read(Blkptr const& bp) {
+    if (bp.hole()) {
+        Vec<u8> zeroes;
+        zeroes.resize(bp.lsize(), 0);
+        return Ok(::move(zeroes));
+    }
+
+    if (bp.embedded())
+        return _decode(bp, _payload(bp));
+
+    Vec<u8> data;
+    if (_arc.lookup(_key(bp), bp.birth, data))
+        return Ok(::move(data));
+    return _load(bp);
+}
+
+Res<> Pool::read(Blkptr const& bp, usize offset, Bytes out) {
+    Vec<u8> data;
+    if (bp.hole() or bp.embedded())
+        data = try$(read(bp));
+    else if (_arc.lookup(_key(bp), bp.birth, offset, out))
+        return Ok();
+    else
+        data = try$(_load(bp));
+
+    if (offset > data.len() or out.len() > data.len() - offset)
+        return Error::invalidData("Zfs::Pool::read: short block");
+    memcpy((byte*) out.buf(), data.buf() + offset, out.len());
+    return Ok();
+}
+
+Res<Dnode> Pool::objset(Blkptr const& bp) {
+    Dnode meta;
+    try$(read(bp, 0, Bytes { (byte*) &meta, sizeof(Dnode) }));
+    return Ok(meta);
+}
+
+Res<Dnode> Pool::dnode(Dnode const& meta, u64 id) {
+    usize bsize = meta.dataBlkSzSec << SECTOR_SHIFT;
+    usize pos   = id * DNODE_SIZE;
+    if (not bsize or pos / bsize > meta.maxBlkId)
+        return Error::notFound("Zfs::Pool::dnode: no such object");
+
+    auto bp = try$(_walk(meta, pos / bsize));
+    if (bp.hole())
+        return Error::notFound("Zfs::Pool::dnode: no such object");
+
+    Dnode dnode;
+    try$(read(bp, pos % bsize, Bytes { (byte*) &dnode, sizeof(Dnode) }));
+    if (not dnode.type)
+        return Error::notFound("Zfs::Pool::dnode: no such object");
+    return Ok(dnode);
+}
+
+Res<usize> Pool::read(Dnode const& dnode, usize offset, Bytes buf) {
+    usize bsize = dnode.dataBlkSzSec << SECTOR_SHIFT;
+    if (not bsize)
+        return Error::invalidData("Zfs::Pool::read: bad dnode");
+
+    usize size = (dnode.maxBlkId + 1) * bsize;
+    if (offset >= size or not buf.len())
+        return Ok(0uz);
+    usize len = min(buf.len(), size - offset);
+
+    u64         last = (offset + len - 1) / bsize;
+    Vec<Blkptr> bps;
+    for (u64 blkid = offset / bsize; blkid <= last; blkid++)
+        bps.pushBack(try$(_walk(dnode, blkid)));
+
+    // What is not cached yet goes to the device in one batch rather than
+    // one block at a time.
+    _fetch(bps);
+
+    usize done = 0;
+    for (auto& bp : bps) {
+        usize pos = (offset + done) % bsize;
+        usize n   = min(bsize - pos, len - done);
+        u8*   dst = (u8*) buf.buf() + done;
+        if (bp.hole())
+            memset(dst, 0, n);
+        else
+            try$(read(bp, pos, Bytes { dst, n }));
+        done += n;
+    }
+
+    return Ok(len);
+}
+
+// MARK: - Blocks --------------------------------------------------------------
+
+Res<Vec<u8>> Pool::_load(Blkptr const& bp) {
+    // Every copy holds the same block, go on to the next when one cannot be
+    // read or fails its checksum.
+    Error err = Error::invalidData("Zfs::Pool::read: no copy of the block");
+    for (usize copy = 0; copy < COPIES and not bp.dva[copy].empty(); copy++) {
+        Vec<u8> raw;
+        usize   skip = 0;
+        auto    req  = _request(bp, copy, raw, skip);
+        if (not req) {
+            err = req.none();
+            continue;
+        }
+
+        if (auto res = blkWait(req.unwrap()); not res) {
+            err = res.none();
+            continue;
+        }
+
+        auto res = _decode(bp, slice(raw, skip, skip + bp.psize()));
+        if (not res) {
+            logWarn("Zfs::Pool::read: copy {} at {:#x}: {}",
+                    copy,
+                    bp.dva[copy].offset(),
+                    res.none().msg());
+            err = res.none();
+            continue;
+        }
+
+        auto data = res.take();
+        _arc.insert(_key(bp), bp.birth, data);
+        return Ok(::move(data));
+    }
+
+    return err;
+}
+
+Res<BlkRequest> Pool::_request(Blkptr const& bp,
+                               usize         copy,
+                               Vec<u8>&      raw,
+                               usize&        skip) {
+    auto const& dva = bp.dva[copy];
+    if (dva.gang())
+        return Error::notSupported("Zfs::Pool::read: gang block");
+    if (dva.vdev() != 0)
+        return Error::notSupported("Zfs::Pool::read: block on another vdev");
+
+    usize bs    = _dev._blockSize;
+    usize start = _offset + LABEL_START + dva.offset();
+    usize first = alignDown(start, bs);
+    usize end   = alignUp(start + bp.psize(), bs);
+    if (end > _offset + _size)
+        return Error::invalidData("Zfs::Pool::read: block past the vdev");
+
+    raw.resize(end - first, 0);
+    skip = start - first;
+
+    BlkRequest req {
+        .dev   = &_dev,
+        .op    = BlkRequest::Op::Read,
+        .lba   = first / bs,
+        .count = (end - first) / bs,
+        .segs  = {},
+        .fn    = nullptr,
+        .ctx   = nullptr,
+    };
+    req.segs.pushBack(raw);
+    return Ok(req);
+}
+
+Vec<bool> Pool::_batch(Vec<BlkRequest>& reqs) {
+    struct _Wait {
+        Atomic<usize> pending { 0 };
+        BlkRequest*   first;
+        bool*         done;
+    } wait;
+
+    Vec<bool> done;
+    done.resize(reqs.len(), false);
+    wait.first = reqs.buf();
+    wait.done  = done.buf();
+
+    wait.pending.store(reqs.len());
+    {
+        BlkPlug plug;
+        for (auto& req : reqs) {
+            req.ctx = &wait;
+            req.fn  = [](BlkRequest& req, Res<> res) {
+                auto* wait                     = static_cast<_Wait*>(req.ctx);
+                wait->done[&req - wait->first] = (bool) res;
+                wait->pending.fetchSub(1, Release);
+            };
+            blkSubmit(req);
+        }
+    }
+
+    while (wait.pending.load(Acquire)) {
+        _dev.poll();
+        _Embed::relaxe();
+    }
+    return done;
+}
+
+Res<Vec<u8>> Pool::_decode(Blkptr const& bp, Bytes raw) {
+    if (not bp.littleEndian())
+        return Error::notSupported("Zfs::Pool::read: big-endian block");
+
+    if (bp.embedded()) {
+        if (bp.cksum() != EmbeddedData)
+            return Error::notSupported("Zfs::Pool::read: embedded type");
+    } else if (bp.cksum() != CksumOff) {
+        Array<u64, 4> sum;
+        switch (bp.cksum()) {
+            case CksumFletcher2: sum = Sdk::Crypto::fletcher2(raw); break;
+            case CksumFletcher4: sum = Sdk::Crypto::fletcher4(raw); break;
+            default:
+                return Error::notSupported("Zfs::Pool::read: checksum type");
+        }
+        for (usize i = 0; i < 4; i++) {
+            if (sum[i] != bp.checksum[i])
+                return Error::invalidData("Zfs::Pool::read: bad checksum");
+        }
+    }
+
+    Vec<u8> data;
+    data.resize(bp.lsize(), 0);
+    switch (bp.comp()) {
+        case CompOff:
+            memcpy(data.buf(), raw.buf(), min(raw.len(), data.len()));
+            break;
+        case CompEmpty: break;
+        case CompLz4:
+            if (not _lz4(raw, data))
+                return Error::invalidData("Zfs::Pool::read: bad lz4 block");
+            break;
+        default:
+            return Error::notSupported("Zfs::Pool::read: compression type");
+    }
+    return Ok(::move(data));
+}
+
+void Pool::_fetch(Slice<Blkptr> bps) {
+    struct _Fetch {
+        Blkptr  bp;
+        Vec<u8> raw;
+        usize   skip;
+    };
+
+    Vec<_Fetch> fetches;
+    for (auto& bp : bps) {
+        if (bp.hole() or bp.embedded() or _arc.cached(_key(bp), bp.birth))
+            continue;
+        fetches.pushBack({ bp, {}, 0 });
+    }
+
+    // Fully built before any request points into it.
+    Vec<BlkRequest> reqs;
+    Vec<_Fetch*>    owners;
+    for (auto& fetch : fetches) {
+        auto req = _request(fetch.bp, 0, fetch.raw, fetch.skip);
+        if (not req)
+            continue;
+        reqs.pushBack(req.take());
+        owners.pushBack(&fetch);
+    }
+    if (not reqs.len())
+        return;
+
+    auto done = _batch(reqs);
+    for (usize i = 0; i < reqs.len(); i++) {
+        auto& fetch = *owners[i];
+        if (not done[i])
+            continue;
+
+        auto raw = slice(fetch.raw, fetch.skip, fetch.skip + fetch.bp.psize());
+        if (auto res = _decode(fetch.bp, raw); res)
+            _arc.insert(_key(fetch.bp), fetch.bp.birth, res.take(), true);
+    }
+}
+
+Res<Blkptr> Pool::_walk(Dnode const& dnode, u64 blkid) {
+    if (not dnode.nlevels or not dnode.nblkptr or dnode.nblkptr > 3 or
+        dnode.indBlkShift <= BLKPTR_SHIFT)
+        return Error::invalidData("Zfs::Pool::_walk: bad dnode");
+
+    usize shift = dnode.indBlkShift - BLKPTR_SHIFT;
+    usize level = dnode.nlevels - 1;
+    u64   top   = level * shift < 64 ? blkid >> (level * shift) : 0;
+    if (top >= dnode.nblkptr)
+        return Ok(Blkptr {});
+
+    Blkptr bp = dnode.blkptr[top];
+    for (; level > 0; level--) {
+        if (bp.hole())
+            return Ok(bp);
+
+        usize count = bp.lsize() / sizeof(Blkptr);
+        usize index = (blkid >> ((level - 1) * shift)) & ((1uz << shift) - 1);
+        if (index >= count)
+            return Error::invalidData("Zfs::Pool::_walk: short block");
+
+        // Only the child taken, and the ones after it a walk that goes on
+        // past it will need, are copied out of the cache.
+        Blkptr ptrs[1 + PREFETCH];
+        usize  n = level > 1 ? min(PREFETCH, count - index - 1) : 0;
+        try$(read(bp,
+                  index * sizeof(Blkptr),
+                  Bytes { (byte*) ptrs, (1 + n) * sizeof(Blkptr) }));
+
+        // Bring the indirect blocks after it in together.
+        if (n)
+            _fetch({ ptrs + 1, n });
+
+        bp = ptrs[0];
+    }
+
+    return Ok(bp);
+}
+
+// MARK: - Uberblocks ----------------------------------------------------------
+
+Res<Vec<Uberblock>> Pool::_uberblocks() {
+    usize end = alignDown(_size, LABEL_SIZE);
+    if (end < LABEL_START + 2 * LABEL_SIZE)
+        return Error::invalidData("Zfs::Pool::open: vdev too small");
+
+    usize labels[LABELS] = {
+        0,
+        LABEL_SIZE,
+        end - 2 * LABEL_SIZE,
+        end - LABEL_SIZE,
+    };
+
+    Vec<Vec<u8>> rings;
+    for (usize i = 0; i < LABELS; i++) {
+        rings.pushBack({});
+        rings[i].resize(RING_SIZE, 0);
+    }
+
+    Vec<BlkRequest> reqs;
+    for (usize i = 0; i < LABELS; i++) {
+        BlkRequest req {
+            .dev   = &_dev,
+            .op    = BlkRequest::Op::Read,
+            .lba   = _lba(labels[i] + RING_OFFSET),
+            .count = RING_SIZE / _dev._blockSize,
+            .segs  = {},
+            .fn    = nullptr,
+            .ctx   = nullptr,
+        };
+        req.segs.pushBack(rings[i]);
+        reqs.pushBack(req);
+    }
+
+    // Slots are at least as large as the sector size of the vdev, which
+    // only the label config says. Uberblocks start on 1K boundaries either
+    // way, and the rest of a larger slot does not look like one.
+    Vec<Uberblock> found;
+    bool           swapped = false;
+    auto           done    = _batch(reqs);
+    for (usize i = 0; i < LABELS; i++) {
+        if (not done[i]) {
+            logWarn("Zfs::Pool::open: label {} unreadable", i);
+            continue;
+        }
+
+        for (usize pos = 0; pos < RING_SIZE; pos += UBERBLOCK_SLOT) {
+            Uberblock uber;
+            memcpy(&uber, rings[i].buf() + pos, sizeof(Uberblock));
+            if (uber.magic == __builtin_bswap64(UBERBLOCK_MAGIC))
+                swapped = true;
+            if (uber.magic != UBERBLOCK_MAGIC or not uber.txg)
+                continue;
+
+            // Labels hold copies of the same uberblocks, keep one of each,
+            // newest first.
+            usize j = 0;
+            for (; j < found.len(); j++) {
+                if (found[j].txg < uber.txg or
+                    (found[j].txg == uber.txg and
+                     found[j].timestamp <= uber.timestamp))
+                    break;
+            }
+            if (j < found.len() and found[j].txg == uber.txg and
+                found[j].timestamp == uber.timestamp)
+                continue;
+            found.insert(j, uber);
+        }
+    }
+
+    if (not found.len() and swapped)
+        return Error::notSupported("Zfs::Pool::open: big-endian pool");
+    if (not found.len())
+        return Error::invalidData("Zfs::Pool::open: no uberblock");
+    return Ok(::move(found));
+}
+
+// MARK: - Module --------------------------------------------------------------
+
+namespace {
+
+// Open for as long as the kernel runs, like the drives under them.
+Vec<Pool*> _pools;
+
+} // namespace
+
+Slice<Pool*> pools() {
+    return _pools;
+}
+
+extern "C" Res<> kmodInit() {
+    auto tree = devtree();
+    if (not tree)
+        return Error::notFound("Zfs::kmodInit: no device tree");
+
+    // Pools are not filesystems the volume scanner could mount, and their
+    // labels lie past the heads it reads, so the drives are asked directly.
+    tree->snapshot().each(Io::Dev::Type::StorageDrive, [](Io::Dev& dev) {
+        auto& stor = static_cast<Io::StorDev&>(dev);
+        if (not stor._blockCount)
+            return;
+
+        if (auto pool = Pool::open(stor); pool) {
+            logInfo("Zfs::kmodInit: pool on {}", dev._name);
+            _pools.pushBack(pool.unwrap());
+        }
+    });
+    return Ok();
+}
+
+} // namespace Zfs
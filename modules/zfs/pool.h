@@ -0,0 +1,146 @@
+#pragma once
+
+#include <realms/io/blk.h>
+#include <realms/io/dev.stor.h>
+#include <sdk-meta/res.h>
+#include <sdk-meta/slice.h>
+#include <sdk-meta/traits.h>
+#include <sdk-meta/vec.h>
+#include <zfs/arc.h>
+#include <zfs/spec.h>
+
+namespace Zfs {
+
+using namespace Realms::Sys;
+
+/**
+ * @brief A pool on a single vdev, read-only: the tree of copy-on-write
+ * blocks under its newest uberblock, each verified against the checksum its
+ * parent keeps for it.
+ *
+ * Blocks are read through an adaptive replacement cache. Walking an object
+ * down to a data block also reads the next few indirect blocks beside the
+ * one it takes, in the same batch of requests, so sequential reads find
+ * them cached. A block that fails its checksum is read from its next copy.
+ */
+struct Pool : Meta::Pinned {
+    static constexpr usize PREFETCH = 8; // Indirect blocks read ahead
+
+    Io::StorDev& _dev;    // Borrowed from the device tree
+    usize        _offset; // Of the vdev on the device, in bytes
+    usize        _size;
+    Uberblock    _uber;
+    Dnode        _mos; // Meta dnode of the meta object set
+    ArcCache     _arc;
+
+    Pool(Io::StorDev& dev, usize offset, usize size);
+
+    /**
+     * @brief Open the pool on the `size` bytes of `dev` from `offset`, the
+     * rest of the device when 0, at the newest uberblock whose tree can be
+     * read.
+     *
+     * @retval Error::invalidData if no uberblock leads to a valid tree.
+     * @retval Error::notSupported for big-endian pools.
+     */
+    static Res<Pool*> open(Io::StorDev& dev,
+                           usize        offset = 0,
+                           usize        size   = 0);
+
+    /**
+     * @brief The contents of the block `bp` points to, verified and
+     * decompressed. Holes read as zeroes.
+     *
+     * @retval Error::invalidData if no copy matches its checksum.
+     * @retval Error::notSupported for gang blocks, other vdevs, and
+     *         checksums or compressions not implemented.
+     */
+    Res<Vec<u8>> read(Blkptr const& bp);
+
+    /**
+     * @brief Copy `out.len()` bytes of the block `bp` points to, from
+     * `offset`, without copying the rest of it out of the cache.
+     *
+     * @retval Error::invalidData if the block is shorter.
+     */
+    Res<> read(Blkptr const& bp, usize offset, Bytes out);
+
+    /**
+     * @brief The meta dnode of the object set `bp` points to.
+     */
+    Res<Dnode> objset(Blkptr const& bp);
+
+    /**
+     * @brief Object `id` of the object set whose meta dnode is `meta`.
+     *
+     * @retval Error::notFound past the last object.
+     */
+    Res<Dnode> dnode(Dnode const& meta, u64 id);
+
+    /**
+     * @brief Read the data of `dnode` from `offset` into `buf`.
+     *
+     * @return The bytes read, short past the last block.
+     */
+    Res<usize> read(Dnode const& dnode, usize offset, Bytes buf);
+
+    // MARK: - Blocks ----------------------------------------------------------
+
+    u64 _lba(usize offset) const {
+        return (_offset + offset) / _dev._blockSize;
+    }
+
+    /**
+     * @brief Read the first copy of `bp` that can be read and verified,
+     * and cache it.
+     */
+    Res<Vec<u8>> _load(Blkptr const& bp);
+
+    /**
+     * @brief Read copy `copy` of `bp` into `raw`, rounded out to whole
+     * device blocks, the block itself starting `skip` bytes in.
+     */
+    Res<BlkRequest> _request(Blkptr const& bp,
+                             usize         copy,
+                             Vec<u8>&      raw,
+                             usize&        skip);
+
+    /**
+     * @brief Submit `reqs` as one plugged batch and wait for all of them.
+     *
+     * @return Whether each request succeeded.
+     */
+    Vec<bool> _batch(Vec<BlkRequest>& reqs);
+
+    /**
+     * @brief Verify the physical contents of `bp` and decompress them.
+     */
+    Res<Vec<u8>> _decode(Blkptr const& bp, Bytes raw);
+
+    /**
+     * @brief Read every block of `bps` not cached yet in one batch, and
+     * cache them as read ahead. Blocks that fail are left to the read that
+     * needs them.
+     */
+    void _fetch(Slice<Blkptr> bps);
+
+    /**
+     * @brief The pointer to data block `blkid` of `dnode`, prefetching the
+     * indirect blocks beside the ones it goes through.
+     */
+    Res<Blkptr> _walk(Dnode const& dnode, u64 blkid);
+
+    // MARK: - Uberblocks ------------------------------------------------------
+
+    /**
+     * @brief The uberblocks of every label, newest first.
+     */
+    Res<Vec<Uberblock>> _uberblocks();
+};
+
+/**
+ * @brief The pools found on the storage drives when the module was loaded.
+ */
+Slice<Pool*> pools();
+
+} // namespace Zfs
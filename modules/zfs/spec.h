@@ -0,0 +1,170 @@
+#pragma once
+
+#include <sdk-meta/array.h>
+#include <sdk-meta/types.h>
+
+// The on-disk format of a ZFS pool, in the host byte order of the machine
+// that wrote it. Only little-endian pools are read.
+namespace Zfs {
+
+static constexpr u64   UBERBLOCK_MAGIC = 0x00ba'b10c;
+static constexpr usize SECTOR_SHIFT    = 9;
+static constexpr usize DNODE_SIZE      = 512;
+static constexpr usize BLKPTR_SHIFT    = 7;
+static constexpr usize EMBEDDED_MAX    = 112; // Payload bytes in a Blkptr
+
+// Two labels at each end of the vdev, each ending with a ring of uberblocks
+// in slots of at least 1K. Allocated space starts after the first two and
+// a boot area.
+static constexpr usize LABEL_SIZE     = 256 * 1024;
+static constexpr usize LABELS         = 4;
+static constexpr usize RING_OFFSET    = 128 * 1024;
+static constexpr usize RING_SIZE      = 128 * 1024;
+static constexpr usize UBERBLOCK_SLOT = 1024;
+static constexpr usize LABEL_START    = 4 * 1024 * 1024;
+
+enum Cksum : u8 {
+    CksumInherit    = 0,
+    CksumOn         = 1,
+    CksumOff        = 2,
+    CksumLabel      = 3,
+    CksumGangHeader = 4,
+    CksumZilog      = 5,
+    CksumFletcher2  = 6,
+    CksumFletcher4  = 7,
+    CksumSha256     = 8,
+};
+
+enum Comp : u8 {
+    CompInherit = 0,
+    CompOn      = 1,
+    CompOff     = 2,
+    CompLzjb    = 3,
+    CompEmpty   = 4,
+    CompZle     = 14,
+    CompLz4     = 15,
+    CompZstd    = 16,
+};
+
+enum EmbeddedType : u8 {
+    EmbeddedData = 0,
+};
+
+/**
+ * @brief Where one copy of a block is allocated.
+ */
+struct [[gnu::packed]] Dva {
+    u64 word0; // Allocated size in sectors, gang grid, vdev
+    u64 word1; // Offset in sectors past LABEL_START, gang bit
+
+    u32 vdev() const { return word0 >> 32; }
+
+    u64 sectors() const { return word1 & ~(1ull << 63); }
+
+    u64 offset() const { return sectors() << SECTOR_SHIFT; }
+
+    bool gang() const { return word1 >> 63; }
+
+    bool empty() const { return word0 == 0 and word1 == 0; }
+};
+
+/**
+ * @brief A pointer to a block, with up to three copies of it and the
+ * checksum of its contents as stored. Embedded pointers carry the block
+ * itself in every word but `prop` and `birth`.
+ */
+struct [[gnu::packed]] Blkptr {
+    Array<Dva, 3> dva;
+    u64           prop;
+    Array<u64, 2> __reserved__0;
+    u64           physBirth;
+    u64           birth; // Transaction group that wrote the block
+    u64           fill;
+    Array<u64, 4> checksum;
+
+    bool embedded() const { return (prop >> 39) & 1; }
+
+    bool hole() const { return not embedded() and dva[0].empty(); }
+
+    usize lsize() const {
+        if (embedded())
+            return (prop & 0x1ff'ffff) + 1;
+        return ((prop & 0xffff) + 1) << SECTOR_SHIFT;
+    }
+
+    usize psize() const {
+        if (embedded())
+            return ((prop >> 25) & 0x7f) + 1;
+        return (((prop >> 16) & 0xffff) + 1) << SECTOR_SHIFT;
+    }
+
+    u8 comp() const { return (prop >> 32) & 0x7f; }
+
+    // Shares its bits with the embedded type.
+    u8 cksum() const { return (prop >> 40) & 0xff; }
+
+    u8 type() const { return (prop >> 48) & 0xff; }
+
+    u8 level() const { return (prop >> 56) & 0x1f; }
+
+    bool littleEndian() const { return prop >> 63; }
+};
+
+struct [[gnu::packed]] Uberblock {
+    u64    magic;
+    u64    version;
+    u64    txg;
+    u64    guidSum;
+    u64    timestamp;
+    Blkptr rootbp; // Of the meta object set
+    u64    softwareVersion;
+    u64    mmpMagic;
+    u64    mmpDelay;
+    u64    mmpConfig;
+    u64    checkpointTxg;
+};
+
+/**
+ * @brief An object: a tree of `nlevels` levels of blocks under `blkptr`,
+ * indirect blocks of `1 << indBlkShift` bytes above data blocks of
+ * `dataBlkSzSec` sectors. The bonus buffer follows the last pointer.
+ */
+struct [[gnu::packed]] Dnode {
+    u8               type;
+    u8               indBlkShift;
+    u8               nlevels;
+    u8               nblkptr;
+    u8               bonusType;
+    u8               cksum;
+    u8               comp;
+    u8               flags;
+    u16              dataBlkSzSec;
+    u16              bonusLen;
+    u8               extraSlots;
+    Array<u8, 3>     __reserved__0;
+    u64              maxBlkId;
+    u64              used;
+    Array<u64, 4>    __reserved__1;
+    Array<Blkptr, 3> blkptr;
+    Array<u8, 64>    __reserved__2;
+};
+
+/**
+ * @brief The root block of an object set, whose objects are the dnodes
+ * stored in the data of `metaDnode`.
+ */
+struct [[gnu::packed]] Objset {
+    Dnode          metaDnode;
+    Array<u8, 192> zilHeader;
+    u64            type;
+    u64            flags;
+    Array<u8, 304> __reserved__0;
+};
+
+static_assert(sizeof(Dva) == 16);
+static_assert(sizeof(Blkptr) == 128);
+static_assert(sizeof(Uberblock) == 208);
+static_assert(sizeof(Dnode) == DNODE_SIZE);
+static_assert(sizeof(Objset) == 1024);
+
+} // namespace Zfs
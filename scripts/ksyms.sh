@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+set -eo pipefail
+
+# Emit the symbol table of the kernel for its second link. Each global
+# symbol defined by the first link becomes three words in .ksyms: address,
+# name and name length. Addresses are left to the linker, so the table
+# growing .rodata does not make them stale.
+#
+# usage: ksyms.sh <nm> <kernel image>
+
+"$1" -g --defined-only --format=posix "$2" | awk '
+$2 != "A" && $1 !~ /^__ksyms_/ {
+    names[n++] = $1
+}
+END {
+    print "section .ksyms progbits alloc noexec nowrite align=8"
+    for (i = 0; i < n; i++) {
+        print "extern $" names[i]
+        print "    dq $" names[i] ", ksym_" i ", " length(names[i])
+    }
+
+    print "section .rodata.ksymstr progbits alloc noexec nowrite align=1"
+    for (i = 0; i < n; i++)
+        print "ksym_" i ": db \"" names[i] "\""
+}'
@@ -1 +1,68 @@
 #include <acpi/bus.h>
+#include <acpi/timer.h>
+#include <realms/mm/mem.h>
+#include <sdk-logs/logger.h>
+
+namespace Acpi {
+
+Res<> TimerDevice::onInit(BusDevice& acpi) {
+    auto desc = acpi.lookupTable("FACP"s);
+    if (not desc) {
+        return Error::notFound("acpi::TimerDevice: no fadt");
+    }
+
+    auto* fadt = desc->as<Fadt>();
+
+    u64 port = fadt->pmTmrBlk;
+    if (fadt->length >= __builtin_offsetof(Fadt, xPmTmrBlk) + sizeof(addresspkg)
+        and fadt->xPmTmrBlk.address
+        and fadt->xPmTmrBlk.addressSpace == 1) {
+        port = fadt->xPmTmrBlk.address;
+    }
+
+    if (port == 0 or fadt->pmTmrLen < 4) {
+        return Error::notFound("acpi::TimerDevice: no pm timer block");
+    }
+
+    _io  = Realms::Hal::PortIo({ (usize) port, 4 });
+    _ext = fadt->flags & Fadt::TmrValExt;
+
+    logInfo("acpi::TimerDevice: pm timer at port {:#x}, {} bits",
+            port,
+            _ext ? 32 : 24);
+    _status = Status::Enabled;
+    return Ok();
+}
+
+Res<> HpetDevice::onInit(BusDevice& acpi) {
+    auto desc = acpi.lookupTable("HPET"s);
+    if (not desc) {
+        return Error::notFound("acpi::HpetDevice: no hpet table");
+    }
+
+    auto* hpet = desc->as<Hpet>();
+    if (hpet->address.addressSpace != 0) {
+        return Error::notSupported("acpi::HpetDevice: hpet is not mmio");
+    }
+
+    _base = (u64 volatile*) try$(
+        Realms::Sys::mmapVirtIo(hpet->address.address));
+
+    // Period of the main counter in femtoseconds lives in the upper half of
+    // the capabilities register.
+    u64 period = _base[Regs::Capabilities / 8] >> 32;
+    if (period == 0 or period > 100'000'000) {
+        return Error::invalidData("acpi::HpetDevice: invalid counter period");
+    }
+    _frequency = 1'000'000'000'000'000ull / period;
+
+    _base[Regs::Config / 8] = _base[Regs::Config / 8] | ConfigBits::Enable;
+
+    logInfo("acpi::HpetDevice: hpet at {:#x}, {} Hz",
+            (u64) hpet->address.address,
+            _frequency);
+    _status = Status::Enabled;
+    return Ok();
+}
+
+} // namespace Acpi
@@ -142,6 +142,62 @@ struct [[gnu::packed]] Mcfg : public Desc {
 struct [[gnu::packed]] Fadt : public Desc {
     u32 fwctrl;
     u32 dsdt;
+    u8  __reserved__0;
+    u8  preferredPmProfile;
+    u16 sciInt;
+    u32 smiCmd;
+    u8  acpiEnable;
+    u8  acpiDisable;
+    u8  s4biosReq;
+    u8  pstateCnt;
+    u32 pm1aEvtBlk;
+    u32 pm1bEvtBlk;
+    u32 pm1aCntBlk;
+    u32 pm1bCntBlk;
+    u32 pm2CntBlk;
+    u32 pmTmrBlk;
+    u32 gpe0Blk;
+    u32 gpe1Blk;
+    u8  pm1EvtLen;
+    u8  pm1CntLen;
+    u8  pm2CntLen;
+    u8  pmTmrLen;
+    u8  gpe0BlkLen;
+    u8  gpe1BlkLen;
+    u8  gpe1Base;
+    u8  cstCnt;
+    u16 pLvl2Lat;
+    u16 pLvl3Lat;
+    u16 flushSize;
+    u16 flushStride;
+    u8  dutyOffset;
+    u8  dutyWidth;
+    u8  dayAlrm;
+    u8  monAlrm;
+    u8  century;
+    u16 iapcBootArch;
+    u8  __reserved__1;
+    u32 flags;
+
+    addresspkg resetReg;
+    u8         resetValue;
+    u16        armBootArch;
+    u8         minorVersion;
+    u64        xFwctrl;
+    u64        xDsdt;
+    addresspkg xPm1aEvtBlk;
+    addresspkg xPm1bEvtBlk;
+    addresspkg xPm1aCntBlk;
+    addresspkg xPm1bCntBlk;
+    addresspkg xPm2CntBlk;
+    addresspkg xPmTmrBlk;
+
+    enum Flags : u32 {
+        TmrValExt = (1 << 8),
+    };
 };
+static_assert(__builtin_offsetof(Fadt, pmTmrBlk) == 76);
+static_assert(__builtin_offsetof(Fadt, flags) == 112);
+static_assert(__builtin_offsetof(Fadt, xPmTmrBlk) == 208);
 
 } // namespace Acpi
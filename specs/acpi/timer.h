@@ -0,0 +1,83 @@
+#pragma once
+
+#include <acpi/bus.h>
+#include <realms/hal/clock.h>
+#include <realms/hal/io.h>
+#include <realms/io/dev.h>
+
+namespace Acpi {
+
+/**
+ * @brief The ACPI power management timer, a fixed 3.579545 MHz counter
+ * that is either 24 or 32 bits wide.
+ */
+struct TimerDevice : public Io::Dev, public Realms::Hal::ClockSource {
+    static constexpr u64 FREQUENCY = 3'579'545;
+
+    Realms::Hal::PortIo _io;
+    bool                _ext;
+
+    TimerDevice()
+        : Io::Dev("acpi-timer-device"s,
+                  "acpi/acpi-timer-device"s,
+                  Io::Dev::Type::SoftwareDevice),
+          _io({ 0, 0 }),
+          _ext(false) { }
+
+    /**
+     * @brief Locate the timer block through the FADT.
+     *
+     * @retval Error::notFound if the FADT is missing or has no timer block.
+     */
+    Res<> onInit(BusDevice& acpi);
+
+    Str name() const override { return "acpi-pm-timer"s; }
+
+    u64 ticks() override { return _io.in32(0).unwrapOr(0) & mask(); }
+
+    u64 frequency() const override { return FREQUENCY; }
+
+    u64 mask() const override {
+        return _ext ? 0xffff'ffffull : 0x00ff'ffffull;
+    }
+};
+
+/**
+ * @brief The HPET main counter, preferred over the PM timer as calibration
+ * reference when the firmware exposes one.
+ */
+struct HpetDevice : public Io::Dev, public Realms::Hal::ClockSource {
+    enum Regs : usize {
+        Capabilities = 0x00,
+        Config       = 0x10,
+        Counter      = 0xf0,
+    };
+
+    enum ConfigBits : u64 {
+        Enable = (1 << 0),
+    };
+
+    u64 volatile* _base;
+    u64           _frequency;
+
+    HpetDevice()
+        : Io::Dev("acpi-hpet-device"s,
+                  "acpi/acpi-hpet-device"s,
+                  Io::Dev::Type::SoftwareDevice),
+          _base(nullptr),
+          _frequency(0) { }
+
+    /**
+     * @retval Error::notFound if there is no HPET table.
+     * @retval Error::notSupported if the counter is not memory mapped.
+     */
+    Res<> onInit(BusDevice& acpi);
+
+    Str name() const override { return "hpet"s; }
+
+    u64 ticks() override { return _base[Regs::Counter / 8]; }
+
+    u64 frequency() const override { return _frequency; }
+};
+
+} // namespace Acpi
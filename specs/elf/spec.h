@@ -0,0 +1,128 @@
+#pragma once
+
+#include <sdk-meta/array.h>
+#include <sdk-meta/types.h>
+
+namespace Elf {
+
+static constexpr inline u32 MAGIC = 0x464C'457F; // "\x7fELF"
+
+struct [[gnu::packed]] Header {
+    enum Class : u8 {
+        Class64 = 2,
+    };
+
+    enum Data : u8 {
+        LittleEndian = 1,
+    };
+
+    enum Type : u16 {
+        Relocatable = 1,
+        Executable  = 2,
+        Shared      = 3,
+    };
+
+    enum Machine : u16 {
+        X86_64 = 62,
+    };
+
+    u32          magic;
+    u8           clazz;
+    u8           data;
+    u8           identVersion;
+    u8           abi;
+    Array<u8, 8> __reserved__0;
+    u16          type;
+    u16          machine;
+    u32          version;
+    u64          entry;
+    u64          phOff;
+    u64          shOff;
+    u32          flags;
+    u16          size;
+    u16          phEntSize;
+    u16          phCount;
+    u16          shEntSize;
+    u16          shCount;
+    u16          shStrIndex;
+};
+
+struct [[gnu::packed]] Section {
+    enum Type : u32 {
+        Null      = 0,
+        Progbits  = 1,
+        Symtab    = 2,
+        Strtab    = 3,
+        Rela      = 4,
+        Nobits    = 8,
+        Rel       = 9,
+        InitArray = 14,
+    };
+
+    enum Flags : u64 {
+        Write = (1 << 0),
+        Alloc = (1 << 1),
+        Exec  = (1 << 2),
+    };
+
+    u32 name;
+    u32 type;
+    u64 flags;
+    u64 addr;
+    u64 offset;
+    u64 size;
+    u32 link;
+    u32 info;
+    u64 align;
+    u64 entSize;
+};
+
+struct [[gnu::packed]] Sym {
+    enum Index : u16 {
+        Undef  = 0,
+        Abs    = 0xFFF1,
+        Common = 0xFFF2,
+    };
+
+    enum Bind : u8 {
+        Local  = 0,
+        Global = 1,
+        Weak   = 2,
+    };
+
+    u32 name;
+    u8  info;
+    u8  other;
+    u16 shIndex;
+    u64 value;
+    u64 size;
+
+    u8 bind() const { return info >> 4; }
+};
+
+struct [[gnu::packed]] Rela {
+    enum Type : u32 {
+        X86_64_None  = 0,
+        X86_64_64    = 1,
+        X86_64_Pc32  = 2,
+        X86_64_Plt32 = 4,
+        X86_64_32    = 10,
+        X86_64_32S   = 11,
+        X86_64_Pc64  = 24,
+    };
+
+    u64 offset;
+    u64 info;
+    i64 addend;
+
+    u32 sym() const { return info >> 32; }
+
+    u32 type() const { return info & 0xFFFF'FFFF; }
+};
+
+static_assert(sizeof(Header) == 64);
+static_assert(sizeof(Section) == 64);
+static_assert(sizeof(Sym) == 24);
+static_assert(sizeof(Rela) == 24);
+
+} // namespace Elf
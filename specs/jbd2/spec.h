@@ -0,0 +1,104 @@
+#pragma once
+
+#include <sdk-meta/array.h>
+#include <sdk-meta/endian.h>
+#include <sdk-meta/types.h>
+
+// The on-disk format of the journaling block device layer used by ext3 and
+// ext4. Everything is big-endian.
+namespace Jbd2 {
+
+static constexpr u32 MAGIC = 0xC03B'3998;
+
+struct [[gnu::packed]] Header {
+    enum Type : u32 {
+        Descriptor = 1,
+        Commit     = 2,
+        SuperV1    = 3,
+        SuperV2    = 4,
+        Revoke     = 5,
+    };
+
+    u32be magic;
+    u32be type;
+    u32be sequence; // Of the transaction the block belongs to
+};
+
+struct [[gnu::packed]] Super {
+    enum Incompat : u32 {
+        Revokes     = 0x01,
+        Bit64       = 0x02, // Block numbers in tags and revokes are 64-bit
+        AsyncCommit = 0x04,
+        CsumV2      = 0x08,
+        CsumV3      = 0x10,
+        FastCommit  = 0x20,
+    };
+
+    Header             header;
+    u32be              blockSize;
+    u32be              maxLen;   // Blocks in the journal, this one included
+    u32be              first;    // First block of the log
+    u32be              sequence; // First transaction expected in the log
+    u32be              start;    // Block it starts at, 0 if the log is empty
+    u32be              error;
+    u32be              featureCompat;
+    u32be              featureIncompat;
+    u32be              featureRoCompat;
+    Array<u8, 16>      uuid;
+    u32be              users;
+    u32be              dynSuper;
+    u32be              maxTransaction;
+    u32be              maxTransData;
+    u8                 checksumType;
+    Array<u8, 3>       __reserved__0;
+    u32be              fcBlocks;
+    u32be              head;
+    Array<u32be, 40>   __reserved__1;
+    u32be              checksum;
+    Array<u8, 16 * 48> userIds;
+};
+
+/**
+ * @brief Where one logged block goes home. Tags follow the header of a
+ * descriptor block, the data blocks they describe follow it in the log. The
+ * first tag is followed by the journal UUID unless it says otherwise.
+ */
+struct [[gnu::packed]] Tag {
+    enum Flags : u16 {
+        Escape   = 0x1, // The block started with MAGIC, zeroed in the log
+        SameUuid = 0x2,
+        Deleted  = 0x4,
+        Last     = 0x8,
+    };
+
+    u32be blockLo;
+    u16be checksum;
+    u16be flags;
+    u32be blockHi; // Only with Super::Bit64
+};
+
+struct [[gnu::packed]] Commit {
+    Header        header;
+    u8            checksumType;
+    u8            checksumSize;
+    Array<u8, 2>  __reserved__0;
+    Array<u32, 8> checksum;
+    u64be         sec;
+    u32be         nsec;
+};
+
+/**
+ * @brief Header of a revoke block, followed by block numbers up to `count`
+ * bytes into the block, header included.
+ */
+struct [[gnu::packed]] Revoke {
+    Header header;
+    u32be  count;
+};
+
+static_assert(sizeof(Header) == 12);
+static_assert(sizeof(Super) == 1024);
+static_assert(sizeof(Tag) == 12);
+static_assert(sizeof(Revoke) == 16);
+
+} // namespace Jbd2
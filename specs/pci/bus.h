@@ -5,6 +5,7 @@
 #include <pci/spec.h>
 #include <realms/io/bus.h>
 #include <realms/io/dev.h>
+#include <sdk-meta/array.h>
 #include <sdk-meta/list.h>
 #include <sdk-meta/vec.h>
 
@@ -20,14 +21,28 @@ struct BusDevice : public Io::Bus, public Io::Dev {
     BusDevice();
     virtual ~BusDevice();
 
+    /**
+     * @brief Pick the configuration access: the MCFG windows when ACPI has
+     * them, the legacy ports otherwise.
+     */
     Res<> onInit() override;
 
     Res<String> path(Rc<Io::Dev> dev) override;
 
+    /**
+     * @brief Walk every segment from its root bus, following bridges down to
+     * the buses behind them, so only populated buses are visited.
+     */
     Res<Slice<Rc<Dev>>> probe() override;
 
     Res<Slice<Rc<Dev>>> devices() override;
 
+    /**
+     * @brief Vendor and device id, then class with and without the
+     * programming interface.
+     */
+    Res<> keys(Rc<Io::Dev> dev, Vec<Io::DrvKey>& out) override;
+
     bool check(u8 bus, u8 slot, u8 func);
 
     bool check(Id& id);
@@ -41,6 +56,17 @@ struct BusDevice : public Io::Bus, public Io::Dev {
     Opt<Rc<Pci::Dev>> create(Id& id);
 
     Res<> remove(Rc<Io::Dev> dev) override;
+
+    /**
+     * @brief Enumerate segment `seg` from its root bus `root`. Segments share
+     * nothing but `_devices`, which the results are added to at the end.
+     */
+    Res<> _scanSegment(u16 seg, u8 root);
+
+    Res<> _scanBus(u16                seg,
+                   u8                 bus,
+                   Array<bool, 256>&  seen,
+                   Vec<Rc<Pci::Dev>>& found);
 };
 
 } // namespace Pci
@@ -20,11 +20,32 @@ BusDevice::~BusDevice() {
 
 Res<> BusDevice::onInit() {
     auto dev = devtree()->find<Acpi::BusDevice>("acpi-bus-device"s);
+    if (not dev) {
+        return Ok();
+    }
 
-    if (dev and dev.unwrap()->lookupTable("MCFG"s)) {
-        _mode = Pci::Mode::Enhanced;
+    auto table = dev->lookupTable("MCFG"s);
+    if (not table) {
+        return Ok();
+    }
+
+    auto* mcfg  = table->as<Acpi::Mcfg>();
+    usize count = (mcfg->length - sizeof(Acpi::Mcfg))
+                / sizeof(Acpi::Mcfg::Packet);
+    for (usize i = 0; i < count; i++) {
+        auto& packet = mcfg->packets[i];
+        auto  res
+            = mapEcam(packet.pseg, packet.busStart, packet.busEnd, packet.base);
+        if (not res) {
+            logWarn("PciBus::onInit: segment {} not mapped", packet.pseg);
+            continue;
+        }
+        _packets.pushBack(packet);
     }
 
+    if (_packets.len()) {
+        _mode = Pci::Mode::Enhanced;
+    }
     return Ok();
 }
 
@@ -33,39 +54,110 @@ Res<String> BusDevice::path(Rc<Io::Dev> dev) {
 }
 
 Res<Slice<Rc<Io::Dev>>> BusDevice::probe() {
-    for (u16 i = 0; i < 256; i++) {
-        for (u16 j = 0; j < 32; j++) {
-            Id id = { (u8) i, (u8) j, 0 };
+    if (_mode == Pci::Mode::Enhanced) {
+        for (auto& packet : _packets)
+            try$(_scanSegment(packet.pseg, packet.busStart));
+    } else {
+        try$(_scanSegment(0, 0));
+    }
+    return Ok(slice(_devices).cast<Rc<Io::Dev>>());
+}
+
+Res<> BusDevice::_scanSegment(u16 seg, u8 root) {
+    Array<bool, 256>  seen {};
+    Vec<Rc<Pci::Dev>> found;
+
+    // A multifunction host bridge is one host controller per function, each
+    // with its own root bus.
+    Id host = { root, 0, 0, seg };
+    if (check(host)
+        and try$(host.in8(Regs::HeaderType)) & HeaderTypes::MultiFunction) {
+        for (u8 func = 0; func < 8; func++) {
+            Id id = { root, 0, func, seg };
+            if (check(id)) {
+                try$(_scanBus(seg, root + func, seen, found));
+            }
+        }
+    } else {
+        try$(_scanBus(seg, root, seen, found));
+    }
+
+    for (auto& dev : found) {
+        bool known = false;
+        for (auto& other : _devices) {
+            if (*other == *dev) {
+                known = true;
+                break;
+            }
+        }
+        if (not known) {
+            _devices.pushBack(dev);
+        }
+    }
+    return Ok();
+}
+
+Res<> BusDevice::_scanBus(u16                seg,
+                          u8                 bus,
+                          Array<bool, 256>&  seen,
+                          Vec<Rc<Pci::Dev>>& found) {
+    // Misconfigured bridges can point back up, each bus is walked once.
+    if (seen[bus]) {
+        return Ok();
+    }
+    seen[bus] = true;
+
+    for (u8 slot = 0; slot < 32; slot++) {
+        Id first = { bus, slot, 0, seg };
+        if (not check(first)) {
+            continue;
+        }
+
+        u8 type  = try$(first.in8(Regs::HeaderType));
+        u8 funcs = (type & HeaderTypes::MultiFunction) ? 8 : 1;
+        for (u8 func = 0; func < funcs; func++) {
+            Id id = { bus, slot, func, seg };
             if (not check(id)) {
                 continue;
             }
 
-            _devices.pushBack(create(id)->cast<Pci::Dev>().take());
-            if (try$(id.in8(Regs::HeaderType)) & 0x80) {
-                // Multifunction device
-                logInfo(
-                    "PciBus::probe: multifunction device found at "
-                    "bus {:02x}, slot {:02x}",
-                    i,
-                    j);
-                for (u16 k = 1; k < 8; k++) {
-                    id.func = k;
-                    if (not check(id)) {
-                        continue;
-                    }
-
-                    create(id);
-                }
+            auto dev = makeRc<Pci::Dev>(id);
+            found.pushBack(dev);
+
+            u8 layout = try$(dev->headerType()) & HeaderTypes::LayoutMask;
+            if (layout != HeaderTypes::PciBridge) {
+                continue;
+            }
+
+            // A bridge the firmware left unnumbered leads nowhere yet.
+            u8 secondary = try$(dev->in8(BridgeRegs::SecondaryBus));
+            if (secondary > bus) {
+                try$(_scanBus(seg, secondary, seen, found));
             }
         }
     }
-    return Ok(slice(_devices).cast<Rc<Io::Dev>>());
+    return Ok();
 }
 
 Res<Slice<Rc<Io::Dev>>> BusDevice::devices() {
     return Ok(slice(_devices).cast<Rc<Io::Dev>>());
 }
 
+Res<> BusDevice::keys(Rc<Io::Dev> dev, Vec<Io::DrvKey>& out) {
+    auto pci = dev.cast<Pci::Dev>();
+    if (not pci) {
+        return Ok();
+    }
+
+    auto& id    = **pci;
+    u8    clazz = try$(id.clazz());
+    u8    sub   = try$(id.subclass());
+    out.pushBack(deviceKey(try$(id.vendorId()), try$(id.deviceId())));
+    out.pushBack(classKey(clazz, sub, try$(id.progIf())));
+    out.pushBack(classKey(clazz, sub));
+    return Ok();
+}
+
 Res<> BusDevice::remove(Rc<Io::Dev> dev) {
     return Error::notImplemented();
 }
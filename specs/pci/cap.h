@@ -0,0 +1,84 @@
+#pragma once
+
+#include <sdk-meta/types.h>
+
+namespace Pci {
+
+enum struct CapId : u8 {
+    PowerManagement = 0x01,
+    Agp             = 0x02,
+    Vpd             = 0x03,
+    SlotId          = 0x04,
+    Msi             = 0x05,
+    HotSwap         = 0x06,
+    PciX            = 0x07,
+    HyperTransport  = 0x08,
+    Vendor          = 0x09,
+    Debug           = 0x0A,
+    Bridge          = 0x0D,
+    PciExpress      = 0x10,
+    MsiX            = 0x11,
+    Sata            = 0x12,
+    AdvancedFeats   = 0x13,
+};
+
+struct Cap {
+    CapId id;
+    u8    offset;
+};
+
+namespace Msi {
+
+enum Regs : u8 {
+    Control = 0x02,
+    AddrLo  = 0x04,
+    AddrHi  = 0x08,
+    Data32  = 0x08,
+    Data64  = 0x0C,
+    Mask32  = 0x0C,
+    Mask64  = 0x10,
+};
+
+enum Control : u16 {
+    Enable           = (1 << 0),
+    MultiCapMask     = (0b111 << 1),
+    MultiEnableMask  = (0b111 << 4),
+    Addr64           = (1 << 7),
+    PerVectorMasking = (1 << 8),
+};
+
+static constexpr inline usize MultiCapShift    = 1;
+static constexpr inline usize MultiEnableShift = 4;
+
+} // namespace Msi
+
+namespace MsiX {
+
+enum Regs : u8 {
+    Control = 0x02,
+    Table   = 0x04,
+    Pba     = 0x08,
+};
+
+enum Control : u16 {
+    TableSizeMask = 0x07ff,
+    FunctionMask  = (1 << 14),
+    Enable        = (1 << 15),
+};
+
+static constexpr inline u32 BirMask = 0b111;
+
+struct [[gnu::packed]] _Entry {
+    u32 addrLo;
+    u32 addrHi;
+    u32 data;
+    u32 ctrl;
+};
+using Entry = _Entry volatile;
+static_assert(sizeof(_Entry) == 16);
+
+static constexpr inline u32 EntryMasked = (1 << 0);
+
+} // namespace MsiX
+
+} // namespace Pci
@@ -1,6 +1,12 @@
 #include <pci/dev.h>
 #include <pci/spec.h>
+#include <realms/hal/arch.h>
+#include <realms/mm/mem.h>
+#include <sdk-logs/logger.h>
+#include <sdk-meta/defer.h>
+#include <sdk-meta/lock.h>
 #include <sdk-meta/res.h>
+#include <sdk-meta/vec.h>
 #include <sdk-text/format.h>
 
 namespace Pci {
@@ -8,30 +14,127 @@ namespace Pci {
 using namespace Realms;
 using namespace Sdk;
 
+namespace {
+
+static constexpr usize CONFIG_SIZE = 4096;
+static constexpr usize LEGACY_SIZE = 256;
+
+// One MCFG window. Written before the first probe and only read after, the
+// windows need no lock.
+struct _Ecam {
+    u16   seg;
+    u8    busStart;
+    u8    busEnd;
+    uflat base; // Virtual address of bus 0
+};
+
+Vec<_Ecam> _ecams;
+Lock       _legacy; // The address and data ports are one shared pair
+
+Opt<uflat> _ecam(Id const& id, usize offset) {
+    for (auto& ecam : _ecams) {
+        if (ecam.seg == id.seg and id.bus >= ecam.busStart
+            and id.bus <= ecam.busEnd)
+            return ecam.base + ((uflat) id.bus << 20)
+                 + ((uflat) id.slot << 15) + ((uflat) id.func << 12) + offset;
+    }
+    return NONE;
+}
+
+u32 _legacyAddr(Id const& id, usize offset) {
+    return 0x8000'0000 | (id.bus << 16) | (id.slot << 11) | (id.func << 8)
+         | (offset & 0xfc);
+}
+
+Res<> _check(Id const& id, usize offset, usize size) {
+    if ((size != 1 and size != 2 and size != 4) or offset % size) {
+        return Error::invalidArgument("Pci::Id: unaligned access");
+    }
+    if (offset + size > CONFIG_SIZE) {
+        return Error::outOfBounds("Pci::Id: past the configuration space");
+    }
+    return Ok();
+}
+
+} // namespace
+
+Res<> mapEcam(u16 seg, u8 busStart, u8 busEnd, uflat phys) {
+    if (busEnd < busStart) {
+        return Error::invalidArgument("Pci::mapEcam: empty bus range");
+    }
+
+    uflat first = phys + ((uflat) busStart << 20);
+    uflat virt  = try$(Sys::mmapVirtIo(first));
+    _ecams.pushBack({
+        .seg      = seg,
+        .busStart = busStart,
+        .busEnd   = busEnd,
+        .base     = virt - ((uflat) busStart << 20),
+    });
+    return Ok();
+}
+
 Res<usize> Id::in(usize offset, usize size) {
-    // u32 addr = (0x8000'0000
-    //             | (bus << 16)
-    //             | (slot << 11)
-    //             | (func << 8)
-    //             | (offset & 0xfc));
+    try$(_check(*this, offset, size));
+
+    if (auto addr = _ecam(*this, offset)) {
+        switch (size) {
+            case 1:  return Ok(*(u8 volatile*) *addr);
+            case 2:  return Ok(*(u16 volatile*) *addr);
+            default: return Ok(*(u32 volatile*) *addr);
+        }
+    }
 
-    return Error::notImplemented();
+    if (seg or offset + size > LEGACY_SIZE) {
+        return Error::notSupported("Pci::Id::in: no memory mapped access");
+    }
+
+    // Accesses are aligned, the low bits pick the bytes of the data port.
+    usize      port = ConfigData::OFF + (offset & 3);
+    LockScoped lk(_legacy);
+    try$(Hal::Pmio::out32(ConfigAddress::OFF, _legacyAddr(*this, offset)));
+    switch (size) {
+        case 1:  return Hal::Pmio::in8(port).map<usize>();
+        case 2:  return Hal::Pmio::in16(port).map<usize>();
+        default: return Hal::Pmio::in32(port).map<usize>();
+    }
 }
 
 Res<> Id::out(usize offset, usize size, usize val) {
-    // u32 addr = (0x8000'0000
-    //             | (bus << 16)
-    //             | (slot << 11)
-    //             | (func << 8)
-    //             | (offset & 0xfc));
+    try$(_check(*this, offset, size));
+
+    if (auto addr = _ecam(*this, offset)) {
+        switch (size) {
+            case 1:  *(u8 volatile*) *addr = (u8) val; break;
+            case 2:  *(u16 volatile*) *addr = (u16) val; break;
+            default: *(u32 volatile*) *addr = (u32) val; break;
+        }
+        return Ok();
+    }
 
-    return Error::notImplemented();
+    if (seg or offset + size > LEGACY_SIZE) {
+        return Error::notSupported("Pci::Id::out: no memory mapped access");
+    }
+
+    usize      port = ConfigData::OFF + (offset & 3);
+    LockScoped lk(_legacy);
+    try$(Hal::Pmio::out32(ConfigAddress::OFF, _legacyAddr(*this, offset)));
+    switch (size) {
+        case 1:  return Hal::Pmio::out8(port, (u8) val);
+        case 2:  return Hal::Pmio::out16(port, (u16) val);
+        default: return Hal::Pmio::out32(port, (u32) val);
+    }
 }
 
-Dev::Dev(u8 bus, u8 slot, u8 func)
-    : Id(bus, slot, func),
+Dev::Dev(u8 bus, u8 slot, u8 func, u16 seg)
+    : Id(bus, slot, func, seg),
       Core::Io::Dev(
-          Text::format("pci-dev-{:02x}-{:02x}-{:02x}", bus, slot, func),
+          seg ? Text::format("pci-dev-{:04x}-{:02x}-{:02x}-{:02x}",
+                             seg,
+                             bus,
+                             slot,
+                             func)
+              : Text::format("pci-dev-{:02x}-{:02x}-{:02x}", bus, slot, func),
           Text::format("/pci/{:02x}-{:02x}-{:02x}:ven={:04x},dev={:04x}",
                        bus,
                        slot,
@@ -47,7 +150,7 @@ Dev::Dev(u8 bus, u8 slot, u8 func, u16 vendorId, u16 deviceId)
     _deviceId = deviceId;
 }
 
-Dev::Dev(Id const& id) : Dev(id.bus, id.slot, id.func) {
+Dev::Dev(Id const& id) : Dev(id.bus, id.slot, id.func, id.seg) {
 }
 
 Dev::Dev(Id const& id, String name, Realms::Sys::Io::Dev::Type type)
@@ -58,4 +161,261 @@ Dev::Dev(Id const& id, String name, Realms::Sys::Io::Dev::Type type)
           type) {
 }
 
+Res<uflat> Dev::bar(u8 i) {
+    if (i > 5) {
+        return Error::invalidArgument("Pci::Dev::bar: index out of range");
+    }
+
+    u32 lo = try$(in32(Regs::Bar0 + i * 4));
+    if (lo & 0x1) {
+        // I/O space bar
+        return Ok((uflat) (lo & ~0x3u));
+    }
+
+    uflat addr = lo & ~0xfu;
+    if (((lo >> 1) & 0b11) == 0b10) {
+        if (i == 5) {
+            return Error::invalidData("Pci::Dev::bar: truncated 64-bit bar");
+        }
+        addr |= (uflat) try$(in32(Regs::Bar0 + (i + 1) * 4)) << 32;
+    }
+    return Ok(addr);
+}
+
+Res<Slice<Cap>> Dev::capabilities() {
+    if (_caps) {
+        return Ok(slice(*_caps));
+    }
+
+    Vec<Cap> caps = {};
+    if (try$(status()) & StatusBits::CapabilitiesList) {
+        u8 offset = try$(in8(Regs::CapabilitiesPointer)) & ~0x3;
+
+        // The list lives in the first 256 bytes of the configuration space,
+        // so a well formed list can never have more than 48 entries. Bound
+        // the walk to survive looping lists from broken devices.
+        for (usize i = 0; offset >= 0x40 and i < 48; i++) {
+            u16 header = try$(in16(offset));
+            caps.pushBack({ (CapId) (header & 0xff), offset });
+            offset = (header >> 8) & ~0x3;
+        }
+    }
+
+    _caps = move(caps);
+    return Ok(slice(*_caps));
+}
+
+Opt<u8> Dev::findCapability(CapId id) {
+    auto caps = capabilities();
+    if (not caps)
+        return NONE;
+
+    for (auto& cap : caps.unwrap()) {
+        if (cap.id == id)
+            return cap.offset;
+    }
+    return NONE;
+}
+
+Res<Slice<Hal::IntrVector>> Dev::allocVectors(usize count, usize firstCpu) {
+    if (_intrMode != IntrMode::Legacy) {
+        return Error::invalidState("Pci::Dev::allocVectors: already enabled");
+    }
+
+    if (findCapability(CapId::MsiX)) {
+        return enableMsiX(count, firstCpu);
+    }
+
+    if (findCapability(CapId::Msi)) {
+        return enableMsi(count, firstCpu);
+    }
+
+    return Error::notSupported("Pci::Dev::allocVectors: no msi capability");
+}
+
+Res<Slice<Hal::IntrVector>> Dev::enableMsiX(usize count, usize firstCpu) {
+    if (_intrMode != IntrMode::Legacy) {
+        return Error::invalidState("Pci::Dev::enableMsiX: already enabled");
+    }
+
+    auto cap = findCapability(CapId::MsiX);
+    if (not cap) {
+        return Error::notSupported(
+            "Pci::Dev::enableMsiX: no msi-x capability");
+    }
+
+    u16   ctrl = try$(in16(*cap + MsiX::Control));
+    usize size = (ctrl & MsiX::TableSizeMask) + 1;
+    if (count == 0 or count > size) {
+        return Error::invalidArgument("Pci::Dev::enableMsiX: invalid count");
+    }
+
+    // The table lives in a memory bar, which must decode before it is
+    // written.
+    try$(enableMemorySpace());
+
+    u32   table  = try$(in32(*cap + MsiX::Table));
+    uflat base   = try$(bar(table & MsiX::BirMask));
+    uflat offset = table & ~MsiX::BirMask;
+    auto  entries = (MsiX::Entry*) try$(Sys::mmapVirtIo(base + offset));
+
+    _vectors.resize(count);
+    if (auto res = Hal::allocIntrs(slice(_vectors), firstCpu); not res) {
+        _vectors.clear();
+        return res.none();
+    }
+
+    // Callers may retry with fewer vectors, so a failure past this point
+    // hands everything back and leaves the function as it was.
+    ArmedDefer rollback { [&] {
+        (void) out16(*cap + MsiX::Control, ctrl);
+        for (auto& v : _vectors)
+            (void) Hal::freeIntr(v);
+        _vectors.clear();
+    } };
+
+    // Mask the whole function while the table is being programmed.
+    try$(out16(*cap + MsiX::Control,
+               ctrl | MsiX::Enable | MsiX::FunctionMask));
+
+    for (usize i = 0; i < size; i++) {
+        if (i >= count) {
+            entries[i].ctrl = MsiX::EntryMasked;
+            continue;
+        }
+
+        entries[i].addrLo = (u32) _vectors[i].msiAddr;
+        entries[i].addrHi = (u32) (_vectors[i].msiAddr >> 32);
+        entries[i].data   = _vectors[i].msiData;
+        entries[i].ctrl   = 0;
+    }
+
+    try$(disableInterrupts());
+    try$(out16(*cap + MsiX::Control,
+               (ctrl | MsiX::Enable) & ~MsiX::FunctionMask));
+    try$(enableBusMastering());
+
+    rollback.disarm();
+    _msixTable = entries;
+    _intrMode  = IntrMode::MsiX;
+    logInfo("Pci::Dev::enableMsiX: {} vectors enabled for {}", count, _name);
+    return Ok(slice(_vectors));
+}
+
+Res<Slice<Hal::IntrVector>> Dev::enableMsi(usize count, usize cpu) {
+    if (_intrMode != IntrMode::Legacy) {
+        return Error::invalidState("Pci::Dev::enableMsi: already enabled");
+    }
+
+    auto cap = findCapability(CapId::Msi);
+    if (not cap) {
+        return Error::notSupported("Pci::Dev::enableMsi: no msi capability");
+    }
+
+    u16   ctrl    = try$(in16(*cap + Msi::Control));
+    usize maxLog2 = (ctrl & Msi::MultiCapMask) >> Msi::MultiCapShift;
+
+    usize log2 = 0;
+    while ((1uz << log2) < count)
+        log2++;
+
+    if (count == 0 or log2 > maxLog2) {
+        return Error::invalidArgument("Pci::Dev::enableMsi: invalid count");
+    }
+
+    usize           n     = 1uz << log2;
+    Hal::IntrVector first = try$(Hal::allocIntr(cpu, n));
+    ArmedDefer      rollback { [&] {
+        (void) out16(*cap + Msi::Control, ctrl);
+        (void) Hal::freeIntr(first, n);
+        _vectors.clear();
+    } };
+
+    _vectors.clear();
+    for (usize i = 0; i < n; i++) {
+        _vectors.pushBack({
+            .cpu     = first.cpu,
+            .vec     = (u8) (first.vec + i),
+            .msiAddr = first.msiAddr,
+            .msiData = first.msiData + (u32) i,
+        });
+    }
+
+    try$(out32(*cap + Msi::AddrLo, (u32) first.msiAddr));
+    if (ctrl & Msi::Addr64) {
+        try$(out32(*cap + Msi::AddrHi, (u32) (first.msiAddr >> 32)));
+        try$(out16(*cap + Msi::Data64, (u16) first.msiData));
+    } else {
+        try$(out16(*cap + Msi::Data32, (u16) first.msiData));
+    }
+
+    u16 enabled = ctrl & ~Msi::MultiEnableMask;
+    enabled |= (log2 << Msi::MultiEnableShift) | Msi::Enable;
+
+    try$(disableInterrupts());
+    try$(out16(*cap + Msi::Control, enabled));
+    try$(enableBusMastering());
+
+    rollback.disarm();
+    _intrMode = IntrMode::Msi;
+    logInfo("Pci::Dev::enableMsi: {} vectors enabled for {}", n, _name);
+    return Ok(slice(_vectors));
+}
+
+Res<> Dev::maskVector(usize index, bool masked) {
+    if (index >= _vectors.len()) {
+        return Error::outOfBounds("Pci::Dev::maskVector: no such vector");
+    }
+
+    switch (_intrMode) {
+        case IntrMode::MsiX: {
+            _msixTable[index].ctrl = masked ? MsiX::EntryMasked : 0;
+            return Ok();
+        }
+        case IntrMode::Msi: {
+            u8  cap  = findCapability(CapId::Msi).take();
+            u16 ctrl = try$(in16(cap + Msi::Control));
+            if (not(ctrl & Msi::PerVectorMasking)) {
+                return Error::notSupported(
+                    "Pci::Dev::maskVector: no per-vector masking");
+            }
+
+            usize reg
+                = cap + ((ctrl & Msi::Addr64) ? Msi::Mask64 : Msi::Mask32);
+            u32 bits = try$(in32(reg));
+            bits = masked ? (bits | (1u << index)) : (bits & ~(1u << index));
+            return out32(reg, bits);
+        }
+        default: {
+            return Error::invalidState("Pci::Dev::maskVector: msi disabled");
+        }
+    }
+}
+
+Res<> Dev::freeVectors() {
+    switch (_intrMode) {
+        case IntrMode::MsiX: {
+            u8 cap = findCapability(CapId::MsiX).take();
+            try$(out16(cap + MsiX::Control,
+                       try$(in16(cap + MsiX::Control)) & ~MsiX::Enable));
+            for (auto& v : _vectors)
+                try$(Hal::freeIntr(v));
+            break;
+        }
+        case IntrMode::Msi: {
+            u8 cap = findCapability(CapId::Msi).take();
+            try$(out16(cap + Msi::Control,
+                       try$(in16(cap + Msi::Control)) & ~Msi::Enable));
+            try$(Hal::freeIntr(_vectors[0], _vectors.len()));
+            break;
+        }
+        default: return Ok();
+    }
+
+    _vectors.clear();
+    _msixTable = nullptr;
+    _intrMode  = IntrMode::Legacy;
+    return Ok();
+}
+
 } // namespace Pci
@@ -1,12 +1,27 @@
 #pragma once
 
+#include <pci/cap.h>
 #include <pci/spec.h>
+#include <realms/hal/intr.h>
 #include <realms/io/dev.h>
+#include <realms/io/drv.h>
+#include <sdk-meta/vec.h>
 
 namespace Pci {
 
 struct Dev : public Id, public Realms::Sys::Io::Dev {
-    Dev(u8 bus, u8 slot, u8 func);
+    enum struct IntrMode {
+        Legacy,
+        Msi,
+        MsiX,
+    };
+
+    Opt<Vec<Cap>>                _caps      = NONE;
+    Vec<Realms::Hal::IntrVector> _vectors   = {};
+    IntrMode                     _intrMode  = IntrMode::Legacy;
+    MsiX::Entry*                 _msixTable = nullptr;
+
+    Dev(u8 bus, u8 slot, u8 func, u16 seg = 0);
     Dev(u8 bus, u8 slot, u8 func, u16 vendorId, u16 deviceId);
     Dev(Id const& id);
     Dev(Id const& id, String name, Realms::Sys::Io::Dev::Type type);
@@ -15,7 +30,8 @@ struct Dev : public Id, public Realms::Sys::Io::Dev {
     Dev& operator=(Dev const&) = delete;
 
     bool operator==(Id const& other) const {
-        return bus == other.bus and slot == other.slot and func == other.func;
+        return seg == other.seg and bus == other.bus and slot == other.slot
+           and func == other.func;
     }
 
     [[gnu::always_inline]] bool barIsMmio(u8 i) {
@@ -30,40 +46,98 @@ struct Dev : public Id, public Realms::Sys::Io::Dev {
         return in8(Regs::InterruptPin);
     }
 
-    [[gnu::always_inline]] Res<u8> command() { return in8(Regs::Command); }
+    [[gnu::always_inline]] Res<u16> command() { return in16(Regs::Command); }
 
-    [[gnu::always_inline]] Res<> command(u8 val) {
-        return out8(Regs::Command, val);
+    [[gnu::always_inline]] Res<> command(u16 val) {
+        return out16(Regs::Command, val);
     }
 
-    [[gnu::always_inline]] Res<u8> status() { return in8(Regs::Status); }
+    [[gnu::always_inline]] Res<u16> status() { return in16(Regs::Status); }
 
     [[gnu::always_inline]] Res<u8> headerType() {
         return in8(Regs::HeaderType);
     }
 
     [[gnu::always_inline]] Res<> enableBusMastering() {
-        return out8(Regs::Command,
-                    try$(in8(Regs::Command)) | Command::BusMaster);
+        return out16(Regs::Command,
+                     try$(in16(Regs::Command)) | Command::BusMaster);
     }
 
     [[gnu::always_inline]] Res<> enableInterrupts() {
-        return out8(Regs::Command,
-                    try$(in8(Regs::Command)) & ~Command::IntDisable);
+        return out16(Regs::Command,
+                     try$(in16(Regs::Command)) & ~Command::IntDisable);
     }
 
     [[gnu::always_inline]] Res<> disableInterrupts() {
-        return out8(Regs::Command,
-                    try$(in8(Regs::Command)) | Command::IntDisable);
+        return out16(Regs::Command,
+                     try$(in16(Regs::Command)) | Command::IntDisable);
     }
 
     [[gnu::always_inline]] Res<> enableMemorySpace() {
-        return out8(Regs::Command,
-                    try$(in8(Regs::Command)) | Command::MemorySpace);
+        return out16(Regs::Command,
+                     try$(in16(Regs::Command)) | Command::MemorySpace);
     }
 
     [[gnu::always_inline]] Res<> enableIoSpace() {
-        return out8(Regs::Command, try$(in8(Regs::Command)) | Command::IoSpace);
+        return out16(Regs::Command,
+                     try$(in16(Regs::Command)) | Command::IoSpace);
     }
+
+    /**
+     * @brief Physical base address of a base address register, following
+     * the upper half for 64-bit memory bars.
+     */
+    Res<uflat> bar(u8 i);
+
+    /**
+     * @brief Walk the capability list once and cache it.
+     */
+    Res<Slice<Cap>> capabilities();
+
+    Opt<u8> findCapability(CapId id);
+
+    /**
+     * @brief Allocate `count` interrupt vectors for the device, one per
+     * queue, preferring MSI-X and falling back to MSI.
+     *
+     * With MSI-X, vector `i` targets processor `(firstCpu + i) % cpuCount()`
+     * so each queue completes on the processor that submits to it. With MSI
+     * all messages share one destination, so the block is allocated on
+     * `firstCpu`, and `count` is rounded up to the next power of two.
+     *
+     * @retval Error::notSupported if the device has neither capability.
+     */
+    Res<Slice<Realms::Hal::IntrVector>> allocVectors(usize count,
+                                                     usize firstCpu = 0);
+
+    Res<Slice<Realms::Hal::IntrVector>> enableMsiX(usize count,
+                                                   usize firstCpu = 0);
+
+    Res<Slice<Realms::Hal::IntrVector>> enableMsi(usize count, usize cpu = 0);
+
+    Res<> maskVector(usize index, bool masked);
+
+    Res<> freeVectors();
 };
+
+// MARK: - Driver Keys ---------------------------------------------------------
+
+// Keys the bus gives each function, so drivers claim them by id or class.
+
+constexpr Realms::Sys::Io::DrvKey deviceKey(u16 vendorId, u16 deviceId) {
+    u64 id = (1ull << 48) | ((u64) vendorId << 16) | deviceId;
+    return Realms::Sys::Io::drvKey(Realms::Sys::Io::DrvSpace::Pci, id);
+}
+
+constexpr Realms::Sys::Io::DrvKey classKey(u8 clazz, u8 subclass, u8 progIf) {
+    u64 id = (2ull << 48) | ((u64) clazz << 16) | ((u64) subclass << 8)
+           | progIf;
+    return Realms::Sys::Io::drvKey(Realms::Sys::Io::DrvSpace::Pci, id);
+}
+
+constexpr Realms::Sys::Io::DrvKey classKey(u8 clazz, u8 subclass) {
+    u64 id = (3ull << 48) | ((u64) clazz << 8) | subclass;
+    return Realms::Sys::Io::drvKey(Realms::Sys::Io::DrvSpace::Pci, id);
+}
+
 } // namespace Pci
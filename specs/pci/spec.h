@@ -36,6 +36,21 @@ enum Regs : u8 {
     MaxLatency              = 0x3F
 };
 
+// Type 1 header, bridges to another bus.
+enum BridgeRegs : u8 {
+    PrimaryBus     = 0x18,
+    SecondaryBus   = 0x19,
+    SubordinateBus = 0x1A,
+};
+
+enum HeaderTypes : u8 {
+    General       = 0x00,
+    PciBridge     = 0x01,
+    CardBusBridge = 0x02,
+    LayoutMask    = 0x7F,
+    MultiFunction = 0x80,
+};
+
 enum Mode {
     Legacy,
     Enhanced
@@ -80,6 +95,12 @@ enum Command {
     IntDisable         = (1 << 10),
 };
 
+enum StatusBits : u16 {
+    InterruptStatus  = (1 << 3),
+    CapabilitiesList = (1 << 4),
+    Capable66Mhz     = (1 << 5),
+};
+
 template <Class>
 struct Subclass;
 
@@ -199,12 +220,25 @@ struct Subclass<Class::Bridge> {
 using ConfigAddress = Realms::Hal::Reg<u32, 0xcf8>;
 using ConfigData    = Realms::Hal::Reg<u32, 0xcfc>;
 
+/**
+ * @brief Use the memory mapped configuration space at `phys`, the window of
+ * bus 0, for buses `[busStart, busEnd]` of segment `seg`. Functions outside
+ * every window go through the 0xCF8/0xCFC ports, which only reach the first
+ * 256 bytes of segment 0.
+ */
+Res<> mapEcam(u16 seg, u8 busStart, u8 busEnd, uflat phys);
+
 struct Id : public Realms::Hal::Io {
+    u16 seg = 0;
     u8  bus, slot, func;
-    u16 _vendorId, _deviceId;
-    u8  _class, _subclass, _progIf;
+    u16 _vendorId = 0, _deviceId = 0;
+    u8  _class = 0, _subclass = 0, _progIf = 0;
 
-    Id(u8 bus, u8 slot, u8 func) : bus(bus), slot(slot), func(func) { }
+    Id(u8 bus, u8 slot, u8 func, u16 seg = 0)
+        : seg(seg),
+          bus(bus),
+          slot(slot),
+          func(func) { }
 
     Res<usize> in(usize offset, usize size) override;
 
@@ -0,0 +1,687 @@
+#include <pci/spec.h>
+#include <realms/core/api.io.h>
+#include <realms/hal/arch.h>
+#include <realms/hal/clock.h>
+#include <realms/mm/mem.h>
+#include <sdk-logs/logger.h>
+#include <sdk-meta/defer.h>
+#include <sdk-text/format.h>
+#include <stor/ahci/controller.h>
+
+namespace Ahci {
+
+using namespace Realms;
+using namespace Sdk;
+
+namespace {
+
+static constexpr usize    LIST_SIZE    = PortDevice::SLOTS * 32;
+static constexpr TimeSpan PORT_TIMEOUT = TimeSpan::ofMilliseconds(500);
+static constexpr TimeSpan CMD_TIMEOUT  = TimeSpan::ofSeconds(10);
+
+bool _until(auto&& cond, TimeSpan timeout) {
+    Instant end = Hal::clock() + timeout;
+    while (not cond()) {
+        if (Hal::clock() > end)
+            return cond();
+        _Embed::relaxe();
+    }
+    return true;
+}
+
+void _onInterrupt(Hal::IntrVector const&, void* ctx) {
+    static_cast<ControllerDevice*>(ctx)->onInterrupt();
+}
+
+} // namespace
+
+// MARK: - PortDevice ----------------------------------------------------------
+
+PortDevice::PortDevice(ControllerDevice& ctrl, usize index)
+    : StorDev(Text::format("ahci-port-device-{}", index),
+              Text::format("pci/ahci-controller-device/port-{}", index),
+              Io::Dev::Type::StorageDrive),
+      _ctrl(ctrl),
+      _regs(ctrl.port(index)),
+      _index(index),
+      _headers(nullptr),
+      _received(nullptr),
+      _tables(0),
+      _tablesPhys(0),
+      _depth(1),
+      _ncq(false),
+      _free(1),
+      _issued(0),
+      _exclusive(0) {
+}
+
+Res<> PortDevice::_stop() {
+    _regs.cmd = _regs.cmd & ~Hba::Start;
+    if (not _until([&] { return not(_regs.cmd & Hba::CommandRunning); },
+                   PORT_TIMEOUT)) {
+        return Error::timedOut("Ahci::PortDevice::_stop: engine still running");
+    }
+
+    _regs.cmd = _regs.cmd & ~Hba::FisRecvEnable;
+    if (not _until([&] { return not(_regs.cmd & Hba::FisRecvRunning); },
+                   PORT_TIMEOUT)) {
+        return Error::timedOut("Ahci::PortDevice::_stop: fis receive running");
+    }
+    return Ok();
+}
+
+Res<> PortDevice::_start() {
+    if (not _until(
+            [&] { return not(_regs.tfd & (Hba::TfdBusy | Hba::TfdDrq)); },
+            PORT_TIMEOUT)) {
+        return Error::timedOut("Ahci::PortDevice::_start: device busy");
+    }
+
+    _regs.cmd = _regs.cmd | Hba::FisRecvEnable;
+    _regs.cmd = _regs.cmd | Hba::Start;
+    return Ok();
+}
+
+Res<> PortDevice::onInit() {
+    try$(_stop());
+
+    // Command tables first so each stays 128-byte aligned, then the command
+    // list (1 KiB aligned) and the received FIS area (256 bytes aligned).
+    usize size  = SLOTS * TABLE_SIZE + LIST_SIZE + sizeof(Hba::Received);
+    auto  range = try$(
+        Sys::pmm().alloc(Sys::pageAlignUp(size), Sys::PmmFlags::Dma));
+    uflat virt = try$(Sys::mmapVirtIo(range.start()));
+    memset((void*) virt, 0, size);
+
+    uflat phys  = range.start();
+    _tables     = virt;
+    _tablesPhys = phys;
+    _headers    = (Hba::CommandHeader*) (virt + SLOTS * TABLE_SIZE);
+    _received
+        = (Hba::Received volatile*) (virt + SLOTS * TABLE_SIZE + LIST_SIZE);
+
+    uflat clb = phys + SLOTS * TABLE_SIZE;
+    uflat fb  = clb + LIST_SIZE;
+    _regs.clb  = (u32) clb;
+    _regs.clbu = (u32) (clb >> 32);
+    _regs.fb   = (u32) fb;
+    _regs.fbu  = (u32) (fb >> 32);
+
+    _regs.serr = _regs.serr;
+    _regs.is   = _regs.is;
+    _regs.ie   = Hba::D2hRegister | Hba::SetDeviceBits | Hba::DescProcessed
+               | Hba::ErrorMask;
+
+    try$(_start());
+    try$(_identify());
+
+    logInfo("Ahci::PortDevice: port {} has {} blocks of {} bytes, {} slots{}",
+            _index,
+            _blockCount,
+            _blockSize,
+            _depth,
+            _ncq ? " (ncq)" : "");
+    return Ok();
+}
+
+Res<> PortDevice::_identify() {
+    auto  range = try$(Sys::pmm().alloc(Sys::PAGE_SIZE, Sys::PmmFlags::Dma));
+    uflat virt  = try$(Sys::mmapVirtIo(range.start()));
+    Defer free { [&] { (void) Sys::pmm().free(range); } };
+
+    Bytes buf { (byte const*) virt, 512 };
+    usize slot = try$(_acquire());
+    try$(_prepare(slot, Ata::IdentifyDevice, 0, buf, false));
+    _issue(slot, false);
+    try$(_wait(slot));
+
+    u16 const* id = (u16 const*) virt;
+    if (not(id[83] & (1 << 10))) {
+        return Error::notSupported("Ahci::PortDevice: drive lacks lba48");
+    }
+
+    _blockCount = (u64) id[100] | (u64) id[101] << 16 | (u64) id[102] << 32
+                | (u64) id[103] << 48;
+
+    // Words 117-118 carry the logical sector size in words when it is not
+    // the usual 512 bytes.
+    if ((id[106] & 0xc000) == 0x4000 and (id[106] & (1 << 12)))
+        _blockSize = ((u32) id[117] | (u32) id[118] << 16) * 2;
+
+    _ncq   = _ctrl._ncq and (id[76] & (1 << 8));
+    _depth = _ncq ? min(_ctrl._slots, (usize) (id[75] & 0x1f) + 1)
+                  : _ctrl._slots;
+    _free.store(_depth == 32 ? ~0u : (1u << _depth) - 1);
+    return Ok();
+}
+
+Opt<usize> PortDevice::_tryAcquire() {
+    while (true) {
+        u32 free = _free.load(Acquire);
+        if (free == 0)
+            return NONE;
+
+        usize slot = __builtin_ctz(free);
+        if (_free.cmpxchg(free, free & ~(1u << slot))) {
+            _slots[slot].done.store(false, Relaxed);
+            _slots[slot].failed = false;
+            _slots[slot].req    = nullptr;
+            return slot;
+        }
+    }
+}
+
+Res<usize> PortDevice::_acquire() {
+    while (true) {
+        if (auto slot = _tryAcquire())
+            return Ok(slot.unwrap());
+
+        _poll();
+        _Embed::relaxe();
+    }
+}
+
+void PortDevice::_release(usize slot) {
+    u32 free;
+    do {
+        free = _free.load(Relaxed);
+    } while (not _free.cmpxchg(free, free | (1u << slot)));
+}
+
+Res<> PortDevice::_prepare(
+    usize slot, u8 command, u64 lba, Slice<Bytes> segs, bool write) {
+    auto& table = _table(slot);
+    memset((void*) &table, 0, sizeof(Hba::_CommandTable));
+
+    // Describe the buffers page by page, merging physically adjacent pages.
+    usize entries = 0;
+    usize bytes   = 0;
+    for (auto& buf : segs) {
+        uflat addr = (uflat) buf.buf();
+        usize left = buf.len();
+        bytes += left;
+        while (left) {
+            usize len  = min(left, Sys::PAGE_SIZE - addr % Sys::PAGE_SIZE);
+            uflat phys = try$(Sys::mmapPhys(addr));
+
+            auto* last = entries ? &table.entries[entries - 1] : nullptr;
+            uflat end  = 0;
+            if (last)
+                end = ((uflat) last->dbau << 32 | last->dba) + last->dbc + 1;
+
+            if (last and end == phys
+                and last->dbc + 1 + len <= Hba::PRDT_MAX_BYTES) {
+                last->dbc = last->dbc + len;
+            } else {
+                if (entries == PRDT_LEN) {
+                    return Error::limitReached(
+                        "Ahci::PortDevice::_prepare: buffer too fragmented");
+                }
+
+                auto& entry = table.entries[entries++];
+                entry.dba   = (u32) phys;
+                entry.dbau  = (u32) (phys >> 32);
+                entry.dbc   = len - 1;
+                entry.i     = 0;
+            }
+
+            addr += len;
+            left -= len;
+        }
+    }
+
+    auto& fis  = *(Command<Fis::HostToDevice>*) &table;
+    fis.id     = Fis::HostToDevice;
+    fis.mode   = 1;
+    fis.device = (1 << 6);
+    fis.lba0   = (u8) lba;
+    fis.lba1   = (u8) (lba >> 8);
+    fis.lba2   = (u8) (lba >> 16);
+    fis.lba3   = (u8) (lba >> 24);
+    fis.lba4   = (u8) (lba >> 32);
+    fis.lba5   = (u8) (lba >> 40);
+
+    fis.command = command;
+    usize count = bytes / _blockSize;
+    if (command == Ata::ReadFpdmaQueued or command == Ata::WriteFpdmaQueued) {
+        // Queued commands carry the count in the feature field and the tag
+        // in the upper bits of the count field.
+        fis.featLo  = (u8) count;
+        fis.featHi  = (u8) (count >> 8);
+        fis.countLo = (u8) (slot << 3);
+    } else if (command != Ata::IdentifyDevice) {
+        fis.countLo = (u8) count;
+        fis.countHi = (u8) (count >> 8);
+    }
+
+    auto& header    = _headers[slot];
+    uflat ctba      = _tablesPhys + slot * TABLE_SIZE;
+    header.cfl      = sizeof(Command<Fis::HostToDevice>) / 4;
+    header.atapi    = 0;
+    header.write    = write;
+    header.prefetch = 0;
+    header.prdtl    = entries;
+    header.prdbc    = 0;
+    header.ctba     = (u32) ctba;
+    header.ctbau    = (u32) (ctba >> 32);
+    return Ok();
+}
+
+bool PortDevice::_tryIssue(usize slot, bool queued) {
+    if (_broken.load(Acquire) or (queued ? _exclusive : _issued))
+        return false;
+
+    _issued |= (1u << slot);
+    if (not queued)
+        _exclusive = (1u << slot);
+
+    threadfence();
+    if (queued and _ncq)
+        _regs.sact = (1u << slot);
+    _regs.ci = (1u << slot);
+    return true;
+}
+
+void PortDevice::_issue(usize slot, bool queued) {
+    while (true) {
+        _Embed::enterCritical();
+        _lock.acquire();
+        bool ready = _tryIssue(slot, queued);
+        _lock.release();
+        _Embed::leaveCritical();
+
+        if (ready)
+            return;
+
+        _poll();
+        _Embed::relaxe();
+    }
+}
+
+void PortDevice::onInterrupt() {
+    _Embed::enterCritical();
+    _lock.acquire();
+
+    u32 status = _regs.is;
+    _regs.is   = status;
+
+    u32 finished;
+    if (status & Hba::ErrorMask) {
+        // A failed queued command aborts the whole queue, so everything in
+        // flight is reported failed. Restarting the port waits on the engine,
+        // it is left to the next caller that may spin.
+        logError("Ahci::PortDevice: port {} error, is={:08x} tfd={:08x}",
+                 _index,
+                 status,
+                 (u32) _regs.tfd);
+
+        finished = _issued;
+        for (usize i = 0; i < SLOTS; i++) {
+            if (finished & (1u << i))
+                _slots[i].failed = true;
+        }
+        _broken.store(true, Release);
+    } else {
+        u32 active = _regs.ci | (_ncq ? _regs.sact : 0);
+        finished   = _issued & ~active;
+    }
+
+    _issued &= ~finished;
+    _exclusive &= ~finished;
+    threadfence();
+
+    // Block layer requests are completed once the lock is dropped, their
+    // callbacks are free to submit more work.
+    u32 async = 0;
+    for (usize i = 0; i < SLOTS; i++) {
+        if (not(finished & (1u << i)))
+            continue;
+
+        if (_slots[i].req)
+            async |= (1u << i);
+        else
+            _slots[i].done.store(true, Release);
+    }
+
+    _lock.release();
+    _Embed::leaveCritical();
+
+    for (usize i = 0; i < SLOTS; i++) {
+        if (not(async & (1u << i)))
+            continue;
+
+        auto* req    = _slots[i].req;
+        bool  failed = _slots[i].failed;
+
+        _slots[i].req = nullptr;
+        _release(i);
+
+        if (failed)
+            req->end(Error::invalidData("Ahci::PortDevice: command failed"));
+        else
+            req->end(Ok());
+    }
+
+    _drain();
+}
+
+void PortDevice::_poll() {
+    _recover();
+    if (_ctrl._irq and Hal::intrEnabled())
+        return;
+
+    // Port first, then the HBA, or the HBA would not signal the next
+    // completion once interrupts are on.
+    onInterrupt();
+    _ctrl._regs->is = 1u << _index;
+}
+
+void PortDevice::_recover() {
+    if (not _broken.load(Acquire) or not _recovering.cmpxchg(false, true))
+        return;
+
+    (void) _stop();
+    _regs.serr = _regs.serr;
+    _regs.is   = _regs.is;
+    (void) _start();
+
+    _broken.store(false, Release);
+    _recovering.store(false, Release);
+    _drain();
+}
+
+void PortDevice::_drain() {
+    Vec<Io::BlkRequest*> failed;
+
+    _Embed::enterCritical();
+    _lock.acquire();
+
+    // In order, so a flush never overtakes the writes queued before it.
+    while (_backlog.len() and not _broken.load(Acquire)) {
+        auto& req    = *_backlog[0];
+        bool  write  = req.op == Io::BlkRequest::Op::Write;
+        bool  flush  = req.op == Io::BlkRequest::Op::Flush;
+        bool  queued = _ncq and not flush;
+        if (queued ? _exclusive : _issued)
+            break;
+
+        auto slot = _tryAcquire();
+        if (not slot)
+            break;
+        _backlog.popFront();
+
+        u8 cmd;
+        if (flush)
+            cmd = Ata::FlushCacheExt;
+        else if (_ncq)
+            cmd = write ? Ata::WriteFpdmaQueued : Ata::ReadFpdmaQueued;
+        else
+            cmd = write ? Ata::WriteDmaExt : Ata::ReadDmaExt;
+
+        if (not _prepare(slot.unwrap(), cmd, req.lba, slice(req.segs), write)) {
+            _release(slot.unwrap());
+            failed.pushBack(&req);
+            continue;
+        }
+
+        _slots[slot.unwrap()].req = &req;
+        (void) _tryIssue(slot.unwrap(), queued);
+    }
+
+    _lock.release();
+    _Embed::leaveCritical();
+
+    for (auto* req : failed)
+        req->end(Error::invalidData("Ahci::PortDevice: cannot map request"));
+}
+
+Res<> PortDevice::_wait(usize slot) {
+    bool done = _until(
+        [&] {
+            _poll();
+            return _slots[slot].done.load(Acquire);
+        },
+        CMD_TIMEOUT);
+
+    // A command that never completes keeps its slot, it may still be
+    // written to by the drive.
+    if (not done) {
+        return Error::timedOut("Ahci::PortDevice: command timed out");
+    }
+
+    bool failed = _slots[slot].failed;
+    _release(slot);
+    if (failed) {
+        return Error::invalidData("Ahci::PortDevice: command failed");
+    }
+    return Ok();
+}
+
+Res<usize> PortDevice::_transfer(Seek seek, Bytes buf, bool write) {
+    if (seek.whence != Whence::BEGIN) {
+        return Error::invalidArgument(
+            "Ahci::PortDevice: only absolute seeks are supported");
+    }
+
+    usize offset = seek.offset;
+    if (offset % _blockSize or buf.len() % _blockSize) {
+        return Error::invalidArgument("Ahci::PortDevice: unaligned transfer");
+    }
+
+    u64 lba = offset / _blockSize;
+    if (lba + buf.len() / _blockSize > _blockCount) {
+        return Error::outOfBounds("Ahci::PortDevice: transfer past the end");
+    }
+
+    // Worst case every page of the chunk is its own PRDT entry.
+    usize chunk  = alignDown((PRDT_LEN - 1) * Sys::PAGE_SIZE, _blockSize);
+    u8    cmd    = _ncq ? (write ? Ata::WriteFpdmaQueued : Ata::ReadFpdmaQueued)
+                        : (write ? Ata::WriteDmaExt : Ata::ReadDmaExt);
+    usize pos    = 0;
+    Res<> result = Ok();
+
+    // Keep as many chunks in flight as the queue allows, retiring them in
+    // submission order.
+    Vec<usize> inflight;
+    while ((result and pos < buf.len()) or inflight.len()) {
+        if (result and pos < buf.len() and inflight.len() < _depth) {
+            usize len  = min(buf.len() - pos, chunk);
+            usize slot = try$(_acquire());
+
+            auto prepared = _prepare(slot,
+                                     cmd,
+                                     lba + pos / _blockSize,
+                                     slice(buf, pos, pos + len),
+                                     write);
+            if (not prepared) {
+                _release(slot);
+                result = prepared;
+                continue;
+            }
+
+            _issue(slot, _ncq);
+            inflight.pushBack(slot);
+            pos += len;
+            continue;
+        }
+
+        if (auto done = _wait(inflight.popFront()); not done)
+            result = done;
+    }
+
+    try$(result);
+    return Ok(buf.len());
+}
+
+Res<usize> PortDevice::read(Seek seek, Bytes& buf) {
+    return _transfer(seek, buf, false);
+}
+
+Res<usize> PortDevice::write(Seek seek, Bytes const& buf) {
+    return _transfer(seek, buf, true);
+}
+
+usize PortDevice::maxBlocks() {
+    return alignDown((PRDT_LEN - 1) * Sys::PAGE_SIZE, _blockSize) / _blockSize;
+}
+
+Res<> PortDevice::submit(Io::BlkRequest& req, usize queue) {
+    // Nothing would ever reap the request without an interrupt.
+    if (not _ctrl._irq)
+        return StorDev::submit(req, queue);
+
+    // Interrupt handlers may submit too, they must not wait on the port.
+    if (Hal::intrEnabled())
+        _recover();
+
+    // Worst case every page touched is its own PRDT entry, anything that
+    // might not fit is not worth queueing.
+    usize pages = 0;
+    for (auto& seg : req.segs) {
+        uflat start = alignDown((uflat) seg.buf(), Sys::PAGE_SIZE);
+        uflat end   = alignUp((uflat) seg.buf() + seg.len(), Sys::PAGE_SIZE);
+        pages += (end - start) / Sys::PAGE_SIZE;
+    }
+    if (pages > PRDT_LEN)
+        return StorDev::submit(req, queue);
+
+    _Embed::enterCritical();
+    _lock.acquire();
+    _backlog.pushBack(&req);
+    _lock.release();
+    _Embed::leaveCritical();
+
+    _drain();
+    return Ok();
+}
+
+Res<> PortDevice::flush() {
+    usize slot = try$(_acquire());
+    try$(_prepare(slot, Ata::FlushCacheExt, 0, {}, false));
+    _issue(slot, false);
+    return _wait(slot);
+}
+
+// MARK: - ControllerDevice ----------------------------------------------------
+
+ControllerDevice::ControllerDevice(Rc<Pci::Dev> pci)
+    : Io::Dev("ahci-controller-device"s,
+              "pci/ahci-controller-device"s,
+              Io::Dev::Type::StorageController),
+      _pci(pci),
+      _regs(nullptr),
+      _slots(1),
+      _ncq(false),
+      _irq(false) {
+}
+
+Res<> ControllerDevice::onInit() {
+    uflat abar = try$(_pci->bar(5));
+    _regs      = (Hba::MemoryRegs*) try$(Sys::mmapVirtIo(abar));
+
+    try$(_pci->enableMemorySpace());
+    try$(_pci->enableBusMastering());
+
+    _regs->ghc = _regs->ghc | Hba::AhciEnable;
+    _slots     = _regs->hostCaps.ncs + 1;
+    _ncq       = _regs->hostCaps.ncq;
+
+    // Ports poll while they are brought up, the handler only knows about
+    // the ones already up.
+    auto vectors = _pci->allocVectors(1);
+    if (vectors)
+        try$(Hal::bindIntr(vectors.unwrap()[0], _onInterrupt, this));
+    else
+        logWarn("Ahci::ControllerDevice: no msi, polling for completions");
+
+    u32 implemented = _regs->pi;
+    for (usize i = 0; i < 32; i++) {
+        if (not(implemented & (1u << i)))
+            continue;
+
+        auto& regs = port(i);
+        if ((regs.ssts & Hba::DetMask) != Hba::DetPresent
+            or regs.sig != Signature::Sata)
+            continue;
+
+        auto dev = makeRc<PortDevice>(*this, i);
+        if (auto res = dev->onInit(); not res) {
+            logWarn("Ahci::ControllerDevice: port {} failed to start", i);
+            continue;
+        }
+
+        _ports.pushBack(dev);
+        if (auto tree = devtree())
+            tree->mount(dev);
+    }
+
+    _regs->is = _regs->is;
+    if (vectors) {
+        _regs->ghc = _regs->ghc | Hba::InterruptEnable;
+        _irq       = true;
+    }
+
+    logInfo("Ahci::ControllerDevice: {} ports, {} slots{}",
+            _ports.len(),
+            _slots,
+            _ncq ? ", ncq" : "");
+    return Ok();
+}
+
+void ControllerDevice::onInterrupt() {
+    u32 pending = _regs->is;
+    for (auto& port : _ports) {
+        if (pending & (1u << port->_index))
+            port->onInterrupt();
+    }
+    _regs->is = pending;
+}
+
+// MARK: - Driver --------------------------------------------------------------
+
+static constexpr Io::DrvKey KEYS[] = {
+    Pci::classKey((u8) Pci::Class::MassStorage,
+                  Pci::Subclass<Pci::Class::MassStorage>::SerialAta,
+                  0x01),
+};
+
+Slice<Io::DrvKey> Driver::keys() {
+    return { KEYS, sizeof(KEYS) / sizeof(*KEYS) };
+}
+
+Res<bool> Driver::match(Rc<Io::Dev> dev) {
+    auto pci = dev.cast<Pci::Dev>();
+    if (not pci)
+        return Ok(false);
+
+    return Ok(try$((*pci)->clazz()) == (u8) Pci::Class::MassStorage
+              and try$((*pci)->subclass())
+                      == Pci::Subclass<Pci::Class::MassStorage>::SerialAta
+              and try$((*pci)->progIf()) == 0x01);
+}
+
+Res<> Driver::onInit(Rc<Io::Dev> dev) {
+    auto pci = dev.cast<Pci::Dev>();
+    if (not pci) {
+        return Error::invalidArgument("Ahci::Driver: not a pci device");
+    }
+
+    auto ctrl = makeRc<ControllerDevice>(pci.take());
+    try$(ctrl->onInit());
+    _controllers.pushBack(ctrl);
+    return Ok();
+}
+
+Res<> Driver::onRemove(Rc<Io::Dev>) {
+    return Error::notImplemented();
+}
+
+Res<> Driver::onSuspend(Rc<Io::Dev>) {
+    return Error::notImplemented();
+}
+
+Res<> Driver::onResume(Rc<Io::Dev>) {
+    return Error::notImplemented();
+}
+
+} // namespace Ahci
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <pci/dev.h>
+#include <realms/hal/intr.h>
+#include <realms/io/blk.h>
+#include <realms/io/dev.stor.h>
+#include <realms/io/drv.h>
+#include <sdk-meta/array.h>
+#include <sdk-meta/atomic.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/opt.h>
+#include <sdk-meta/rc.h>
+#include <sdk-meta/vec.h>
+#include <stor/ahci/spec.h>
+
+namespace Ahci {
+
+using namespace Realms::Sys;
+
+struct ControllerDevice;
+
+/**
+ * @brief A SATA drive behind one AHCI port.
+ *
+ * Every command slot the HBA and drive support is kept busy at once. With NCQ
+ * the slots carry READ/WRITE FPDMA QUEUED commands the drive is free to
+ * reorder, otherwise they still pipeline plain DMA commands through the HBA.
+ * The PRDT is built page by page straight from the caller's buffer, so no
+ * bounce copy is made.
+ */
+struct PortDevice : public Io::StorDev {
+    static constexpr usize SLOTS    = 32;
+    static constexpr usize PRDT_LEN = 56; // A command table fits in 1 KiB
+    static constexpr usize TABLE_SIZE
+        = sizeof(Hba::_CommandTable) + PRDT_LEN * sizeof(Hba::PrdtEntry);
+
+    struct Slot {
+        Atomic<bool>    done { true };
+        bool            failed = false;
+        Io::BlkRequest* req    = nullptr; // Completed from the interrupt
+    };
+
+    ControllerDevice&       _ctrl;
+    Hba::PortRegs&          _regs;
+    usize                   _index;
+    Hba::CommandHeader*     _headers;
+    Hba::Received volatile* _received;
+    uflat                   _tables; // Virtual address of SLOTS tables
+    uflat                   _tablesPhys;
+    usize                   _depth; // Usable slots
+    bool                    _ncq;
+    Atomic<u32>             _free;      // Bitmap of free slots
+    u32                     _issued;    // Bitmap of slots in flight
+    u32                     _exclusive; // In flight non-queued command
+    Lock                    _lock;      // Serializes CI/SACT and completion
+    Vec<Io::BlkRequest*>    _backlog;   // Waiting for a slot, under `_lock`
+    Array<Slot, SLOTS>      _slots;
+
+    // Set by the interrupt on an error and cleared once a waiter restarted
+    // the port, nothing is issued in between.
+    Atomic<bool> _broken { false };
+    Atomic<bool> _recovering { false };
+
+    PortDevice(ControllerDevice& ctrl, usize index);
+
+    /**
+     * @brief Allocate the command list, received FIS area and command
+     * tables, start the port and identify the drive.
+     *
+     * @retval Error::timedOut if the port engine does not stop or start.
+     */
+    Res<> onInit();
+
+    Res<usize> read(Seek seek, Bytes& buf) override;
+
+    Res<usize> write(Seek seek, Bytes const& buf) override;
+
+    Res<> flush();
+
+    usize maxBlocks() override;
+
+    /**
+     * @brief Issue a block layer request on one slot and return, the request
+     * completes from the interrupt handler. Without a free slot it waits in
+     * the backlog instead of spinning, as callers may be completion callbacks
+     * running from the interrupt. Requests too fragmented for one PRDT, or
+     * made while the controller has no interrupt, go through the synchronous
+     * path instead.
+     */
+    Res<> submit(Io::BlkRequest& req, usize queue) override;
+
+    void poll() override { _poll(); }
+
+    /**
+     * @brief Collect finished commands. Called from the controller interrupt,
+     * or by waiters when it cannot be delivered.
+     */
+    void onInterrupt();
+
+    /**
+     * @brief Restart a port that failed and collect finished commands when
+     * the interrupt cannot be delivered: the controller has no vector, is
+     * not set up yet, or the caller runs with interrupts off, as at boot.
+     * Called by waiters, never from the interrupt.
+     */
+    void _poll();
+
+    /**
+     * @brief Restart the port after an error, waiting on its engine, then
+     * issue what piled up meanwhile. Never from the interrupt.
+     */
+    void _recover();
+
+    Res<> _stop();
+
+    Res<> _start();
+
+    Res<> _identify();
+
+    Opt<usize> _tryAcquire();
+
+    Res<usize> _acquire();
+
+    void _release(usize slot);
+
+    /**
+     * @brief Issue backlogged requests while slots are free and the queue
+     * allows them, never waiting.
+     */
+    void _drain();
+
+    Res<> _prepare(
+        usize slot, u8 command, u64 lba, Slice<Bytes> segs, bool write);
+
+    Res<> _prepare(usize slot, u8 command, u64 lba, Bytes buf, bool write) {
+        return _prepare(slot, command, lba, Slice<Bytes> { &buf, 1 }, write);
+    }
+
+    /**
+     * @brief Hand a prepared slot to the HBA. Non-queued commands cannot
+     * overlap queued ones on an NCQ drive, so they wait for the queue to
+     * drain and hold it until they complete.
+     */
+    void _issue(usize slot, bool queued);
+
+    /**
+     * @brief Hand `slot` to the HBA if the queue allows it. The caller holds
+     * `_lock`.
+     */
+    bool _tryIssue(usize slot, bool queued);
+
+    Res<> _wait(usize slot);
+
+    Res<usize> _transfer(Seek seek, Bytes buf, bool write);
+
+    Hba::CommandTable& _table(usize slot) {
+        return *(Hba::CommandTable*) (_tables + slot * TABLE_SIZE);
+    }
+};
+
+struct ControllerDevice : public Io::Dev {
+    Rc<Pci::Dev>        _pci;
+    Hba::MemoryRegs*    _regs;
+    usize               _slots;
+    bool                _ncq;
+    bool                _irq;
+    Vec<Rc<PortDevice>> _ports;
+
+    ControllerDevice(Rc<Pci::Dev> pci);
+
+    Hba::PortRegs& port(usize i) {
+        return *(Hba::PortRegs*) ((uflat) _regs + 0x100 + i * 0x80);
+    }
+
+    /**
+     * @brief Enable AHCI mode, bring up every implemented port with a SATA
+     * drive attached, polling, then route the controller interrupt through
+     * MSI.
+     */
+    Res<> onInit();
+
+    void onInterrupt();
+
+    Slice<Rc<PortDevice>> ports() { return slice(_ports); }
+};
+
+struct Driver : public Io::Drv {
+    static constexpr auto requisites = toArray({
+        "core.pmm"s,
+        "core.vmm"s,
+        "pci-bus-device"s,
+    });
+
+    Vec<Rc<ControllerDevice>> _controllers;
+
+    Driver() { name = "ahci"s; }
+
+    Slice<Io::DrvKey> keys() override;
+
+    Res<bool> match(Rc<Io::Dev> dev) override;
+
+    Res<> onInit(Rc<Io::Dev> dev) override;
+
+    Res<> onRemove(Rc<Io::Dev> dev) override;
+
+    Res<> onSuspend(Rc<Io::Dev> dev) override;
+
+    Res<> onResume(Rc<Io::Dev> dev) override;
+};
+
+} // namespace Ahci
@@ -150,8 +150,68 @@ struct [[gnu::packed]] Command<Fis::DevBits> {
     u32 __reserved__0;
 };
 
+enum Ata : u8 {
+    ReadDmaExt       = 0x25,
+    WriteDmaExt      = 0x35,
+    ReadFpdmaQueued  = 0x60,
+    WriteFpdmaQueued = 0x61,
+    FlushCacheExt    = 0xEA,
+    IdentifyDevice   = 0xEC,
+};
+
+enum Signature : u32 {
+    Sata   = 0x0000'0101,
+    Atapi  = 0xEB14'0101,
+    Semb   = 0xC33C'0101,
+    PortMp = 0x9669'0101,
+};
+
 namespace Hba {
 
+enum GlobalControl : u32 {
+    Reset           = (1 << 0),
+    InterruptEnable = (1 << 1),
+    AhciEnable      = (1u << 31),
+};
+
+enum PortCommand : u32 {
+    Start          = (1 << 0),
+    SpinUp         = (1 << 1),
+    PowerOn        = (1 << 2),
+    FisRecvEnable  = (1 << 4),
+    FisRecvRunning = (1 << 14),
+    CommandRunning = (1 << 15),
+};
+
+enum PortInterrupt : u32 {
+    D2hRegister    = (1 << 0),
+    PioSetupFis    = (1 << 1),
+    DmaSetupFis    = (1 << 2),
+    SetDeviceBits  = (1 << 3),
+    DescProcessed  = (1 << 5),
+    PortChange     = (1 << 6),
+    InterfaceFatal = (1 << 27),
+    HostBusData    = (1 << 28),
+    HostBusFatal   = (1 << 29),
+    TaskFileError  = (1 << 30),
+    ErrorMask = InterfaceFatal | HostBusData | HostBusFatal | TaskFileError,
+};
+
+enum TaskFile : u32 {
+    TfdError = (1 << 0),
+    TfdDrq   = (1 << 3),
+    TfdBusy  = (1 << 7),
+};
+
+enum SataStatus : u32 {
+    DetMask    = 0xF,
+    DetPresent = 0x3,
+    IpmShift   = 8,
+    IpmActive  = 0x1,
+};
+
+static constexpr usize PRDT_MAX_BYTES = 4 * 1024 * 1024;
+
 struct [[gnu::packed]] Capability {
     u32 np: 5;
     u32 sxs: 1;
@@ -272,7 +332,7 @@ struct [[gnu::packed]] _CommandTable {
     Array<u8, 0x40> cfis;
     Array<u8, 0x10> atapiCmd;
     u8              __reserved__0[0x30];
-    PrdtEntry       entries[1];
+    PrdtEntry       entries[];
 };
 using CommandTable = _CommandTable volatile;
 
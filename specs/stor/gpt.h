@@ -1,9 +1,9 @@
 #pragma once
 
-#include <persistence-partition/mbr.h>
 #include <sdk-meta/array.h>
 #include <sdk-meta/types.h>
 #include <sdk-meta/uuid.h>
+#include <stor/mbr.h>
 
 namespace Gpt {
 
@@ -39,10 +39,13 @@ struct [[gnu::packed]] Table {
     u64  lbaEnd;
     Uuid diskIdentifier;
     u64  lbaEntries;
+    u32  entryCount;
     u32  entrySize;
     u32  checksumEntries;
 
     Array<u8, 512 - 0x5c> __reserved__1;
 };
+static_assert(sizeof(Table) == 512);
+static_assert(sizeof(Entry) == 128);
 
 } // namespace Gpt
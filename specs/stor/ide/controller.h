@@ -0,0 +1,186 @@
+#pragma once
+
+#include <pci/dev.h>
+#include <realms/hal/intr.h>
+#include <realms/hal/vmm.h>
+#include <realms/io/blk.h>
+#include <realms/io/dev.stor.h>
+#include <realms/io/drv.h>
+#include <sdk-meta/array.h>
+#include <sdk-meta/box.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/rc.h>
+#include <sdk-meta/vec.h>
+#include <stor/ide/spec.h>
+
+namespace Ide {
+
+using namespace Realms::Sys;
+
+struct ControllerDevice;
+struct DriveDevice;
+
+/**
+ * @brief One IDE channel. Both drives on it share the taskfile and the bus
+ * master engine, so commands run one at a time and the rest wait in a FIFO.
+ */
+struct Bus : Meta::Pinned {
+    static constexpr usize PRDT_LEN = PAGE_SIZE / sizeof(PrdEntry);
+
+    ControllerDevice& _ctrl;
+    Channel           _channel;
+    ChannelRegs       _regs;
+    PrdEntry*         _prdt;
+    uflat             _prdtPhys;
+    bool              _dma; // Bus master block present
+    Lock              _lock;
+
+    Vec<Io::BlkRequest*> _queue;
+    Io::BlkRequest*      _active  = nullptr; // Owned by whoever set it
+    bool                 _running = false;   // On the bus master engine
+
+    Bus(ControllerDevice& ctrl, Channel channel, ChannelRegs regs);
+
+    /**
+     * @brief Allocate the PRD table, it must not cross a 64 KiB boundary,
+     * which one page never does.
+     */
+    Res<> onInit();
+
+    u16 _port(Regs reg);
+
+    Res<u8> _in(Regs reg);
+
+    Res<> _out(Regs reg, u8 val);
+
+    Res<u8> _status();
+
+    /**
+     * @brief Wait for BSY to clear, and for DRQ to be set if `drq`.
+     *
+     * @retval Error::invalidData if the drive reports an error.
+     * @retval Error::timedOut if it stays busy.
+     */
+    Res<u8> _wait(bool drq);
+
+    Res<> _select(Ata drive, u64 lba, bool lba48);
+
+    Res<> _command(DriveDevice& drive, u8 command, u64 lba, usize count);
+
+    /**
+     * @brief Describe the request's segments in the PRD table.
+     *
+     * @retval Error::limitReached if they need more entries than the table
+     *         holds or memory above 4 GiB, both handled by PIO instead.
+     */
+    Res<> _prepare(Io::BlkRequest& req);
+
+    Res<> _startDma(DriveDevice& drive, Io::BlkRequest& req);
+
+    Res<> _pio(DriveDevice& drive, Io::BlkRequest& req);
+
+    /**
+     * @brief Queue a request and start it if the channel is idle.
+     */
+    void enqueue(DriveDevice& drive, Io::BlkRequest& req);
+
+    /**
+     * @brief Start queued requests until one is left running on the bus
+     * master engine or the queue is empty.
+     */
+    void _kick();
+
+    /**
+     * @brief Complete the running DMA command if the engine raised its
+     * interrupt bit.
+     *
+     * @return true if a command was completed.
+     */
+    bool _finish();
+
+    /**
+     * @brief Complete the running command and start the next one.
+     */
+    bool onInterrupt();
+};
+
+/**
+ * @brief An ATA drive on one of the channels.
+ */
+struct DriveDevice : public Io::StorDev {
+    Bus&  _bus;
+    Ata   _drive;
+    usize _index;
+    bool  _lba48;
+    bool  _dma; // Drive and controller both do multiword or Ultra DMA
+
+    DriveDevice(Bus& bus, Ata drive, usize index);
+
+    /**
+     * @brief Identify the drive with a PIO IDENTIFY DEVICE.
+     *
+     * @retval Error::notFound if no ATA drive answers.
+     */
+    Res<> onInit();
+
+    Res<usize> read(Seek seek, Bytes& buf) override;
+
+    Res<usize> write(Seek seek, Bytes const& buf) override;
+
+    usize maxBlocks() override;
+
+    /**
+     * @brief Queue the request on the channel. It completes from the
+     * interrupt handler when DMA and an MSI vector are available, and
+     * before this returns otherwise. Legacy IRQs are not routed, so
+     * controllers without MSI always complete before this returns.
+     */
+    Res<> submit(Io::BlkRequest& req, usize queue) override;
+
+    Res<usize> _transfer(Seek seek, Bytes buf, bool write);
+};
+
+struct ControllerDevice : public Io::Dev {
+    Rc<Pci::Dev>         _pci;
+    bool                 _irq;
+    Vec<Box<Bus>>        _buses;
+    Vec<Rc<DriveDevice>> _drives;
+
+    ControllerDevice(Rc<Pci::Dev> pci);
+
+    /**
+     * @brief Find the channels, in native or compatibility mode, and the
+     * drives on them.
+     */
+    Res<> onInit();
+
+    void onInterrupt();
+
+    Slice<Rc<DriveDevice>> drives() { return slice(_drives); }
+};
+
+struct Driver : public Io::Drv {
+    static constexpr auto requisites = toArray({
+        "core.pmm"s,
+        "core.vmm"s,
+        "pci-bus-device"s,
+    });
+
+    Vec<Rc<ControllerDevice>> _controllers;
+
+    Driver() { name = "ide"s; }
+
+    Slice<Io::DrvKey> keys() override;
+
+    Res<bool> match(Rc<Io::Dev> dev) override;
+
+    Res<> onInit(Rc<Io::Dev> dev) override;
+
+    Res<> onRemove(Rc<Io::Dev> dev) override;
+
+    Res<> onSuspend(Rc<Io::Dev> dev) override;
+
+    Res<> onResume(Rc<Io::Dev> dev) override;
+};
+
+} // namespace Ide
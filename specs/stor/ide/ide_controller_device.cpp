@@ -0,0 +1,599 @@
+#include <pci/spec.h>
+#include <realms/core/api.io.h>
+#include <realms/hal/clock.h>
+#include <realms/hal/io.h>
+#include <realms/mm/mem.h>
+#include <sdk-logs/logger.h>
+#include <sdk-meta/array.h>
+#include <sdk-meta/atomic.h>
+#include <sdk-text/format.h>
+#include <stor/ide/controller.h>
+
+namespace Ide {
+
+using namespace Realms;
+using namespace Sdk;
+
+namespace {
+
+static constexpr TimeSpan CMD_TIMEOUT = TimeSpan::ofSeconds(10);
+static constexpr uflat    DMA_LIMIT   = 0x1'0000'0000; // 32-bit PRDs
+
+bool _until(auto&& cond, TimeSpan timeout) {
+    Instant end = Hal::clock() + timeout;
+    while (not cond()) {
+        if (Hal::clock() > end)
+            return cond();
+        _Embed::relaxe();
+    }
+    return true;
+}
+
+void _onInterrupt(Hal::IntrVector const&, void* ctx) {
+    static_cast<ControllerDevice*>(ctx)->onInterrupt();
+}
+
+usize _regionLen(PrdEntry const& entry) {
+    return entry.count ? entry.count : PRD_MAX_BYTES;
+}
+
+} // namespace
+
+// MARK: - Bus -----------------------------------------------------------------
+
+Bus::Bus(ControllerDevice& ctrl, Channel channel, ChannelRegs regs)
+    : _ctrl(ctrl),
+      _channel(channel),
+      _regs(regs),
+      _prdt(nullptr),
+      _prdtPhys(0),
+      _dma(regs.bmide != 0) {
+}
+
+Res<> Bus::onInit() {
+    if (not _dma)
+        return Ok();
+
+    auto range = try$(Sys::pmm().alloc(Sys::PAGE_SIZE, Sys::PmmFlags::Dma));
+    if (range.start() + Sys::PAGE_SIZE > DMA_LIMIT) {
+        (void) Sys::pmm().free(range);
+        _dma = false;
+        return Ok();
+    }
+
+    _prdtPhys = range.start();
+    _prdt     = (PrdEntry*) try$(Sys::mmapVirtIo(_prdtPhys));
+    return Ok();
+}
+
+u16 Bus::_port(Regs reg) {
+    u8 r = (u8) reg;
+    if (r < (u8) Regs::SecCnt1)
+        return _regs.base + r;
+    if (r < (u8) Regs::Control)
+        return _regs.base + r - 0x06;
+    return _regs.ctrl + r - (u8) Regs::Control;
+}
+
+Res<u8> Bus::_in(Regs reg) {
+    return Hal::Pmio::in8(_port(reg));
+}
+
+Res<> Bus::_out(Regs reg, u8 val) {
+    return Hal::Pmio::out8(_port(reg), val);
+}
+
+Res<u8> Bus::_status() {
+    // Reading the alternate status four times gives the drive the 400ns it
+    // needs to update the status after a command or a select.
+    for (usize i = 0; i < 4; i++)
+        try$(_in(Regs::AltStatus));
+    return _in(Regs::Status);
+}
+
+Res<u8> Bus::_wait(bool drq) {
+    u8   status = 0;
+    bool ready  = _until(
+        [&] {
+            status = _in(Regs::Status).unwrapOr(Busy);
+            if (status & Busy)
+                return false;
+            return (status & (Failed | WriteFault)) or not drq
+                or (status & DataReady);
+        },
+        CMD_TIMEOUT);
+
+    if (not ready) {
+        return Error::timedOut("Ide::Bus::_wait: drive busy");
+    }
+
+    if (status & (Failed | WriteFault)) {
+        return Error::invalidData("Ide::Bus::_wait: drive reported an error");
+    }
+    return Ok(status);
+}
+
+Res<> Bus::_select(Ata drive, u64 lba, bool lba48) {
+    u8 head = lba48 ? 0 : (u8) ((lba >> 24) & 0x0f);
+    try$(_out(Regs::DevSel, 0xe0 | (drive << 4) | head));
+    try$(_status());
+    return Ok();
+}
+
+Res<> Bus::_command(DriveDevice& drive, u8 command, u64 lba, usize count) {
+    try$(_wait(false));
+    try$(_select(drive._drive, lba, drive._lba48));
+
+    // A count of 0 means 256 sectors, or 65536 with the 48-bit commands.
+    if (drive._lba48) {
+        try$(_out(Regs::SecCnt1, (u8) (count >> 8)));
+        try$(_out(Regs::Lba3, (u8) (lba >> 24)));
+        try$(_out(Regs::Lba4, (u8) (lba >> 32)));
+        try$(_out(Regs::Lba5, (u8) (lba >> 40)));
+    }
+    try$(_out(Regs::SecCnt0, (u8) count));
+    try$(_out(Regs::Lba0, (u8) lba));
+    try$(_out(Regs::Lba1, (u8) (lba >> 8)));
+    try$(_out(Regs::Lba2, (u8) (lba >> 16)));
+    try$(_out(Regs::Command, command));
+    return Ok();
+}
+
+Res<> Bus::_prepare(Io::BlkRequest& req) {
+    // Describe the buffers page by page, merging physically adjacent pages
+    // as long as they stay within the same 64 KiB region.
+    usize entries = 0;
+    for (auto& seg : req.segs) {
+        uflat addr = (uflat) seg.buf();
+        usize left = seg.len();
+        while (left) {
+            usize len  = min(left, Sys::PAGE_SIZE - addr % Sys::PAGE_SIZE);
+            uflat phys = try$(Sys::mmapPhys(addr));
+            if (phys + len > DMA_LIMIT) {
+                return Error::limitReached("Ide::Bus::_prepare: above 4 GiB");
+            }
+
+            auto* last = entries ? &_prdt[entries - 1] : nullptr;
+            if (last and last->base + _regionLen(*last) == phys
+                and last->base / PRD_MAX_BYTES
+                        == (phys + len - 1) / PRD_MAX_BYTES) {
+                last->count = (u16) (_regionLen(*last) + len);
+            } else {
+                if (entries == PRDT_LEN) {
+                    return Error::limitReached(
+                        "Ide::Bus::_prepare: buffer too fragmented");
+                }
+
+                auto& entry = _prdt[entries++];
+                entry.base  = (u32) phys;
+                entry.count = (u16) len;
+                entry.flags = 0;
+            }
+
+            addr += len;
+            left -= len;
+        }
+    }
+
+    if (not entries) {
+        return Error::invalidArgument("Ide::Bus::_prepare: empty request");
+    }
+    _prdt[entries - 1].flags = PRD_EOT;
+    return Ok();
+}
+
+Res<> Bus::_startDma(DriveDevice& drive, Io::BlkRequest& req) {
+    try$(_prepare(req));
+
+    bool write = req.op == Io::BlkRequest::Op::Write;
+    u8   dir   = write ? 0 : BmWrite;
+    u8   cmd   = drive._lba48 ? (write ? WriteDmaExt : ReadDmaExt)
+                              : (write ? WriteDma : ReadDma);
+
+    // Load the table with the engine stopped and clear the stale interrupt
+    // and error bits, they are write one to clear.
+    threadfence();
+    try$(Hal::Pmio::out8(_regs.bmide + BmCommand, 0));
+    try$(Hal::Pmio::out32(_regs.bmide + BmPrdt, (u32) _prdtPhys));
+    try$(Hal::Pmio::out8(_regs.bmide + BmCommand, dir));
+    try$(Hal::Pmio::out8(_regs.bmide + BmStatus, BmInterrupt | BmError));
+
+    try$(_command(drive, cmd, req.lba, req.count));
+    try$(Hal::Pmio::out8(_regs.bmide + BmCommand, dir | BmStart));
+    return Ok();
+}
+
+Res<> Bus::_pio(DriveDevice& drive, Io::BlkRequest& req) {
+    if (req.op == Io::BlkRequest::Op::Flush) {
+        try$(_command(drive, drive._lba48 ? FlushCacheExt : FlushCache, 0, 0));
+        try$(_wait(false));
+        return Ok();
+    }
+
+    bool write = req.op == Io::BlkRequest::Op::Write;
+    u8   cmd   = drive._lba48 ? (write ? WritePioExt : ReadPioExt)
+                              : (write ? WritePio : ReadPio);
+    try$(_command(drive, cmd, req.lba, req.count));
+
+    // The drive raises DRQ once per sector.
+    usize words = drive._blockSize / 2;
+    for (auto& seg : req.segs) {
+        for (usize off = 0; off < seg.len(); off += drive._blockSize) {
+            try$(_wait(true));
+
+            Slice<u16> data { (u16*) (seg.buf() + off), words };
+            if (write)
+                try$(Hal::Pmio::outs16(_regs.base, data));
+            else
+                try$(Hal::Pmio::ins16(_regs.base, data));
+        }
+    }
+
+    if (write)
+        try$(_wait(false));
+    return Ok();
+}
+
+void Bus::enqueue(DriveDevice&, Io::BlkRequest& req) {
+    _Embed::enterCritical();
+    _lock.acquire();
+    _queue.pushBack(&req);
+    _lock.release();
+    _Embed::leaveCritical();
+
+    _kick();
+}
+
+void Bus::_kick() {
+    while (true) {
+        _Embed::enterCritical();
+        _lock.acquire();
+        if (_active or not _queue.len()) {
+            _lock.release();
+            _Embed::leaveCritical();
+            return;
+        }
+
+        auto* req   = _queue.popFront();
+        auto& drive = *static_cast<DriveDevice*>(req->dev);
+        _active     = req;
+
+        // Started under the lock so the interrupt cannot see the command
+        // before `_running` is set.
+        Res<> started = Error::notSupported("Ide::Bus: no dma");
+        if (drive._dma and req->op != Io::BlkRequest::Op::Flush) {
+            started  = _startDma(drive, *req);
+            _running = started.has();
+        }
+        _lock.release();
+        _Embed::leaveCritical();
+
+        if (started) {
+            if (_ctrl._irq)
+                return;
+
+            // Without an interrupt vector the bus master status is polled,
+            // its interrupt bit is set whether or not INTRQ is routed.
+            if (_until([&] { return _finish(); }, CMD_TIMEOUT))
+                continue;
+
+            (void) Hal::Pmio::out8(_regs.bmide + BmCommand, 0);
+            _Embed::enterCritical();
+            _lock.acquire();
+            _active  = nullptr;
+            _running = false;
+            _lock.release();
+            _Embed::leaveCritical();
+
+            req->end(Error::timedOut("Ide::Bus: dma command timed out"));
+            continue;
+        }
+
+        // No DMA for this request, move it by hand.
+        auto res = _pio(drive, *req);
+
+        _Embed::enterCritical();
+        _lock.acquire();
+        _active = nullptr;
+        _lock.release();
+        _Embed::leaveCritical();
+
+        req->end(res);
+    }
+}
+
+bool Bus::_finish() {
+    _Embed::enterCritical();
+    _lock.acquire();
+
+    u8 bm = 0;
+    if (_running)
+        bm = Hal::Pmio::in8(_regs.bmide + BmStatus).unwrapOr(0);
+
+    if (not(bm & BmInterrupt)) {
+        _lock.release();
+        _Embed::leaveCritical();
+        return false;
+    }
+
+    // Stop the engine, acknowledge it, then read the status to acknowledge
+    // the drive.
+    (void) Hal::Pmio::out8(_regs.bmide + BmCommand, 0);
+    (void) Hal::Pmio::out8(_regs.bmide + BmStatus, BmInterrupt | BmError);
+    u8 status = _in(Regs::Status).unwrapOr(Failed);
+
+    auto* req = _active;
+    _active   = nullptr;
+    _running  = false;
+    threadfence();
+
+    _lock.release();
+    _Embed::leaveCritical();
+
+    if ((bm & BmError) or (status & (Failed | WriteFault))) {
+        logError("Ide::Bus: channel {} error, bm={:02x} status={:02x}",
+                 (usize) _channel,
+                 bm,
+                 status);
+        req->end(Error::invalidData("Ide::Bus: dma command failed"));
+    } else {
+        req->end(Ok());
+    }
+    return true;
+}
+
+bool Bus::onInterrupt() {
+    if (not _finish())
+        return false;
+    _kick();
+    return true;
+}
+
+// MARK: - DriveDevice ---------------------------------------------------------
+
+DriveDevice::DriveDevice(Bus& bus, Ata drive, usize index)
+    : StorDev(Text::format("ide-drive-device-{}", index),
+              Text::format("pci/ide-controller-device/drive-{}", index),
+              Io::Dev::Type::StorageDrive),
+      _bus(bus),
+      _drive(drive),
+      _index(index),
+      _lba48(false),
+      _dma(false) {
+}
+
+Res<> DriveDevice::onInit() {
+    try$(_bus._select(_drive, 0, false));
+    try$(_bus._out(Regs::SecCnt0, 0));
+    try$(_bus._out(Regs::Lba0, 0));
+    try$(_bus._out(Regs::Lba1, 0));
+    try$(_bus._out(Regs::Lba2, 0));
+    try$(_bus._out(Regs::Command, IdentifyDrive));
+
+    // A floating bus reads all ones, an empty position all zeroes.
+    u8 status = try$(_bus._status());
+    if (status == 0 or status == 0xff) {
+        return Error::notFound("Ide::DriveDevice: no drive");
+    }
+
+    auto idle = [&] {
+        return not(_bus._in(Regs::Status).unwrapOr(Busy) & Busy);
+    };
+    if (not _until(idle, CMD_TIMEOUT)) {
+        return Error::timedOut("Ide::DriveDevice: identify timed out");
+    }
+
+    // ATAPI and SATA devices abort IDENTIFY DEVICE and leave their signature
+    // in the LBA registers.
+    if (try$(_bus._in(Regs::Lba1)) or try$(_bus._in(Regs::Lba2))) {
+        return Error::notSupported("Ide::DriveDevice: not an ata drive");
+    }
+    try$(_bus._wait(true));
+
+    Array<u16, 256> id {};
+    try$(Hal::Pmio::ins16(_bus._regs.base, { id.buf(), id.len() }));
+
+    _lba48 = id[83] & (1 << 10);
+    _dma   = _bus._dma and (id[49] & (1 << 8));
+    if (_lba48) {
+        _blockCount = (u64) id[100] | (u64) id[101] << 16
+                    | (u64) id[102] << 32 | (u64) id[103] << 48;
+    } else {
+        _blockCount = (u32) id[60] | (u32) id[61] << 16;
+    }
+
+    logInfo("Ide::DriveDevice: drive {} has {} blocks of {} bytes{}",
+            _index,
+            _blockCount,
+            _blockSize,
+            _dma ? " (dma)" : " (pio)");
+    return Ok();
+}
+
+usize DriveDevice::maxBlocks() {
+    if (not _lba48)
+        return 256;
+    return alignDown((Bus::PRDT_LEN - 1) * Sys::PAGE_SIZE, _blockSize)
+         / _blockSize;
+}
+
+Res<> DriveDevice::submit(Io::BlkRequest& req, usize) {
+    _bus.enqueue(*this, req);
+    return Ok();
+}
+
+Res<usize> DriveDevice::_transfer(Seek seek, Bytes buf, bool write) {
+    if (seek.whence != Whence::BEGIN) {
+        return Error::invalidArgument(
+            "Ide::DriveDevice: only absolute seeks are supported");
+    }
+
+    usize offset = seek.offset;
+    if (offset % _blockSize or buf.len() % _blockSize) {
+        return Error::invalidArgument("Ide::DriveDevice: unaligned transfer");
+    }
+
+    u64 lba = offset / _blockSize;
+    if (lba + buf.len() / _blockSize > _blockCount) {
+        return Error::outOfBounds("Ide::DriveDevice: transfer past the end");
+    }
+
+    auto  op    = write ? Io::BlkRequest::Op::Write : Io::BlkRequest::Op::Read;
+    usize chunk = maxBlocks() * _blockSize;
+    for (usize pos = 0; pos < buf.len(); pos += chunk) {
+        usize len = min(buf.len() - pos, chunk);
+
+        Io::BlkRequest req {
+            .dev   = this,
+            .op    = op,
+            .lba   = lba + pos / _blockSize,
+            .count = len / _blockSize,
+            .segs  = {},
+            .fn    = nullptr,
+            .ctx   = nullptr,
+        };
+        req.segs.pushBack(slice(buf, pos, pos + len));
+        try$(Io::blkWait(req));
+    }
+    return Ok(buf.len());
+}
+
+Res<usize> DriveDevice::read(Seek seek, Bytes& buf) {
+    return _transfer(seek, buf, false);
+}
+
+Res<usize> DriveDevice::write(Seek seek, Bytes const& buf) {
+    return _transfer(seek, buf, true);
+}
+
+// MARK: - ControllerDevice ----------------------------------------------------
+
+ControllerDevice::ControllerDevice(Rc<Pci::Dev> pci)
+    : Io::Dev("ide-controller-device"s,
+              "pci/ide-controller-device"s,
+              Io::Dev::Type::StorageController),
+      _pci(pci),
+      _irq(false) {
+}
+
+Res<> ControllerDevice::onInit() {
+    u8 progIf = try$(_pci->progIf());
+    try$(_pci->enableIoSpace());
+
+    // BAR4 holds the bus master block, without it both channels stay on
+    // PIO.
+    uflat bm = _pci->bar(4).unwrapOr(0);
+    if (bm) {
+        try$(_pci->enableBusMastering());
+    } else {
+        logWarn("Ide::ControllerDevice: no bus master block, using pio");
+    }
+
+    // Only MSI gets here: the legacy IRQ 14 and 15 of compatibility mode are
+    // not routed through the I/O APIC, so controllers without MSI, PIIX
+    // among them, always poll the bus master status.
+    if (auto vectors = _pci->allocVectors(1); vectors) {
+        try$(Hal::bindIntr(vectors.unwrap()[0], _onInterrupt, this));
+        _irq = true;
+    } else {
+        logWarn("Ide::ControllerDevice: no msi, polling for completions");
+    }
+
+    // A simplex engine can only run one channel at a time, keep it for the
+    // primary.
+    bool simplex
+        = bm and (Hal::Pmio::in8(bm + BmStatus).unwrapOr(0) & BmSimplex);
+
+    for (usize ch = 0; ch < 2; ch++) {
+        // Bits 0 and 2 of the programming interface select native mode, in
+        // which the channel ports come from the BARs.
+        ChannelRegs regs {};
+        if (progIf & (1 << (ch * 2))) {
+            regs.base = (u16) try$(_pci->bar(ch * 2));
+            regs.ctrl = (u16) try$(_pci->bar(ch * 2 + 1)) + 2;
+        } else {
+            regs.base = LEGACY_BASE[ch];
+            regs.ctrl = LEGACY_CONTROL[ch];
+        }
+        if (bm and not(simplex and ch > 0))
+            regs.bmide = (u16) (bm + ch * 8);
+
+        auto bus = makeBox<Bus>(*this, (Channel) ch, regs);
+        if (auto res = bus->onInit(); not res) {
+            logWarn("Ide::ControllerDevice: channel {} failed to start", ch);
+            continue;
+        }
+
+        // Interrupts stay enabled on the drive even when polling, the bus
+        // master interrupt bit follows INTRQ.
+        (void) bus->_out(Regs::Control, 0);
+
+        for (usize i = 0; i < 2; i++) {
+            auto dev = makeRc<DriveDevice>(*bus, (Ata) i, ch * 2 + i);
+            if (auto res = dev->onInit(); not res)
+                continue;
+
+            _drives.pushBack(dev);
+            if (auto tree = devtree())
+                tree->mount(dev);
+        }
+        _buses.pushBack(move(bus));
+    }
+
+    logInfo("Ide::ControllerDevice: {} drives{}",
+            _drives.len(),
+            bm ? ", bus master dma" : "");
+    return Ok();
+}
+
+void ControllerDevice::onInterrupt() {
+    for (auto& bus : _buses)
+        bus->onInterrupt();
+}
+
+// MARK: - Driver --------------------------------------------------------------
+
+static constexpr Io::DrvKey KEYS[] = {
+    Pci::classKey((u8) Pci::Class::MassStorage,
+                  Pci::Subclass<Pci::Class::MassStorage>::Ide),
+};
+
+Slice<Io::DrvKey> Driver::keys() {
+    return { KEYS, sizeof(KEYS) / sizeof(*KEYS) };
+}
+
+Res<bool> Driver::match(Rc<Io::Dev> dev) {
+    auto pci = dev.cast<Pci::Dev>();
+    if (not pci)
+        return Ok(false);
+
+    return Ok(try$((*pci)->clazz()) == (u8) Pci::Class::MassStorage
+              and try$((*pci)->subclass())
+                      == Pci::Subclass<Pci::Class::MassStorage>::Ide);
+}
+
+Res<> Driver::onInit(Rc<Io::Dev> dev) {
+    auto pci = dev.cast<Pci::Dev>();
+    if (not pci) {
+        return Error::invalidArgument("Ide::Driver: not a pci device");
+    }
+
+    auto ctrl = makeRc<ControllerDevice>(pci.take());
+    try$(ctrl->onInit());
+    _controllers.pushBack(ctrl);
+    return Ok();
+}
+
+Res<> Driver::onRemove(Rc<Io::Dev>) {
+    return Error::notImplemented();
+}
+
+Res<> Driver::onSuspend(Rc<Io::Dev>) {
+    return Error::notImplemented();
+}
+
+Res<> Driver::onResume(Rc<Io::Dev>) {
+    return Error::notImplemented();
+}
+
+} // namespace Ide
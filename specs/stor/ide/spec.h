@@ -12,10 +12,10 @@ enum Status : u8 {
     DataReady    = (1 << 3),
     Corrected    = (1 << 2),
     Index        = (1 << 1),
-    Error        = (1 << 0),
+    Failed       = (1 << 0),
 };
 
-enum Error : u8 {
+enum ErrorBits : u8 {
     BadBlock           = (1 << 7),
     BadData            = (1 << 6),
     MediaChanged       = (1 << 5),
@@ -55,7 +55,10 @@ enum Ata : u8 {
     Slave  = 1,
 };
 
-enum Regs {
+// Registers 0x08 to 0x0B are the high order bytes of the 48-bit taskfile,
+// written to the same ports as their low order counterparts. Registers from
+// 0x0C live in the control block.
+enum struct Regs : u8 {
     Data      = 0x00,
     Error     = 0x01,
     Feats     = 0x01,
@@ -100,6 +103,50 @@ struct Drive {
     u8   model[41];
 };
 
+enum Control : u8 {
+    NoInterrupt = (1 << 1), // nIEN
+    SoftReset   = (1 << 2),
+    HighOrder   = (1 << 7), // HOB, read back the high order bytes
+};
+
+// MARK: - Bus Master IDE ------------------------------------------------------
+
+// Offsets in the bus master block from BAR4, the secondary channel's
+// registers follow the primary's at +8.
+enum BusMaster : u8 {
+    BmCommand = 0x00,
+    BmStatus  = 0x02,
+    BmPrdt    = 0x04,
+};
+
+enum BmCommandBits : u8 {
+    BmStart = (1 << 0),
+    BmWrite = (1 << 3), // Set when the device writes to memory, on reads
+};
+
+enum BmStatusBits : u8 {
+    BmActive    = (1 << 0),
+    BmError     = (1 << 1),
+    BmInterrupt = (1 << 2),
+    BmDrive0Dma = (1 << 5),
+    BmDrive1Dma = (1 << 6),
+    BmSimplex   = (1 << 7),
+};
+
+// A region may not cross a 64 KiB boundary, a count of 0 means 64 KiB.
+struct [[gnu::packed]] PrdEntry {
+    u32 base;
+    u16 count;
+    u16 flags;
+};
+static_assert(sizeof(PrdEntry) == 8);
+
+static constexpr u16   PRD_EOT       = (1 << 15);
+static constexpr usize PRD_MAX_BYTES = 64 * 1024;
+
+static constexpr u16 LEGACY_BASE[]    = { 0x1F0, 0x170 };
+static constexpr u16 LEGACY_CONTROL[] = { 0x3F6, 0x376 };
+
 struct Port {
     u16 data;
     u16 error;
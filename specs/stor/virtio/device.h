@@ -0,0 +1,232 @@
+#pragma once
+
+#include <pci/dev.h>
+#include <realms/hal/arch.h>
+#include <realms/hal/intr.h>
+#include <realms/io/blk.h>
+#include <realms/io/dev.stor.h>
+#include <realms/io/drv.h>
+#include <sdk-meta/array.h>
+#include <sdk-meta/atomic.h>
+#include <sdk-meta/box.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/rc.h>
+#include <sdk-meta/vec.h>
+#include <stor/virtio/spec.h>
+
+namespace VirtioBlk {
+
+using namespace Realms::Sys;
+
+struct Device;
+
+/**
+ * @brief One virtqueue, split or packed, and the requests in flight on it.
+ *
+ * Every request takes a single ring entry pointing to an indirect table of
+ * its own: the header, the data page by page, then the status byte. Entries
+ * are made available as requests come, the device is only notified once per
+ * batch, and with event indices only when it asked to be. Likewise it only
+ * interrupts once past the last entry the driver has seen.
+ */
+struct Queue : Meta::Pinned {
+    static constexpr usize DEPTH     = 128; // Slots, at most
+    static constexpr usize TABLE_LEN = 64;  // Descriptors of one request
+    static constexpr usize SEGS      = TABLE_LEN - 2;
+    static constexpr usize TABLE_SIZE
+        = TABLE_LEN * sizeof(Virtio::Split::_Desc);
+
+    struct Slot {
+        Atomic<bool>    done { true };
+        Io::BlkRequest* req = nullptr; // Completed from the interrupt
+    };
+
+    Device& _dev;
+    u16     _index;
+    bool    _packed = false;
+    usize   _size   = 0; // Entries in the ring, and slots
+    usize   _ring   = 0; // Bytes of the ring, the tables follow
+    uflat   _virt   = 0;
+    uflat   _phys   = 0;
+
+    // Split rings.
+    Virtio::Split::Desc* _desc  = nullptr;
+    u16 volatile*        _avail = nullptr; // Flags, index, ring, used event
+    u16 volatile*        _used  = nullptr; // Flags, index, ring, avail event
+
+    // Packed ring.
+    Virtio::Packed::Desc*  _descs       = nullptr;
+    Virtio::Packed::Event* _driverEvent = nullptr;
+    Virtio::Packed::Event* _deviceEvent = nullptr;
+
+    u16 volatile*      _notify   = nullptr;
+    Lock               _lock;            // Serializes the ring and completion
+    u16                _next     = 0;    // Split: avail index, packed: entry
+    bool               _wrap     = true; // Packed, of `_next`
+    u16                _lastUsed = 0;
+    bool               _usedWrap = true; // Packed, of `_lastUsed`
+    u16                _added    = 0;    // Entries since the last notification
+    Vec<u16>           _free;
+    Array<Slot, DEPTH> _slots;
+
+    Queue(Device& dev, u16 index) : _dev(dev), _index(index) { }
+
+    /**
+     * @brief Allocate the ring and the per-slot tables, program them into
+     * the device and route completions to MSI-X entry `vector`.
+     */
+    Res<> onInit(u16 vector);
+
+    /**
+     * @brief Collect finished requests. Called from the queue interrupt, or
+     * by waiters when it cannot be delivered.
+     */
+    void onInterrupt();
+
+    /**
+     * @brief Collect finished requests when the interrupt cannot be
+     * delivered: the device has no MSI-X, or the caller runs with interrupts
+     * off, as at boot.
+     */
+    void _poll();
+
+    /**
+     * @brief Notify the device of the entries added since the last call,
+     * if it wants to hear about them.
+     */
+    void kick();
+
+    Res<usize> _acquire();
+
+    void _release(usize slot);
+
+    /**
+     * @brief Fill the indirect table of `slot` for a request of `type` at
+     * `sector` over `segs`, merging physically adjacent pages.
+     *
+     * @return The number of descriptors used.
+     */
+    Res<usize> _prepare(usize slot, u32 type, u64 sector, Slice<Bytes> segs);
+
+    /**
+     * @brief Make the table of `slot`, `len` descriptors long, available to
+     * the device. It is not notified until kick().
+     */
+    void _publish(usize slot, usize len);
+
+    Res<> _wait(usize slot);
+
+    // Offsets in the queue memory, from `_virt` or `_phys`.
+
+    uflat _table(usize slot) const { return _ring + slot * TABLE_SIZE; }
+
+    uflat _header(usize slot) const {
+        return _ring + _size * TABLE_SIZE + slot * sizeof(ReqHeader);
+    }
+
+    uflat _status(usize slot) const {
+        return _ring + _size * (TABLE_SIZE + sizeof(ReqHeader)) + slot;
+    }
+
+    Virtio::Split::UsedElem& _usedElem(usize i) {
+        return ((Virtio::Split::UsedElem*) (_used + 2))[i];
+    }
+
+    u16 volatile& _usedEvent() { return _avail[2 + _size]; }
+
+    u16 volatile& _availEvent() { return _used[2 + 4 * _size]; }
+};
+
+/**
+ * @brief A virtio-blk disk on the PCI transport.
+ *
+ * The device gets as many virtqueues as it and the processors allow, each
+ * completing on the processor whose block layer queue feeds it. Packed
+ * rings are used when offered, split ones otherwise; either way requests
+ * need indirect descriptors.
+ */
+struct Device : public Io::StorDev {
+    Rc<Pci::Dev>       _pci;
+    Virtio::CommonCfg* _common     = nullptr;
+    Config*            _config     = nullptr;
+    uflat              _notifyBase = 0;
+    u32                _notifyMul  = 0;
+    u64                _features   = 0; // Negotiated
+    usize              _segs       = Queue::SEGS;
+    usize              _sizeMax    = 0; // Of a segment, 0 if unbounded
+    bool               _irq        = false;
+    Vec<Box<Queue>>    _queues;
+
+    Device(Rc<Pci::Dev> pci);
+
+    /**
+     * @brief Find the transport structures, negotiate features, set up the
+     * queues and their vectors, then start the device.
+     *
+     * @retval Error::notSupported if the device lacks version 1 or indirect
+     *         descriptors.
+     */
+    Res<> onInit();
+
+    bool has(u8 feature) const { return _features & (1ull << feature); }
+
+    Res<usize> read(Seek seek, Bytes& buf) override;
+
+    Res<usize> write(Seek seek, Bytes const& buf) override;
+
+    Res<> flush();
+
+    usize queues() override { return _queues.len(); }
+
+    usize maxBlocks() override;
+
+    /**
+     * @brief Make a block layer request available on `queue` and return, it
+     * completes from the queue interrupt. Requests too fragmented for one
+     * table go through the synchronous path instead.
+     */
+    Res<> submit(Io::BlkRequest& req, usize queue) override;
+
+    void commit(usize queue) override;
+
+    void poll() override;
+
+    /**
+     * @brief Read the capabilities into the BARs they point to.
+     */
+    Res<> _map();
+
+    Res<> _negotiate();
+
+    Res<> _setupQueues();
+
+    Queue& _queue() { return *_queues[Hal::cpuId() % _queues.len()]; }
+
+    Res<usize> _transfer(Seek seek, Bytes buf, bool write);
+};
+
+struct Driver : public Io::Drv {
+    static constexpr auto requisites = toArray({
+        "core.pmm"s,
+        "core.vmm"s,
+        "pci-bus-device"s,
+    });
+
+    Vec<Rc<Device>> _devices;
+
+    Driver() { name = "virtio-blk"s; }
+
+    Slice<Io::DrvKey> keys() override;
+
+    Res<bool> match(Rc<Io::Dev> dev) override;
+
+    Res<> onInit(Rc<Io::Dev> dev) override;
+
+    Res<> onRemove(Rc<Io::Dev> dev) override;
+
+    Res<> onSuspend(Rc<Io::Dev> dev) override;
+
+    Res<> onResume(Rc<Io::Dev> dev) override;
+};
+
+} // namespace VirtioBlk
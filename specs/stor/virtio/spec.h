@@ -0,0 +1,75 @@
+#pragma once
+
+#include <sdk-meta/types.h>
+#include <virtio/spec.h>
+
+namespace VirtioBlk {
+
+static constexpr u16   TRANSITIONAL_ID = 0x1001;
+static constexpr u16   MODERN_ID       = 0x1042;
+static constexpr usize SECTOR_SIZE     = 512; // Of `capacity` and `sector`
+
+// Bit numbers in the device specific part of the feature words.
+enum Feature : u8 {
+    SizeMax   = 1,
+    SegMax    = 2,
+    Geometry  = 4,
+    ReadOnly  = 5,
+    BlkSize   = 6,
+    Flush     = 9,
+    Topology  = 10,
+    ConfigWce = 11,
+    MultiQ    = 12,
+};
+
+enum Type : u32 {
+    TypeIn    = 0,
+    TypeOut   = 1,
+    TypeFlush = 4,
+    TypeGetId = 8,
+};
+
+enum ReqStatus : u8 {
+    StatusOk     = 0,
+    StatusIoErr  = 1,
+    StatusUnsupp = 2,
+};
+
+struct [[gnu::packed]] _Config {
+    u64 capacity; // In sectors of SECTOR_SIZE
+    u32 sizeMax;  // Bytes in one segment, with SizeMax
+    u32 segMax;   // Segments in one request, with SegMax
+
+    struct [[gnu::packed]] {
+        u16 cylinders;
+        u8  heads;
+        u8  sectors;
+    } geometry;
+
+    u32 blkSize;
+
+    struct [[gnu::packed]] {
+        u8  physicalBlockExp;
+        u8  alignmentOffset;
+        u16 minIoSize;
+        u32 optIoSize;
+    } topology;
+
+    u8  writeback;
+    u8  __reserved__0;
+    u16 numQueues; // With MultiQ
+};
+using Config = _Config volatile;
+static_assert(sizeof(_Config) == 36);
+
+/**
+ * @brief Leads every request, followed by the data and a status byte.
+ */
+struct [[gnu::packed]] ReqHeader {
+    u32 type;
+    u32 ioprio;
+    u64 sector;
+};
+static_assert(sizeof(ReqHeader) == 16);
+
+} // namespace VirtioBlk
@@ -0,0 +1,756 @@
+#include <pci/spec.h>
+#include <realms/core/api.io.h>
+#include <realms/hal/arch.h>
+#include <realms/hal/clock.h>
+#include <realms/mm/mem.h>
+#include <sdk-logs/logger.h>
+#include <sdk-text/format.h>
+#include <stor/virtio/device.h>
+
+namespace VirtioBlk {
+
+using namespace Realms;
+using namespace Sdk;
+
+namespace {
+
+static constexpr TimeSpan RESET_TIMEOUT = TimeSpan::ofMilliseconds(500);
+static constexpr TimeSpan CMD_TIMEOUT   = TimeSpan::ofSeconds(10);
+
+constexpr u64 _bit(u8 feature) { return 1ull << feature; }
+
+// Features the driver makes use of, the rest are left off.
+static constexpr u64 WANTED
+    = _bit(Virtio::Version1) | _bit(Virtio::IndirectDesc)
+    | _bit(Virtio::EventIdx) | _bit(Virtio::RingPacked) | _bit(SizeMax)
+    | _bit(SegMax) | _bit(ReadOnly) | _bit(BlkSize) | _bit(Flush)
+    | _bit(MultiQ);
+
+bool _until(auto&& cond, TimeSpan timeout) {
+    Instant end = Hal::clock() + timeout;
+    while (not cond()) {
+        if (Hal::clock() > end)
+            return cond();
+        _Embed::relaxe();
+    }
+    return true;
+}
+
+void _onInterrupt(Hal::IntrVector const&, void* ctx) {
+    static_cast<Queue*>(ctx)->onInterrupt();
+}
+
+void _onSharedInterrupt(Hal::IntrVector const&, void* ctx) {
+    for (auto& queue : static_cast<Device*>(ctx)->_queues)
+        queue->onInterrupt();
+}
+
+} // namespace
+
+// MARK: - Queue ---------------------------------------------------------------
+
+Res<> Queue::onInit(u16 vector) {
+    auto& common       = *_dev._common;
+    common.queueSelect = _index;
+
+    _size = min((usize) common.queueSize, DEPTH);
+    if (_size == 0) {
+        return Error::notSupported("VirtioBlk::Queue::onInit: queue missing");
+    }
+    common.queueSize = _size;
+    _packed          = _dev.has(Virtio::RingPacked);
+
+    // The ring and its event areas first, then a table, a header and a
+    // status byte for each slot.
+    usize driver, device;
+    if (_packed) {
+        driver = _size * sizeof(Virtio::Packed::_Desc);
+        device = driver + sizeof(Virtio::Packed::_Event);
+        _ring  = alignUp(device + sizeof(Virtio::Packed::_Event), 16);
+    } else {
+        driver = _size * sizeof(Virtio::Split::_Desc);
+        device = alignUp(driver + Virtio::Split::availSize(_size), 4);
+        _ring  = alignUp(device + Virtio::Split::usedSize(_size), 16);
+    }
+
+    usize size  = _status(_size);
+    auto  range = try$(
+        Sys::pmm().alloc(Sys::pageAlignUp(size), Sys::PmmFlags::Dma));
+    _virt = try$(Sys::mmapVirtIo(range.start()));
+    _phys = range.start();
+    memset((void*) _virt, 0, size);
+
+    if (_packed) {
+        _descs       = (Virtio::Packed::Desc*) _virt;
+        _driverEvent = (Virtio::Packed::Event*) (_virt + driver);
+        _deviceEvent = (Virtio::Packed::Event*) (_virt + device);
+
+        // Both wrap counters start set.
+        _driverEvent->offWrap = 1 << 15;
+        _driverEvent->flags   = _dev.has(Virtio::EventIdx)
+                                  ? Virtio::Packed::Desc
+                                  : Virtio::Packed::Enable;
+    } else {
+        _desc  = (Virtio::Split::Desc*) _virt;
+        _avail = (u16 volatile*) (_virt + driver);
+        _used  = (u16 volatile*) (_virt + device);
+    }
+
+    common.queueDescLo   = (u32) _phys;
+    common.queueDescHi   = (u32) (_phys >> 32);
+    common.queueDriverLo = (u32) (_phys + driver);
+    common.queueDriverHi = (u32) ((_phys + driver) >> 32);
+    common.queueDeviceLo = (u32) (_phys + device);
+    common.queueDeviceHi = (u32) ((_phys + device) >> 32);
+
+    common.queueMsixVector = vector;
+    if (common.queueMsixVector != vector) {
+        return Error::notSupported(
+            "VirtioBlk::Queue::onInit: interrupt vector refused");
+    }
+
+    _notify = (u16 volatile*) (_dev._notifyBase
+                               + common.queueNotifyOff * _dev._notifyMul);
+
+    _free.ensure(_size);
+    for (usize i = _size; i > 0; i--)
+        _free.pushBack(i - 1);
+
+    common.queueEnable = 1;
+    return Ok();
+}
+
+Res<usize> Queue::_acquire() {
+    while (true) {
+        _Embed::enterCritical();
+        _lock.acquire();
+
+        bool  ready = _free.len() > 0;
+        usize slot  = ready ? _free.popBack() : 0;
+
+        _lock.release();
+        _Embed::leaveCritical();
+
+        if (ready) {
+            _slots[slot].done.store(false, Relaxed);
+            _slots[slot].req = nullptr;
+            return Ok(slot);
+        }
+
+        // The entries filling the ring may still wait for the end of their
+        // batch, the device has to hear about them to free any slot.
+        kick();
+        _poll();
+        _Embed::relaxe();
+    }
+}
+
+void Queue::_release(usize slot) {
+    _Embed::enterCritical();
+    _lock.acquire();
+    _free.pushBack(slot);
+    _lock.release();
+    _Embed::leaveCritical();
+}
+
+Res<usize> Queue::_prepare(usize        slot,
+                           u32          type,
+                           u64          sector,
+                           Slice<Bytes> segs) {
+    auto& header  = *(ReqHeader*) (_virt + _header(slot));
+    header.type   = type;
+    header.ioprio = 0;
+    header.sector = sector;
+    *(u8 volatile*) (_virt + _status(slot)) = 0xff;
+
+    // Packed tables hold packed descriptors, which are never chained, split
+    // ones are chained in order. Both are 16 bytes with the address and the
+    // length first.
+    auto* split  = (Virtio::Split::Desc*) (_virt + _table(slot));
+    auto* packed = (Virtio::Packed::Desc*) (_virt + _table(slot));
+
+    usize len = 0;
+    auto  add = [&](uflat addr, u32 bytes, u16 flags) {
+        if (_packed) {
+            packed[len].addr  = addr;
+            packed[len].len   = bytes;
+            packed[len].id    = 0;
+            packed[len].flags = flags;
+        } else {
+            split[len].addr  = addr;
+            split[len].len   = bytes;
+            split[len].flags = flags;
+            split[len].next  = len + 1;
+            if (len) {
+                auto& prev = split[len - 1];
+                prev.flags = prev.flags | Virtio::Split::Next;
+            }
+        }
+        len++;
+    };
+
+    add(_phys + _header(slot), sizeof(ReqHeader), 0);
+
+    // Describe the buffers page by page, merging physically adjacent pages.
+    u16   flags   = type == TypeIn ? Virtio::Split::Write : 0;
+    usize maxSegs = min(_dev._segs, SEGS);
+    usize maxLen  = _dev._sizeMax ? _dev._sizeMax : (usize) ~0u;
+    for (auto& buf : segs) {
+        uflat addr = (uflat) buf.buf();
+        usize left = buf.len();
+        while (left) {
+            usize chunk = min(left, Sys::PAGE_SIZE - addr % Sys::PAGE_SIZE);
+            chunk       = min(chunk, maxLen);
+            uflat phys  = try$(Sys::mmapPhys(addr));
+
+            auto& last = split[len - 1];
+            if (len > 1 and last.addr + last.len == phys
+                and last.len + chunk <= maxLen) {
+                last.len = last.len + chunk;
+            } else {
+                if (len - 1 == maxSegs) {
+                    return Error::limitReached(
+                        "VirtioBlk::Queue::_prepare: buffer too fragmented");
+                }
+                add(phys, chunk, flags);
+            }
+
+            addr += chunk;
+            left -= chunk;
+        }
+    }
+
+    add(_phys + _status(slot), 1, Virtio::Split::Write);
+    return Ok(len);
+}
+
+void Queue::_publish(usize slot, usize len) {
+    uflat table = _phys + _table(slot);
+    u32   bytes = len * sizeof(Virtio::Split::_Desc);
+
+    _Embed::enterCritical();
+    _lock.acquire();
+
+    if (_packed) {
+        // The flags go last, they hand the entry over to the device.
+        auto& desc = _descs[_next];
+        desc.addr  = table;
+        desc.len   = bytes;
+        desc.id    = slot;
+        threadfence();
+        desc.flags = Virtio::Packed::Indirect
+                   | (_wrap ? Virtio::Packed::Avail : Virtio::Packed::Used);
+
+        if (++_next == _size) {
+            _next = 0;
+            _wrap = not _wrap;
+        }
+    } else {
+        // Descriptor `slot` always points to the table of `slot`.
+        _desc[slot].addr  = table;
+        _desc[slot].len   = bytes;
+        _desc[slot].flags = Virtio::Split::Indirect;
+        _desc[slot].next  = 0;
+
+        _avail[2 + _next % _size] = slot;
+        threadfence();
+        _avail[1] = ++_next;
+    }
+    _added++;
+
+    _lock.release();
+    _Embed::leaveCritical();
+}
+
+void Queue::kick() {
+    _Embed::enterCritical();
+    _lock.acquire();
+
+    bool need = false;
+    if (_added) {
+        // The new entries must be visible before the device's wishes are
+        // read, or both sides could wait on each other.
+        threadfence();
+
+        u16  next     = _next;
+        u16  old      = next - _added;
+        bool eventIdx = _dev.has(Virtio::EventIdx);
+        if (_packed) {
+            u16 offWrap = _deviceEvent->offWrap;
+            u16 flags   = _deviceEvent->flags;
+            if (flags != Virtio::Packed::Desc) {
+                need = flags != Virtio::Packed::Disable;
+            } else {
+                // An event on the previous lap is one ring length behind.
+                u16 event = offWrap & 0x7fff;
+                if ((bool) (offWrap >> 15) != _wrap)
+                    event -= _size;
+                need = Virtio::needEvent(event, next, old);
+            }
+        } else if (eventIdx) {
+            need = Virtio::needEvent(_availEvent(), next, old);
+        } else {
+            need = not(_used[0] & Virtio::Split::NoNotify);
+        }
+        _added = 0;
+    }
+
+    if (need)
+        *_notify = _index;
+
+    _lock.release();
+    _Embed::leaveCritical();
+}
+
+void Queue::onInterrupt() {
+    u16   async[DEPTH];
+    usize count    = 0;
+    bool  eventIdx = _dev.has(Virtio::EventIdx);
+
+    // A packed entry is used once both its bits match the wrap counter.
+    auto pending = [&] {
+        if (not _packed)
+            return _lastUsed != _used[1];
+
+        u16  flags = _descs[_lastUsed].flags;
+        bool avail = flags & Virtio::Packed::Avail;
+        bool used  = flags & Virtio::Packed::Used;
+        return avail == _usedWrap and used == _usedWrap;
+    };
+
+    _Embed::enterCritical();
+    _lock.acquire();
+
+    // With event indices the device only interrupts again once past the
+    // entry asked for, so look once more after asking.
+    while (true) {
+        while (pending()) {
+            threadfence();
+
+            u16 slot;
+            if (_packed) {
+                slot = _descs[_lastUsed].id;
+                if (++_lastUsed == _size) {
+                    _lastUsed = 0;
+                    _usedWrap = not _usedWrap;
+                }
+            } else {
+                slot = _usedElem(_lastUsed % _size).id;
+                _lastUsed++;
+            }
+
+            if (_slots[slot].req)
+                async[count++] = slot;
+            else
+                _slots[slot].done.store(true, Release);
+        }
+
+        if (not eventIdx)
+            break;
+
+        if (_packed)
+            _driverEvent->offWrap = _lastUsed | (u16) _usedWrap << 15;
+        else
+            _usedEvent() = _lastUsed;
+        threadfence();
+
+        if (not pending())
+            break;
+    }
+
+    _lock.release();
+    _Embed::leaveCritical();
+
+    // Block layer requests are completed once the lock is dropped, their
+    // callbacks are free to submit more work.
+    for (usize i = 0; i < count; i++) {
+        usize slot   = async[i];
+        auto* req    = _slots[slot].req;
+        u8    status = *(u8 volatile*) (_virt + _status(slot));
+
+        _slots[slot].req = nullptr;
+        _release(slot);
+
+        if (status != StatusOk)
+            req->end(Error::invalidData("VirtioBlk::Queue: request failed"));
+        else
+            req->end(Ok());
+    }
+}
+
+void Queue::_poll() {
+    if (not _dev._irq or not Hal::intrEnabled())
+        onInterrupt();
+}
+
+Res<> Queue::_wait(usize slot) {
+    bool done = _until(
+        [&] {
+            _poll();
+            return _slots[slot].done.load(Acquire);
+        },
+        CMD_TIMEOUT);
+
+    // A request that never completes keeps its slot, its table may still be
+    // read by the device.
+    if (not done) {
+        return Error::timedOut("VirtioBlk::Queue: request timed out");
+    }
+
+    u8 status = *(u8 volatile*) (_virt + _status(slot));
+    _release(slot);
+    if (status == StatusUnsupp) {
+        return Error::notSupported("VirtioBlk::Queue: request unsupported");
+    }
+    if (status != StatusOk) {
+        return Error::invalidData("VirtioBlk::Queue: request failed");
+    }
+    return Ok();
+}
+
+// MARK: - Device --------------------------------------------------------------
+
+Device::Device(Rc<Pci::Dev> pci)
+    : StorDev(Text::format("virtio-blk-device-{}-{}", pci->bus, pci->slot),
+              Text::format("pci/virtio-blk-device-{}-{}", pci->bus, pci->slot),
+              Io::Dev::Type::StorageDrive),
+      _pci(pci) {
+}
+
+Res<> Device::_map() {
+    for (auto& cap : try$(_pci->capabilities())) {
+        if (cap.id != Pci::CapId::Vendor)
+            continue;
+
+        u8 type = try$(_pci->in8(cap.offset + Virtio::CapType));
+        u8 bar  = try$(_pci->in8(cap.offset + Virtio::CapBar));
+        if (bar > 5 or type == Virtio::PciCfg or type == Virtio::IsrCfg)
+            continue;
+
+        u32   offset = try$(_pci->in32(cap.offset + Virtio::CapOffset));
+        uflat base   = try$(_pci->bar(bar));
+        uflat virt   = try$(Sys::mmapVirtIo(base + offset));
+
+        // The first structure of each type is the preferred one.
+        if (type == Virtio::CommonCfg and not _common) {
+            _common = (Virtio::CommonCfg*) virt;
+        } else if (type == Virtio::NotifyCfg and not _notifyBase) {
+            _notifyBase = virt;
+            _notifyMul  = try$(
+                _pci->in32(cap.offset + Virtio::CapNotifyMultiplier));
+        } else if (type == Virtio::DeviceCfg and not _config) {
+            _config = (Config*) virt;
+        }
+    }
+
+    if (not _common or not _notifyBase or not _config) {
+        return Error::notSupported(
+            "VirtioBlk::Device::_map: not a modern virtio device");
+    }
+    return Ok();
+}
+
+Res<> Device::_negotiate() {
+    u64 offered = 0;
+    for (u32 i = 0; i < 2; i++) {
+        _common->deviceFeatureSelect = i;
+        offered |= (u64) _common->deviceFeature << (32 * i);
+    }
+
+    if (not(offered & _bit(Virtio::Version1))
+        or not(offered & _bit(Virtio::IndirectDesc))) {
+        return Error::notSupported(
+            "VirtioBlk::Device::_negotiate: needs version 1 and indirect "
+            "descriptors");
+    }
+
+    _features = offered & WANTED;
+    for (u32 i = 0; i < 2; i++) {
+        _common->driverFeatureSelect = i;
+        _common->driverFeature       = (u32) (_features >> (32 * i));
+    }
+
+    _common->deviceStatus = _common->deviceStatus | Virtio::FeaturesOk;
+    if (not(_common->deviceStatus & Virtio::FeaturesOk)) {
+        return Error::notSupported(
+            "VirtioBlk::Device::_negotiate: features refused");
+    }
+
+    // The configuration is read again if the device changed it meanwhile.
+    u8 generation;
+    do {
+        generation  = _common->configGeneration;
+        _blockSize  = has(BlkSize) ? _config->blkSize : SECTOR_SIZE;
+        _blockCount = _config->capacity * SECTOR_SIZE / _blockSize;
+        _sizeMax    = has(SizeMax) ? _config->sizeMax : 0;
+        _segs       = has(SegMax) ? max((usize) _config->segMax, 1uz)
+                                  : Queue::SEGS;
+    } while (generation != _common->configGeneration);
+    return Ok();
+}
+
+Res<> Device::_setupQueues() {
+    usize count = 1;
+    if (has(MultiQ))
+        count = min((usize) _config->numQueues, Hal::cpuCount());
+    count = max(min(count, (usize) _common->numQueues), 1uz);
+
+    // One vector per queue, each on the processor feeding that queue, or
+    // a single one shared by all of them.
+    usize vectors = count;
+    auto  msix    = _pci->enableMsiX(vectors);
+    if (not msix and count > 1) {
+        vectors = 1;
+        msix    = _pci->enableMsiX(vectors);
+    }
+    _irq = (bool) msix;
+    if (not _irq)
+        logWarn("VirtioBlk::Device: no msi-x, polling for completions");
+
+    _common->configMsixVector = Virtio::NO_VECTOR;
+    for (usize i = 0; i < count; i++) {
+        u16 vector = not _irq      ? Virtio::NO_VECTOR
+                   : vectors == 1 ? 0
+                                  : (u16) i;
+
+        auto queue = makeBox<Queue>(*this, i);
+        try$(queue->onInit(vector));
+        _queues.pushBack(::move(queue));
+    }
+
+    if (_irq and vectors == 1) {
+        try$(Hal::bindIntr(msix.unwrap()[0], _onSharedInterrupt, this));
+    } else if (_irq) {
+        for (usize i = 0; i < count; i++)
+            try$(Hal::bindIntr(msix.unwrap()[i], _onInterrupt, &*_queues[i]));
+    }
+    return Ok();
+}
+
+Res<> Device::onInit() {
+    try$(_pci->enableMemorySpace());
+    try$(_pci->enableBusMastering());
+    try$(_map());
+
+    _common->deviceStatus = 0;
+    if (not _until([&] { return _common->deviceStatus == 0; },
+                   RESET_TIMEOUT)) {
+        return Error::timedOut("VirtioBlk::Device::onInit: reset timed out");
+    }
+
+    _common->deviceStatus = Virtio::Acknowledge;
+    _common->deviceStatus = _common->deviceStatus | Virtio::Driver;
+
+    Res<> res = _negotiate();
+    if (res)
+        res = _setupQueues();
+    if (not res) {
+        _common->deviceStatus = _common->deviceStatus | Virtio::Failed;
+        return res;
+    }
+
+    _common->deviceStatus = _common->deviceStatus | Virtio::DriverOk;
+
+    logInfo("VirtioBlk::Device: {} blocks of {} bytes, {} {} queues{}{}",
+            _blockCount,
+            _blockSize,
+            _queues.len(),
+            has(Virtio::RingPacked) ? "packed" : "split",
+            has(Virtio::EventIdx) ? ", event index" : "",
+            has(ReadOnly) ? ", read-only" : "");
+    return Ok();
+}
+
+Res<usize> Device::_transfer(Seek seek, Bytes buf, bool write) {
+    if (seek.whence != Whence::BEGIN) {
+        return Error::invalidArgument(
+            "VirtioBlk::Device: only absolute seeks are supported");
+    }
+
+    if (write and has(ReadOnly)) {
+        return Error::readOnlyFilesystem("VirtioBlk::Device: read-only disk");
+    }
+
+    usize offset = seek.offset;
+    if (offset % _blockSize or buf.len() % _blockSize) {
+        return Error::invalidArgument("VirtioBlk::Device: unaligned transfer");
+    }
+
+    u64 lba = offset / _blockSize;
+    if (lba + buf.len() / _blockSize > _blockCount) {
+        return Error::outOfBounds("VirtioBlk::Device: transfer past the end");
+    }
+
+    // Slots belong to their queue, so stay on the first one picked.
+    auto& queue  = _queue();
+    usize chunk  = maxBlocks() * _blockSize;
+    u64   ratio  = _blockSize / SECTOR_SIZE;
+    u32   type   = write ? TypeOut : TypeIn;
+    usize pos    = 0;
+    Res<> result = Ok();
+
+    // Keep as many chunks in flight as the queue allows, notifying the
+    // device once per round and retiring them in submission order.
+    Vec<usize> inflight;
+    while ((result and pos < buf.len()) or inflight.len()) {
+        if (result and pos < buf.len() and inflight.len() < queue._size) {
+            usize len  = min(buf.len() - pos, chunk);
+            usize slot = try$(queue._acquire());
+
+            auto prepared = queue._prepare(slot,
+                                           type,
+                                           (lba + pos / _blockSize) * ratio,
+                                           slice(buf, pos, pos + len));
+            if (not prepared) {
+                queue._release(slot);
+                result = prepared.none();
+                continue;
+            }
+
+            queue._publish(slot, prepared.unwrap());
+            inflight.pushBack(slot);
+            pos += len;
+            continue;
+        }
+
+        queue.kick();
+        if (auto done = queue._wait(inflight.popFront()); not done)
+            result = done;
+    }
+
+    try$(result);
+    return Ok(buf.len());
+}
+
+Res<usize> Device::read(Seek seek, Bytes& buf) {
+    return _transfer(seek, buf, false);
+}
+
+Res<usize> Device::write(Seek seek, Bytes const& buf) {
+    return _transfer(seek, buf, true);
+}
+
+usize Device::maxBlocks() {
+    // Worst case every page, or every `_sizeMax` bytes, is its own segment.
+    usize segment = _sizeMax ? min(_sizeMax, Sys::PAGE_SIZE) : Sys::PAGE_SIZE;
+    usize segs    = min(_segs, Queue::SEGS);
+    return max(alignDown((segs - 1) * segment, _blockSize) / _blockSize, 1uz);
+}
+
+Res<> Device::submit(Io::BlkRequest& req, usize queue) {
+    bool write = req.op == Io::BlkRequest::Op::Write;
+    bool flush = req.op == Io::BlkRequest::Op::Flush;
+
+    // Without a flush command the device has no volatile cache to write out.
+    if (flush and not has(Flush)) {
+        req.end(Ok());
+        return Ok();
+    }
+
+    if (write and has(ReadOnly)) {
+        return Error::readOnlyFilesystem("VirtioBlk::Device: read-only disk");
+    }
+
+    // Nothing would ever reap the request without an interrupt.
+    if (not _irq and flush) {
+        req.end(Device::flush());
+        return Ok();
+    }
+    if (not _irq)
+        return StorDev::submit(req, queue);
+
+    u32 type;
+    if (flush)
+        type = TypeFlush;
+    else
+        type = write ? TypeOut : TypeIn;
+
+    auto& q      = *_queues[queue];
+    u64   sector = flush ? 0 : req.lba * (_blockSize / SECTOR_SIZE);
+    usize slot   = try$(q._acquire());
+
+    auto len = q._prepare(slot, type, sector, slice(req.segs));
+    if (not len) {
+        q._release(slot);
+        return StorDev::submit(req, queue);
+    }
+
+    q._slots[slot].req = &req;
+    q._publish(slot, len.unwrap());
+    return Ok();
+}
+
+void Device::commit(usize queue) {
+    _queues[queue]->kick();
+}
+
+void Device::poll() {
+    for (auto& queue : _queues)
+        queue->_poll();
+}
+
+Res<> Device::flush() {
+    if (not has(Flush))
+        return Ok();
+
+    auto& queue = _queue();
+    usize slot  = try$(queue._acquire());
+    auto  len   = queue._prepare(slot, TypeFlush, 0, {});
+    if (not len) {
+        queue._release(slot);
+        return len.none();
+    }
+
+    queue._publish(slot, len.unwrap());
+    queue.kick();
+    return queue._wait(slot);
+}
+
+// MARK: - Driver --------------------------------------------------------------
+
+static constexpr Io::DrvKey KEYS[] = {
+    Pci::deviceKey(Virtio::VENDOR_ID, TRANSITIONAL_ID),
+    Pci::deviceKey(Virtio::VENDOR_ID, MODERN_ID),
+};
+
+Slice<Io::DrvKey> Driver::keys() {
+    return { KEYS, sizeof(KEYS) / sizeof(*KEYS) };
+}
+
+Res<bool> Driver::match(Rc<Io::Dev> dev) {
+    auto pci = dev.cast<Pci::Dev>();
+    if (not pci)
+        return Ok(false);
+
+    u16 device = try$((*pci)->deviceId());
+    return Ok(try$((*pci)->vendorId()) == Virtio::VENDOR_ID
+              and (device == TRANSITIONAL_ID or device == MODERN_ID));
+}
+
+Res<> Driver::onInit(Rc<Io::Dev> dev) {
+    auto pci = dev.cast<Pci::Dev>();
+    if (not pci) {
+        return Error::invalidArgument("VirtioBlk::Driver: not a pci device");
+    }
+
+    auto disk = makeRc<Device>(pci.take());
+    try$(disk->onInit());
+    _devices.pushBack(disk);
+    if (auto tree = devtree())
+        tree->mount(disk);
+    return Ok();
+}
+
+Res<> Driver::onRemove(Rc<Io::Dev>) {
+    return Error::notImplemented();
+}
+
+Res<> Driver::onSuspend(Rc<Io::Dev>) {
+    return Error::notImplemented();
+}
+
+Res<> Driver::onResume(Rc<Io::Dev>) {
+    return Error::notImplemented();
+}
+
+} // namespace VirtioBlk
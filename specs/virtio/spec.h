@@ -0,0 +1,163 @@
+#pragma once
+
+#include <sdk-meta/array.h>
+#include <sdk-meta/types.h>
+
+// Virtio 1.x over PCI: the transport capabilities and both virtqueue
+// layouts. Everything is little-endian.
+namespace Virtio {
+
+static constexpr u16 VENDOR_ID = 0x1af4;
+static constexpr u16 NO_VECTOR = 0xffff;
+
+enum Status : u8 {
+    Acknowledge = 0x01,
+    Driver      = 0x02,
+    DriverOk    = 0x04,
+    FeaturesOk  = 0x08,
+    NeedsReset  = 0x40,
+    Failed      = 0x80,
+};
+
+// Bit numbers in the 64-bit feature words, 24 to 40 are not device specific.
+enum Feature : u8 {
+    IndirectDesc = 28,
+    EventIdx     = 29,
+    Version1     = 32,
+    RingPacked   = 34,
+};
+
+enum CfgType : u8 {
+    CommonCfg = 1,
+    NotifyCfg = 2,
+    IsrCfg    = 3,
+    DeviceCfg = 4,
+    PciCfg    = 5,
+};
+
+// Offsets in a vendor capability of PCI config space, which points into a
+// BAR. Only the notify capability has a multiplier.
+enum PciCapRegs : u8 {
+    CapType             = 0x03,
+    CapBar              = 0x04,
+    CapOffset           = 0x08,
+    CapLength           = 0x0C,
+    CapNotifyMultiplier = 0x10,
+};
+
+struct [[gnu::packed]] _CommonCfg {
+    u32 deviceFeatureSelect;
+    u32 deviceFeature;
+    u32 driverFeatureSelect;
+    u32 driverFeature;
+    u16 configMsixVector;
+    u16 numQueues;
+    u8  deviceStatus;
+    u8  configGeneration;
+
+    // Of the queue selected by `queueSelect`.
+    u16 queueSelect;
+    u16 queueSize;
+    u16 queueMsixVector;
+    u16 queueEnable;
+    u16 queueNotifyOff;
+    u32 queueDescLo;
+    u32 queueDescHi;
+    u32 queueDriverLo;
+    u32 queueDriverHi;
+    u32 queueDeviceLo;
+    u32 queueDeviceHi;
+};
+using CommonCfg = _CommonCfg volatile;
+
+/**
+ * @brief Whether the other side asked to be told once `event` is passed,
+ * the index moving from `old` to `next`.
+ */
+inline bool needEvent(u16 event, u16 next, u16 old) {
+    return (u16) (next - event - 1) < (u16) (next - old);
+}
+
+// MARK: - Split Virtqueues ----------------------------------------------------
+
+namespace Split {
+
+enum DescFlags : u16 {
+    Next     = 0x1,
+    Write    = 0x2, // Written by the device
+    Indirect = 0x4, // Points to a table of descriptors
+};
+
+enum AvailFlags : u16 {
+    NoInterrupt = 0x1,
+};
+
+enum UsedFlags : u16 {
+    NoNotify = 0x1,
+};
+
+struct [[gnu::packed]] _Desc {
+    u64 addr;
+    u32 len;
+    u16 flags;
+    u16 next;
+};
+using Desc = _Desc volatile;
+static_assert(sizeof(_Desc) == 16);
+
+struct [[gnu::packed]] _UsedElem {
+    u32 id;
+    u32 len;
+};
+using UsedElem = _UsedElem volatile;
+
+// The rings are sized by the queue: the available ring is `flags`, `idx`,
+// `size` entries then `usedEvent`; the used ring is `flags`, `idx`, `size`
+// elements then `availEvent`.
+
+static constexpr usize availSize(usize size) { return 6 + 2 * size; }
+
+static constexpr usize usedSize(usize size) { return 6 + 8 * size; }
+
+} // namespace Split
+
+// MARK: - Packed Virtqueues ---------------------------------------------------
+
+namespace Packed {
+
+enum DescFlags : u16 {
+    Next     = 0x1,
+    Write    = 0x2,
+    Indirect = 0x4,
+    Avail    = 1 << 7,
+    Used     = 1 << 15,
+};
+
+enum EventFlags : u16 {
+    Enable  = 0x0,
+    Disable = 0x1,
+    Desc    = 0x2, // At the descriptor in `offWrap`
+};
+
+struct [[gnu::packed]] _Desc {
+    u64 addr;
+    u32 len;
+    u16 id;
+    u16 flags;
+};
+using Desc = _Desc volatile;
+static_assert(sizeof(_Desc) == 16);
+
+/**
+ * @brief Where the driver or the device wants to hear from the other, the
+ * ring wrap counter in the top bit of `offWrap`.
+ */
+struct [[gnu::packed]] _Event {
+    u16 offWrap;
+    u16 flags;
+};
+using Event = _Event volatile;
+
+} // namespace Packed
+
+} // namespace Virtio
@@ -2,10 +2,14 @@
 
 #include <acpi/tables.h>
 #include <arch/x86_64/regs.h>
+#include <arch/x86_64/tsc.h>
 #include <realms/core/mod.h>
 #include <realms/core/registry.h>
+#include <realms/hal/clock.h>
+#include <realms/hal/intr.h>
 #include <realms/hal/io.h>
 #include <realms/io/dev.h>
+#include <sdk-meta/atomic.h>
 #include <sdk-meta/opt.h>
 #include <sdk-meta/ptr.h>
 
@@ -29,9 +33,15 @@ using IcrLow              = Hal::Reg<u32, 0x300>;
 using IcrHigh             = Hal::Reg<u32, 0x310>;
 using TimerInitial        = Hal::Reg<u32, 0x380>;
 using TimerCurrent        = Hal::Reg<u32, 0x390>;
+using TimerDivide         = Hal::Reg<u32, 0x3E0>;
+using LvtTimer            = Hal::Reg<u32, 0x320>;
 
 using Base = Hal::Reg<u64, 0xF0>;
 
+// Delivered when an interrupt is withdrawn before it is taken, it is never
+// in service and must not be acknowledged.
+static constexpr u8 SPURIOUS_VECTOR = 0xff;
+
 enum struct Lvt {
     Timer       = 0x320,
     Thermal     = 0x330,
@@ -79,6 +89,8 @@ struct Local : public Hal::Io {
 
     Res<> send(Dest dest, Message message, u8 vec);
 
+    Res<> eoi() { return write<InterruptReset>(0); }
+
     u8 id() const { return _apicId; }
 };
 
@@ -92,15 +104,85 @@ Res<> out64(usize offset, u64 value);
 
 Slice<Local> units();
 
-struct TimerDevice : public Core::Io::Dev {
-    Local& _local;
-    u32    _busSpeed, _irqSrc;
+Opt<usize> indexOf(u8 apicId);
+
+/**
+ * @brief Record a unit for every usable processor listed in `madt`, and
+ * enable the one of the caller.
+ *
+ * @retval Error::notFound if the table lists no processor.
+ */
+Res<> setupUnits(Acpi::Madt& madt);
+
+/**
+ * @brief Message address that routes an MSI to the local apic `apicId` in
+ * physical destination mode.
+ */
+[[gnu::always_inline]] inline u64 msiAddress(u8 apicId) {
+    return 0xfee0'0000ull | ((u64) apicId << 12);
+}
+
+/**
+ * @brief Message data for an edge-triggered, fixed-delivery MSI.
+ */
+[[gnu::always_inline]] inline u32 msiData(u8 vec) {
+    return (u32) Message::Fixed | vec;
+}
+
+enum TimerMode : u32 {
+    OneShot     = (0b00 << 17),
+    Periodic    = (0b01 << 17),
+    TscDeadline = (0b10 << 17),
+    Masked      = (1 << 16),
+};
 
-    TimerDevice(Local& local)
+/**
+ * @brief The local apic timer of one processor, driven as a one-shot
+ * event source.
+ *
+ * When the processor supports it the timer runs in TSC-deadline mode and the
+ * deadline is written straight to the MSR, otherwise the initial count is
+ * derived from the calibrated bus speed.
+ */
+struct TimerDevice : public Core::Io::Dev, public Hal::ClockEvent {
+    Local&          _local;
+    Tsc&            _tsc;
+    Atomic<u32>     _busSpeed; // Ticks per second, divider of 16
+    u32             _irqSrc;
+    Hal::IntrVector _vector;
+    bool            _deadline;
+    bool            _ready;
+
+    TimerDevice(Local& local, Tsc& tsc)
         : Dev("x86_64-apic-timer-device"s, "acpi/x86_64-apic-timer-device"s),
           _local(local),
-          _busSpeed(0),
-          _irqSrc(0) { }
+          _tsc(tsc),
+          _busSpeed(0u),
+          _irqSrc(0),
+          _vector({}),
+          _deadline(false),
+          _ready(false) { }
+
+    /**
+     * @brief Measure the timer frequency against `ref`, with a divider of 16.
+     */
+    Res<> calibrate(Hal::ClockSource& ref);
+
+    /**
+     * @brief Program the LVT on the processor owning this timer. Must run on
+     * that processor.
+     */
+    Res<> setup(Hal::IntrVector vector, bool deadline);
+
+    /**
+     * @brief Raise the timer interrupt on the owning processor, from any
+     * processor.
+     */
+    Res<> kick() { return _local.send(_vector.vec); }
+
+    Res<> arm(Instant deadline) override;
+
+    Res<> disarm() override;
 };
 
 } // namespace Realms::Hal::x86_64::Apic
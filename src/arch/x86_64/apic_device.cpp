@@ -8,4 +8,47 @@ Slice<Local> units() {
     return _units;
 }
 
+Opt<usize> indexOf(u8 apicId) {
+    for (usize i = 0; i < _units.len(); i++) {
+        if (_units[i].id() == apicId)
+            return i;
+    }
+    return NONE;
+}
+
+Res<> setupUnits(Acpi::Madt& madt) {
+    uflat at  = (uflat) madt._items;
+    uflat end = (uflat) &madt + madt.length;
+    while (at + sizeof(Acpi::Madt::Item) <= end) {
+        auto* item = (Acpi::Madt::Item*) at;
+        if (item->length < sizeof(Acpi::Madt::Item))
+            break;
+        at += item->length;
+
+        // Processors that are neither enabled nor online capable are never
+        // going to run.
+        auto* entry = (Acpi::Madt::LocalApic*) item;
+        if (item->type != 0 or not(entry->flags & 0b11))
+            continue;
+
+        Local unit;
+        unit._processorId = entry->processorId;
+        unit._apicId      = entry->apicId;
+        unit._base        = madt.address;
+        unit._vbase       = 0;
+        _units.pushBack(unit);
+    }
+
+    if (_units.len() == 0) {
+        return Error::notFound("Apic::setupUnits: no processor in the madt");
+    }
+
+    // Every processor sees its own unit at the same address, so one mapping
+    // serves all of them.
+    try$(_units[0].init());
+    for (auto& unit : _units)
+        unit._vbase = _units[0]._vbase;
+    return Ok();
+}
+
 } // namespace Realms::Hal::x86_64::Apic
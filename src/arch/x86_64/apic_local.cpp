@@ -13,7 +13,7 @@ Res<> Local::init() {
     base |= (1ul << 11);
     try$(msr.write<Base>(base));
 
-    try$(write<Spurious>(try$(read<Spurious>()) | 0x1ff));
+    try$(write<Spurious>(try$(read<Spurious>()) | 0x100 | SPURIOUS_VECTOR));
     return Ok();
 }
 
@@ -1,3 +1,171 @@
+#include <acpi/bus.h>
+#include <acpi/timer.h>
 #include <arch/x86_64/apic.h>
+#include <arch/x86_64/cpuid.h>
+#include <arch/x86_64/tsc.h>
+#include <realms/core/api.io.h>
+#include <realms/hal/arch.h>
+#include <realms/tasks/timer.h>
+#include <sdk-logs/logger.h>
+#include <sdk-meta/box.h>
+#include <sdk-meta/vec.h>
 
-namespace Realms::Hal::x86_64::Apic { }
+namespace Realms::Hal::x86_64::Apic {
+
+namespace {
+
+static constexpr u32 DIVIDE_BY_16 = 0b0011;
+
+} // namespace
+
+Res<> TimerDevice::calibrate(Hal::ClockSource& ref) {
+    try$(_local.write<TimerDivide>(DIVIDE_BY_16));
+    try$(_local.write<LvtTimer>(TimerMode::Masked));
+    try$(_local.write<TimerInitial>(0xffff'ffff));
+
+    ref.delay(TimeSpan::ofMilliseconds(10));
+
+    u32 elapsed = 0xffff'ffff - try$(_local.read<TimerCurrent>());
+    try$(_local.write<TimerInitial>(0));
+
+    _busSpeed.store(elapsed * 100, Relaxed);
+    return Ok();
+}
+
+Res<> TimerDevice::setup(Hal::IntrVector vector, bool deadline) {
+    _vector   = vector;
+    _deadline = deadline;
+
+    try$(_local.write<TimerDivide>(DIVIDE_BY_16));
+    try$(_local.write<LvtTimer>(
+        vector.vec | (deadline ? TimerMode::TscDeadline : TimerMode::OneShot)));
+
+    _ready = true;
+    return Ok();
+}
+
+Res<> TimerDevice::arm(Instant deadline) {
+    if (not _ready) {
+        return Error::notReady("Apic::TimerDevice::arm: timer not set up");
+    }
+
+    if (_deadline) {
+        // Writing a deadline in the past fires immediately, which is what
+        // an expired timer wants anyway.
+        wrmsr(Msr::TscDeadline, _tsc.tscOf(deadline));
+        return Ok();
+    }
+
+    Instant now   = _tsc.now();
+    u64     delta = deadline > now ? (deadline - now).getAsMicroseconds() : 0;
+    u64     count = (u128) delta * _busSpeed.load(Relaxed) / 1'000'000;
+
+    // A count of zero stops the timer, and a deadline that does not fit
+    // simply fires early and gets re-armed by the timer queue.
+    return _local.write<TimerInitial>((u32) clamp(count, 1ull, 0xffff'ffffull));
+}
+
+Res<> TimerDevice::disarm() {
+    if (_deadline) {
+        wrmsr(Msr::TscDeadline, 0);
+        return Ok();
+    }
+    return _local.write<TimerInitial>(0);
+}
+
+} // namespace Realms::Hal::x86_64::Apic
+
+namespace Realms::Hal {
+
+namespace {
+
+x86_64::Tsc                         _tsc;
+Vec<Box<x86_64::Apic::TimerDevice>> _timers;
+bool                                _deadline = false;
+
+void _onTimer(IntrVector const&, void*) {
+    Sys::onClockEvent();
+}
+
+} // namespace
+
+Instant clock() {
+    return _tsc.calibrated() ? _tsc.now() : Instant::epoch();
+}
+
+Res<ClockEvent*> clockEvent() {
+    usize id    = cpuId();
+    auto& timer = *_timers[id];
+
+    if (not timer._ready)
+        try$(timer.setup(timer._vector, _deadline));
+    return Ok(static_cast<ClockEvent*>(&timer));
+}
+
+Res<> clockKick(usize cpu) {
+    if (cpu >= _timers.len()) {
+        return Error::invalidArgument("clockKick: no such cpu");
+    }
+    return _timers[cpu]->kick();
+}
+
+} // namespace Realms::Hal
+
+namespace Realms::Sys {
+
+Res<> setupTimers() {
+    auto acpi = devtree()->find<Acpi::BusDevice>("acpi-bus-device"s);
+    if (not acpi) {
+        return Error::notFound("setupTimers: no acpi bus");
+    }
+
+    // Prefer the HPET as calibration reference, it is both faster and
+    // wider than the PM timer.
+    static Acpi::HpetDevice  hpet;
+    static Acpi::TimerDevice pmTimer;
+
+    Hal::ClockSource* ref = nullptr;
+    if (hpet.onInit(*acpi)) {
+        ref = &hpet;
+    } else if (pmTimer.onInit(*acpi)) {
+        ref = &pmTimer;
+    } else {
+        return Error::notFound("setupTimers: no reference clock");
+    }
+
+    if (not Hal::x86_64::Tsc::invariant()) {
+        logWarn("setupTimers: tsc is not invariant, drift is expected");
+    }
+
+    try$(Hal::_tsc.calibrate(*ref, TimeSpan::ofMilliseconds(50)));
+    Hal::_deadline = Hal::x86_64::capabilities().tscval;
+
+    // Vectors are taken up front, so a processor can raise the timer
+    // interrupt of another one that never armed its timer yet.
+    auto units = Hal::x86_64::Apic::units();
+    for (usize i = 0; i < units.len(); i++) {
+        auto timer
+            = makeBox<Hal::x86_64::Apic::TimerDevice>(units[i], Hal::_tsc);
+        timer->_vector = try$(Hal::allocIntr(i));
+        try$(Hal::bindIntr(timer->_vector, Hal::_onTimer, nullptr));
+        Hal::_timers.pushBack(::move(timer));
+    }
+    setupTimerQueues(units.len());
+
+    // The apic timer ticks at the same rate on every processor, so only the
+    // boot processor measures it.
+    if (not Hal::_deadline) {
+        try$(Hal::_timers[Hal::cpuId()]->calibrate(*ref));
+        u32 busSpeed = Hal::_timers[Hal::cpuId()]->_busSpeed.load(Relaxed);
+        for (auto& timer : Hal::_timers)
+            timer->_busSpeed.store(busSpeed, Relaxed);
+    }
+
+    logInfo("setupTimers: tsc {} kHz calibrated against {}, {} mode",
+            Hal::_tsc.frequency() / 1000,
+            ref->name(),
+            Hal::_deadline ? "tsc-deadline" : "one-shot");
+    return Ok();
+}
+
+} // namespace Realms::Sys
@@ -7,12 +7,21 @@
 #include <arch/x86_64/idt.h>
 #include <arch/x86_64/regs.h>
 #include <pci/bus.h>
+#include <realms/hal/arch.h>
+#include <realms/hal/intr.h>
+#include <realms/hal/clock.h>
 #include <realms/io/devtree.h>
+#include <realms/io/drivers.h>
+#include <realms/io/mmap.h>
 #include <realms/mm/mem.h>
+#include <realms/tasks/rcu.h>
 #include <sdk-logs/logger.h>
 #include <sdk-meta/iter.h>
 #include <sdk-meta/manual.h>
 #include <sdk-meta/res.h>
+#include <stor/ahci/controller.h>
+#include <stor/ide/controller.h>
+#include <stor/virtio/device.h>
 
 extern "C" {
     unsigned const smp_trampoline_entry = 0x2000;
@@ -23,12 +32,71 @@ extern "C" {
 
 namespace Realms::Hal {
 
+bool _cpuLocalReady = false;
+
 extern "C" void _intDispatch(int num, x86_64::Regs* regs) {
+    if (num == x86_64::Apic::SPURIOUS_VECTOR) {
+        return;
+    }
+
+    if (num >= 0x20) {
+        usize cpu = cpuId();
+        if (not dispatchIntr(cpu, (u8) num)) {
+            logWarn("Interrupt: unhandled vector {} on cpu {}\n", num, cpu);
+        }
+        (void) x86_64::Apic::units()[cpu].eoi();
+        return;
+    }
+
+    if (num == 0x0e) {
+        uflat addr;
+        asm volatile("mov %%cr2, %0" : "=r"(addr));
+
+        // File mappings may have to read the page in, which takes interrupts,
+        // and take the cache and map locks. A fault with interrupts off or
+        // under one of those locks would wait forever, it fails instead.
+        if ((regs->rflags & (1 << 9)) and not Sys::Io::cacheLocked()) {
+            asm volatile("sti");
+            bool handled = Sys::Io::mmapFault(addr, regs->err & (1 << 1));
+            asm volatile("cli");
+            if (handled) {
+                return;
+            }
+        }
+    }
+
     logInfo("Interrupt: {}, regs: {:#x}\n", num, (uflat) regs);
     __asm__ __volatile__("cli; hlt");
     __builtin_unreachable();
 }
 
+usize cpuId() {
+    if (not _cpuLocalReady) [[unlikely]]
+        return 0;
+
+    // GS points to the CpuLocal of the processor, whose first field points
+    // back to it.
+    x86_64::CpuLocal* local;
+    asm volatile("mov %%gs:0, %0" : "=r"(local));
+    return local->id;
+}
+
+usize cpuCount() {
+    return max(x86_64::Apic::units().len(), 1uz);
+}
+
+void idle() {
+    // Interrupts go back to how the caller had them, the flags are saved
+    // before and restored after.
+    asm volatile("pushfq; sti; hlt; popfq" ::: "memory");
+}
+
+bool intrEnabled() {
+    u64 flags;
+    asm volatile("pushfq; pop %0" : "=r"(flags));
+    return flags & (1 << 9);
+}
+
 x86_64::Idt              _idt;
 Manual<x86_64::CpuLocal> _cpuLocal;
 
@@ -49,20 +117,21 @@ Res<> init() {
     }
 
     _cpuLocal(0, _idt);
-    _cpuLocal->gdtPtr.load();
-    _cpuLocal->idtPtr.load();
-
+    x86_64::loadCpuLocal(_cpuLocal.unwrap());
     return Ok();
 }
 
+void x86_64::loadCpuLocal(CpuLocal& local) {
+    local.gdtPtr.load();
+    local.idtPtr.load();
+    x86_64::wrmsr(x86_64::Msr::GsBase, (u64) &local);
+    _cpuLocalReady = true;
+}
+
 } // namespace Realms::Hal
 
 namespace Realms::Sys {
 
-[[noreturn]] void mpinitEntry(u16 id) {
-    Hal::x86_64::halt();
-}
-
 Hal::x86_64::Gdt::Pack* s_gdtPtr = (Hal::x86_64::Gdt::Pack*) 0x1010;
 
 extern "C" Hal::x86_64::Gdt::Pack GdtPack64;
@@ -74,6 +143,23 @@ u64 volatile* s_stack        = (u64*) 0x1028;
 u64 volatile* s_entrypoint   = (u64*) 0x1030;
 bool volatile s_doneInit     = false;
 
+[[noreturn]] void mpinitEntry(u16 id) {
+    using Hal::x86_64::CpuLocal;
+
+    auto  range = Core::pmm()
+                     .alloc(pageAlignUp(sizeof(CpuLocal)))
+                     .unwrap("mpinitEntry: failed to allocate cpu local");
+    void* virt  = (void*) mmapVirtIo(range.start()).unwrap();
+    usize index = Hal::x86_64::Apic::indexOf(id).unwrapOr(0);
+    Hal::x86_64::loadCpuLocal(*new (virt) CpuLocal(index, Hal::_idt));
+    s_doneInit = true;
+
+    // Nothing is scheduled here yet, the processor halts with no reference
+    // a grace period would have to wait for.
+    rcuOffline();
+    Hal::x86_64::halt();
+}
+
 Res<usize> setupMultitasking() {
     memcpy((void*) smp_trampoline_entry,
            &smp_trampoline_start,
@@ -110,7 +196,10 @@ Res<usize> setupMultitasking() {
             try$(it.send(Hal::x86_64::Apic::Dest::Self,
                          Hal::x86_64::Apic::Message::Startup,
                          (smp_trampoline_entry >> 12)));
-            // sleep 100ms
+
+            Instant deadline = Hal::clock() + TimeSpan::ofMilliseconds(100);
+            while (*s_magic != 0xb33f and Hal::clock() < deadline)
+                asm volatile("pause");
         }
 
         while (not s_doneInit)
@@ -136,4 +225,48 @@ Opt<Io::Devtree&> devtree() {
     return s_devtree;
 }
 
+Res<> setupArch() {
+    // ACPI comes up first, it lists the processors and the timers calibrate
+    // against its clocks.
+    auto acpi = createDevtree().find<Acpi::BusDevice>("acpi-bus-device"s);
+    if (not acpi) {
+        return Error::notFound("setupArch: no acpi bus");
+    }
+    try$(acpi->onInit());
+
+    auto madt = acpi->lookupTable("APIC");
+    if (not madt) {
+        return Error::notFound("setupArch: no madt");
+    }
+    try$(Hal::x86_64::Apic::setupUnits(*madt->as<Acpi::Madt>()));
+
+    // The boot processor need not be the first one listed.
+    auto units  = Hal::x86_64::Apic::units();
+    u8   apicId = try$(units[0].read<Hal::x86_64::Apic::ApicId>()) >> 24;
+
+    Hal::_cpuLocal->id = Hal::x86_64::Apic::indexOf(apicId).unwrapOr(0);
+    return Ok();
+}
+
+Res<usize> setupDevices() {
+    static Io::Drivers       drivers;
+    static Ahci::Driver      ahci;
+    static Ide::Driver       ide;
+    static VirtioBlk::Driver virtioBlk;
+
+    auto pci = createDevtree().find<Pci::BusDevice>("pci-bus-device"s);
+    if (not pci) {
+        return Error::notFound("setupDevices: no pci bus");
+    }
+    try$(pci->onInit());
+
+    // AHCI claims a controller before the legacy IDE driver is asked.
+    drivers.add(ahci);
+    drivers.add(ide);
+    drivers.add(virtioBlk);
+
+    Io::Bus* bus = &*pci;
+    return drivers.start({ &bus, 1 }, createDevtree());
+}
+
 } // namespace Realms::Sys
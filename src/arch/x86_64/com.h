@@ -12,17 +12,31 @@
 
 #pragma once
 
+#include <realms/hal/intr.h>
 #include <realms/hal/io.h>
 #include <sdk-io/text.h>
 #include <sdk-io/traits.h>
+#include <sdk-meta/_embed.h>
+#include <sdk-meta/array.h>
+#include <sdk-meta/lock.h>
 
 namespace Realms::Hal::x86_64 {
 
 using Sdk::Io::TextEncoderBase;
 
 struct Com : public TextEncoderBase<> {
+    static constexpr usize FIFO_SIZE = 16;
+    static constexpr usize TX_SIZE   = 4096;
+
     PortIo _io;
 
+    // Transmit ring, `_head` and `_tail` only ever grow.
+    Lock               _lock;
+    Array<u8, TX_SIZE> _tx {};
+    usize              _head = 0;
+    usize              _tail = 0;
+    bool               _irq  = false;
+
     enum Regs {
         DATA                    = 0,
         INTERRUPT               = 1,
@@ -152,14 +166,92 @@ struct Com : public TextEncoderBase<> {
         return Ok(1uz);
     }
 
+    /**
+     * @brief Move up to a FIFO's worth of queued bytes to the chip if the
+     * transmitter holding register is empty. Called with `_lock` held.
+     *
+     * @return true if the FIFO was refilled.
+     */
+    Res<bool> _burst() {
+        if (_head == _tail or not try$(canWrite()))
+            return Ok(false);
+
+        // THRE means the whole FIFO is empty, so it takes 16 bytes at once,
+        // as long as they do not wrap around the ring.
+        usize at  = _tail % TX_SIZE;
+        usize len = min(_head - _tail, FIFO_SIZE, TX_SIZE - at);
+        try$(_io.outs(DATA, 1, { _tx.buf() + at, len }));
+        _tail += len;
+        return Ok(true);
+    }
+
+    /**
+     * @brief Wait for the ring to drain, one FIFO at a time.
+     */
+    Res<> _drain() {
+        while (_head != _tail)
+            try$(_burst());
+        return Ok();
+    }
+
+    /**
+     * @brief Deliver transmit interrupts to `vector` and let them refill the
+     * FIFO, writes then return as soon as their bytes are queued. IRQ 4 or
+     * 3 must already be routed to `vector`.
+     */
+    Res<> bindIntr(IntrVector const& vector) {
+        try$(Hal::bindIntr(
+            vector,
+            [](IntrVector const&, void* ctx) {
+                (void) static_cast<Com*>(ctx)->onInterrupt();
+            },
+            this));
+
+        // Input stays polled: a pending receive interrupt outranks THRE and
+        // would hide it until someone reads the data register.
+        LockScoped lk(_lock);
+        _irq = true;
+        try$(writeReg(INTERRUPT, WHEN_TRANSMITTER_EMPTY));
+        return Ok();
+    }
+
+    Res<> onInterrupt() {
+        // Bits 1-3 of the identification read 0b001 for THRE, reading it
+        // also acknowledges the interrupt.
+        u8 id = try$(readReg(INTERRUPT_IDENTIFICATOR));
+        if ((id & 0x0f) != 0x02)
+            return Ok();
+
+        LockScoped lk(_lock);
+        try$(_burst());
+        return Ok();
+    }
+
     Res<> write(byte b) override {
-        try$(putByte(b));
+        try$(write(Bytes { &b, 1 }));
         return Ok();
     }
 
     Res<usize> write(Bytes bytes) override {
-        for (auto b : bytes) {
-            try$(putByte(b));
+        usize done = 0;
+        while (done < bytes.len()) {
+            _Embed::enterCritical();
+            _lock.acquire();
+
+            while (done < bytes.len() and _head - _tail < TX_SIZE)
+                _tx[_head++ % TX_SIZE] = bytes[done++];
+
+            // Polling drains everything before returning, with interrupts
+            // only an idle transmitter needs a kick, or a full ring a wait.
+            Res<> res = Ok();
+            if (not _irq or done < bytes.len())
+                res = _drain();
+            else if (auto burst = _burst(); not burst)
+                res = burst.none();
+
+            _lock.release();
+            _Embed::leaveCritical();
+            try$(res);
         }
 
         return Ok(bytes.len());
@@ -29,6 +29,12 @@ struct [[gnu::aligned(0x10)]] CpuLocal : Meta::Pinned {
           idtPtr(idt) { }
 };
 
+/**
+ * @brief Load the tables of `local` on the calling processor and point GS
+ * to it, which is where cpuId() reads the processor index from.
+ */
+void loadCpuLocal(CpuLocal& local);
+
 [[noreturn, maybe_unused]] static inline void halt() {
     while (true) {
         __asm__ __volatile__("cli; hlt;");
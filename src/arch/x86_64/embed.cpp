@@ -0,0 +1,46 @@
+#include <realms/hal/arch.h>
+#include <sdk-meta/_embed.h>
+#include <sdk-meta/array.h>
+
+namespace _Embed {
+
+namespace {
+
+static constexpr usize MAX_CPUS  = 256;
+static constexpr u64   RFLAGS_IF = (1 << 9);
+
+Array<u32, MAX_CPUS>  _depth {};
+Array<bool, MAX_CPUS> _enabled {};
+
+} // namespace
+
+void relaxe() {
+    asm volatile("pause");
+}
+
+unsigned cpuIndex() {
+    return Realms::Hal::cpuId();
+}
+
+void enterCritical() {
+    u64 flags;
+    asm volatile(
+        "pushfq\n\t"
+        "pop %0\n\t"
+        "cli"
+        : "=r"(flags)
+        :
+        : "memory");
+
+    usize id = Realms::Hal::cpuId();
+    if (_depth[id]++ == 0)
+        _enabled[id] = flags & RFLAGS_IF;
+}
+
+void leaveCritical() {
+    usize id = Realms::Hal::cpuId();
+    if (--_depth[id] == 0 and _enabled[id])
+        asm volatile("sti" ::: "memory");
+}
+
+} // namespace _Embed
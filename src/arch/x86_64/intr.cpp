@@ -0,0 +1,159 @@
+#include <arch/x86_64/apic.h>
+#include <arch/x86_64/idt.h>
+#include <realms/hal/arch.h>
+#include <realms/hal/intr.h>
+#include <sdk-logs/logger.h>
+#include <sdk-meta/array.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/vec.h>
+
+namespace Realms::Hal {
+
+namespace {
+
+// Vectors below 0x40 are exceptions and legacy irqs, 0xf0 and above are
+// reserved for ipis and the spurious vector.
+static constexpr usize VEC_START = 0x40;
+static constexpr usize VEC_END   = 0xf0;
+
+struct _Slot {
+    IntrHandler handler;
+    void*       ctx;
+};
+
+struct _Table {
+    Array<u64, x86_64::Idt::LEN / 64> used;
+    Array<_Slot, x86_64::Idt::LEN>    slots;
+};
+
+Lock        _lock;
+Vec<_Table> _tables;
+
+bool _isUsed(_Table& table, usize vec) {
+    return table.used[vec / 64] & (1ull << (vec % 64));
+}
+
+void _setUsed(_Table& table, usize vec, bool used) {
+    if (used)
+        table.used[vec / 64] |= (1ull << (vec % 64));
+    else
+        table.used[vec / 64] &= ~(1ull << (vec % 64));
+}
+
+// The processor count is fixed once the application processors are up, so
+// the table is only ever grown once and never moves under `dispatchIntr`.
+_Table& _tableOf(usize cpu) {
+    if (_tables.len() < cpuCount())
+        _tables.resize(cpuCount());
+    return _tables[cpu];
+}
+
+IntrVector _vectorOf(usize cpu, usize vec) {
+    u8 apicId = x86_64::Apic::units()[cpu].id();
+    return {
+        .cpu     = cpu,
+        .vec     = (u8) vec,
+        .msiAddr = x86_64::Apic::msiAddress(apicId),
+        .msiData = x86_64::Apic::msiData((u8) vec),
+    };
+}
+
+} // namespace
+
+Res<IntrVector> allocIntr(usize cpu, usize count) {
+    if (cpu >= cpuCount()) {
+        return Error::invalidArgument("allocIntr: no such cpu");
+    }
+
+    if (count == 0 or (count & (count - 1)) != 0) {
+        return Error::invalidArgument("allocIntr: count must be a power of 2");
+    }
+
+    LockScoped lk(_lock);
+    auto&      table = _tableOf(cpu);
+
+    for (usize base = VEC_START; base + count <= VEC_END; base += count) {
+        bool free = true;
+        for (usize i = 0; i < count and free; i++)
+            free = not _isUsed(table, base + i);
+
+        if (not free)
+            continue;
+
+        for (usize i = 0; i < count; i++) {
+            _setUsed(table, base + i, true);
+            table.slots[base + i] = {};
+        }
+        return Ok(_vectorOf(cpu, base));
+    }
+
+    return Error::limitReached("allocIntr: no free vector");
+}
+
+Res<> allocIntrs(Slice<IntrVector> out, usize firstCpu) {
+    usize cpus = cpuCount();
+    for (usize i = 0; i < out.len(); i++) {
+        auto res = allocIntr((firstCpu + i) % cpus);
+        if (not res) {
+            for (usize j = 0; j < i; j++)
+                (void) freeIntr(out[j]);
+            return res.none();
+        }
+        out[i] = res.take();
+    }
+    return Ok();
+}
+
+Res<> freeIntr(IntrVector const& vector, usize count) {
+    LockScoped lk(_lock);
+
+    if (vector.cpu >= _tables.len()) {
+        return Error::invalidArgument("freeIntr: no such cpu");
+    }
+
+    auto& table = _tables[vector.cpu];
+    for (usize i = 0; i < count; i++) {
+        _setUsed(table, vector.vec + i, false);
+        table.slots[vector.vec + i] = {};
+    }
+    return Ok();
+}
+
+Res<> bindIntr(IntrVector const& vector, IntrHandler handler, void* ctx) {
+    LockScoped lk(_lock);
+
+    if (vector.cpu >= _tables.len()
+        or not _isUsed(_tables[vector.cpu], vector.vec)) {
+        return Error::invalidState("bindIntr: vector is not allocated");
+    }
+
+    _tables[vector.cpu].slots[vector.vec] = { handler, ctx };
+    return Ok();
+}
+
+Res<> unbindIntr(IntrVector const& vector) {
+    LockScoped lk(_lock);
+
+    if (vector.cpu >= _tables.len()) {
+        return Error::invalidArgument("unbindIntr: no such cpu");
+    }
+
+    _tables[vector.cpu].slots[vector.vec] = {};
+    return Ok();
+}
+
+bool dispatchIntr(usize cpu, u8 vec) {
+    // Handlers are only installed once the vector has been allocated, and
+    // slots never move, so reading without the lock is safe here.
+    if (cpu >= _tables.len())
+        return false;
+
+    auto slot = _tables[cpu].slots[vec];
+    if (slot.handler == nullptr)
+        return false;
+
+    slot.handler(_vectorOf(cpu, vec), slot.ctx);
+    return true;
+}
+
+} // namespace Realms::Hal
@@ -48,4 +48,64 @@ Res<> out64(usize port, u64 val) {
     return Ok();
 }
 
+Res<> ins8(usize port, Slice<u8> buf) {
+    u8*   ptr   = buf.buf();
+    usize count = buf.len();
+    asm volatile("rep insb"
+                 : "+D"(ptr), "+c"(count)
+                 : "d"((u16) port)
+                 : "memory");
+    return Ok();
+}
+
+Res<> outs8(usize port, Slice<u8> buf) {
+    u8 const* ptr   = buf.buf();
+    usize     count = buf.len();
+    asm volatile("rep outsb"
+                 : "+S"(ptr), "+c"(count)
+                 : "d"((u16) port)
+                 : "memory");
+    return Ok();
+}
+
+Res<> ins16(usize port, Slice<u16> buf) {
+    u16*  ptr   = buf.buf();
+    usize count = buf.len();
+    asm volatile("rep insw"
+                 : "+D"(ptr), "+c"(count)
+                 : "d"((u16) port)
+                 : "memory");
+    return Ok();
+}
+
+Res<> outs16(usize port, Slice<u16> buf) {
+    u16 const* ptr   = buf.buf();
+    usize      count = buf.len();
+    asm volatile("rep outsw"
+                 : "+S"(ptr), "+c"(count)
+                 : "d"((u16) port)
+                 : "memory");
+    return Ok();
+}
+
+Res<> ins32(usize port, Slice<u32> buf) {
+    u32*  ptr   = buf.buf();
+    usize count = buf.len();
+    asm volatile("rep insl"
+                 : "+D"(ptr), "+c"(count)
+                 : "d"((u16) port)
+                 : "memory");
+    return Ok();
+}
+
+Res<> outs32(usize port, Slice<u32> buf) {
+    u32 const* ptr   = buf.buf();
+    usize      count = buf.len();
+    asm volatile("rep outsl"
+                 : "+S"(ptr), "+c"(count)
+                 : "d"((u16) port)
+                 : "memory");
+    return Ok();
+}
+
 } // namespace Realms::Hal::Pmio
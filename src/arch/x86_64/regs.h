@@ -42,6 +42,7 @@ struct _Msr : public Hal::Io {
 
 enum class Msr : u32 {
     Apic         = (0x1b),
+    TscDeadline  = (0x6e0),
     Efer         = (0xc000'0080),
     Star         = (0xc000'0081),
     Lstar        = (0xc000'0082),
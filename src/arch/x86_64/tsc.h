@@ -0,0 +1,89 @@
+#pragma once
+
+#include <arch/x86_64/cpuid.h>
+#include <realms/hal/clock.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/types.h>
+
+namespace Realms::Hal::x86_64 {
+
+[[gnu::always_inline]] static inline u64 rdtsc() {
+    u32 lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64) hi << 32) | lo;
+}
+
+/**
+ * @brief The time stamp counter, calibrated against a slower reference.
+ *
+ * Conversions to and from microseconds use a 32.32 fixed point multiplier
+ * so reading the clock never divides. The calibration is read on every clock
+ * access and only written when calibrating, so it sits behind a seqlock.
+ */
+struct Tsc : public Hal::ClockSource {
+    struct Calibration {
+        u64 frequency = 0;
+        u64 base      = 0;
+        u64 toUs      = 0; // (1'000'000 << 32) / frequency
+        u64 fromUs    = 0; // (frequency << 32) / 1'000'000
+    };
+
+    IrqSeqLock<Calibration> _cal;
+
+    Str name() const override { return "tsc"s; }
+
+    u64 ticks() override { return rdtsc(); }
+
+    u64 frequency() const override { return _cal.read().frequency; }
+
+    bool calibrated() const { return frequency() != 0; }
+
+    /**
+     * @brief Whether the counter keeps a constant rate across P-, C- and
+     * T-states, which is required to use it as the monotonic clock.
+     */
+    static bool invariant() {
+        if (cpuid(0x8000'0000).eax < 0x8000'0007)
+            return false;
+        return cpuid(0x8000'0007).edx & (1 << 8);
+    }
+
+    /**
+     * @brief Measure the frequency over `span` of the reference clock.
+     */
+    Res<> calibrate(Hal::ClockSource& ref, TimeSpan span) {
+        u64 refStart = ref.ticks();
+        u64 start    = rdtsc();
+        ref.delay(span);
+        u64 end    = rdtsc();
+        u64 refEnd = ref.ticks();
+
+        u64 refTicks = (refEnd - refStart) & ref.mask();
+        if (refTicks == 0) {
+            return Error::invalidState("Tsc::calibrate: reference is stuck");
+        }
+
+        u64 frequency = (u128) (end - start) * ref.frequency() / refTicks;
+        _cal.write({
+            .frequency = frequency,
+            .base      = start,
+            .toUs      = ((u128) 1'000'000 << 32) / frequency,
+            .fromUs    = ((u128) frequency << 32) / 1'000'000,
+        });
+        return Ok();
+    }
+
+    [[gnu::always_inline]] Instant instant(u64 tsc) const {
+        Calibration cal = _cal.read();
+        return (u64) (((u128) (tsc - cal.base) * cal.toUs) >> 32);
+    }
+
+    [[gnu::always_inline]] Instant now() const { return instant(rdtsc()); }
+
+    [[gnu::always_inline]] u64 tscOf(Instant instant) const {
+        Calibration cal = _cal.read();
+        return cal.base + (u64) (((u128) instant.val() * cal.fromUs) >> 32);
+    }
+};
+
+} // namespace Realms::Hal::x86_64
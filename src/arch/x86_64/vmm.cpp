@@ -2,15 +2,17 @@
 #include <arch/x86_64/vmm.h>
 #include <realms/mm/mem.h>
 #include <sdk-meta/literals.h>
+#include <sdk-meta/lock.h>
 #include <sdk-meta/opt.h>
 
 namespace Realms::Hal::x86_64 {
 
 Opt<x86_64::Vmm> _vmm = NONE;
+Lock             _bitsLock; // Guards the heap bits of the kernel vmm
 
 Pml<4> _kpml4;
 Pml<3> _kPhysPdpt;
-Pml<2> _kImagePde;
+Pml<2> _kImagePde, _kImagePdeLo;
 Pml<3> _kpdpt, _kpdptLo;
 Pml<2> _kHeapDir[4];
 
@@ -36,12 +38,16 @@ Res<> Pml<L>::mapRange(VmmRange             virt,
     pre$(virt.aligned(granularity()) and phys.aligned(granularity()));
     pre$(virt.size() == phys.size());
 
+    // Only the entries the range covers, clipped to this table. The image
+    // directory covers 512 MiB, the rest of its gigabyte is left for
+    // Vmm::map() to fill with small pages.
     IndexRange range
         = indexRange(indexOf(virt.start()), (virt.size() / granularity()));
-    range.end(0x200);
+    range.end(min(range.end(), Len));
 
     for (usize i = range.start(); i < range.end(); i++) {
-        entries[i].with(flags).with(phys.start() + i * granularity());
+        entries[i].with(flags).with(
+            phys.start() + (i - range.start()) * granularity());
     }
     logInfo("Pml<{}>::map: mapped index {}-{} ({:#d}) -> {:#x}\n",
             Level,
@@ -59,6 +65,7 @@ Res<VmmRange> Vmm::alloc(Opt<VmmRange>   vrange,
     pre$(not vrange or vrange->aligned(Hal::PAGE_SIZE));
     pre$(amount > 0);
 
+    LockScoped lk(_bitsLock);
     if (not _bits.len()) {
         // the bits buffer is not initialized
         logWarn("Vmm::alloc: bits buffer is not initialized\n");
@@ -85,39 +92,110 @@ Res<VmmRange> Vmm::alloc(Opt<VmmRange>   vrange,
 }
 
 Res<> Vmm::free(VmmRange range) {
-    // if (not range.aligned(Hal::PAGE_SIZE)) {
-    //     logError("Vmm::free: given range {:#x} is not aligned to {:#x}",
-    //              range._start,
-    //              Hal::PAGE_SIZE);
-    //     return Error::invalidArgument("Vmm::free: range is not page aligned");
-    // }
+    if (not range.aligned(Hal::PAGE_SIZE) or not range.size()) {
+        return Error::invalidArgument("Vmm::free: empty or unaligned range");
+    }
+    if (not Hal::HEAP_REGION.contains(range)) {
+        return Error::invalidArgument("Vmm::free: range is not in the heap");
+    }
 
-    // auto bitsRange = range.downscale(Hal::PAGE_SIZE);
+    BitsRange bits = {
+        (range.start() - Hal::HEAP_REGION.start()) / Hal::PAGE_SIZE,
+        range.size() / Hal::PAGE_SIZE,
+    };
 
-    // if (not _bits.free(bitsRange)) {
-    //     logError("Vmm::free: failed to free range {:#x}", range._start);
-    //     return Error::invalidArgument("Vmm::free: failed to free range");
-    // }
+    LockScoped lk(_bitsLock);
+    if (bits.end() > _bits.len()) {
+        return Error::invalidArgument("Vmm::free: range was never allocated");
+    }
+    for (usize i = bits.start(); i < bits.end(); i++) {
+        if (not _bits.get(i)) {
+            return Error::invalidArgument("Vmm::free: range is not allocated");
+        }
+    }
+    _bits.setRange(bits, false);
+
+    return Ok();
+}
 
-    // return Ok();
+namespace {
 
-    return Error::notImplemented("Vmm::free: not implemented");
+void _invlpg(uflat virt) {
+    asm volatile("invlpg (%0)" ::"r"(virt) : "memory");
+}
+
+} // namespace
+
+template <usize L>
+Res<Pml<L - 1>*> Vmm::pmlAt(Pml<L>& up, usize vaddr, bool alloc) {
+    auto& e = up.at(vaddr);
+
+    if (not e.present()) {
+        if (not alloc) {
+            return Error::notFound("Vmm::pmlAt: no entry found");
+        }
+        auto  range = Core::pmm().alloc(Hal::PAGE_SIZE, Hal::PmmFlags::Kernel);
+        uflat lo    = try$(range).start();
+        memset((void*) (lo + Hal::DIRECT_IO_REGION.start()), 0,
+               Hal::PAGE_SIZE);
+        e.with({ Hal::VmmFlags::PRESENT | Hal::VmmFlags::WRITE }).with(lo);
+    }
+
+    if (e.data & Entry::PAGE_SIZE) {
+        return Error::invalidState("Vmm::pmlAt: large page in the way");
+    }
+    return Ok((Pml<L - 1>*) (e.addr() + Hal::DIRECT_IO_REGION.start()));
+}
+
+Res<Entry*> Vmm::entryAt(usize vaddr, bool alloc) {
+    auto* pml3 = try$(pmlAt(*_pml4, vaddr, alloc));
+    auto* pml2 = try$(pmlAt(*pml3, vaddr, alloc));
+    auto* pml1 = try$(pmlAt(*pml2, vaddr, alloc));
+    return Ok(&pml1->at(vaddr));
 }
 
 Res<> Vmm::map(VmmRange virt, PmmRange phys, Flags<VmmFlags> flags) {
     pre$(virt.aligned(Hal::PAGE_SIZE) and phys.aligned(Hal::PAGE_SIZE));
     pre$((virt.size() == phys.size()) and (phys.size() % Hal::PAGE_SIZE == 0));
-    pre$(Hal::HEAP_REGION.contains(virt));
-
-    return Error::notImplemented("Vmm::map: not implemented");
+    // The kernel region reaches the top of the address space, its end()
+    // wraps to zero.
+    pre$(virt.start() >= Hal::KERNEL_REGION.start()
+         and virt.size() <= Hal::KERNEL_REGION.start()
+                                + Hal::KERNEL_REGION.size() - virt.start());
+
+    // Pages already mapped are replaced, which is how protections change.
+    for (usize off = 0; off < virt.size(); off += Hal::PAGE_SIZE) {
+        auto* e   = try$(entryAt(virt.start() + off, true));
+        bool  was = e->present();
+        e->data   = 0;
+        e->with(flags | Hal::VmmFlags::PRESENT).with(phys.start() + off);
+        if (was) {
+            _invlpg(virt.start() + off);
+        }
+    }
+    return Ok();
 }
 
 Res<> Vmm::unmap(VmmRange range) {
-    return Error::notImplemented("Vmm::unmap: not implemented");
+    pre$(range.aligned(Hal::PAGE_SIZE));
+
+    for (usize off = 0; off < range.size(); off += Hal::PAGE_SIZE) {
+        auto e = entryAt(range.start() + off);
+        if (not e or not e.unwrap()->present()) {
+            continue;
+        }
+        e.unwrap()->data = 0;
+        _invlpg(range.start() + off);
+    }
+    return Ok();
 }
 
 Res<VmmPage> Vmm::at(usize address) {
-    return Error::notImplemented("Vmm::at: not implemented");
+    auto* e = try$(entryAt(Hal::pageAlignDown(address)));
+    if (not e->present()) {
+        return Error::notFound("Vmm::at: not mapped");
+    }
+    return Ok(VmmPage { e->flags(), e->addr() });
 }
 
 Res<> Vmm::load() {
@@ -145,10 +223,14 @@ Res<> createKernelVmm() {
     try$(_kpdpt.map(CORE_REGION.start(),
                     u64(&_kImagePde) - CORE_REGION.start()));
     try$(_kpdptLo.map(USER_REGION.start(),
-                      u64(&_kImagePde) - CORE_REGION.start()));
+                      u64(&_kImagePdeLo) - CORE_REGION.start()));
     try$(_kImagePde.mapRange({ 0xffff'ffff'8000'0000, 512_MiB },
                              { 0x0, 512_MiB }));
 
+    // Its own directory, so modules mapped past the image do not show up
+    // in the low half as well.
+    try$(_kImagePdeLo.mapRange({ 0x0, 512_MiB }, { 0x0, 512_MiB }));
+
     _vmm.emplace(&_kpml4);
 
     return Ok();
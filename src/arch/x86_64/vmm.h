@@ -42,6 +42,7 @@ struct [[gnu::packed]] Entry {
         if (data & PAGE_SIZE)     f |= Hal::VmmFlags::PAGE_SIZE;
         if (data & NO_EXECUTE)    f |= Hal::VmmFlags::NO_EXECUTE;
         if (data & NO_CACHE)      f |= Hal::VmmFlags::UNCACHED;
+        if (data & DIRTY)         f |= Hal::VmmFlags::DIRTY;
 
         return f;
     }
@@ -150,23 +151,18 @@ struct Vmm : Hal::Vmm {
 
     ~Vmm() override = default;
 
+    /**
+     * @brief The table `up` points to for `vaddr`, allocated zeroed when
+     * missing and `alloc` is set.
+     */
     template <usize L>
-    Res<Pml<L - 1>*> pmlAt(Pml<L>& up, usize vaddr, bool alloc = false) {
-        // auto& e = up.at(vaddr);
+    Res<Pml<L - 1>*> pmlAt(Pml<L>& up, usize vaddr, bool alloc = false);
 
-        // if (not e.present()) {
-        //     if (not alloc) {
-        //         return Error::notFound("Vmm::pmlAt: no entry found");
-        //     }
-        //     usize lo = try$(_pmm.alloc(Hal::PAGE_SIZE, {}))._start;
-        //     memset((void*) _mapper.map(lo), 0, Hal::PAGE_SIZE);
-        //     up.replace(vaddr, { lo, Entry::PRESENT | Entry::READWRITE });
-        // }
-
-        // return Ok((Pml<L - 1>*) _mapper.map(e.address()));
-
-        return Error::notImplemented("Vmm::pmlAt: not implemented");
-    }
+    /**
+     * @brief The last level entry of `vaddr`, building the tables down to it
+     * when `alloc` is set.
+     */
+    Res<Entry*> entryAt(usize vaddr, bool alloc = false);
 
     Res<VmmRange> alloc(Opt<VmmRange>   vrange,
                         usize           amount,
@@ -4,10 +4,22 @@
 
 namespace Realms::Sys {
 
+/**
+ * @brief Wall-clock time, advanced from the last value set with
+ * `dateTime(DateTime)` using the monotonic clock.
+ */
 DateTime dateTime();
 
+void dateTime(DateTime now);
+
+/**
+ * @brief Monotonic time since boot, in microseconds.
+ */
 u64 now();
 
+/**
+ * @brief Monotonic time since boot, in seconds.
+ */
 u64 uptimes();
 
 } // namespace Realms::Sys
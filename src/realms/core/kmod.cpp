@@ -0,0 +1,485 @@
+#include <elf/spec.h>
+#include <realms/core/kmod.h>
+#include <realms/mm/mem.h>
+#include <sdk-logs/logger.h>
+#include <sdk-meta/lock.h>
+
+extern "C" {
+    // Three words per kernel symbol, address, name and name length, laid
+    // out by the second link of the kernel.
+    extern uflat const __ksyms_start[];
+    extern uflat const __ksyms_end[];
+}
+
+namespace Realms::Sys {
+
+namespace {
+
+Lock          _lock;                          // Guards the two below
+uflat         _next = MODULES_REGION.start(); // Never handed out yet
+Vec<VmmRange> _free;                          // Handed out and returned
+
+// MARK: - Object --------------------------------------------------------------
+
+/**
+ * @brief An object file being linked, with what was learnt about it.
+ */
+struct _Object {
+    enum Group : u8 {
+        Text,
+        Rodata,
+        Data,
+        Unloaded,
+    };
+
+    Bytes             image;
+    Vec<Elf::Section> sections;
+    Vec<Elf::Sym>     syms;
+    Bytes             strtab;
+    Vec<usize>        offsets;   // In the image being built, by section
+    Vec<Group>        groups;    // By section
+    Array<usize, 3>   starts {}; // Of each group, page aligned
+    usize             size = 0;
+    Vec<uflat>        addrs;     // Of each symbol, once resolved
+    Vec<bool>         resolved;
+
+    Str str(u32 at) const {
+        if (at >= strtab.len())
+            return {};
+        usize end = at;
+        while (end < strtab.len() and strtab.buf()[end])
+            end++;
+        return { (char const*) strtab.buf() + at, end - at };
+    }
+
+    bool loaded(usize section) const {
+        return section < groups.len() and groups[section] != Unloaded;
+    }
+};
+
+Res<> _parse(Bytes image, u16 type, _Object& obj) {
+    Elf::Header hdr;
+    if (image.len() < sizeof(hdr))
+        return Error::invalidData("kmodLoad: truncated header");
+    memcpy(&hdr, image.buf(), sizeof(hdr));
+
+    if (hdr.magic != Elf::MAGIC or hdr.clazz != Elf::Header::Class64
+        or hdr.data != Elf::Header::LittleEndian
+        or hdr.type != type or hdr.machine != Elf::Header::X86_64)
+        return Error::invalidData("kmodLoad: not for x86_64 or wrong type");
+    if (hdr.shEntSize != sizeof(Elf::Section)
+        or hdr.shOff + hdr.shCount * sizeof(Elf::Section) > image.len())
+        return Error::invalidData("kmodLoad: bad section table");
+
+    obj.image = image;
+    obj.sections.resize(hdr.shCount, {});
+    memcpy(obj.sections.buf(), image.buf() + hdr.shOff,
+           hdr.shCount * sizeof(Elf::Section));
+
+    Opt<usize> symtab = NONE;
+    for (usize i = 0; i < obj.sections.len(); i++) {
+        auto& sec = obj.sections[i];
+        if (sec.type != Elf::Section::Nobits
+            and sec.offset + sec.size > image.len())
+            return Error::invalidData("kmodLoad: section past end of file");
+        if (sec.type == Elf::Section::Symtab)
+            symtab = i;
+    }
+    if (not symtab)
+        return Error::invalidData("kmodLoad: no symbol table");
+
+    auto& sec = obj.sections[*symtab];
+    if (sec.link >= obj.sections.len())
+        return Error::invalidData("kmodLoad: bad string table");
+    auto& str  = obj.sections[sec.link];
+    obj.strtab = slice(image, str.offset, str.offset + str.size);
+
+    obj.syms.resize(sec.size / sizeof(Elf::Sym), {});
+    memcpy(obj.syms.buf(), image.buf() + sec.offset,
+           obj.syms.len() * sizeof(Elf::Sym));
+    obj.addrs.resize(obj.syms.len(), 0);
+    obj.resolved.resize(obj.syms.len(), false);
+    return Ok();
+}
+
+// Sections are placed group by group, so each group is one run of pages.
+void _layout(_Object& obj) {
+    Array<usize, 3> sizes {};
+    obj.offsets.resize(obj.sections.len(), 0);
+    obj.groups.resize(obj.sections.len(), _Object::Unloaded);
+
+    for (usize i = 0; i < obj.sections.len(); i++) {
+        auto& sec = obj.sections[i];
+        if (not(sec.flags & Elf::Section::Alloc) or not sec.size)
+            continue;
+
+        auto group = _Object::Rodata;
+        if (sec.flags & Elf::Section::Exec)
+            group = _Object::Text;
+        else if (sec.flags & Elf::Section::Write)
+            group = _Object::Data;
+
+        usize align    = max(sec.align, 1uz);
+        sizes[group]   = alignUp(sizes[group], align);
+        obj.offsets[i] = sizes[group];
+        obj.groups[i]  = group;
+        sizes[group] += sec.size;
+    }
+
+    for (usize g = 0; g < 3; g++) {
+        obj.starts[g] = obj.size;
+        obj.size += pageAlignUp(sizes[g]);
+    }
+    for (usize i = 0; i < obj.sections.len(); i++) {
+        if (obj.loaded(i))
+            obj.offsets[i] += obj.starts[obj.groups[i]];
+    }
+}
+
+// MARK: - Memory --------------------------------------------------------------
+
+Res<VmmRange> _reserve(usize size) {
+    LockScoped lk(_lock);
+
+    for (usize i = 0; i < _free.len(); i++) {
+        if (_free[i].size() < size)
+            continue;
+        VmmRange range = { _free[i].start(), size };
+        _free[i]       = { _free[i].start() + size, _free[i].size() - size };
+        if (not _free[i].size())
+            _free.removeAt(i);
+        return Ok(range);
+    }
+
+    // The region reaches the top of the address space, its end() wraps.
+    if (size > MODULES_REGION.start() + MODULES_REGION.size() - _next)
+        return Error::outOfMemory("kmodLoad: modules region is full");
+    VmmRange range = { _next, size };
+    _next += size;
+    return Ok(range);
+}
+
+void _release(Kmod& mod) {
+    (void) globalVmm().unmap(mod.range);
+    for (auto phys : mod._pages)
+        (void) pmm().free({ phys, PAGE_SIZE });
+    mod._pages.clear();
+
+    LockScoped lk(_lock);
+    _free.pushBack(mod.range);
+}
+
+// Mapped writable while the image is built, the final protections come
+// once it is relocated.
+Res<> _populate(Kmod& mod) {
+    Flags<VmmFlags> prot = { VmmFlags::READ | VmmFlags::WRITE
+                             | VmmFlags::NO_EXECUTE };
+
+    for (usize off = 0; off < mod.range.size(); off += PAGE_SIZE) {
+        uflat phys = try$(pmm().alloc(PAGE_SIZE, PmmFlags::Kernel)).start();
+        mod._pages.pushBack(phys);
+        try$(globalVmm().map({ mod.range.start() + off, PAGE_SIZE },
+                             { phys, PAGE_SIZE }, prot));
+    }
+    memset((void*) mod.range.start(), 0, mod.range.size());
+    return Ok();
+}
+
+Res<> _protect(Kmod& mod, _Object const& obj) {
+    Flags<VmmFlags> prots[] = {
+        VmmFlags::READ | VmmFlags::EXECUTE,
+        VmmFlags::READ | VmmFlags::NO_EXECUTE,
+        VmmFlags::READ | VmmFlags::WRITE | VmmFlags::NO_EXECUTE,
+    };
+
+    for (usize g = 0; g < 3; g++) {
+        usize end = g + 1 < 3 ? obj.starts[g + 1] : obj.size;
+        for (usize off = obj.starts[g]; off < end; off += PAGE_SIZE) {
+            try$(globalVmm().map({ mod.range.start() + off, PAGE_SIZE },
+                                 { mod._pages[off / PAGE_SIZE], PAGE_SIZE },
+                                 prots[g]));
+        }
+    }
+    return Ok();
+}
+
+// MARK: - Linking -------------------------------------------------------------
+
+Res<uflat> _symbol(_Object& obj, Kmod& mod, usize index) {
+    if (index >= obj.syms.len())
+        return Error::invalidData("kmodLoad: bad symbol index");
+    if (obj.resolved[index])
+        return Ok(obj.addrs[index]);
+
+    auto& sym  = obj.syms[index];
+    uflat addr = 0;
+    if (sym.shIndex == Elf::Sym::Undef and index) {
+        Str name = obj.str(sym.name);
+        if (auto found = ksymsLookup(name)) {
+            addr = found.unwrap();
+        } else if (sym.bind() != Elf::Sym::Weak) {
+            logError("kmodLoad: {}: undefined symbol {}", mod.name(), name);
+            return Error::notFound("kmodLoad: undefined symbol");
+        }
+    } else if (sym.shIndex == Elf::Sym::Abs) {
+        addr = sym.value;
+    } else if (sym.shIndex == Elf::Sym::Common) {
+        return Error::invalidData("kmodLoad: common symbol, use -fno-common");
+    } else if (obj.loaded(sym.shIndex)) {
+        addr = mod.range.start() + obj.offsets[sym.shIndex] + sym.value;
+    }
+
+    obj.addrs[index]    = addr;
+    obj.resolved[index] = true;
+    return Ok(addr);
+}
+
+Res<> _relocate(_Object& obj, Kmod& mod) {
+    for (auto& sec : obj.sections) {
+        if (sec.type != Elf::Section::Rela or not obj.loaded(sec.info))
+            continue;
+
+        auto& target = obj.sections[sec.info];
+        uflat base   = mod.range.start() + obj.offsets[sec.info];
+        usize count  = sec.size / sizeof(Elf::Rela);
+        for (usize i = 0; i < count; i++) {
+            Elf::Rela rela;
+            memcpy(&rela, obj.image.buf() + sec.offset + i * sizeof(rela),
+                   sizeof(rela));
+            uflat s     = try$(_symbol(obj, mod, rela.sym()));
+            uflat place = base + rela.offset;
+            u64   value = s + rela.addend;
+            usize width = 4;
+            bool  fits  = true;
+            switch (rela.type()) {
+                case Elf::Rela::X86_64_None: continue;
+
+                case Elf::Rela::X86_64_64: width = 8; break;
+
+                case Elf::Rela::X86_64_Pc64:
+                    value -= place;
+                    width = 8;
+                    break;
+
+                case Elf::Rela::X86_64_Pc32:
+                case Elf::Rela::X86_64_Plt32:
+                    value -= place;
+                    fits = (i64) value == (i32) value;
+                    break;
+
+                case Elf::Rela::X86_64_32: fits = value == (u32) value; break;
+
+                case Elf::Rela::X86_64_32S:
+                    fits = (i64) value == (i32) value;
+                    break;
+
+                default:
+                    return Error::invalidData("kmodLoad: unknown relocation");
+            }
+            if (rela.offset + width > target.size)
+                return Error::invalidData("kmodLoad: relocation past section");
+            if (not fits)
+                return Error::invalidData("kmodLoad: relocation out of range");
+            memcpy((void*) place, &value, width);
+        }
+    }
+    return Ok();
+}
+
+SymTable* _exports(_Object& obj, Kmod& mod) {
+    Vec<SymTable::Sym> syms;
+    for (usize i = 0; i < obj.syms.len(); i++) {
+        auto& sym = obj.syms[i];
+        bool  visible
+            = sym.bind() == Elf::Sym::Global or sym.bind() == Elf::Sym::Weak;
+        if (not visible or sym.shIndex == Elf::Sym::Undef
+            or sym.shIndex == Elf::Sym::Common)
+            continue;
+
+        Str name = obj.str(sym.name);
+        if (name)
+            syms.pushBack({ name, _symbol(obj, mod, i).unwrapOr(0) });
+    }
+    return SymTable::build(syms);
+}
+
+void _construct(_Object const& obj, Kmod& mod) {
+    for (usize i = 0; i < obj.sections.len(); i++) {
+        auto& sec = obj.sections[i];
+        if (sec.type != Elf::Section::InitArray or not obj.loaded(i))
+            continue;
+
+        auto* fns = (void (**)()) (mod.range.start() + obj.offsets[i]);
+        for (usize f = 0; f < sec.size / sizeof(uflat); f++)
+            fns[f]();
+    }
+}
+
+// Names of the symbols `obj` needs and cannot do without.
+Vec<Str> _needs(_Object const& obj) {
+    Vec<Str> needs;
+    for (auto& sym : obj.syms) {
+        if (sym.shIndex == Elf::Sym::Undef and sym.bind() == Elf::Sym::Global
+            and obj.str(sym.name))
+            needs.pushBack(obj.str(sym.name));
+    }
+    return needs;
+}
+
+} // namespace
+
+// MARK: - Loading -------------------------------------------------------------
+
+Res<> kmodKernel() {
+    Vec<SymTable::Sym> syms;
+    for (auto* at = __ksyms_start; at + 3 <= __ksyms_end; at += 3)
+        syms.pushBack({ { (char const*) at[1], at[2] }, at[0] });
+
+    if (not syms.len())
+        return Error::notFound("kmodKernel: linked without its symbols");
+    ksymsAdd(SymTable::build(syms));
+    return Ok();
+}
+
+Res<Kmod*> kmodLoad(KmodImage image) {
+    _Object obj;
+    try$(_parse(image.image, Elf::Header::Relocatable, obj));
+    _layout(obj);
+    if (not obj.size)
+        return Error::invalidData("kmodLoad: nothing to load");
+
+    auto* mod = new Kmod();
+    for (usize i = 0; i < image.name.len(); i++)
+        mod->_name.pushBack(image.name.buf()[i]);
+
+    auto range = _reserve(obj.size);
+    if (not range) {
+        delete mod;
+        return range.none();
+    }
+    mod->range = range.unwrap();
+
+    auto res = _populate(*mod);
+    if (res) {
+        for (usize i = 0; i < obj.sections.len(); i++) {
+            auto& sec = obj.sections[i];
+            if (obj.loaded(i) and sec.type != Elf::Section::Nobits)
+                memcpy((void*) (mod->range.start() + obj.offsets[i]),
+                       image.image.buf() + sec.offset, sec.size);
+        }
+        res = _relocate(obj, *mod);
+    }
+    if (res)
+        res = _protect(*mod, obj);
+    if (not res) {
+        _release(*mod);
+        delete mod;
+        return res.none();
+    }
+
+    mod->_exports = _exports(obj, *mod);
+    ksymsAdd(mod->_exports);
+    _construct(obj, *mod);
+
+    if (auto init = mod->_exports->lookup("kmodInit"s)) {
+        auto fn = (Res<> (*)()) init.unwrap();
+        if (auto done = fn(); not done) {
+            logError("kmodLoad: {}: kmodInit failed", mod->name());
+            ksymsRemove(mod->_exports);
+            _release(*mod);
+            delete mod;
+            return done.none();
+        }
+    }
+    return Ok(mod);
+}
+
+Vec<Kmod*> kmodLoadAll(Slice<KmodImage> images) {
+    struct _Pending {
+        KmodImage image;
+        _Object   obj;
+        SymTable* defines = nullptr; // Addresses left out, names only
+        bool      done    = false;
+    };
+
+    Vec<_Pending*> pending;
+    for (auto& image : images) {
+        auto* p   = new _Pending { .image = image };
+        auto  res = _parse(image.image, Elf::Header::Relocatable, p->obj);
+        if (not res) {
+            logError("kmodLoadAll: {}: {}", image.name, res.none().msg());
+            delete p;
+            continue;
+        }
+
+        Vec<SymTable::Sym> syms;
+        for (auto& sym : p->obj.syms) {
+            Str name = p->obj.str(sym.name);
+            if (sym.bind() != Elf::Sym::Local
+                and sym.shIndex != Elf::Sym::Undef and name)
+                syms.pushBack({ name, 0 });
+        }
+        p->defines = SymTable::build(syms);
+        pending.pushBack(p);
+    }
+
+    // A module is ready once no module still pending defines a symbol it
+    // needs. Nothing in a wave needs anything from the rest of it.
+    Vec<Kmod*> loaded;
+    usize      left = pending.len();
+    while (left) {
+        Vec<_Pending*> wave;
+        for (auto* p : pending) {
+            if (p->done)
+                continue;
+
+            bool ready = true;
+            for (auto name : _needs(p->obj)) {
+                for (auto* other : pending) {
+                    if (other != p and not other->done
+                        and other->defines->lookup(name)) {
+                        ready = false;
+                        break;
+                    }
+                }
+                if (not ready)
+                    break;
+            }
+            if (ready)
+                wave.pushBack(p);
+        }
+
+        if (not wave.len()) {
+            logError("kmodLoadAll: {} modules need each other", left);
+            break;
+        }
+
+        for (auto* p : wave) {
+            if (auto mod = kmodLoad(p->image))
+                loaded.pushBack(mod.unwrap());
+            else
+                logError("kmodLoadAll: {}: {}", p->image.name,
+                         mod.none().msg());
+            p->done = true;
+            left--;
+        }
+    }
+
+    for (auto* p : pending) {
+        delete p->defines;
+        delete p;
+    }
+    return loaded;
+}
+
+Res<> kmodUnload(Kmod* mod) {
+    if (auto exit = mod->_exports->lookup("kmodExit"s))
+        ((void (*)()) exit.unwrap())();
+
+    ksymsRemove(mod->_exports);
+    _release(*mod);
+    delete mod;
+    return Ok();
+}
+
+} // namespace Realms::Sys
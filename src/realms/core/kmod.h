@@ -0,0 +1,72 @@
+#pragma once
+
+#include <realms/core/ksyms.h>
+#include <realms/hal/vmm.h>
+#include <sdk-meta/res.h>
+#include <sdk-meta/slice.h>
+#include <sdk-meta/vec.h>
+#include <sdk-text/str.h>
+
+namespace Realms::Sys {
+
+/**
+ * @brief A relocatable ELF object linked into the modules region.
+ *
+ * The image holds the executable sections first, then the read-only ones,
+ * then the writable ones, each group starting on a page of its own so it
+ * can be mapped with its own protection. Global symbols the module defines
+ * are added to the shared scope for modules loaded after it.
+ */
+struct Kmod {
+    Vec<char>  _name;
+    VmmRange   range;
+    Vec<uflat> _pages;             // Physical pages backing `range`, in order
+    SymTable*  _exports = nullptr; // In the shared scope while loaded
+
+    Str name() const { return { _name.buf(), _name.len() }; }
+};
+
+struct KmodImage {
+    Str   name;
+    Bytes image; // The whole object file, only read while loading
+};
+
+/**
+ * @brief Put the global symbols of the kernel, from the table linked into
+ * its image, in the shared scope. Modules can only link against what is in
+ * the scope.
+ *
+ * @retval Error::notFound if the kernel was linked without the table.
+ */
+Res<> kmodKernel();
+
+/**
+ * @brief Link `image` into the modules region, run its constructors, then
+ * its `kmodInit()` if it has one.
+ *
+ * Symbols are resolved the first time a relocation uses them, each against
+ * the shared scope at most once, and every relocation is applied in a
+ * single pass over the relocation sections.
+ *
+ * @retval Error::notFound if a symbol it needs is nowhere in the scope.
+ * @retval Error::invalidData if the image is malformed or a relocation does
+ * not fit.
+ */
+Res<Kmod*> kmodLoad(KmodImage image);
+
+/**
+ * @brief Load `images`, each after the modules among them it links
+ * against, in waves of modules that need nothing from one another.
+ *
+ * @retval The modules loaded, in load order. Failures are logged and do not
+ * stop the others.
+ */
+Vec<Kmod*> kmodLoadAll(Slice<KmodImage> images);
+
+/**
+ * @brief Run the module's `kmodExit()` if it has one, withdraw its symbols
+ * and free it.
+ */
+Res<> kmodUnload(Kmod* mod);
+
+} // namespace Realms::Sys
@@ -0,0 +1,134 @@
+#include <realms/core/ksyms.h>
+#include <sdk-meta/lock.h>
+
+namespace Realms::Sys {
+
+namespace {
+
+using _Scope = Vec<SymTable*>;
+
+Lock           _lock; // Serializes writers, lookups go through RCU
+RcuPtr<_Scope> _scope { new _Scope() };
+
+} // namespace
+
+// MARK: - SymTable ------------------------------------------------------------
+
+SymTable* SymTable::build(Slice<Sym> syms) {
+    auto* table = new SymTable();
+
+    // About four symbols a bucket and a bloom word per eight symbols, both
+    // powers of two, as the GNU linker sizes them.
+    usize buckets = 1;
+    while (buckets * 4 < syms.len())
+        buckets <<= 1;
+    usize words = 1;
+    while (words * 8 < syms.len())
+        words <<= 1;
+
+    usize size = 0;
+    for (auto& sym : syms)
+        size += sym.name.len();
+    table->_names.ensure(size);
+
+    // Counted then placed, each bucket's symbols end up side by side.
+    Vec<u32> hashes;
+    Vec<u32> start;
+    start.resize(buckets + 1, 0);
+    for (auto& sym : syms) {
+        u32 h = hash(sym.name);
+        hashes.pushBack(h);
+        start[h % buckets + 1]++;
+    }
+    for (usize b = 0; b < buckets; b++)
+        start[b + 1] += start[b];
+
+    table->_syms.resize(syms.len(), {});
+    table->_chain.resize(syms.len(), 0);
+    table->_buckets.resize(buckets, EMPTY);
+    table->_bloom.resize(words, 0);
+
+    Vec<u32> next = Vec<u32>(slice(start));
+    for (usize i = 0; i < syms.len(); i++) {
+        auto& sym = syms[i];
+        u32   h   = hashes[i];
+        usize at  = next[h % buckets]++;
+
+        // Reserved above, the names never move once copied.
+        Str name { table->_names.buf() + table->_names.len(), sym.name.len() };
+        for (usize c = 0; c < sym.name.len(); c++)
+            table->_names.pushBack(sym.name.buf()[c]);
+
+        table->_syms[at]  = { name, sym.addr };
+        table->_chain[at] = h & ~1u;
+
+        u64 bits = (1ull << (h % 64)) | (1ull << ((h >> table->_shift) % 64));
+        table->_bloom[(h / 64) % words] |= bits;
+    }
+
+    for (usize b = 0; b < buckets; b++) {
+        if (start[b] == start[b + 1])
+            continue;
+
+        table->_buckets[b] = start[b];
+        table->_chain[start[b + 1] - 1] |= 1;
+    }
+    return table;
+}
+
+Opt<uflat> SymTable::lookup(Str name, u32 h) const {
+    if (not _syms.len())
+        return NONE;
+
+    u64 word = _bloom[(h / 64) % _bloom.len()];
+    u64 mask = (1ull << (h % 64)) | (1ull << ((h >> _shift) % 64));
+    if ((word & mask) != mask)
+        return NONE;
+
+    u32 i = _buckets[h % _buckets.len()];
+    if (i == EMPTY)
+        return NONE;
+
+    for (;; i++) {
+        if ((_chain[i] | 1) == (h | 1) and _syms[i].name == name)
+            return _syms[i].addr;
+        if (_chain[i] & 1)
+            return NONE;
+    }
+}
+
+// MARK: - Scope ---------------------------------------------------------------
+
+void ksymsAdd(SymTable* table) {
+    LockScoped lk(_lock);
+
+    auto* scope = new _Scope(*_scope.load());
+    scope->pushBack(table);
+    retireRcu(_scope.publish(scope));
+}
+
+void ksymsRemove(SymTable* table) {
+    LockScoped lk(_lock);
+
+    auto* scope = new _Scope();
+    for (auto* other : *_scope.load()) {
+        if (other != table)
+            scope->pushBack(other);
+    }
+    retireRcu(_scope.publish(scope));
+    retireRcu(table);
+}
+
+Opt<uflat> ksymsLookup(Str name) {
+    RcuReadScope scope;
+
+    // Hashed once for every table.
+    u32 h = SymTable::hash(name);
+    for (auto* table : *_scope) {
+        if (auto addr = table->lookup(name, h))
+            return addr;
+    }
+    return NONE;
+}
+
+} // namespace Realms::Sys
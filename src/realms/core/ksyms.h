@@ -0,0 +1,72 @@
+#pragma once
+
+#include <realms/tasks/rcu.h>
+#include <sdk-meta/opt.h>
+#include <sdk-meta/res.h>
+#include <sdk-meta/slice.h>
+#include <sdk-meta/types.h>
+#include <sdk-meta/vec.h>
+#include <sdk-text/str.h>
+
+namespace Realms::Sys {
+
+/**
+ * @brief A fixed set of symbols hashed the way GNU `.gnu.hash` sections are.
+ *
+ * A bloom filter turns most misses away before any bucket is read. Symbols
+ * are stored grouped by bucket, each next to its full hash with the low bit
+ * marking the last of its bucket, so a hit compares names only when the
+ * hashes agree and a chain is one contiguous run.
+ */
+struct SymTable {
+    struct Sym {
+        Str   name;
+        uflat addr;
+    };
+
+    Vec<char> _names;     // Every name, back to back
+    Vec<Sym>  _syms;      // Grouped by bucket, names point into `_names`
+    Vec<u32>  _chain;     // Hash of each symbol, low bit set on a bucket's last
+    Vec<u32>  _buckets;   // First symbol of each bucket, EMPTY if none
+    Vec<u64>  _bloom;
+    u32       _shift = 6; // Second bloom bit, from the hash shifted right
+
+    static constexpr u32 EMPTY = ~0u;
+
+    /**
+     * @brief The table of `syms`, names copied in.
+     */
+    static SymTable* build(Slice<Sym> syms);
+
+    static u32 hash(Str name) {
+        u32 h = 5381;
+        for (usize i = 0; i < name.len(); i++)
+            h = h * 33 + (u8) name.buf()[i];
+        return h;
+    }
+
+    usize len() const { return _syms.len(); }
+
+    Opt<uflat> lookup(Str name) const { return lookup(name, hash(name)); }
+
+    Opt<uflat> lookup(Str name, u32 h) const;
+};
+
+/**
+ * @brief Add `table` to the scope modules are linked against, after the
+ * tables already there. The scope owns it from then on.
+ */
+void ksymsAdd(SymTable* table);
+
+/**
+ * @brief Take `table` out of the scope and free it once no lookup can be
+ * using it anymore.
+ */
+void ksymsRemove(SymTable* table);
+
+/**
+ * @brief The address of `name` in the first table of the scope having it.
+ */
+Opt<uflat> ksymsLookup(Str name);
+
+} // namespace Realms::Sys
@@ -1,8 +1,10 @@
 #pragma GCC diagnostic ignored "-Wcomment"
 
 #include <realms/core/api.mem.h>
+#include <realms/core/kmod.h>
 #include <realms/core/main.h>
 #include <realms/hal/arch.h>
+#include <realms/tasks/rcu.h>
 #include <sdk-logs/logger.h>
 #include <sdk-meta/literals.h>
 #include <sdk-meta/res.h>
@@ -51,6 +53,7 @@ namespace Realms::Sys {
 
 Res<> main(Boot::Info& info) {
     try$(Hal::init());
+    rcuOnline();
 
     logInfo(KERNEL_SPLASH);
 
@@ -81,6 +84,22 @@ Res<> main(Boot::Info& info) {
                      | filter$(it.tag == Boot::Tag::Memory)
                      | select$(it.template as<Boot::Tag::Memory>())));
 
+    // Modules fail to link without it, the kernel itself runs on.
+    if (auto res = kmodKernel(); not res)
+        logWarn("No kernel symbols for modules: {}\n", res.none().msg());
+
+    try$(setupArch());
+    try$(setupTimers());
+
+    usize devices = try$(setupDevices());
+    logInfo("Started {} devices\n", devices);
+
+    // A machine without disks boots all the same.
+    if (auto volumes = setupVolumes(); not volumes)
+        logWarn("No volumes scanned: {}\n", volumes.none().msg());
+    else
+        logInfo("Found {} volumes\n", volumes.unwrap());
+
     return Ok();
 }
 
@@ -13,6 +13,12 @@ Res<> setupArch();
 
 Res<> setupMemory(Ranges<MemoryRange> auto const& ranges);
 
+Res<> setupTimers();
+
+Res<usize> setupDevices();
+
+Res<usize> setupVolumes();
+
 Res<usize> setupMultitasking();
 
 Res<> main(Boot::Info&);
@@ -1,44 +1,171 @@
 #pragma once
 
+#include <realms/tasks/rcu.h>
 #include <sdk-meta/box.h>
-#include <sdk-meta/dict.h>
 #include <sdk-meta/lock.h>
 #include <sdk-meta/res.h>
+#include <sdk-meta/vec.h>
 #include <sdk-text/str.h>
 
 namespace Realms::Sys {
 
+/**
+ * @brief Entries in the order they were added, scanned on lookup. Registries
+ * hold a handful of them and are copied whole on every change.
+ */
 template <typename K, typename V>
-using DictionaryStrategy = Meta::Dict<K, V>;
+struct ListStrategy {
+    struct _Entry {
+        K key;
+        V value;
+    };
+
+    Vec<_Entry> _entries;
+
+    Opt<V&> get(K const& key) {
+        for (auto& entry : _entries) {
+            if (entry.key == key)
+                return entry.value;
+        }
+        return NONE;
+    }
+
+    bool contains(K const& key) { return (bool) get(key); }
+
+    void put(K const& key, V const& value) {
+        if (auto existing = get(key))
+            *existing = value;
+        else
+            _entries.pushBack({ key, value });
+    }
+
+    bool remove(K const& key) {
+        for (usize i = 0; i < _entries.len(); i++) {
+            if (_entries[i].key == key) {
+                _entries.removeAt(i);
+                return true;
+            }
+        }
+        return false;
+    }
+};
 
 template <typename T>
 struct Metadata;
 
+/**
+ * @brief Metadata of the implementations of `V`, read under RCU and copied
+ * whole by writers.
+ *
+ * Implementations built into the kernel enroll from static constructors,
+ * before there is a heap: they are chained through storage of their own and
+ * never removed. Everything else goes into the table.
+ */
 template <typename K,
           typename V,
-          template <typename, typename> class Strategy = DictionaryStrategy>
+          template <typename, typename> class Strategy = ListStrategy>
 struct Registry {
-    ReadWriteLock            lock;
-    Strategy<K, Metadata<V>> strategy;
+    using Table = Strategy<K, Metadata<V>>;
+
+    struct Static {
+        K           key;
+        Metadata<V> metadata;
+        Static*     next = nullptr;
+    };
+
+    Lock          lock; // Serializes writers, lookups go through RCU
+    RcuPtr<Table> strategy;
+    Static*       builtins = nullptr; // Only changed before any lookup
+
+    ~Registry() { delete strategy.publish(nullptr); }
+
+    /**
+     * @brief Chain a built-in entry. Only called from static constructors.
+     */
+    void enroll(Static& entry) {
+        entry.next = builtins;
+        builtins   = &entry;
+    }
+
+    Opt<Metadata<V>> get(K const& key) {
+        RcuReadScope scope;
+
+        if (auto* table = strategy.load()) {
+            if (auto metadata = table->get(key))
+                return *metadata;
+        }
+        for (auto* entry = builtins; entry; entry = entry->next) {
+            if (entry->key == key)
+                return entry->metadata;
+        }
+        return NONE;
+    }
+
+    Res<> add(K const& key, Metadata<V> metadata) {
+        LockScoped lk(lock);
+
+        auto* table = _copy();
+        table->put(key, metadata);
+        retireRcu(strategy.publish(table));
+        return Ok();
+    }
 
-    Res<> add(K const& key, Metadata<V> metadata) { }
+    Res<> addIfAbsent(K const& key, Metadata<V> metadata) {
+        if (get(key))
+            return Error::invalidState("registry entry already exists");
 
-    Res<> addIfAbsent(K const& key, Metadata<V> metadata) { }
+        LockScoped lk(lock);
 
-    Res<> remove(K const& key) { };
+        if (strategy.load() and strategy->contains(key))
+            return Error::invalidState("registry entry already exists");
+
+        auto* table = _copy();
+        table->put(key, metadata);
+        retireRcu(strategy.publish(table));
+        return Ok();
+    }
+
+    Res<> remove(K const& key) {
+        LockScoped lk(lock);
+
+        if (not strategy.load() or not strategy->contains(key))
+            return Error::notFound("registry entry not found");
+
+        auto* table = _copy();
+        table->remove(key);
+        retireRcu(strategy.publish(table));
+        return Ok();
+    }
+
+    // Called with `lock` held. The table is only allocated on first use.
+    Table* _copy() {
+        auto* table = strategy.load();
+        return table ? new Table(*table) : new Table();
+    }
 };
 
+/**
+ * @brief The registry of the implementations of `R`.
+ */
+template <typename R>
+inline typename R::Registry registry {};
+
 template <typename R, typename T>
 struct Registration {
-    [[maybe_unused]]
-    static inline bool const _
-        = []() {
-        Metadata<R> metadata = {
+    static inline typename R::Registry::Static _entry {
+        .key      = T::name,
+        .metadata = {
             .name       = T::name,
             .priority   = T::priority,
             .requisites = T::requisites,
             .build      = []() -> Opt<Rc<R>> { return makeRc<T>(); },
-        };
+        },
+    };
+
+    [[maybe_unused]]
+    static inline bool const _
+        = []() {
+        registry<R>.enroll(_entry);
         return true;
     }();
 };
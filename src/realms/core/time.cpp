@@ -0,0 +1,56 @@
+#include <realms/core/api.time.h>
+#include <realms/hal/clock.h>
+#include <sdk-meta/lock.h>
+
+namespace Realms::Sys {
+
+namespace {
+
+struct _Wall {
+    DateTime time;
+    Instant  at;
+};
+
+IrqSeqLock<_Wall> _wall {
+    { { { 0, 0, 0 }, Date::epoch(), DateTimeKind::Utc }, Instant::epoch() }
+};
+
+DateTime _advance(DateTime dt, u64 secs) {
+    u64 total = dt.time.sec + dt.time.min * 60 + dt.time.hour * 3600 + secs;
+
+    dt.time.sec  = total % 60;
+    dt.time.min  = (total / 60) % 60;
+    dt.time.hour = (total / 3600) % 24;
+
+    for (u64 days = total / 86400; days > 0; days--) {
+        if (++dt.date.day < dt.date.year.daysIn(dt.date.month))
+            continue;
+
+        dt.date.day = 0;
+        if (dt.date.month == Month::DECEMBER)
+            dt.date.year = dt.date.year.next();
+        dt.date.month = dt.date.month.next();
+    }
+    return dt;
+}
+
+} // namespace
+
+DateTime dateTime() {
+    _Wall wall = _wall.read();
+    return _advance(wall.time, (Hal::clock() - wall.at).getAsSeconds());
+}
+
+void dateTime(DateTime now) {
+    _wall.write({ now, Hal::clock() });
+}
+
+u64 now() {
+    return Hal::clock().val();
+}
+
+u64 uptimes() {
+    return TimeSpan(now()).getAsSeconds();
+}
+
+} // namespace Realms::Sys
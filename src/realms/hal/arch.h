@@ -1,9 +1,30 @@
 #pragma once
 
 #include <sdk-meta/res.h>
+#include <sdk-meta/types.h>
 
 namespace Realms::Hal {
 
 Res<> init();
 
+/**
+ * @brief Index of the processor executing the caller, in `[0, cpuCount())`.
+ */
+usize cpuId();
+
+usize cpuCount();
+
+/**
+ * @brief Enable interrupts and wait for the next one. Both happen at once,
+ * so an interrupt pending when called still ends the wait. Returns with
+ * interrupts as they were when called.
+ */
+void idle();
+
+/**
+ * @brief Whether the caller's processor takes interrupts right now. They are
+ * off in interrupt handlers, in critical sections and during boot.
+ */
+bool intrEnabled();
+
 } // namespace Realms::Hal
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <sdk-meta/_embed.h>
+#include <sdk-meta/res.h>
+#include <sdk-meta/time.h>
+#include <sdk-meta/types.h>
+
+namespace Realms::Hal {
+
+/**
+ * @brief A free running counter with a known frequency.
+ *
+ * Used both as the reference to calibrate faster counters against, and as
+ * the monotonic time base once calibrated.
+ */
+struct ClockSource {
+    virtual ~ClockSource() = default;
+
+    virtual Str name() const = 0;
+
+    virtual u64 ticks() = 0;
+
+    virtual u64 frequency() const = 0;
+
+    /**
+     * @brief Mask of the valid counter bits, the counter wraps past it.
+     */
+    virtual u64 mask() const { return ~0ull; }
+
+    /**
+     * @brief Busy wait for `span`, tolerating a single wrap of the counter.
+     */
+    void delay(TimeSpan span) {
+        u64 total = (u128) span.getAsMicroseconds() * frequency() / 1'000'000;
+        u64 last  = ticks();
+
+        while (total) {
+            u64 curr  = ticks();
+            u64 delta = (curr - last) & mask();
+            last      = curr;
+            total     = delta >= total ? 0 : total - delta;
+            _Embed::relaxe();
+        }
+    }
+};
+
+/**
+ * @brief A per processor one-shot event source.
+ *
+ * The timer subsystem arms it for the earliest pending deadline only, there
+ * is no periodic tick.
+ */
+struct ClockEvent {
+    virtual ~ClockEvent() = default;
+
+    virtual Res<> arm(Instant deadline) = 0;
+
+    virtual Res<> disarm() = 0;
+};
+
+/**
+ * @brief Monotonic time since boot, in microseconds.
+ */
+Instant clock();
+
+/**
+ * @brief The event source of the processor executing the caller, set up on
+ * first use.
+ *
+ * @retval An error if it could not be set up.
+ */
+Res<ClockEvent*> clockEvent();
+
+/**
+ * @brief Make processor `cpu` take a clock event now, so it re-arms its
+ * event source for a deadline queued from elsewhere.
+ */
+Res<> clockKick(usize cpu);
+
+} // namespace Realms::Hal
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <sdk-meta/res.h>
+#include <sdk-meta/slice.h>
+#include <sdk-meta/types.h>
+
+namespace Realms::Hal {
+
+/**
+ * @brief A hardware interrupt vector bound to a single processor.
+ *
+ * Vectors are allocated per processor, so the same vector number may be in
+ * use on several processors at once. The message address and data are filled
+ * in by the architecture and can be written as-is into an MSI capability or
+ * an MSI-X table entry to route a device interrupt to `cpu`.
+ */
+struct IntrVector {
+    usize cpu;
+    u8    vec;
+    u64   msiAddr;
+    u32   msiData;
+};
+
+using IntrHandler = void (*)(IntrVector const& vector, void* ctx);
+
+/**
+ * @brief Allocate `count` consecutive vectors on processor `cpu`.
+ *
+ * The block is naturally aligned to `count`, which must be a power of two,
+ * as required by multi-message MSI where the device ORs the message number
+ * into the low bits of the data.
+ *
+ * @return The first vector of the block.
+ * @retval Error::invalidArgument if `cpu` does not exist or `count` is not a
+ *         power of two.
+ * @retval Error::limitReached if no suitable block is free on `cpu`.
+ */
+Res<IntrVector> allocIntr(usize cpu, usize count = 1);
+
+/**
+ * @brief Allocate one vector per entry of `out`, spreading them across
+ * processors starting from `firstCpu`.
+ */
+Res<> allocIntrs(Slice<IntrVector> out, usize firstCpu = 0);
+
+Res<> freeIntr(IntrVector const& vector, usize count = 1);
+
+Res<> bindIntr(IntrVector const& vector, IntrHandler handler, void* ctx);
+
+Res<> unbindIntr(IntrVector const& vector);
+
+/**
+ * @brief Called by the architecture entry stub for every external vector.
+ *
+ * @return true if a handler was bound to the vector.
+ */
+bool dispatchIntr(usize cpu, u8 vec);
+
+} // namespace Realms::Hal
@@ -2,6 +2,7 @@
 
 #include <sdk-meta/range.h>
 #include <sdk-meta/res.h>
+#include <sdk-meta/slice.h>
 #include <sdk-meta/types.h>
 
 namespace Realms::Hal {
@@ -33,6 +34,45 @@ struct Io {
         return Ok();
     }
 
+    /**
+     * @brief Fill `buf` from the single register at `offset`, `size` bytes
+     * at a time, the way a data port or a FIFO is drained.
+     *
+     * @retval Error::invalidArgument if `buf` is not a multiple of `size`.
+     */
+    virtual Res<> ins(usize offset, usize size, Bytes buf) {
+        if (buf.len() % size) {
+            return Error::invalidArgument("Io::ins: partial unit");
+        }
+
+        for (usize i = 0; i < buf.len(); i += size) {
+            usize val = try$(in(offset, size));
+            for (usize j = 0; j < size; j++)
+                buf[i + j] = (byte) (val >> (j * 8));
+        }
+        return Ok();
+    }
+
+    /**
+     * @brief Write `buf` to the single register at `offset`, `size` bytes at
+     * a time.
+     *
+     * @retval Error::invalidArgument if `buf` is not a multiple of `size`.
+     */
+    virtual Res<> outs(usize offset, usize size, Bytes buf) {
+        if (buf.len() % size) {
+            return Error::invalidArgument("Io::outs: partial unit");
+        }
+
+        for (usize i = 0; i < buf.len(); i += size) {
+            usize val = 0;
+            for (usize j = 0; j < size; j++)
+                val |= (usize) buf[i + j] << (j * 8);
+            try$(out(offset, size, val));
+        }
+        return Ok();
+    }
+
     template <typename R>
     Res<typename R::Type> read() {
         return Ok(
@@ -83,6 +123,21 @@ Res<u64> in64(usize);
 
 Res<> out64(usize, u64);
 
+// String variants, moving a whole buffer through one port with `rep ins` and
+// `rep outs` instead of a call per unit.
+
+Res<> ins8(usize, Slice<u8>);
+
+Res<> outs8(usize, Slice<u8>);
+
+Res<> ins16(usize, Slice<u16>);
+
+Res<> outs16(usize, Slice<u16>);
+
+Res<> ins32(usize, Slice<u32>);
+
+Res<> outs32(usize, Slice<u32>);
+
 } // namespace Pmio
 
 struct PortIo : public Io {
@@ -121,6 +176,48 @@ struct PortIo : public Io {
             default: return Error::invalidArgument("PortIo::out: invalid size");
         }
     }
+
+    Res<> ins(usize offset, usize size, Bytes buf) override {
+        u16 addr = _range._start + offset;
+
+        if (not _range.contains(addr)) {
+            return Error::outOfBounds("PortIo::ins: address out of bounds");
+        }
+
+        if (buf.len() % size) {
+            return Error::invalidArgument("PortIo::ins: partial unit");
+        }
+
+        usize count = buf.len() / size;
+        switch (size) {
+            case 1: return Pmio::ins8(addr, { (u8*) buf.buf(), count });
+            case 2: return Pmio::ins16(addr, { (u16*) buf.buf(), count });
+            case 4: return Pmio::ins32(addr, { (u32*) buf.buf(), count });
+            default:
+                return Error::invalidArgument("PortIo::ins: invalid size");
+        }
+    }
+
+    Res<> outs(usize offset, usize size, Bytes buf) override {
+        u16 addr = _range._start + offset;
+
+        if (not _range.contains(addr)) {
+            return Error::outOfBounds("PortIo::outs: address out of bounds");
+        }
+
+        if (buf.len() % size) {
+            return Error::invalidArgument("PortIo::outs: partial unit");
+        }
+
+        usize count = buf.len() / size;
+        switch (size) {
+            case 1: return Pmio::outs8(addr, { (u8*) buf.buf(), count });
+            case 2: return Pmio::outs16(addr, { (u16*) buf.buf(), count });
+            case 4: return Pmio::outs32(addr, { (u32*) buf.buf(), count });
+            default:
+                return Error::invalidArgument("PortIo::outs: invalid size");
+        }
+    }
 };
 
 struct Mmio : public Io {
@@ -0,0 +1,290 @@
+#include <realms/hal/arch.h>
+#include <realms/io/blk.h>
+#include <sdk-meta/_embed.h>
+#include <sdk-meta/array.h>
+#include <sdk-meta/atomic.h>
+
+namespace Realms::Sys::Io {
+
+namespace {
+
+static constexpr usize MAX_CPUS = 256;
+
+Lock                      _lock; // Guards lazy BlkDev creation
+Array<BlkPlug*, MAX_CPUS> _plugs {};
+
+bool _before(BlkRequest const* a, BlkRequest const* b) {
+    if (a->dev != b->dev)
+        return a->dev < b->dev;
+    return a->lba < b->lba;
+}
+
+// Batches are small, typically a plug's worth of requests, and usually
+// already close to sorted.
+void _sort(Slice<BlkRequest*> batch) {
+    for (usize i = 1; i < batch.len(); i++) {
+        BlkRequest* req = batch[i];
+        usize       j   = i;
+        for (; j > 0 and _before(req, batch[j - 1]); j--)
+            batch[j] = batch[j - 1];
+        batch[j] = req;
+    }
+}
+
+} // namespace
+
+// MARK: - BlkRequest ----------------------------------------------------------
+
+void BlkRequest::_absorb(BlkRequest& next) {
+    if (not _merged) {
+        _count = count;
+        _segs  = segs.len();
+    }
+
+    count += next.count;
+    for (auto& seg : next.segs)
+        segs.pushBack(seg);
+
+    next._merged = nullptr;
+    if (_tail)
+        _tail->_merged = &next;
+    else
+        _merged = &next;
+    _tail = &next;
+}
+
+void BlkRequest::end(Res<> res) {
+    BlkRequest* merged = _merged;
+    if (merged) {
+        count = _count;
+        segs.trunc(_segs);
+    }
+    _merged = nullptr;
+    _tail   = nullptr;
+
+    // The callback may free the request, so read the chain first.
+    fn(*this, res);
+    while (merged) {
+        BlkRequest* next = merged->_merged;
+        merged->_merged  = nullptr;
+        merged->fn(*merged, res);
+        merged = next;
+    }
+}
+
+// MARK: - StorDev -------------------------------------------------------------
+
+namespace {
+
+// `buf` as requests of at most maxBlocks() each, submitted together and
+// waited for together. The segments go to the driver as they are.
+Res<usize> _transfer(StorDev&       dev,
+                     BlkRequest::Op op,
+                     Seek           seek,
+                     IoBuf const&   buf,
+                     char const*    misaligned) {
+    usize bs  = dev._blockSize;
+    usize pos = seek.apply(0, dev._blockCount * bs);
+    if (pos % bs or buf.len() % bs)
+        return Error::invalidArgument(misaligned);
+
+    struct _Batch {
+        Atomic<usize> pending { 0 };
+        Atomic<bool>  failed { false };
+    } batch;
+
+    usize           limit = max(dev.maxBlocks(), 1uz) * bs;
+    Vec<BlkRequest> reqs;
+    for (usize off = 0; off < buf.len(); off += limit) {
+        usize      len = min(buf.len() - off, limit);
+        BlkRequest req {
+            .dev   = &dev,
+            .op    = op,
+            .lba   = (pos + off) / bs,
+            .count = len / bs,
+            .segs  = {},
+            .fn    = [](BlkRequest& req, Res<> res) {
+                auto* batch = static_cast<_Batch*>(req.ctx);
+                if (not res)
+                    batch->failed.store(true);
+                batch->pending.fetchSub(1, Release);
+            },
+            .ctx   = &batch,
+        };
+        auto part = buf.slice(off, off + len);
+        for (auto& seg : part.segs())
+            req.segs.pushBack(seg.bytes());
+        reqs.pushBack(::move(req));
+    }
+
+    batch.pending.store(reqs.len());
+    {
+        BlkPlug plug;
+        for (auto& req : reqs)
+            blkSubmit(req);
+    }
+
+    while (batch.pending.load(Acquire)) {
+        dev.poll();
+        _Embed::relaxe();
+    }
+    if (batch.failed.load())
+        return Error::invalidData("StorDev: i/o failed");
+    return Ok(buf.len());
+}
+
+} // namespace
+
+Res<usize> StorDev::readv(Seek seek, IoBuf& buf) {
+    return _transfer(*this, BlkRequest::Op::Read, seek, buf,
+                     "StorDev::readv: not block aligned");
+}
+
+Res<usize> StorDev::writev(Seek seek, IoBuf const& buf) {
+    return _transfer(*this, BlkRequest::Op::Write, seek, buf,
+                     "StorDev::writev: not block aligned");
+}
+
+Res<> StorDev::submit(BlkRequest& req, usize) {
+    Res<> res = Ok();
+    usize pos = req.lba * _blockSize;
+
+    if (req.op != BlkRequest::Op::Flush) {
+        for (auto& seg : req.segs) {
+            auto done = req.op == BlkRequest::Op::Read
+                          ? read(Seek::fromBegin(pos), seg)
+                          : write(Seek::fromBegin(pos), seg);
+            if (not done) {
+                res = done.none();
+                break;
+            }
+            pos += seg.len();
+        }
+    }
+
+    req.end(res);
+    return Ok();
+}
+
+// MARK: - BlkDev --------------------------------------------------------------
+
+BlkDev::BlkDev(StorDev& dev) : _dev(dev) {
+    usize hw = max(dev.queues(), 1uz);
+    for (usize i = 0; i < Hal::cpuCount(); i++)
+        _queues.pushBack(makeBox<BlkQueue>(i % hw));
+}
+
+void BlkDev::dispatch(Slice<BlkRequest*> batch) {
+    auto& queue = *_queues[Hal::cpuId() % _queues.len()];
+
+    // Requests queued by an interrupted dispatch on this processor are
+    // picked up here as well.
+    Vec<BlkRequest*> pending;
+    _Embed::enterCritical();
+    queue._lock.acquire();
+    for (auto* req : batch)
+        queue._pending.pushBack(req);
+    swap(pending, queue._pending);
+    queue._lock.release();
+    _Embed::leaveCritical();
+
+    _sort(slice(pending));
+
+    usize maxBlocks = _dev.maxBlocks();
+    for (usize i = 0; i < pending.len();) {
+        BlkRequest& head = *pending[i++];
+        while (i < pending.len() and head._mergeable(*pending[i], maxBlocks))
+            head._absorb(*pending[i++]);
+
+        if (auto res = _dev.submit(head, queue._hw); not res)
+            head.end(res);
+    }
+    _dev.commit(queue._hw);
+}
+
+BlkDev& blkDev(StorDev& dev) {
+    if (dev._blk)
+        return *dev._blk;
+
+    LockScoped lk(_lock);
+    if (not dev._blk)
+        dev._blk = new BlkDev(dev);
+    return *dev._blk;
+}
+
+// MARK: - BlkPlug -------------------------------------------------------------
+
+BlkPlug::BlkPlug() : _cpu(Hal::cpuId()) {
+    _outer       = _plugs[_cpu];
+    _plugs[_cpu] = this;
+}
+
+BlkPlug::~BlkPlug() {
+    _plugs[_cpu] = _outer;
+    if (_outer) {
+        for (auto* req : _list)
+            _outer->_list.pushBack(req);
+        return;
+    }
+    flush();
+}
+
+void BlkPlug::flush() {
+    _sort(slice(_list));
+
+    for (usize i = 0; i < _list.len();) {
+        usize j = i;
+        while (j < _list.len() and _list[j]->dev == _list[i]->dev)
+            j++;
+
+        blkDev(*_list[i]->dev).dispatch(slice(_list, i, j));
+        i = j;
+    }
+    _list.clear();
+}
+
+// MARK: - Submission ----------------------------------------------------------
+
+void blkSubmit(BlkRequest& req) {
+    if (req.op != BlkRequest::Op::Flush
+        and req.lba + req.count > req.dev->_blockCount) {
+        req.end(Error::outOfBounds("blkSubmit: request past end of device"));
+        return;
+    }
+
+    if (auto* plug = _plugs[Hal::cpuId()]) {
+        plug->_list.pushBack(&req);
+        return;
+    }
+
+    BlkRequest* batch[] = { &req };
+    blkDev(*req.dev).dispatch({ batch, 1 });
+}
+
+Res<> blkWait(BlkRequest& req) {
+    struct _Waiter {
+        Atomic<bool> done { false };
+        Res<>        res = Ok();
+    } waiter;
+
+    req.fn  = [](BlkRequest& req, Res<> res) {
+        auto* waiter = static_cast<_Waiter*>(req.ctx);
+        waiter->res  = res;
+        waiter->done.store(true, Release);
+    };
+    req.ctx = &waiter;
+
+    blkSubmit(req);
+
+    // Waiting under a plug would never let the request out.
+    if (auto* plug = _plugs[Hal::cpuId()])
+        plug->flush();
+
+    while (not waiter.done.load(Acquire)) {
+        req.dev->poll();
+        _Embed::relaxe();
+    }
+    return waiter.res;
+}
+
+} // namespace Realms::Sys::Io
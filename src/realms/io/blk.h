@@ -0,0 +1,117 @@
+#pragma once
+
+#include <realms/io/dev.stor.h>
+#include <sdk-meta/box.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/res.h>
+#include <sdk-meta/traits.h>
+#include <sdk-meta/types.h>
+#include <sdk-meta/vec.h>
+
+namespace Realms::Sys::Io {
+
+/**
+ * @brief One block I/O: a range of blocks, the memory segments backing it in
+ * order, and a completion callback.
+ *
+ * The request must stay alive until its callback runs. While queued it may
+ * absorb adjacent requests; `lba`, `count` and `segs` are restored before any
+ * callback sees them.
+ */
+struct BlkRequest {
+    enum struct Op : u8 {
+        Read,
+        Write,
+        Flush,
+    };
+
+    using Callback = void (*)(BlkRequest& req, Res<> res);
+
+    StorDev*   dev;
+    Op         op;
+    u64        lba;
+    usize      count; // In blocks
+    Vec<Bytes> segs;
+    Callback   fn;
+    void*      ctx;
+
+    BlkRequest* _merged = nullptr; // Requests riding along with this one
+    BlkRequest* _tail   = nullptr;
+    usize       _count  = 0;
+    usize       _segs   = 0;
+
+    usize bytes() const { return count * dev->_blockSize; }
+
+    /**
+     * @brief Complete the request and every request merged into it. Called
+     * by drivers, possibly from interrupt context.
+     */
+    void end(Res<> res);
+
+    bool _mergeable(BlkRequest const& next, usize maxBlocks) const {
+        return op == next.op and op != Op::Flush and dev == next.dev
+           and lba + count == next.lba and count + next.count <= maxBlocks;
+    }
+
+    void _absorb(BlkRequest& next);
+};
+
+/**
+ * @brief A per-CPU software queue in front of one hardware queue.
+ */
+struct BlkQueue : Meta::Pinned {
+    Lock             _lock;
+    Vec<BlkRequest*> _pending;
+    usize            _hw;
+
+    BlkQueue(usize hw) : _hw(hw) { }
+};
+
+/**
+ * @brief Block layer state of one storage device, created on first use.
+ */
+struct BlkDev : Meta::Pinned {
+    StorDev&           _dev;
+    Vec<Box<BlkQueue>> _queues; // One per processor
+
+    BlkDev(StorDev& dev);
+
+    /**
+     * @brief Sort a batch by block, merge neighbours and hand the result to
+     * the hardware queue mapped to the current processor.
+     */
+    void dispatch(Slice<BlkRequest*> batch);
+};
+
+/**
+ * @brief Hold back submissions made on this processor until the plug goes
+ * out of scope, so they reach the driver as one sorted, merged batch.
+ * Plugs nest, the outermost one flushes.
+ */
+struct [[nodiscard]] BlkPlug : Meta::Pinned {
+    Vec<BlkRequest*> _list;
+    BlkPlug*         _outer;
+    usize            _cpu;
+
+    BlkPlug();
+
+    ~BlkPlug();
+
+    void flush();
+};
+
+BlkDev& blkDev(StorDev& dev);
+
+/**
+ * @brief Queue a request. Completion is reported through `req.fn`, errors
+ * included, and may happen before this returns.
+ */
+void blkSubmit(BlkRequest& req);
+
+/**
+ * @brief Submit and wait, polling the device meanwhile. For callers that
+ * have nothing else to do.
+ */
+Res<> blkWait(BlkRequest& req);
+
+} // namespace Realms::Sys::Io
@@ -5,6 +5,7 @@
 #include <sdk-meta/rc.h>
 #include <sdk-meta/res.h>
 #include <sdk-meta/types.h>
+#include <sdk-meta/vec.h>
 #include <sdk-text/str.h>
 
 namespace Realms::Sys::Io {
@@ -25,6 +26,12 @@ struct Bus {
 
     virtual Res<Slice<Rc<Dev>>> devices() = 0;
 
+    /**
+     * @brief Append the keys `dev` is known by to `out`, the most specific
+     * first. Devices without any are offered to keyless drivers only.
+     */
+    virtual Res<> keys(Rc<Dev> dev, Vec<DrvKey>& out) { return Ok(); }
+
     virtual Res<> remove(Rc<Dev> dev) = 0;
 };
 
@@ -0,0 +1,659 @@
+#include <realms/hal/arch.h>
+#include <realms/io/cache.h>
+#include <realms/io/mmap.h>
+#include <realms/mm/mem.h>
+#include <sdk-meta/_embed.h>
+#include <sdk-meta/array.h>
+#include <sdk-meta/vec.h>
+
+namespace Realms::Sys::Io {
+
+namespace {
+
+static constexpr usize READAHEAD_MIN = 4;    // Pages
+static constexpr usize READAHEAD_MAX = 1024; // Pages, 4 MiB
+static constexpr usize SHRINK_BATCH  = 32;
+static constexpr usize MAX_CPUS      = 256;
+
+Array<u32, MAX_CPUS> _held {}; // Cache and mapping locks, per processor
+
+Lock       _clock;           // Guards the ring and the hand
+CachePage* _hand  = nullptr; // Next page the clock looks at
+usize      _count = 0;
+usize      _limit = 16384; // Soft cap in pages, 64 MiB
+
+// Called with `_clock` held. New pages go right behind the hand so they get
+// a full turn before being considered.
+void _link(CachePage& page) {
+    if (not _hand) {
+        page._prev = page._next = &page;
+        _hand                   = &page;
+    } else {
+        page._next          = _hand;
+        page._prev          = _hand->_prev;
+        _hand->_prev->_next = &page;
+        _hand->_prev        = &page;
+    }
+    _count++;
+}
+
+// Called with `_clock` held.
+void _unlink(CachePage& page) {
+    if (page._next == &page) {
+        _hand = nullptr;
+    } else {
+        page._prev->_next = page._next;
+        page._next->_prev = page._prev;
+        if (_hand == &page)
+            _hand = page._next;
+    }
+    page._prev = page._next = nullptr;
+    _count--;
+}
+
+void _free(CachePage* page) {
+    (void) pmm().free({ page->phys, PAGE_SIZE });
+    delete page;
+}
+
+Res<CachePage*> _alloc(CacheMapping& mapping, u64 index) {
+    if (_count >= _limit)
+        cacheShrink(SHRINK_BATCH);
+
+    // Running out of physical memory is what the cache is for, give pages
+    // back and retry once before failing.
+    auto range = pmm().alloc(PAGE_SIZE, PmmFlags::Cached);
+    if (not range) {
+        cacheShrink(SHRINK_BATCH * 4);
+        range = pmm().alloc(PAGE_SIZE, PmmFlags::Cached);
+    }
+
+    uflat phys = try$(range).start();
+    uflat virt = try$(mmapVirtIo(phys));
+    return Ok(new CachePage {
+        .mapping = &mapping,
+        .index   = index,
+        .phys    = phys,
+        .virt    = virt,
+    });
+}
+
+// Look the page up or insert an empty one, either way referenced.
+Res<CachePage*> _lookup(CacheMapping& mapping, u64 index) {
+    CacheLocked lk(mapping._lock);
+
+    if (auto* page = mapping._pages.get(index)) {
+        page->refs.inc();
+        page->set(CachePage::Referenced);
+        return Ok(page);
+    }
+
+    auto* page = try$(_alloc(mapping, index));
+    page->refs.store(1);
+    mapping._pages.put(index, page);
+
+    CacheLocked clk(_clock);
+    _link(*page);
+    return Ok(page);
+}
+
+// Take the page for reading if nobody has, or is, filling it.
+bool _claimFill(CachePage& page) {
+    while (true) {
+        u8 f = page.flags.load();
+        if (f & (CachePage::Busy | CachePage::Uptodate))
+            return false;
+        if (page.flags.cmpxchg(f, (f | CachePage::Busy) & ~CachePage::Failed))
+            return true;
+    }
+}
+
+// Take a dirty page for write-back.
+bool _claimFlush(CachePage& page) {
+    while (true) {
+        u8 f = page.flags.load();
+        if (not(f & CachePage::Dirty) or (f & CachePage::Busy))
+            return false;
+        if (page.flags.cmpxchg(f, (f | CachePage::Busy) & ~CachePage::Dirty)) {
+            page.mapping->_dirty.dec();
+            return true;
+        }
+    }
+}
+
+void _fill(CacheMapping& mapping, Slice<CachePage*> run) {
+    if (not run)
+        return;
+
+    if (auto res = mapping.fill(run); not res) {
+        for (auto* page : run)
+            cacheFilled(*page, res);
+    }
+}
+
+void _flush(CacheMapping& mapping, Slice<CachePage*> run) {
+    if (not run)
+        return;
+
+    if (auto res = mapping.flush(run); not res) {
+        for (auto* page : run)
+            cacheFlushed(*page, res);
+    }
+}
+
+void _wait(CachePage& page) {
+    while (page.has(CachePage::Busy)) {
+        page.mapping->poll();
+        _Embed::relaxe();
+    }
+}
+
+usize _pageCount(CacheMapping& mapping) {
+    return alignUp(mapping.size(), PAGE_SIZE) / PAGE_SIZE;
+}
+
+} // namespace
+
+// MARK: - Locking -------------------------------------------------------------
+
+CacheLocked::CacheLocked(Lock& lock) : _lock(lock) {
+    _held[Hal::cpuId()]++;
+    _lock.acquire();
+}
+
+CacheLocked::~CacheLocked() {
+    _lock.release();
+    _held[Hal::cpuId()]--;
+}
+
+bool cacheLocked() {
+    return _held[Hal::cpuId()];
+}
+
+// MARK: - CacheMapping --------------------------------------------------------
+
+// Derived mappings sync in their own destructor, flush() and size() are gone
+// by the time this runs.
+CacheMapping::~CacheMapping() {
+    CacheLocked lk(_lock);
+    _pages.each([](u64, CachePage& page) {
+        {
+            CacheLocked clk(_clock);
+            _unlink(page);
+        }
+        _free(&page);
+    });
+    _pages.clear();
+}
+
+// MARK: - BlkMapping ----------------------------------------------------------
+
+namespace {
+
+struct _BlkIo {
+    BlkRequest      req;
+    Vec<CachePage*> pages;
+};
+
+Res<> _blkSubmit(BlkMapping& mapping, Slice<CachePage*> pages, bool write) {
+    StorDev& dev    = mapping._dev;
+    usize    offset = pages[0]->index * PAGE_SIZE;
+    usize    len    = min(pages.len() * PAGE_SIZE, mapping.size() - offset);
+
+    auto* io = new _BlkIo {
+        .req = {
+            .dev   = &dev,
+            .op    = write ? BlkRequest::Op::Write : BlkRequest::Op::Read,
+            .lba   = offset / dev._blockSize,
+            .count = alignUp(len, dev._blockSize) / dev._blockSize,
+            .segs  = {},
+            .fn    = nullptr,
+            .ctx   = nullptr,
+        },
+        .pages = {},
+    };
+
+    // The last page of a device whose size is not page aligned is only
+    // partially backed, the rest reads as zeroes.
+    for (auto* page : pages) {
+        usize n = min(len, PAGE_SIZE);
+        if (n < PAGE_SIZE and not write)
+            memset((void*) (page->virt + n), 0, PAGE_SIZE - n);
+        io->req.segs.pushBack(
+            Bytes { (byte*) page->virt, alignUp(n, dev._blockSize) });
+        io->pages.pushBack(page);
+        len -= n;
+    }
+
+    io->req.ctx = io;
+    if (write) {
+        io->req.fn = [](BlkRequest& req, Res<> res) {
+            auto* io = static_cast<_BlkIo*>(req.ctx);
+            for (auto* page : io->pages)
+                cacheFlushed(*page, res);
+            delete io;
+        };
+    } else {
+        io->req.fn = [](BlkRequest& req, Res<> res) {
+            auto* io = static_cast<_BlkIo*>(req.ctx);
+            for (auto* page : io->pages)
+                cacheFilled(*page, res);
+            delete io;
+        };
+    }
+
+    blkSubmit(io->req);
+    return Ok();
+}
+
+} // namespace
+
+BlkMapping::~BlkMapping() {
+    (void) cacheSync(*this);
+}
+
+Res<> BlkMapping::fill(Slice<CachePage*> pages) {
+    return _blkSubmit(*this, pages, false);
+}
+
+Res<> BlkMapping::flush(Slice<CachePage*> pages) {
+    return _blkSubmit(*this, pages, true);
+}
+
+// MARK: - Completion ----------------------------------------------------------
+
+void cacheFilled(CachePage& page, Res<> res) {
+    page.set(res ? CachePage::Uptodate : CachePage::Failed);
+    page.clear(CachePage::Busy);
+}
+
+void cacheFlushed(CachePage& page, Res<> res) {
+    if (not res) {
+        page.set(CachePage::Failed);
+        if (not(page.flags.fetchOr(CachePage::Dirty) & CachePage::Dirty))
+            page.mapping->_dirty.inc();
+    }
+    page.clear(CachePage::Busy);
+}
+
+// MARK: - Lookup --------------------------------------------------------------
+
+Res<CachePage*> cacheGet(CacheMapping& mapping, u64 index) {
+    auto* page = try$(_lookup(mapping, index));
+
+    if (_claimFill(*page))
+        _fill(mapping, { &page, 1 });
+    _wait(*page);
+
+    if (not page->has(CachePage::Uptodate)) {
+        cachePut(*page);
+        return Error::invalidData("cacheGet: failed to read page");
+    }
+    return Ok(page);
+}
+
+void cachePut(CachePage& page) {
+    page.refs.dec(Release);
+}
+
+void cacheDirty(CachePage& page) {
+    if (not(page.flags.fetchOr(CachePage::Dirty) & CachePage::Dirty))
+        page.mapping->_dirty.inc();
+}
+
+usize cacheReadahead(CacheMapping& mapping, u64 index, usize count) {
+    usize total   = _pageCount(mapping);
+    count         = min(count, total > index ? total - index : 0);
+    usize claimed = 0;
+
+    // Missing pages are gathered into runs, each becoming one request, and
+    // the plug lets the block layer see the whole window at once.
+    BlkPlug         plug;
+    Vec<CachePage*> run;
+    for (u64 i = index; i < index + count; i++) {
+        auto page = _lookup(mapping, i);
+        if (not page)
+            break;
+
+        if (_claimFill(**page)) {
+            run.pushBack(*page);
+            claimed++;
+        } else {
+            _fill(mapping, slice(run));
+            run.clear();
+        }
+        // In flight pages are kept by their Busy bit.
+        cachePut(**page);
+    }
+    _fill(mapping, slice(run));
+    return claimed;
+}
+
+// MARK: - Read-ahead ----------------------------------------------------------
+
+namespace {
+
+using Pattern = CacheReadahead::Pattern;
+
+void _collapse(CacheMapping& mapping, CacheReadahead& ra) {
+    if (ra.window)
+        mapping._stats.collapses.inc(Relaxed);
+    ra.pattern = Pattern::Random;
+    ra.window  = 0;
+    ra.next    = 0;
+}
+
+usize _grow(usize window, usize pages) {
+    if (not window)
+        return clamp(pages * 4, READAHEAD_MIN, READAHEAD_MAX);
+    return min(window * 2, READAHEAD_MAX);
+}
+
+// Sequential: keep `window` pages in flight past the reader, topping the
+// window up once the reader has eaten into half of it.
+usize _sequential(CacheMapping& mapping, CacheReadahead& ra, u64 last) {
+    if (ra.next > last + 1 + ra.window / 2)
+        return 0;
+
+    u64   from = max(ra.next, last + 1);
+    usize done = cacheReadahead(mapping, from, ra.window);
+    ra.next    = from + ra.window;
+    ra.window  = _grow(ra.window, 0);
+    return done;
+}
+
+// Strided: fetch the same extent one or more strides ahead, the number of
+// strides following the window.
+usize _strided(CacheMapping&   mapping,
+               CacheReadahead& ra,
+               u64             first,
+               usize           pages) {
+    usize depth = max(ra.window / pages, 1uz);
+    u64   until = first + ra.stride * depth;
+    usize done  = 0;
+
+    for (u64 at = max(ra.next, first + ra.stride); at <= until;
+         at += ra.stride) {
+        done += cacheReadahead(mapping, at, pages);
+    }
+    ra.next   = until + ra.stride;
+    ra.window = _grow(ra.window, pages);
+    return done;
+}
+
+} // namespace
+
+usize cacheAdvise(CacheMapping&   mapping,
+                  CacheReadahead& ra,
+                  u64             first,
+                  u64             last) {
+    LockScoped lk(ra._lock);
+
+    usize pages = last - first + 1;
+    u64   prev  = ra.start;
+    ra.start    = first;
+
+    // Reading the tail of the previous page again counts as sequential,
+    // small reads rarely end on a page boundary.
+    if (first == ra.last or first == ra.last + 1) {
+        if (ra.pattern != Pattern::Sequential) {
+            ra.pattern = Pattern::Sequential;
+            ra.window  = _grow(0, pages);
+            ra.next    = 0;
+        }
+        ra.last = last;
+        mapping._stats.sequential.inc(Relaxed);
+        return _sequential(mapping, ra, last);
+    }
+    ra.last = last;
+
+    u64 stride = first - prev;
+    if (prev != ~0ull and first > prev and stride > pages) {
+        if (ra.pattern == Pattern::Strided and stride == ra.stride) {
+            mapping._stats.strided.inc(Relaxed);
+            return _strided(mapping, ra, first, pages);
+        }
+
+        // One gap is not a pattern yet, wait for it to repeat.
+        _collapse(mapping, ra);
+        ra.pattern = Pattern::Strided;
+        ra.stride  = stride;
+        mapping._stats.random.inc(Relaxed);
+        return 0;
+    }
+
+    _collapse(mapping, ra);
+    mapping._stats.random.inc(Relaxed);
+    return 0;
+}
+
+// MARK: - Read & Write --------------------------------------------------------
+
+namespace {
+
+// The requested pages go out first, the window behind them in the same
+// plug, then only the requested ones are waited on.
+void _request(CacheMapping&   mapping,
+              usize           offset,
+              usize           len,
+              CacheReadahead* ra) {
+    BlkPlug plug;
+    u64     first  = offset / PAGE_SIZE;
+    u64     last   = (offset + len - 1) / PAGE_SIZE;
+    usize   pages  = last - first + 1;
+    usize   missed = cacheReadahead(mapping, first, pages);
+    usize   ahead  = cacheAdvise(mapping, ra ? *ra : mapping._readahead,
+                                 first, last);
+
+    mapping._stats.hits.fetchAdd(pages - missed, Relaxed);
+    mapping._stats.misses.fetchAdd(missed, Relaxed);
+    mapping._stats.readahead.fetchAdd(ahead, Relaxed);
+}
+
+} // namespace
+
+Res<usize> cacheRead(CacheMapping&   mapping,
+                     usize           offset,
+                     Bytes           buf,
+                     CacheReadahead* ra) {
+    usize size = mapping.size();
+    if (offset >= size or not buf)
+        return Ok(0uz);
+
+    usize len = min(buf.len(), size - offset);
+    _request(mapping, offset, len, ra);
+
+    usize done = 0;
+    while (done < len) {
+        usize pos  = offset + done;
+        usize off  = pos % PAGE_SIZE;
+        usize n    = min(PAGE_SIZE - off, len - done);
+        auto* page = try$(cacheGet(mapping, pos / PAGE_SIZE));
+
+        memcpy(buf.buf() + done, (void const*) (page->virt + off), n);
+        cachePut(*page);
+        done += n;
+    }
+    return Ok(done);
+}
+
+Res<usize> cacheView(CacheMapping&   mapping,
+                     usize           offset,
+                     usize           len,
+                     IoBuf&          out,
+                     CacheReadahead* ra) {
+    usize size = mapping.size();
+    if (offset >= size or not len)
+        return Ok(0uz);
+
+    len = min(len, size - offset);
+    _request(mapping, offset, len, ra);
+
+    // The reference cacheGet() takes moves into the view.
+    usize done = 0;
+    while (done < len) {
+        usize pos  = offset + done;
+        usize off  = pos % PAGE_SIZE;
+        usize n    = min(PAGE_SIZE - off, len - done);
+        auto* page = try$(cacheGet(mapping, pos / PAGE_SIZE));
+
+        out.append(makeRc<CacheIoPage>(*page), off, n);
+        done += n;
+    }
+    return Ok(done);
+}
+
+Res<usize> cacheWrite(CacheMapping& mapping, usize offset, Bytes buf) {
+    usize size = mapping.capacity();
+    if (offset >= size or not buf)
+        return Ok(0uz);
+
+    usize len  = min(buf.len(), size - offset);
+    usize done = 0;
+    while (done < len) {
+        usize pos  = offset + done;
+        usize off  = pos % PAGE_SIZE;
+        usize n    = min(PAGE_SIZE - off, len - done);
+        auto* page = try$(_lookup(mapping, pos / PAGE_SIZE));
+
+        // A page overwritten whole does not need to be read first.
+        if (n == PAGE_SIZE and _claimFill(*page)) {
+            memcpy((void*) page->virt, buf.buf() + done, n);
+            cacheFilled(*page, Ok());
+        } else {
+            if (_claimFill(*page))
+                _fill(mapping, { &page, 1 });
+            _wait(*page);
+
+            if (not page->has(CachePage::Uptodate)) {
+                cachePut(*page);
+                return Error::invalidData("cacheWrite: failed to read page");
+            }
+            memcpy((void*) (page->virt + off), buf.buf() + done, n);
+        }
+
+        cacheDirty(*page);
+        cachePut(*page);
+        done += n;
+    }
+    return Ok(done);
+}
+
+// MARK: - Write-back ----------------------------------------------------------
+
+Res<> cacheSync(CacheMapping& mapping) {
+    if (not mapping._dirty.load())
+        return Ok();
+
+    Vec<CachePage*> pages;
+    {
+        CacheLocked lk(mapping._lock);
+        mapping._pages.each([&](u64, CachePage& page) {
+            if (_claimFlush(page)) {
+                page.refs.inc();
+                pages.pushBack(&page);
+            }
+        });
+    }
+
+    // Taken before they are closed, so a store in between still reaches
+    // the write-back and a store after it faults and dirties the page again.
+    mmapProtect(mapping, slice(pages));
+
+    // Pages come out of the tree in index order, so consecutive ones are
+    // written with a single request.
+    {
+        BlkPlug plug;
+        usize   start = 0;
+        for (usize i = 1; i <= pages.len(); i++) {
+            if (i < pages.len() and pages[i]->index == pages[i - 1]->index + 1)
+                continue;
+            _flush(mapping, slice(pages, start, i));
+            start = i;
+        }
+    }
+
+    Res<> res = Ok();
+    for (auto* page : pages) {
+        _wait(*page);
+        if (page->has(CachePage::Failed))
+            res = Error::invalidData("cacheSync: write-back failed");
+        cachePut(*page);
+    }
+    return res;
+}
+
+usize cacheShrink(usize count) {
+    CachePage*                      victims = nullptr;
+    Array<CachePage*, SHRINK_BATCH> dirty {};
+    usize                           ndirty = 0;
+    usize                           freed  = 0;
+
+    {
+        CacheLocked clk(_clock);
+
+        // Two turns at most: the first one may only clear referenced bits.
+        usize budget = 2 * _count;
+        while (freed < count and _hand and budget--) {
+            CachePage* page = _hand;
+            _hand           = page->_next;
+
+            if (page->refs.load() or page->has(CachePage::Busy))
+                continue;
+
+            if (page->has(CachePage::Dirty)) {
+                // Closing a mapped page takes the map lock, which may be
+                // held by the fault that got us here.
+                if (page->writable.load())
+                    continue;
+                if (ndirty < dirty.len()) {
+                    page->refs.inc();
+                    dirty[ndirty++] = page;
+                }
+                continue;
+            }
+
+            if (page->has(CachePage::Referenced)) {
+                page->clear(CachePage::Referenced);
+                continue;
+            }
+
+            // Lookups take references under the mapping lock, so checking
+            // again while holding it makes the removal safe. Never wait for
+            // it here, the lock order is mapping then clock.
+            auto& mapping = *page->mapping;
+            if (not mapping._lock.tryAcquire())
+                continue;
+
+            u8 flags = page->flags.load();
+            if (page->refs.load() or (flags & CachePage::Busy)
+                or (flags & CachePage::Dirty)) {
+                mapping._lock.release();
+                continue;
+            }
+            mapping._pages.remove(page->index);
+            mapping._lock.release();
+
+            _unlink(*page);
+            page->_next = victims;
+            victims     = page;
+            freed++;
+        }
+    }
+
+    while (victims) {
+        CachePage* next = victims->_next;
+        _free(victims);
+        victims = next;
+    }
+
+    // Start writing dirty pages back so the next pass finds them clean.
+    for (usize i = 0; i < ndirty; i++) {
+        if (_claimFlush(*dirty[i]))
+            _flush(*dirty[i]->mapping, { &dirty[i], 1 });
+        cachePut(*dirty[i]);
+    }
+    return freed;
+}
+
+} // namespace Realms::Sys::Io
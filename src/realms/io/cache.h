@@ -0,0 +1,253 @@
+#pragma once
+
+#include <realms/hal/vmm.h>
+#include <realms/io/blk.h>
+#include <realms/io/dev.stor.h>
+#include <sdk-io/iobuf.h>
+#include <sdk-meta/atomic.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/radix.h>
+#include <sdk-meta/rc.h>
+#include <sdk-meta/res.h>
+#include <sdk-meta/types.h>
+
+namespace Realms::Sys::Io {
+
+using Sdk::Io::IoBuf;
+
+struct CacheMapping;
+
+/**
+ * @brief A lock of the cache or of a file mapping, held. Counted per
+ * processor, a page fault taken under one fails instead of waiting for it.
+ */
+struct CacheLocked : Meta::Pinned {
+    Lock& _lock;
+
+    CacheLocked(Lock& lock);
+
+    ~CacheLocked();
+};
+
+/**
+ * @brief Whether this processor holds a lock of the cache or of a mapping.
+ */
+bool cacheLocked();
+
+/**
+ * @brief Access pattern of one reader, usually a file handle, and the
+ * read-ahead window it earned.
+ */
+struct CacheReadahead {
+    enum struct Pattern : u8 {
+        Random,
+        Sequential,
+        Strided,
+    };
+
+    Lock    _lock;
+    Pattern pattern = Pattern::Random;
+    u64     start   = ~0ull; // First page of the last read
+    u64     last    = ~0ull; // Last page of the last read
+    u64     stride  = 0;     // In pages, between the starts of two reads
+    usize   window  = 0;     // In pages, 0 when collapsed
+    u64     next    = 0;     // First page not submitted yet
+};
+
+/**
+ * @brief Per-object counters, updated without ordering.
+ */
+struct CacheStats {
+    Atomic<usize> hits { 0 };      // Pages found cached or in flight
+    Atomic<usize> misses { 0 };    // Pages the reader had to wait for
+    Atomic<usize> readahead { 0 }; // Pages read ahead
+    Atomic<usize> sequential { 0 };
+    Atomic<usize> strided { 0 };
+    Atomic<usize> random { 0 };
+    Atomic<usize> collapses { 0 }; // Windows dropped on a pattern break
+};
+
+/**
+ * @brief One page of a cached object, backed by one physical page.
+ */
+struct CachePage {
+    enum Flags : u8 {
+        Uptodate   = (1 << 0),
+        Dirty      = (1 << 1),
+        Busy       = (1 << 2), // I/O in flight
+        Referenced = (1 << 3), // Second chance for the clock
+        Failed     = (1 << 4),
+    };
+
+    CacheMapping* mapping;
+    u64           index;
+    uflat         phys;
+    uflat         virt;
+    Atomic<u8>    flags { 0 };
+    Atomic<u32>   refs { 0 };
+    Atomic<u32>   writable { 0 }; // Shared mappings open for writing it
+
+    CachePage* _prev = nullptr; // Clock ring
+    CachePage* _next = nullptr;
+
+    Bytes bytes() const { return { (byte const*) virt, PAGE_SIZE }; }
+
+    bool has(Flags f) { return flags.load(Acquire) & f; }
+
+    void set(Flags f) { flags.fetchOr(f); }
+
+    void clear(Flags f) { flags.fetchAnd((u8) ~f); }
+};
+
+/**
+ * @brief The cached pages of one object, a block device or a file, and how
+ * to move them to and from the backing store.
+ */
+struct CacheMapping : Meta::Pinned {
+    Lock             _lock;
+    Radix<CachePage> _pages;
+    Atomic<usize>    _dirty { 0 };
+    CacheReadahead   _readahead; // For readers without their own state
+    CacheStats       _stats;
+
+    /**
+     * @brief Drop the pages, dirty ones included. Derived mappings write
+     * them back first, while they can still be flushed.
+     */
+    virtual ~CacheMapping();
+
+    /**
+     * @brief Size of the object in bytes.
+     */
+    virtual usize size() = 0;
+
+    /**
+     * @brief How far writes may extend the object, in bytes.
+     */
+    virtual usize capacity() { return size(); }
+
+    /**
+     * @brief Start reading a run of consecutive pages. Each page is reported
+     * through `cacheFilled()`, possibly before this returns.
+     */
+    virtual Res<> fill(Slice<CachePage*> pages) = 0;
+
+    /**
+     * @brief Start writing a run of consecutive pages back. Each page is
+     * reported through `cacheFlushed()`.
+     */
+    virtual Res<> flush(Slice<CachePage*> pages) = 0;
+
+    /**
+     * @brief Poll the device under the mapping, for waiters on its pages.
+     */
+    virtual void poll() { }
+};
+
+/**
+ * @brief A mapping over a whole storage device, moving pages through the
+ * block layer.
+ */
+struct BlkMapping : public CacheMapping {
+    StorDev& _dev;
+
+    BlkMapping(StorDev& dev) : _dev(dev) { }
+
+    ~BlkMapping();
+
+    usize size() override { return _dev._blockCount * _dev._blockSize; }
+
+    Res<> fill(Slice<CachePage*> pages) override;
+
+    Res<> flush(Slice<CachePage*> pages) override;
+
+    void poll() override { _dev.poll(); }
+};
+
+void cacheFilled(CachePage& page, Res<> res);
+
+void cacheFlushed(CachePage& page, Res<> res);
+
+/**
+ * @brief Look a page up, reading it in on a miss. The page is returned
+ * up to date and referenced, release it with `cachePut()`.
+ */
+Res<CachePage*> cacheGet(CacheMapping& mapping, u64 index);
+
+void cachePut(CachePage& page);
+
+/**
+ * @brief Mark a page written to, for the next write-back to take.
+ */
+void cacheDirty(CachePage& page);
+
+/**
+ * @brief Start reading up to `count` pages from `index` that are not cached
+ * yet, without waiting for them.
+ *
+ * @return The number of pages submitted.
+ */
+usize cacheReadahead(CacheMapping& mapping, u64 index, usize count);
+
+/**
+ * @brief Record a read of pages `first` to `last` and start the read-ahead
+ * its pattern calls for: a growing window past sequential reads, the next
+ * extents of strided ones, nothing for random ones.
+ *
+ * @return The number of pages submitted.
+ */
+usize cacheAdvise(CacheMapping&   mapping,
+                  CacheReadahead& ra,
+                  u64             first,
+                  u64             last);
+
+Res<usize> cacheRead(CacheMapping&   mapping,
+                     usize           offset,
+                     Bytes           buf,
+                     CacheReadahead* ra = nullptr);
+
+/**
+ * @brief A cached page lent to an `IoBuf`, held in the cache until its last
+ * view goes. Views are for reading, writes through them are not tracked.
+ */
+struct CacheIoPage : public Sdk::Io::IoPage {
+    CachePage& page;
+
+    CacheIoPage(CachePage& page) : page(page) { }
+
+    ~CacheIoPage() override { cachePut(page); }
+
+    byte* buf() override { return (byte*) page.virt; }
+
+    usize len() const override { return PAGE_SIZE; }
+
+    uflat phys() const override { return page.phys; }
+};
+
+/**
+ * @brief Like `cacheRead()`, but append the cached pages themselves to `out`
+ * instead of copying out of them.
+ */
+Res<usize> cacheView(CacheMapping&   mapping,
+                     usize           offset,
+                     usize           len,
+                     IoBuf&          out,
+                     CacheReadahead* ra = nullptr);
+
+Res<usize> cacheWrite(CacheMapping& mapping, usize offset, Bytes buf);
+
+/**
+ * @brief Write every dirty page of the mapping back and wait for it.
+ */
+Res<> cacheSync(CacheMapping& mapping);
+
+/**
+ * @brief Evict up to `count` clean, unreferenced pages. Dirty pages met on
+ * the way are queued for write-back so a later pass can take them, except
+ * those a mapping can still write, left to `cacheSync()`.
+ *
+ * @return The number of pages freed.
+ */
+usize cacheShrink(usize count);
+
+} // namespace Realms::Sys::Io
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <realms/io/dev.h>
+#include <sdk-io/iobuf.h>
 #include <sdk-io/seek.h>
 #include <sdk-meta/opt.h>
 #include <sdk-meta/rc.h>
@@ -11,16 +12,68 @@
 
 namespace Realms::Sys::Io {
 
+using Sdk::Io::IoBuf;
 using Sdk::Io::Seek;
 using Sdk::Io::Whence;
 
+struct BlkDev;
+struct BlkRequest;
+
 struct StorDev : public Dev {
-    usize _blockSize { 512 };
-    usize _blockCount { 0 };
+    usize   _blockSize { 512 };
+    usize   _blockCount { 0 };
+    BlkDev* _blk { nullptr }; // Block layer state, created on first use
+
+    using Dev::Dev;
 
     virtual Res<usize> read(Seek seek, Bytes& buf) = 0;
 
     virtual Res<usize> write(Seek seek, Bytes const& buf) = 0;
+
+    /**
+     * @brief Read into the segments of `buf` through the block layer, so
+     * the driver transfers straight into its pages. Position and length
+     * must be whole blocks.
+     */
+    virtual Res<usize> readv(Seek seek, IoBuf& buf);
+
+    virtual Res<usize> writev(Seek seek, IoBuf const& buf);
+
+    /**
+     * @brief Number of hardware submission queues, processors are spread
+     * over them.
+     */
+    virtual usize queues() { return 1; }
+
+    /**
+     * @brief Largest request, in blocks, the block layer may build by
+     * merging.
+     */
+    virtual usize maxBlocks() { return 256; }
+
+    /**
+     * @brief Start `req` on hardware queue `queue`, calling `req.end()` once
+     * done. The default runs it synchronously through read() and write().
+     * Nothing polls the device afterwards, so one without an interrupt must
+     * complete the request before returning.
+     *
+     * @retval An error if the request could not be started, in which case
+     * `req.end()` must not have been called.
+     */
+    virtual Res<> submit(BlkRequest& req, usize queue);
+
+    /**
+     * @brief Collect finished requests while the interrupt that would report
+     * them cannot be delivered, as at boot. Called by anyone waiting on the
+     * device, never from an interrupt.
+     */
+    virtual void poll() { }
+
+    /**
+     * @brief Called once a batch of submit() calls on `queue` is over, so
+     * the hardware can be told about all of them at once.
+     */
+    virtual void commit(usize queue) { (void) queue; }
 };
 
 } // namespace Realms::Sys::Io
@@ -1,14 +1,27 @@
 #include <realms/io/devtree.h>
+#include <realms/io/drv.h>
+#include <sdk-meta/hash.h>
 
 namespace Realms::Sys::Io {
 
+Devtree::Node::Node(Node* parent, Str key) : parent(parent) {
+    for (usize i = 0; i < key.len(); i++)
+        _key.pushBack(key.buf()[i]);
+}
+
+Opt<Dev&> Devtree::Node::dev() {
+    auto* entry = this->entry.load(Acquire);
+    if (not entry)
+        return NONE;
+    return *entry->dev;
+}
+
 Devtree::Devtree()
-    : _root(makeBox<Node>(
-          makeRc<Dev>("device-tree-root"s, "/"s, Dev::Type::SoftwareDevice),
-          NONE,
-          8)),
-      _count(1),
-      _table(16) {
+    : _root(new Node(nullptr, Str {})),
+      _stats({ .count = 1, .version = 0 }) {
+    auto root
+        = makeRc<Dev>("device-tree-root"s, "/"s, Dev::Type::SoftwareDevice);
+    _add(root, 0);
 }
 
 Devtree::Devtree(Items<Rc<Dev>> devices) : Devtree() {
@@ -16,14 +29,203 @@ Devtree::Devtree(Items<Rc<Dev>> devices) : Devtree() {
         mount(dev);
 }
 
+Devtree::~Devtree() {
+    for (auto* entry = _head.load(); entry;) {
+        auto* next = entry->next;
+        delete entry;
+        entry = next;
+    }
+
+    for (auto* bound = _bound.load(); bound;) {
+        for (auto* link = bound->head.load(); link;) {
+            auto* next = link->next;
+            delete link;
+            link = next;
+        }
+        auto* next = bound->next;
+        delete bound;
+        bound = next;
+    }
+
+    _free(_root);
+}
+
+Devtree::Node& Devtree::root() {
+    return *_root;
+}
+
+// MARK: - Writers -------------------------------------------------------------
+
+Devtree::Node* Devtree::_place(Dev const& dev) {
+    Node* at   = _root;
+    Str   path = dev._path.str();
+
+    for (usize i = 0; i < path.len();) {
+        usize end = i;
+        while (end < path.len() and path.buf()[end] != '/')
+            end++;
+
+        Str comp { path.buf() + i, end - i };
+        i = end + 1;
+        if (not comp)
+            continue;
+
+        Node* next = _childOf(at, comp);
+        if (not next) {
+            next           = new Node(at, comp);
+            next->_sibling = at->_child.load();
+            at->_child.store(next, Release);
+        }
+        at = next;
+    }
+
+    // The path is taken, or says nothing: the device goes under it by name.
+    // Two devices with the same name there get a node each, the newest one
+    // is found first.
+    if (at->entry.load()) {
+        auto* node     = new Node(at, dev._name.str());
+        node->_sibling = at->_child.load();
+        at->_child.store(node, Release);
+        at = node;
+    }
+    return at;
+}
+
+Devtree::Entry* Devtree::_add(Rc<Dev> device, usize version) {
+    auto* node  = _place(*device);
+    u64   hash  = _hash(device->_name.str());
+    auto& type  = _types[(usize) device->_type];
+    auto& names = _names[hash % BUCKETS];
+
+    // Built whole before any reader can reach it.
+    auto* entry = new Entry {
+        .dev        = device,
+        .node       = node,
+        .version    = version,
+        .next       = _head.load(),
+        .nextOfType = type.load(),
+        .nextOfName = names.load(),
+        .hash       = hash,
+    };
+    _head.store(entry, Release);
+    type.store(entry, Release);
+    names.store(entry, Release);
+    node->entry.store(entry, Release);
+
+    if (device->_drv)
+        _index(entry, *device->_drv, version);
+    return entry;
+}
+
+void Devtree::_index(Entry* entry, Drv& drv, usize version) {
+    auto* bound = _bound.load();
+    while (bound and bound->drv != &drv)
+        bound = bound->next;
+
+    if (not bound) {
+        bound = new _Bound { .drv = &drv, .next = _bound.load() };
+        _bound.store(bound, Release);
+    }
+
+    auto* link = new _Link {
+        .entry   = entry,
+        .version = version,
+        .next    = bound->head.load(),
+    };
+    bound->head.store(link, Release);
+}
+
 Devtree::Node& Devtree::mount(Rc<Dev> device) {
     LockScoped lk(_lock);
+
+    // Published before the version moves, so a snapshot of the new version
+    // always finds the entry.
+    usize version = _stats.read().version + 1;
+    auto* entry   = _add(device, version);
+
+    _stats.with([](Stats& stats) {
+        stats.count++;
+        stats.version++;
+    });
+    return *entry->node;
 }
 
-Opt<Rc<Dev>> Devtree::find(Str name) {
+void Devtree::bind(Rc<Dev> device, Drv& drv) {
     LockScoped lk(_lock);
 
-    return _table[name].value.mapTo$(it.dev);
+    auto* entry  = _entry(*device);
+    device->_drv = drv;
+    if (not entry)
+        return;
+
+    usize version = _stats.read().version + 1;
+    _index(entry, drv, version);
+    _stats.with([](Stats& stats) { stats.version++; });
+}
+
+void Devtree::_free(Node* node) {
+    for (auto* child = node->_child.load(); child;) {
+        auto* next = child->_sibling;
+        _free(child);
+        child = next;
+    }
+    delete node;
+}
+
+// MARK: - Readers -------------------------------------------------------------
+
+u64 Devtree::_hash(Str name) {
+    return fnv64((byte const*) name.buf(), name.len());
+}
+
+Devtree::Entry* Devtree::_entry(Dev const& dev) {
+    u64   hash  = _hash(dev._name.str());
+    auto* entry = _names[hash % BUCKETS].load(Acquire);
+    while (entry and &*entry->dev != &dev)
+        entry = entry->nextOfName;
+    return entry;
+}
+
+Devtree::Node* Devtree::_childOf(Node* node, Str key) {
+    auto* child = node->_child.load(Acquire);
+    while (child and child->key() != key)
+        child = child->_sibling;
+    return child;
+}
+
+Devtree::Entry* Devtree::_find(Str name) {
+    u64   hash  = _hash(name);
+    auto* entry = _names[hash % BUCKETS].load(Acquire);
+    for (; entry; entry = entry->nextOfName) {
+        if (entry->hash == hash and entry->dev->_name.str() == name)
+            return entry;
+    }
+    return nullptr;
+}
+
+Opt<Dev&> Devtree::find(Str name) {
+    auto* entry = _find(name);
+    if (not entry)
+        return NONE;
+    return *entry->dev;
+}
+
+Opt<Dev&> Devtree::lookup(Str path) {
+    Node* at = _root;
+    for (usize i = 0; i < path.len() and at;) {
+        usize end = i;
+        while (end < path.len() and path.buf()[end] != '/')
+            end++;
+
+        Str comp { path.buf() + i, end - i };
+        i = end + 1;
+        if (comp)
+            at = _childOf(at, comp);
+    }
+
+    if (not at)
+        return NONE;
+    return at->dev();
 }
 
 } // namespace Realms::Sys::Io
@@ -1,42 +1,190 @@
 #pragma once
 
 #include <realms/io/dev.h>
-#include <sdk-meta/box.h>
+#include <sdk-meta/array.h>
+#include <sdk-meta/atomic.h>
 #include <sdk-meta/lock.h>
+#include <sdk-meta/rc.h>
+#include <sdk-meta/vec.h>
 
 namespace Realms::Sys::Io {
 
+/**
+ * @brief Every device of the system, placed in a trie by the components of
+ * its path and indexed by name, type and driver.
+ *
+ * Devices are only ever added. Entries, trie nodes and index links are
+ * published fully built and never change or go away before the tree does,
+ * so lookups and iteration take no lock and need no read-side section.
+ * Readers borrow the devices, valid for as long as the tree, since copying
+ * an entry's reference would race on its count.
+ * Each entry carries the version of the tree that added it, which is all a
+ * snapshot needs to see the tree as it was.
+ */
 struct Devtree final {
+    static constexpr usize BUCKETS = 256;
+    static constexpr usize TYPES   = (usize) Dev::Type::SoftwareDevice + 1;
+
+    struct Node;
+
+    struct Entry {
+        Rc<Dev> dev;
+        Node*   node;
+        usize   version;    // Version of the tree that added it
+        Entry*  next;       // Added before this one
+        Entry*  nextOfType; // Of the same type, added before
+        Entry*  nextOfName; // In the same name bucket
+        u64     hash;       // Of the name
+    };
+
     struct Node {
-        Rc<Dev>    dev;
-        Opt<Node&> parent;
-        Vec<Node>  childrens;
+        Vec<char>      _key;               // Path component, empty at root
+        Node*          parent;
+        Atomic<Entry*> entry { nullptr };  // Null for a bare component
+        Atomic<Node*>  _child { nullptr }; // Most recently added
+        Node*          _sibling = nullptr;
+
+        Node(Node* parent, Str key);
+
+        Str key() const { return { _key.buf(), _key.len() }; }
+
+        Opt<Dev&> dev();
+    };
+
+    // Devices bound to one driver, after they were added to the tree.
+    struct _Link {
+        Entry* entry;
+        usize  version;
+        _Link* next;
+    };
+
+    struct _Bound {
+        Drv*           drv;
+        Atomic<_Link*> head { nullptr };
+        _Bound*        next;
+    };
+
+    struct Stats {
+        usize count;
+        usize version;
+    };
+
+    /**
+     * @brief The tree as of one version. Cheap to take and valid for as
+     * long as the tree, iterating it sees nothing added after it was taken.
+     * Devices come newest first.
+     */
+    struct Snapshot {
+        Devtree* _tree;
+        usize    version;
+        usize    count;
+
+        void each(auto&& f) const {
+            auto* entry = _tree->_head.load(Acquire);
+            for (; entry; entry = entry->next) {
+                if (entry->version <= version)
+                    f(*entry->dev);
+            }
+        }
+
+        void each(Dev::Type type, auto&& f) const {
+            auto* entry = _tree->_types[(usize) type].load(Acquire);
+            for (; entry; entry = entry->nextOfType) {
+                if (entry->version <= version)
+                    f(*entry->dev);
+            }
+        }
+
+        void each(Drv& drv, auto&& f) const {
+            auto* bound = _tree->_bound.load(Acquire);
+            while (bound and bound->drv != &drv)
+                bound = bound->next;
+            if (not bound)
+                return;
+
+            auto* link = bound->head.load(Acquire);
+            for (; link; link = link->next) {
+                if (link->version <= version)
+                    f(*link->entry->dev);
+            }
+        }
     };
 
-    Box<Node>        _root;
-    usize            _count;
-    usize            _version;
-    Lock             _lock;
-    Dict<Str, Node&> _table;
+    Node*                          _root;
+    SeqLock<Stats>                 _stats;
+    Lock                           _lock; // Serializes writers only
+    Atomic<Entry*>                 _head { nullptr };
+    Array<Atomic<Entry*>, TYPES>   _types {};
+    Array<Atomic<Entry*>, BUCKETS> _names {};
+    Atomic<_Bound*>                _bound { nullptr };
 
     Devtree();
 
     Devtree(Items<Rc<Dev>> devices);
 
+    ~Devtree();
+
     Node& root();
 
+    usize count() const { return _stats.read().count; }
+
+    usize version() const { return _stats.read().version; }
+
+    Snapshot snapshot() {
+        auto stats = _stats.read();
+        return { this, stats.version, stats.count };
+    }
+
+    /**
+     * @brief Add `device` at its path, or under it by name when the path is
+     * empty or already taken.
+     */
     Node& mount(Rc<Dev> device);
 
+    /**
+     * @brief Record that `drv` drives `device` and index it as such.
+     */
+    void bind(Rc<Dev> device, Drv& drv);
+
     template <Meta::Extends<Dev> D>
-    [[gnu::always_inline]] Opt<Rc<D>> find(Str name) {
-        auto rc = find(name);
-        if (not rc)
+    [[gnu::always_inline]] Opt<D&> find(Str name) {
+        auto* entry = _find(name);
+        if (not entry)
             return NONE;
 
-        return rc->template cast<D>();
+        auto dev = entry->dev.template is<D>();
+        if (not dev)
+            return NONE;
+        return dev.buf();
     }
 
-    Opt<Rc<Dev>> find(Str name);
+    /**
+     * @brief The device most recently added under `name`.
+     */
+    Opt<Dev&> find(Str name);
+
+    /**
+     * @brief The device at `path`, components separated by slashes.
+     */
+    Opt<Dev&> lookup(Str path);
+
+    bool has(Dev const& dev) { return _entry(dev); }
+
+    static u64 _hash(Str name);
+
+    Entry* _entry(Dev const& dev);
+
+    Entry* _find(Str name);
+
+    static Node* _childOf(Node* node, Str key);
+
+    Node* _place(Dev const& dev);
+
+    Entry* _add(Rc<Dev> device, usize version);
+
+    void _index(Entry* entry, Drv& drv, usize version);
+
+    static void _free(Node* node);
 };
 
 } // namespace Realms::Sys::Io
@@ -0,0 +1,136 @@
+#include <realms/io/drivers.h>
+#include <sdk-logs/logger.h>
+
+namespace Realms::Sys::Io {
+
+Drivers::~Drivers() {
+    _index.each([](u64, _Claim& claim) { delete &claim; });
+}
+
+void Drivers::add(Drv& drv, Slice<Str> requisites) {
+    _all.pushBack({ .drv = &drv, .requisites = requisites });
+
+    auto keys = drv.keys();
+    if (not keys.len()) {
+        _keyless.pushBack(&drv);
+        return;
+    }
+
+    for (auto key : keys) {
+        auto* claim = _index.get(key);
+        if (not claim)
+            claim = _index.put(key, new _Claim());
+        claim->drivers.pushBack(&drv);
+    }
+}
+
+Opt<Drv&> Drivers::match(Bus& bus, Rc<Dev> dev) {
+    Vec<DrvKey> keys;
+    if (auto res = bus.keys(dev, keys); not res)
+        logWarn("Drivers::match: no keys for {}: {}", dev->_name,
+                res.none().msg());
+
+    // A driver claiming several keys of the device is only asked once.
+    Vec<Drv*> asked;
+    auto      accepts = [&](Drv* drv) {
+        for (auto* other : asked) {
+            if (other == drv)
+                return false;
+        }
+        asked.pushBack(drv);
+        return drv->match(dev).unwrapOr(false);
+    };
+
+    for (auto key : keys) {
+        auto* claim = _index.get(key);
+        if (not claim)
+            continue;
+        for (auto* drv : claim->drivers) {
+            if (accepts(drv))
+                return *drv;
+        }
+    }
+
+    for (auto* drv : _keyless) {
+        if (accepts(drv))
+            return *drv;
+    }
+    return NONE;
+}
+
+Slice<Str> Drivers::_requisitesOf(Drv& drv) {
+    for (auto& entry : _all) {
+        if (entry.drv == &drv)
+            return entry.requisites;
+    }
+    return {};
+}
+
+bool Drivers::_ready(_Bind const& bind, Slice<_Bind> binds) {
+    for (auto req : bind.requisites) {
+        if (req == bind.drv->name)
+            continue;
+
+        // Requisites no device is bound to are modules, loaded by now.
+        for (auto& other : binds) {
+            if (not other.done and other.drv->name == req)
+                return false;
+        }
+    }
+    return true;
+}
+
+Res<usize> Drivers::start(Slice<Bus*> buses, Devtree& tree) {
+    Vec<_Bind> binds;
+    for (auto* bus : buses) {
+        for (auto& dev : try$(bus->probe())) {
+            if (dev->_drv)
+                continue;
+            if (not tree.has(*dev))
+                tree.mount(dev);
+
+            if (auto drv = match(*bus, dev)) {
+                binds.pushBack({
+                    .dev        = dev,
+                    .drv        = &drv.unwrap(),
+                    .requisites = _requisitesOf(*drv),
+                });
+            }
+        }
+    }
+
+    usize up   = 0;
+    usize left = binds.len();
+    while (left) {
+        // Picked whole before any of it starts, so a wave never waits on
+        // itself.
+        Vec<_Bind*> wave;
+        for (auto& bind : binds) {
+            if (not bind.done and _ready(bind, binds))
+                wave.pushBack(&bind);
+        }
+
+        if (not wave.len()) {
+            logError("Drivers::start: {} devices wait on each other", left);
+            break;
+        }
+
+        for (auto* bind : wave) {
+            auto res = bind->drv->onInit(bind->dev);
+            if (res) {
+                bind->dev->_status = Dev::Status::Initialized;
+                tree.bind(bind->dev, *bind->drv);
+                up++;
+            } else {
+                bind->dev->_status = Dev::Status::Unavailable;
+                logWarn("Drivers::start: {} failed on {}: {}",
+                        bind->drv->name, bind->dev->_name, res.none().msg());
+            }
+            bind->done = true;
+            left--;
+        }
+    }
+    return Ok(up);
+}
+
+} // namespace Realms::Sys::Io
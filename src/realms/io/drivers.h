@@ -0,0 +1,82 @@
+#pragma once
+
+#include <realms/io/bus.h>
+#include <realms/io/devtree.h>
+#include <realms/io/drv.h>
+#include <sdk-meta/opt.h>
+#include <sdk-meta/radix.h>
+#include <sdk-meta/vec.h>
+
+namespace Realms::Sys::Io {
+
+/**
+ * @brief Binds the devices buses find to the registered drivers and brings
+ * them up.
+ *
+ * Drivers are indexed by the keys they claim, so placing a device costs a
+ * lookup per key it has instead of a `match` call per driver, and `match`
+ * only settles between the few candidates. Bound devices then start in
+ * waves: a device waits for every device bound to a driver named in the
+ * module requisites of its own, and no device of a wave depends on another
+ * of the same wave.
+ */
+struct Drivers {
+    struct _Claim {
+        Vec<Drv*> drivers; // In registration order
+    };
+
+    struct _Driver {
+        Drv*       drv;
+        Slice<Str> requisites;
+    };
+
+    struct _Bind {
+        Rc<Dev>    dev;
+        Drv*       drv;
+        Slice<Str> requisites;
+        bool       done = false;
+    };
+
+    Radix<_Claim> _index;
+    Vec<Drv*>     _keyless; // Asked about every device
+    Vec<_Driver>  _all;
+
+    ~Drivers();
+
+    /**
+     * @brief Register `drv`, whose devices start after those of the drivers
+     * named in `requisites`.
+     */
+    void add(Drv& drv, Slice<Str> requisites);
+
+    /**
+     * @brief Register `drv` with the requisites its type declares, as for a
+     * `Mod`.
+     */
+    template <Meta::Extends<Drv> D>
+    void add(D& drv) {
+        add(drv, D::requisites);
+    }
+
+    /**
+     * @brief The driver for `dev`: the first of those claiming one of its
+     * keys, from the most specific, whose `match` agrees, then the first
+     * keyless one that does.
+     */
+    Opt<Drv&> match(Bus& bus, Rc<Dev> dev);
+
+    /**
+     * @brief Probe `buses`, mount what they find into `tree` and start every
+     * device a driver takes, binding it there once up.
+     *
+     * @retval The number of devices started. Failed devices are marked
+     * unavailable, devices whose drivers require each other never start.
+     */
+    Res<usize> start(Slice<Bus*> buses, Devtree& tree);
+
+    Slice<Str> _requisitesOf(Drv& drv);
+
+    static bool _ready(_Bind const& bind, Slice<_Bind> binds);
+};
+
+} // namespace Realms::Sys::Io
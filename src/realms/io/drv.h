@@ -1,15 +1,45 @@
 #pragma once
 
 #include <realms/io/dev.h>
+#include <sdk-meta/hash.h>
 #include <sdk-meta/rc.h>
 #include <sdk-meta/res.h>
+#include <sdk-meta/slice.h>
 #include <sdk-text/str.h>
 
 namespace Realms::Sys::Io {
 
+/**
+ * @brief An id a bus gives its devices and drivers claim them by: the id
+ * space in the top byte, the bus' own id below it.
+ */
+using DrvKey = u64;
+
+enum struct DrvSpace : u8 {
+    Pci  = 1,
+    Acpi = 2,
+};
+
+static constexpr DrvKey drvKey(DrvSpace space, u64 id) {
+    return ((u64) space << 56) | (id & 0x00FF'FFFF'FFFF'FFFF);
+}
+
+/**
+ * @brief The key of ACPI `_HID` or `_CID` `hid`, such as "PNP0501".
+ */
+inline DrvKey acpiKey(Str hid) {
+    return drvKey(DrvSpace::Acpi, fnv64((byte const*) hid.buf(), hid.len()));
+}
+
 struct Drv {
     Str name;
 
+    /**
+     * @brief Keys of the devices the driver may take, `match` is only asked
+     * about those. Empty to be asked about every device.
+     */
+    virtual Slice<DrvKey> keys() { return {}; }
+
     virtual Res<bool> match(Rc<Dev> dev) = 0;
 
     virtual Res<> onInit(Rc<Dev> dev) = 0;
@@ -19,11 +19,73 @@ bool File::canWrite(FileHandle& handle) const {
 }
 
 Res<usize> File::read(FileHandle& handle, Seek whence, Bytes bytes) {
-    return Error::notImplemented("File::read: not implemented");
+    if (not mapping)
+        return Error::notImplemented("File::read: not implemented");
+
+    usize pos = whence.apply(handle.offset.offset, size);
+    usize n   = try$(cacheRead(*mapping, pos, bytes, &handle.readahead));
+
+    handle.offset = Seek::fromBegin(pos + n);
+    return Ok(n);
 }
 
 Res<usize> File::write(FileHandle& handle, Seek whence, Bytes bytes) {
-    return Error::notImplemented("File::write: not implemented");
+    if (not mapping)
+        return Error::notImplemented("File::write: not implemented");
+
+    // Grow the file first, write-back must not take the new pages for ones
+    // past the end while they are being copied in.
+    usize pos = whence.apply(handle.offset.offset, size);
+    usize old = size;
+    size      = max(size, min(pos + bytes.len(), mapping->capacity()));
+
+    auto n = cacheWrite(*mapping, pos, bytes);
+    if (not n) {
+        size = old;
+        return n.none();
+    }
+
+    handle.offset = Seek::fromBegin(pos + n.unwrap());
+    size          = max(old, pos + n.unwrap());
+    return n;
+}
+
+Res<usize> File::readv(FileHandle& handle,
+                       Seek        whence,
+                       usize       len,
+                       IoBuf&      out) {
+    if (mapping) {
+        usize pos = whence.apply(handle.offset.offset, size);
+        usize n   = try$(cacheView(*mapping, pos, len, out, &handle.readahead));
+
+        handle.offset = Seek::fromBegin(pos + n);
+        return Ok(n);
+    }
+
+    // Nothing to lend, the bytes land in fresh pages.
+    auto  buf  = IoBuf::alloc(len);
+    usize done = 0;
+    for (auto& seg : buf.segs()) {
+        auto  at = done ? Seek::fromCurrent(0) : whence;
+        usize n  = try$(read(handle, at, seg.bytes()));
+        done += n;
+        if (n < seg.len)
+            break;
+    }
+    out.append(buf.slice(0, done));
+    return Ok(done);
+}
+
+Res<usize> File::writev(FileHandle& handle, Seek whence, IoBuf const& buf) {
+    usize done = 0;
+    for (auto& seg : buf.segs()) {
+        auto  at = done ? Seek::fromCurrent(0) : whence;
+        usize n  = try$(write(handle, at, seg.bytes()));
+        done += n;
+        if (n < seg.len)
+            break;
+    }
+    return Ok(done);
 }
 
 } // namespace Realms::Sys::Io
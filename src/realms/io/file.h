@@ -1,6 +1,8 @@
 #pragma once
 
+#include <realms/io/cache.h>
 #include <realms/io/dev.h>
+#include <sdk-io/iobuf.h>
 #include <sdk-io/path.h>
 #include <sdk-io/seek.h>
 #include <sdk-io/traits.h>
@@ -12,6 +14,7 @@
 
 namespace Realms::Sys::Io {
 
+using Sdk::Io::IoBuf;
 using Sdk::Io::Path;
 using Sdk::Io::Seek;
 using Sdk::Io::Whence;
@@ -80,6 +83,7 @@ enum struct FileSource {
 struct FileHandle : Sdk::Io::Reader, Sdk::Io::Writer, Sdk::Io::Seeker {
     Rc<Io::File> const file;
     Seek               offset;
+    CacheReadahead     readahead;
 };
 
 struct File : public Node {
@@ -90,6 +94,11 @@ struct File : public Node {
     DateTime modified;
     DateTime accessed;
 
+    CacheMapping* mapping = nullptr; // Page cache, null for uncached files
+
+    File(Rc<Dev> device, Path path)
+        : Node { device, path }, path(path), size(0) { }
+
     virtual ~File() = default;
 
     /**
@@ -134,10 +143,23 @@ struct File : public Node {
      * @return Res<usize> 
      */
     virtual Res<usize> write(FileHandle& handle, Seek whence, Bytes bytes);
+
+    /**
+     * @brief Append up to `len` bytes from `whence` to `out`. Cached files
+     * lend their pages, so nothing is copied.
+     */
+    virtual Res<usize> readv(FileHandle& handle,
+                             Seek        whence,
+                             usize       len,
+                             IoBuf&      out);
+
+    virtual Res<usize> writev(FileHandle&  handle,
+                              Seek         whence,
+                              IoBuf const& buf);
 };
 
 struct Directory : public Node {
-    Vec<Str> items;
+    Vec<String> items;
 };
 
 struct Symlink : public Node { };
@@ -0,0 +1,1402 @@
+#include <realms/hal/vmm.h>
+#include <realms/io/fs.ext2.h>
+#include <sdk-logs/logger.h>
+#include <sdk-meta/_embed.h>
+#include <sdk-meta/array.h>
+#include <sdk-meta/atomic.h>
+#include <sdk-meta/vec.h>
+
+namespace Realms::Sys::Io {
+
+namespace {
+
+static constexpr usize COPY_CHUNK = 64 * 1024;
+
+bool _isDir(ext2::Inode const& inode) {
+    return (inode.mode & ext2::TypeMask) == ext2::Directory;
+}
+
+usize _fileSize(ext2::Inode const& inode) {
+    usize size = inode.sizeLo;
+    if ((inode.mode & ext2::TypeMask) == ext2::Regular)
+        size |= (usize) (u32) inode.diracl << 32;
+    return size;
+}
+
+void _setSize(ext2::Inode& inode, usize size) {
+    inode.sizeLo = (u32) size;
+    if ((inode.mode & ext2::TypeMask) == ext2::Regular)
+        inode.diracl = (u32) (size >> 32);
+}
+
+// Fast symlinks keep their target in `blocks` in place of block numbers, they
+// own no block but the extended attribute one.
+bool _isInline(ext2::Inode const& inode, usize blockSize) {
+    usize acl = inode.fileacl ? blockSize / 512 : 0;
+    return (inode.mode & ext2::TypeMask) == ext2::Symlink
+       and inode.sectors == acl;
+}
+
+void _addSectors(ext2::Inode& inode, usize blocks, usize blockSize) {
+    inode.sectors = (u32) (inode.sectors + blocks * (blockSize / 512));
+}
+
+u8 _dirType(u16 mode) {
+    switch (mode & ext2::TypeMask) {
+        case ext2::Regular:   return ext2::DirRegular;
+        case ext2::Directory: return ext2::DirDirectory;
+        case ext2::Symlink:   return ext2::DirSymlink;
+        case ext2::CharDev:   return ext2::DirCharDev;
+        case ext2::BlockDev:  return ext2::DirBlockDev;
+        case ext2::Fifo:      return ext2::DirFifo;
+        case ext2::Socket:    return ext2::DirSocket;
+        default:              return ext2::DirUnknown;
+    }
+}
+
+// Entries are 4-byte aligned, the 8-byte header included.
+usize _recLen(usize nameLen) { return alignUp(8 + nameLen, 4); }
+
+// Whether the entry at `off` holds its name and stays in its block.
+bool _fits(ext2::DirEntry const& entry, usize off, usize len, usize bs) {
+    usize rec = entry.recLen;
+    return rec >= sizeof(ext2::DirEntry) and 8 + len <= rec and
+           off % bs + rec <= bs;
+}
+
+bool _test(Vec<u8> const& bitmap, usize bit) {
+    return bitmap[bit / 8] & (1 << (bit % 8));
+}
+
+void _mark(Vec<u8>& bitmap, usize bit, bool set) {
+    if (set)
+        bitmap[bit / 8] |= (u8) (1 << (bit % 8));
+    else
+        bitmap[bit / 8] &= (u8) ~(1 << (bit % 8));
+}
+
+// First clear bit in [from, to), skipping full bytes whole.
+Opt<usize> _scan(Vec<u8> const& bitmap, usize from, usize to) {
+    for (usize bit = from; bit < to;) {
+        if (bit % 8 == 0 and bitmap[bit / 8] == 0xff) {
+            bit += 8;
+            continue;
+        }
+        if (not _test(bitmap, bit))
+            return bit;
+        bit++;
+    }
+    return NONE;
+}
+
+// A batch of page I/O split in several requests. Pages are reported once
+// the last one completes; `pending` starts with a reference held by the
+// submitter so an early completion cannot end the batch.
+struct _PageIo {
+    Atomic<usize>   pending { 1 };
+    Atomic<bool>    failed { false };
+    Vec<CachePage*> pages;
+    Vec<BlkRequest> reqs;
+    bool            write;
+};
+
+void _put(_PageIo* io) {
+    if (io->pending.fetchSub(1) != 1)
+        return;
+
+    Res<> res = Ok();
+    if (io->failed.load())
+        res = Error::invalidData("Ext2Mapping: i/o failed");
+
+    for (auto* page : io->pages) {
+        if (io->write)
+            cacheFlushed(*page, res);
+        else
+            cacheFilled(*page, res);
+    }
+    delete io;
+}
+
+Res<> _pageIo(Ext2Fs&           fs,
+              Slice<CachePage*> pages,
+              u64               first,
+              Slice<Ext2Run>    runs,
+              bool              write) {
+    usize bs  = fs._blockSize;
+    usize bpp = PAGE_SIZE / bs;
+
+    Vec<Bytes> blocks;
+    for (auto* page : pages) {
+        for (usize i = 0; i < bpp; i++)
+            blocks.pushBack(Bytes { (byte*) (page->virt + i * bs), bs });
+    }
+
+    if (not write) {
+        for (auto& run : runs) {
+            if (run.block)
+                continue;
+            for (usize i = 0; i < run.count; i++)
+                memset((void*) blocks[run.index - first + i].buf(), 0, bs);
+        }
+    }
+
+    auto* io  = new _PageIo();
+    io->write = write;
+    for (auto* page : pages)
+        io->pages.pushBack(page);
+    fs._requests(runs, first, slice(blocks), write, io->reqs);
+
+    io->pending.store(io->reqs.len() + 1);
+    {
+        BlkPlug plug;
+        for (auto& req : io->reqs) {
+            req.ctx = io;
+            req.fn  = [](BlkRequest& req, Res<> res) {
+                auto* io = static_cast<_PageIo*>(req.ctx);
+                if (not res)
+                    io->failed.store(true);
+                _put(io);
+            };
+            blkSubmit(req);
+        }
+    }
+    _put(io);
+    return Ok();
+}
+
+} // namespace
+
+// MARK: - Mapping -------------------------------------------------------------
+
+usize Ext2Mapping::size() { return _file.size; }
+
+usize Ext2Mapping::capacity() {
+    usize p = _file._fs._perBlock;
+    return (ext2::DIRECT_BLOCKS + p + p * p + p * p * p) * _file._fs._blockSize;
+}
+
+Res<> Ext2Mapping::fill(Slice<CachePage*> pages) {
+    auto& fs    = _file._fs;
+    usize bs    = fs._blockSize;
+    u64   first = pages[0]->index * (PAGE_SIZE / bs);
+    usize count = pages.len() * (PAGE_SIZE / bs);
+
+    // Blocks past the end of the file are holes, they read as zeroes.
+    usize total  = alignUp(size(), bs) / bs;
+    usize mapped = total > first ? min(count, total - first) : 0;
+
+    Vec<Ext2Run> runs;
+    {
+        LockScoped lk(_file._lock);
+        try$(fs._runs(_file._inode, first, mapped, runs));
+    }
+    if (mapped < count)
+        runs.pushBack({ first + mapped, 0, count - mapped });
+
+    return _pageIo(fs, pages, first, slice(runs), false);
+}
+
+Res<> Ext2Mapping::flush(Slice<CachePage*> pages) {
+    auto& fs = _file._fs;
+
+    // Whatever starts the write-back, blocks are allocated and pointed to
+    // in the same transaction.
+    JournalHandle handle(fs._journal);
+
+    usize bs    = fs._blockSize;
+    u64   first = pages[0]->index * (PAGE_SIZE / bs);
+    usize count = pages.len() * (PAGE_SIZE / bs);
+
+    usize total  = alignUp(size(), bs) / bs;
+    usize mapped = total > first ? min(count, total - first) : 0;
+
+    Vec<Ext2Run> runs;
+    Vec<Ext2Run> out;
+    auto         push = [&](Ext2Run run) {
+        if (out.len()) {
+            auto& last = out[out.len() - 1];
+            if (last.block + last.count == run.block and
+                last.index + last.count == run.index) {
+                last.count += run.count;
+                return;
+            }
+        }
+        out.pushBack(run);
+    };
+
+    LockScoped lk(_file._lock);
+    try$(fs._runs(_file._inode, first, mapped, runs));
+
+    // Holes get their blocks now, each run right after the block before it
+    // when that one is free, so data written piecemeal still lands in long
+    // runs.
+    u32 goal = 0;
+    for (auto run : runs) {
+        if (run.block) {
+            push(run);
+            goal = run.block + run.count;
+            continue;
+        }
+
+        if (not goal and run.index)
+            goal = try$(fs._lookup(_file._inode, run.index - 1)) + 1;
+        if (goal <= 1)
+            goal = fs._goal(_file._ino);
+
+        while (run.count) {
+            usize n     = run.count;
+            u32   block = try$(fs._allocBlocks(goal, n));
+            for (usize i = 0; i < n; i++)
+                try$(fs._install(_file._inode, run.index + i, block + i));
+            _addSectors(_file._inode, n, bs);
+            _file._dirty = true;
+
+            push({ run.index, block, n });
+            run.index += n;
+            run.count -= n;
+            goal = block + n;
+        }
+    }
+
+    // Every indirect block touched above goes out once.
+    try$(fs._indirectFlush());
+    return _pageIo(fs, pages, first, slice(out), true);
+}
+
+void Ext2Mapping::poll() {
+    _file._fs._dev->poll();
+}
+
+// MARK: - File ----------------------------------------------------------------
+
+Ext2File::Ext2File(Ext2Fs& fs, u32 ino, ext2::Inode const& inode, Path path)
+    : File(fs._dev, path), _fs(fs), _ino(ino), _inode(inode), _mapping(*this) {
+    size    = _fileSize(inode);
+    name    = this->path.len() ? this->path.comp[this->path.len() - 1].str()
+                                : Str {};
+    mapping = &_mapping;
+}
+
+Ext2File::~Ext2File() {
+    if (not _orphan) {
+        (void) sync();
+        return;
+    }
+
+    // Dirty pages go with the mapping, there is nothing to write them to.
+    if (auto res = _fs._release(_ino, _inode, false); not res)
+        logError("Ext2File: release failed: {}", res.none().msg());
+}
+
+Res<> Ext2File::sync() {
+    JournalHandle handle(_fs._journal);
+    try$(cacheSync(_mapping));
+
+    LockScoped lk(_lock);
+    if (_fileSize(_inode) != size) {
+        _setSize(_inode, size);
+        _dirty = true;
+    }
+    if (not _dirty)
+        return Ok();
+
+    try$(_fs._writeInode(_ino, _inode));
+    _dirty = false;
+    return Ok();
+}
+
+// MARK: - Mount ---------------------------------------------------------------
+
+Ext2Fs::Ext2Fs(Rc<StorDev> dev, usize offset)
+    : _dev(dev),
+      _offset(offset),
+      _super {},
+      _blockSize(1024),
+      _inodeSize(128),
+      _perBlock(256),
+      _firstInode(ext2::GOOD_OLD_INODE) {
+    name = "ext2";
+}
+
+Ext2Fs::~Ext2Fs() {
+    _indirect.each([](u64, Vec<u32>& entries) { delete &entries; });
+    _indirect.clear();
+    if (not _journal)
+        return;
+
+    // A log left behind is replayed on the next mount, here or elsewhere.
+    auto res = _journal->checkpoint();
+    delete _journal;
+    _journal = nullptr;
+    if (not res) {
+        logError("Ext2Fs: checkpoint failed: {}", res.none().msg());
+        return;
+    }
+
+    _super.featureIncompat = _super.featureIncompat & ~ext2::Recover;
+    if (auto res = _writeSuper(); not res)
+        logError("Ext2Fs: superblock write failed: {}", res.none().msg());
+}
+
+Res<Rc<Ext2Fs>> Ext2Fs::mount(Rc<StorDev> dev, usize offset) {
+    auto  rc = makeRc<Ext2Fs>(dev, offset);
+    auto& fs = *rc;
+    try$(fs._load());
+
+    // Feature flags only exist from revision 1 on.
+    auto& super   = fs._super;
+    bool  dynamic = super.vmajor >= 1;
+    bool  recover = dynamic and (super.featureIncompat & ext2::Recover);
+    if (dynamic and (super.featureCompat & ext2::HasJournal)) {
+        if (auto res = fs._openJournal(); not res) {
+            // Without anything to replay, ext3 can be written as ext2.
+            if (recover)
+                return res.none();
+            logWarn("Ext2Fs::mount: journal unusable: {}", res.none().msg());
+        } else {
+            // Replay may have rewritten the superblock and descriptors.
+            // Other systems only replay a journal flagged as needing it, so
+            // the flag goes home before anything else is logged.
+            try$(fs._load());
+            super.featureIncompat = super.featureIncompat | ext2::Recover;
+            try$(fs._writeSuper());
+            try$(fs._journal->checkpoint());
+            recover = false;
+        }
+    }
+    if (recover)
+        return Error::notSupported("Ext2Fs::mount: journal needs replaying");
+
+    return Ok(rc);
+}
+
+Res<> Ext2Fs::_load() {
+    // The superblock sits 1 KiB in whatever the block size, read the device
+    // blocks around it.
+    usize   devBs = _dev->_blockSize;
+    usize   at    = _offset + ext2::SUPERBLK_OFFSET;
+    usize   start = alignDown(at, devBs);
+    Vec<u8> buf;
+    buf.resize(alignUp(at + sizeof(ext2::Superblk), devBs) - start, 0);
+    Bytes bytes = buf;
+    try$(_dev->read(Seek::fromBegin(start), bytes));
+    memcpy(&_super, buf.buf() + (at - start), sizeof(ext2::Superblk));
+
+    auto& super    = _super;
+    u32   incompat = ext2::FileType | ext2::Recover;
+    if (super.magic != ext2::MAGIC)
+        return Error::invalidData("Ext2Fs::mount: bad magic");
+    if (super.vmajor >= 1 and (super.featureIncompat & ~incompat))
+        return Error::notSupported("Ext2Fs::mount: incompatible features");
+
+    _blockSize = 1024uz << super.blockSize;
+    if (_blockSize > PAGE_SIZE or _blockSize % devBs)
+        return Error::notSupported("Ext2Fs::mount: unsupported block size");
+    if (_offset % devBs or not super.blocksPergroup or not super.inodesPergroup)
+        return Error::invalidData("Ext2Fs::mount: bad geometry");
+
+    _perBlock = _blockSize / sizeof(u32);
+    if (super.vmajor >= 1) {
+        _inodeSize  = super.inodeSize;
+        _firstInode = super.firstInode;
+    }
+
+    _indirect.each([](u64, Vec<u32>& entries) { delete &entries; });
+    _indirect.clear();
+    _indirectOrder.clear();
+    _indirectDirty.clear();
+
+    usize per    = super.blocksPergroup;
+    usize span   = super.blocks - super.firstBlock;
+    usize groups = alignUp(span, per) / per;
+    usize descs  = sizeof(ext2::BlockGroupDesc) * groups;
+
+    Vec<u8> table;
+    table.resize(alignUp(descs, _blockSize), 0);
+    try$(_read(super.firstBlock + 1, table));
+
+    auto const* desc = (ext2::BlockGroupDesc const*) table.buf();
+    _groups.clear();
+    for (usize i = 0; i < groups; i++)
+        _groups.pushBack(_Group { .desc = desc[i] });
+    return Ok();
+}
+
+Res<> Ext2Fs::_openJournal() {
+    auto  inode = try$(_readInode(_super.journalInode));
+    usize count = _fileSize(inode) / _blockSize;
+
+    Vec<Ext2Run> runs;
+    try$(_runs(inode, 0, count, runs));
+
+    Vec<JournalExtent> extents;
+    for (auto& run : runs) {
+        if (not run.block)
+            return Error::invalidData("Ext2Fs::_openJournal: sparse journal");
+        extents.pushBack({ run.block, run.count });
+    }
+
+    _journal = try$(Journal::open(_dev, _offset, _blockSize, ::move(extents)));
+    return Ok();
+}
+
+Res<> Ext2Fs::sync() {
+    JournalHandle handle(_journal);
+    {
+        LockScoped lk(_lock);
+        if (_dirty)
+            try$(_writeGroups());
+    }
+
+    // Commits once the last handle closes, this one or the caller's.
+    if (_journal)
+        try$(_journal->commit());
+    return Ok();
+}
+
+Res<> Ext2Fs::_writeGroups() {
+    for (auto& group : _groups) {
+        if (not group.dirty)
+            continue;
+        try$(_write(group.desc.blockBitmap, group.blockBitmap));
+        try$(_write(group.desc.inodeBitmap, group.inodeBitmap));
+        group.dirty = false;
+    }
+
+    Vec<u8> table;
+    table.resize(
+        alignUp(sizeof(ext2::BlockGroupDesc) * _groups.len(), _blockSize), 0);
+    auto* desc = (ext2::BlockGroupDesc*) table.buf();
+    for (usize i = 0; i < _groups.len(); i++)
+        desc[i] = _groups[i].desc;
+    try$(_write(_super.firstBlock + 1, table));
+    try$(_writeSuper());
+
+    _dirty = false;
+    return Ok();
+}
+
+Res<> Ext2Fs::_writeSuper() {
+    // The superblock shares its block with the boot sector when blocks are
+    // larger than 1 KiB.
+    u64     block = ext2::SUPERBLK_OFFSET / _blockSize;
+    Vec<u8> buf;
+    buf.resize(_blockSize, 0);
+    try$(_read(block, buf));
+    memcpy(buf.buf() + ext2::SUPERBLK_OFFSET % _blockSize,
+           &_super,
+           sizeof(ext2::Superblk));
+    return _write(block, buf);
+}
+
+// MARK: - Blocks --------------------------------------------------------------
+
+Res<> Ext2Fs::_io(u64 block, Bytes buf, bool write) {
+    usize count = buf.len() / _blockSize;
+    if (_journal and write) {
+        for (usize i = 0; i < count; i++) {
+            auto part = slice(buf, i * _blockSize, (i + 1) * _blockSize);
+            try$(_journal->write(block + i, part));
+        }
+        return Ok();
+    }
+
+    usize devBs = _dev->_blockSize;
+    usize limit = max(_dev->maxBlocks(), 1uz) * devBs;
+
+    for (usize pos = 0; pos < buf.len(); pos += limit) {
+        usize      len = min(buf.len() - pos, limit);
+        BlkRequest req {
+            .dev   = &*_dev,
+            .op    = write ? BlkRequest::Op::Write : BlkRequest::Op::Read,
+            .lba   = _lba(block) + pos / devBs,
+            .count = len / devBs,
+            .segs  = {},
+            .fn    = nullptr,
+            .ctx   = nullptr,
+        };
+        req.segs.pushBack(slice(buf, pos, pos + len));
+        try$(blkWait(req));
+    }
+
+    // Logged blocks are newer than their home copy.
+    if (_journal) {
+        for (usize i = 0; i < count; i++)
+            _journal->read(block + i,
+                           slice(buf, i * _blockSize, (i + 1) * _blockSize));
+    }
+    return Ok();
+}
+
+void Ext2Fs::_requests(Slice<Ext2Run>   runs,
+                       u64              first,
+                       Slice<Bytes>     blocks,
+                       bool             write,
+                       Vec<BlkRequest>& out) {
+    usize devBs = _dev->_blockSize;
+    usize limit = max(_dev->maxBlocks() * devBs / _blockSize, 1uz);
+
+    for (auto& run : runs) {
+        if (not run.block)
+            continue;
+
+        for (usize done = 0; done < run.count; done += limit) {
+            usize      n = min(run.count - done, limit);
+            BlkRequest req {
+                .dev   = &*_dev,
+                .op    = write ? BlkRequest::Op::Write : BlkRequest::Op::Read,
+                .lba   = _lba(run.block + done),
+                .count = n * _blockSize / devBs,
+                .segs  = {},
+                .fn    = nullptr,
+                .ctx   = nullptr,
+            };
+
+            // Blocks of one page are adjacent in memory, so a run gets one
+            // segment per page rather than per block.
+            for (usize i = 0; i < n; i++) {
+                Bytes mem  = blocks[run.index + done + i - first];
+                usize segs = req.segs.len();
+                if (segs and req.segs[segs - 1].buf() +
+                                     req.segs[segs - 1].len() ==
+                                 mem.buf()) {
+                    auto& last = req.segs[segs - 1];
+                    last       = Bytes { last.buf(), last.len() + mem.len() };
+                } else {
+                    req.segs.pushBack(mem);
+                }
+            }
+            out.pushBack(::move(req));
+        }
+    }
+}
+
+// MARK: - Inodes --------------------------------------------------------------
+
+Res<ext2::Inode> Ext2Fs::_readInode(u32 ino) {
+    if (ino == 0 or ino > _super.inodes)
+        return Error::invalidArgument("Ext2Fs::_readInode: bad inode number");
+
+    usize group = (ino - 1) / _super.inodesPergroup;
+    usize byte  = ((ino - 1) % _super.inodesPergroup) * _inodeSize;
+
+    Vec<u8> buf;
+    buf.resize(_blockSize, 0);
+    try$(_read(_groups[group].desc.inodeTable + byte / _blockSize, buf));
+
+    ext2::Inode inode;
+    memcpy(&inode, buf.buf() + byte % _blockSize, sizeof(ext2::Inode));
+    return Ok(inode);
+}
+
+Res<> Ext2Fs::_writeInode(u32 ino, ext2::Inode const& inode) {
+    if (ino == 0 or ino > _super.inodes)
+        return Error::invalidArgument("Ext2Fs::_writeInode: bad inode number");
+
+    usize group = (ino - 1) / _super.inodesPergroup;
+    usize byte  = ((ino - 1) % _super.inodesPergroup) * _inodeSize;
+    u64   block = _groups[group].desc.inodeTable + byte / _blockSize;
+
+    // Neighbours share the block, keep them from overwriting each other.
+    LockScoped lk(_lock);
+    Vec<u8>    buf;
+    buf.resize(_blockSize, 0);
+    try$(_read(block, buf));
+    memcpy(buf.buf() + byte % _blockSize, &inode, sizeof(ext2::Inode));
+    return _write(block, buf);
+}
+
+// MARK: - Block tree ----------------------------------------------------------
+
+Res<Vec<u32>*> Ext2Fs::_indirectLoad(u32 block) {
+    if (auto* entries = _indirect.get(block))
+        return Ok(entries);
+
+    try$(_indirectEvict());
+
+    Vec<u8> buf;
+    buf.resize(_blockSize, 0);
+    try$(_read(block, buf));
+
+    auto* entries = new Vec<u32>();
+    auto* raw     = (u32le const*) buf.buf();
+    for (usize i = 0; i < _perBlock; i++)
+        entries->pushBack(raw[i]);
+
+    _indirect.put(block, entries);
+    _indirectOrder.pushBack(block);
+    return Ok(entries);
+}
+
+Res<u32> Ext2Fs::_indirectAt(u32 block, usize slot) {
+    LockScoped lk(_lock);
+    auto*      entries = try$(_indirectLoad(block));
+    return Ok((*entries)[slot]);
+}
+
+Res<> Ext2Fs::_indirectSet(u32 block, usize slot, u32 val) {
+    LockScoped lk(_lock);
+    auto*      entries = try$(_indirectLoad(block));
+    (*entries)[slot]   = val;
+
+    _indirectDirty.removeAll(block);
+    _indirectDirty.pushBack(block);
+    return Ok();
+}
+
+Res<u32> Ext2Fs::_indirectNew(u32 goal) {
+    usize count = 1;
+    u32   block = try$(_allocBlocks(goal, count));
+
+    LockScoped lk(_lock);
+    _indirectDrop(block);
+    try$(_indirectEvict());
+
+    auto* entries = new Vec<u32>();
+    entries->resize(_perBlock, 0);
+    _indirect.put(block, entries);
+    _indirectOrder.pushBack(block);
+    _indirectDirty.pushBack(block);
+    return Ok(block);
+}
+
+Res<> Ext2Fs::_indirectEvict() {
+    if (_indirectOrder.len() < INDIRECT_CACHE)
+        return Ok();
+
+    u32 block = _indirectOrder[0];
+    try$(_indirectWrite(block));
+    _indirectDrop(block);
+    return Ok();
+}
+
+Res<> Ext2Fs::_indirectWrite(u32 block) {
+    if (not _indirectDirty.removeAll(block))
+        return Ok();
+
+    auto*   entries = _indirect.get(block);
+    Vec<u8> buf;
+    buf.resize(_blockSize, 0);
+    auto* raw = (u32le*) buf.buf();
+    for (usize i = 0; i < _perBlock; i++)
+        raw[i] = (*entries)[i];
+
+    if (auto res = _write(block, buf); not res) {
+        _indirectDirty.pushBack(block);
+        return res;
+    }
+    return Ok();
+}
+
+Res<> Ext2Fs::_indirectFlush() {
+    LockScoped lk(_lock);
+    while (_indirectDirty.len())
+        try$(_indirectWrite(_indirectDirty[0]));
+    return Ok();
+}
+
+void Ext2Fs::_indirectDrop(u32 block) {
+    _indirectDirty.removeAll(block);
+
+    auto* entries = _indirect.remove(block);
+    if (not entries)
+        return;
+
+    delete entries;
+    for (usize i = 0; i < _indirectOrder.len(); i++) {
+        if (_indirectOrder[i] == block) {
+            _indirectOrder.removeAt(i);
+            break;
+        }
+    }
+}
+
+Res<usize> Ext2Fs::_path(u64 index, Array<usize, 4>& slots) {
+    u64 p = _perBlock;
+
+    if (index < ext2::DIRECT_BLOCKS) {
+        slots[0] = index;
+        return Ok(1uz);
+    }
+
+    index -= ext2::DIRECT_BLOCKS;
+    if (index < p) {
+        slots[0] = ext2::SINGLE_INDIRECT;
+        slots[1] = index;
+        return Ok(2uz);
+    }
+
+    index -= p;
+    if (index < p * p) {
+        slots[0] = ext2::DOUBLE_INDIRECT;
+        slots[1] = index / p;
+        slots[2] = index % p;
+        return Ok(3uz);
+    }
+
+    index -= p * p;
+    if (index < p * p * p) {
+        slots[0] = ext2::TRIPLE_INDIRECT;
+        slots[1] = index / (p * p);
+        slots[2] = (index / p) % p;
+        slots[3] = index % p;
+        return Ok(4uz);
+    }
+
+    return Error::fileTooLarge("Ext2Fs::_path: block past the triple indirect");
+}
+
+Res<u32> Ext2Fs::_lookup(ext2::Inode const& inode, u64 index) {
+    Array<usize, 4> slots {};
+    usize           depth = try$(_path(index, slots));
+
+    u32 block = inode.blocks[slots[0]];
+    for (usize i = 1; i < depth and block; i++)
+        block = try$(_indirectAt(block, slots[i]));
+    return Ok(block);
+}
+
+Res<> Ext2Fs::_runs(ext2::Inode const& inode,
+                    u64                index,
+                    usize              count,
+                    Vec<Ext2Run>&      out) {
+    for (u64 i = index; i < index + count; i++) {
+        u32 block = try$(_lookup(inode, i));
+
+        if (out.len()) {
+            auto& last  = out[out.len() - 1];
+            bool  joins = last.block ? block == last.block + last.count
+                                     : block == 0;
+            if (joins) {
+                last.count++;
+                continue;
+            }
+        }
+        out.pushBack({ i, block, 1 });
+    }
+    return Ok();
+}
+
+Res<> Ext2Fs::_install(ext2::Inode& inode, u64 index, u32 block) {
+    Array<usize, 4> slots {};
+    usize           depth = try$(_path(index, slots));
+
+    if (depth == 1) {
+        inode.blocks[slots[0]] = block;
+        return Ok();
+    }
+
+    u32 parent = inode.blocks[slots[0]];
+    if (not parent) {
+        parent                 = try$(_indirectNew(block));
+        inode.blocks[slots[0]] = parent;
+        _addSectors(inode, 1, _blockSize);
+    }
+
+    for (usize i = 1; i < depth - 1; i++) {
+        u32 next = try$(_indirectAt(parent, slots[i]));
+        if (not next) {
+            next = try$(_indirectNew(block));
+            try$(_indirectSet(parent, slots[i], next));
+            _addSectors(inode, 1, _blockSize);
+        }
+        parent = next;
+    }
+
+    return _indirectSet(parent, slots[depth - 1], block);
+}
+
+Res<> Ext2Fs::_freeTree(u32 block, usize depth) {
+    if (not block)
+        return Ok();
+
+    if (depth > 0) {
+        for (usize slot = 0; slot < _perBlock; slot++) {
+            u32 child = try$(_indirectAt(block, slot));
+            try$(_freeTree(child, depth - 1));
+        }
+
+        LockScoped lk(_lock);
+        _indirectDrop(block);
+    }
+    return _freeBlocks(block, 1);
+}
+
+Res<> Ext2Fs::_truncate(ext2::Inode& inode) {
+    if (_isInline(inode, _blockSize)) {
+        for (auto& block : inode.blocks)
+            block = 0;
+        _setSize(inode, 0);
+        return Ok();
+    }
+
+    // Data blocks one run at a time, then the indirect trees.
+    u32   start = 0;
+    usize count = 0;
+    for (usize i = 0; i < ext2::DIRECT_BLOCKS; i++) {
+        u32 block = inode.blocks[i];
+        if (count and block == start + count) {
+            count++;
+            continue;
+        }
+        if (count)
+            try$(_freeBlocks(start, count));
+        start = block;
+        count = block ? 1 : 0;
+    }
+    if (count)
+        try$(_freeBlocks(start, count));
+
+    try$(_freeTree(inode.blocks[ext2::SINGLE_INDIRECT], 1));
+    try$(_freeTree(inode.blocks[ext2::DOUBLE_INDIRECT], 2));
+    try$(_freeTree(inode.blocks[ext2::TRIPLE_INDIRECT], 3));
+
+    for (auto& block : inode.blocks)
+        block = 0;
+    inode.sectors = 0;
+    _setSize(inode, 0);
+    return Ok();
+}
+
+// MARK: - Allocation ----------------------------------------------------------
+
+Res<Ext2Fs::_Group*> Ext2Fs::_group(usize index, bool bitmaps) {
+    auto& group = _groups[index];
+    if (bitmaps and not group.blockBitmap.len()) {
+        Vec<u8> blocks;
+        Vec<u8> inodes;
+        blocks.resize(_blockSize, 0);
+        inodes.resize(_blockSize, 0);
+        try$(_read(group.desc.blockBitmap, blocks));
+        try$(_read(group.desc.inodeBitmap, inodes));
+        group.blockBitmap = ::move(blocks);
+        group.inodeBitmap = ::move(inodes);
+    }
+    return Ok(&group);
+}
+
+Res<> Ext2Fs::_logGroup(usize index, bool inodes) {
+    if (not _journal)
+        return Ok();
+
+    auto& group = _groups[index];
+    if (inodes)
+        try$(_write(group.desc.inodeBitmap, group.inodeBitmap));
+    else
+        try$(_write(group.desc.blockBitmap, group.blockBitmap));
+
+    usize   perBlock = _blockSize / sizeof(ext2::BlockGroupDesc);
+    usize   first    = index - index % perBlock;
+    Vec<u8> table;
+    table.resize(_blockSize, 0);
+    auto* desc = (ext2::BlockGroupDesc*) table.buf();
+    for (usize i = first; i < min(first + perBlock, _groups.len()); i++)
+        desc[i - first] = _groups[i].desc;
+    return _write(_super.firstBlock + 1 + index / perBlock, table);
+}
+
+Res<u32> Ext2Fs::_allocBlocks(u32 goal, usize& count) {
+    LockScoped lk(_lock);
+
+    usize first  = _super.firstBlock;
+    usize per    = _super.blocksPergroup;
+    usize groups = _groups.len();
+    if (goal < first or goal >= _super.blocks)
+        goal = first;
+
+    usize start = (goal - first) / per;
+    usize near  = (goal - first) % per;
+    for (usize n = 0; n <= groups; n++) {
+        usize index = (start + n) % groups;
+        if (not _groups[index].desc.freeBlocksCount)
+            continue;
+
+        auto& group = *try$(_group(index, true));
+        usize bits  = min(per, _super.blocks - first - index * per);
+
+        // The goal itself, then the rest of its group after it, then the
+        // other groups, and last the part of its group before it.
+        usize from = n == 0 ? near : 0;
+        usize to   = n == groups ? min(near, bits) : bits;
+        auto  bit  = _scan(group.blockBitmap, from, to);
+        if (not bit)
+            continue;
+
+        usize at  = bit.unwrap();
+        usize len = 1;
+        while (len < count and at + len < bits and
+               not _test(group.blockBitmap, at + len))
+            len++;
+
+        for (usize i = 0; i < len; i++)
+            _mark(group.blockBitmap, at + i, true);
+        group.desc.freeBlocksCount = (u16) (group.desc.freeBlocksCount - len);
+        _super.blocksFree          = (u32) (_super.blocksFree - len);
+        group.dirty                = true;
+        _dirty                     = true;
+        try$(_logGroup(index, false));
+
+        count = len;
+        return Ok((u32) (first + index * per + at));
+    }
+
+    return Error::storageFull("Ext2Fs::_allocBlocks: no free blocks");
+}
+
+Res<> Ext2Fs::_freeBlocks(u32 block, usize count) {
+    LockScoped lk(_lock);
+
+    usize per  = _super.blocksPergroup;
+    usize last = ~0uz; // Group of the block before, logged once left
+    for (usize i = 0; i < count; i++) {
+        usize rel   = block + i - _super.firstBlock;
+        auto& group = *try$(_group(rel / per, true));
+        if (not _test(group.blockBitmap, rel % per))
+            return Error::invalidData("Ext2Fs::_freeBlocks: block not in use");
+
+        if (last != rel / per and last != ~0uz)
+            try$(_logGroup(last, false));
+        last = rel / per;
+
+        _mark(group.blockBitmap, rel % per, false);
+        group.desc.freeBlocksCount = (u16) (group.desc.freeBlocksCount + 1);
+        _super.blocksFree          = (u32) (_super.blocksFree + 1);
+        group.dirty                = true;
+
+        // The block may come back as file data, which is not logged.
+        if (_journal)
+            _journal->revoke(block + i);
+    }
+    _dirty = true;
+    return last != ~0uz ? _logGroup(last, false) : Ok();
+}
+
+Res<u32> Ext2Fs::_allocInode(u32 parent, bool dir) {
+    LockScoped lk(_lock);
+
+    usize per    = _super.inodesPergroup;
+    usize groups = _groups.len();
+    usize start  = parent ? (parent - 1) / per : 0;
+
+    for (usize n = 0; n < groups; n++) {
+        usize index = (start + n) % groups;
+        if (not _groups[index].desc.freeInodesCount)
+            continue;
+
+        // The first inodes of the filesystem are reserved.
+        auto& group = *try$(_group(index, true));
+        usize from  = index == 0 ? _firstInode - 1 : 0;
+        auto  bit   = _scan(group.inodeBitmap, from, per);
+        if (not bit)
+            continue;
+
+        _mark(group.inodeBitmap, bit.unwrap(), true);
+        group.desc.freeInodesCount = (u16) (group.desc.freeInodesCount - 1);
+        if (dir)
+            group.desc.usedDirsCount = (u16) (group.desc.usedDirsCount + 1);
+        _super.inodesFree = (u32) (_super.inodesFree - 1);
+        group.dirty       = true;
+        _dirty            = true;
+        try$(_logGroup(index, true));
+        return Ok((u32) (index * per + bit.unwrap() + 1));
+    }
+
+    return Error::storageFull("Ext2Fs::_allocInode: no free inodes");
+}
+
+Res<> Ext2Fs::_freeInode(u32 ino, bool dir) {
+    LockScoped lk(_lock);
+
+    usize per   = _super.inodesPergroup;
+    auto& group = *try$(_group((ino - 1) / per, true));
+    _mark(group.inodeBitmap, (ino - 1) % per, false);
+    group.desc.freeInodesCount = (u16) (group.desc.freeInodesCount + 1);
+    if (dir)
+        group.desc.usedDirsCount = (u16) (group.desc.usedDirsCount - 1);
+    _super.inodesFree = (u32) (_super.inodesFree + 1);
+    group.dirty       = true;
+    _dirty            = true;
+    return _logGroup((ino - 1) / per, true);
+}
+
+u32 Ext2Fs::_goal(u32 ino) const {
+    usize group = (ino - 1) / _super.inodesPergroup;
+    return (u32) (_super.firstBlock + group * _super.blocksPergroup);
+}
+
+// MARK: - Directories ---------------------------------------------------------
+
+Res<Vec<u8>> Ext2Fs::_readAll(ext2::Inode const& inode) {
+    usize count = alignUp(_fileSize(inode), _blockSize) / _blockSize;
+
+    Vec<u8> data;
+    data.resize(count * _blockSize, 0);
+
+    Vec<Ext2Run> runs;
+    try$(_runs(inode, 0, count, runs));
+    for (auto& run : runs) {
+        if (not run.block)
+            continue;
+        try$(_read(run.block,
+                   slice(data,
+                         run.index * _blockSize,
+                         (run.index + run.count) * _blockSize)));
+    }
+    return Ok(::move(data));
+}
+
+Res<u32> Ext2Fs::_find(u32 dir, Str name) {
+    auto inode = try$(_readInode(dir));
+    if (not _isDir(inode))
+        return Error::notADirectory("Ext2Fs::_find: not a directory");
+
+    auto data = try$(_readAll(inode));
+    for (usize off = 0; off + sizeof(ext2::DirEntry) <= data.len();) {
+        auto& entry = *(ext2::DirEntry*) (data.buf() + off);
+        usize len = _fileType() ? entry.nameLen
+                                : entry.nameLen | (entry.type << 8);
+        if (not _fits(entry, off, len, _blockSize))
+            return Error::invalidData("Ext2Fs::_find: corrupted directory");
+        if (entry.inode and Str { entry.name, len } == name)
+            return Ok((u32) entry.inode);
+        off += entry.recLen;
+    }
+    return Error::notFound("Ext2Fs::_find: no such entry");
+}
+
+Res<u32> Ext2Fs::_resolve(Path const& path, usize depth) {
+    u32 ino = ext2::ROOT_INODE;
+    for (usize i = 0; i < depth; i++)
+        ino = try$(_find(ino, path.comp[i].str()));
+    return Ok(ino);
+}
+
+Res<> Ext2Fs::_link(u32 dir, Str name, u32 ino, u8 type) {
+    if (not name or name.len() > 255)
+        return Error::invalidArgument("Ext2Fs::_link: bad name");
+
+    auto  inode = try$(_readInode(dir));
+    auto  data  = try$(_readAll(inode));
+    usize need  = _recLen(name.len());
+
+    auto fill = [&](ext2::DirEntry& entry, usize recLen) {
+        entry.inode   = ino;
+        entry.recLen  = (u16) recLen;
+        entry.nameLen = (u8) name.len();
+        entry.type    = _fileType() ? type : 0;
+        memcpy(entry.name, name.buf(), name.len());
+    };
+
+    // Reuse the slack at the end of an entry, or an unused one.
+    for (usize off = 0; off + sizeof(ext2::DirEntry) <= data.len();) {
+        auto& entry = *(ext2::DirEntry*) (data.buf() + off);
+        usize rec   = entry.recLen;
+        usize len   = _fileType() ? entry.nameLen
+                                  : entry.nameLen | (entry.type << 8);
+        if (not _fits(entry, off, len, _blockSize))
+            return Error::invalidData("Ext2Fs::_link: corrupted directory");
+
+        usize used = entry.inode ? _recLen(len) : 0;
+        if (rec - used >= need) {
+            if (used) {
+                entry.recLen = (u16) used;
+                fill(*(ext2::DirEntry*) (data.buf() + off + used), rec - used);
+            } else {
+                fill(entry, rec);
+            }
+
+            usize index = off / _blockSize;
+            u32   block = try$(_lookup(inode, index));
+            return _write(block,
+                          slice(data,
+                                index * _blockSize,
+                                (index + 1) * _blockSize));
+        }
+        off += rec;
+    }
+
+    // Grow the directory by a block holding only the new entry.
+    usize index = data.len() / _blockSize;
+    u32   goal  = index ? try$(_lookup(inode, index - 1)) + 1 : _goal(dir);
+    usize count = 1;
+    u32   block = try$(_allocBlocks(goal, count));
+
+    Vec<u8> buf;
+    buf.resize(_blockSize, 0);
+    fill(*(ext2::DirEntry*) buf.buf(), _blockSize);
+    try$(_write(block, buf));
+
+    try$(_install(inode, index, block));
+    try$(_indirectFlush());
+    _addSectors(inode, 1, _blockSize);
+    _setSize(inode, (index + 1) * _blockSize);
+    return _writeInode(dir, inode);
+}
+
+Res<u32> Ext2Fs::_unlink(u32 dir, Str name) {
+    auto inode = try$(_readInode(dir));
+    auto data  = try$(_readAll(inode));
+
+    usize prev = 0;
+    for (usize off = 0; off + sizeof(ext2::DirEntry) <= data.len();) {
+        auto& entry = *(ext2::DirEntry*) (data.buf() + off);
+        usize len = _fileType() ? entry.nameLen
+                                : entry.nameLen | (entry.type << 8);
+        if (not _fits(entry, off, len, _blockSize))
+            return Error::invalidData("Ext2Fs::_unlink: corrupted directory");
+        if (not entry.inode or Str { entry.name, len } != name) {
+            prev = off;
+            off += entry.recLen;
+            continue;
+        }
+
+        // Entries never cross a block, the first of a block is only marked
+        // unused, the others are folded into the one before.
+        u32 ino = entry.inode;
+        if (off % _blockSize == 0) {
+            entry.inode = 0;
+        } else {
+            auto& before  = *(ext2::DirEntry*) (data.buf() + prev);
+            before.recLen = (u16) (before.recLen + entry.recLen);
+        }
+
+        usize index = off / _blockSize;
+        u32   block = try$(_lookup(inode, index));
+        try$(_write(block,
+                    slice(data, index * _blockSize, (index + 1) * _blockSize)));
+        return Ok(ino);
+    }
+    return Error::notFound("Ext2Fs::_unlink: no such entry");
+}
+
+// MARK: - Fs ------------------------------------------------------------------
+
+Res<> Ext2Fs::create(Path path) {
+    if (not path.len())
+        return Error::invalidArgument("Ext2Fs::create: empty path");
+
+    JournalHandle handle(_journal);
+    LockScoped    lk(_nsLock);
+    u32           dir  = try$(_resolve(path, path.len() - 1));
+    Str           name = path.comp[path.len() - 1].str();
+    if (_find(dir, name))
+        return Error::alreadyExists("Ext2Fs::create: file exists");
+
+    u32         ino = try$(_allocInode(dir, false));
+    ext2::Inode inode {};
+    inode.mode  = (u16) (ext2::Regular | 0644);
+    inode.links = 1;
+    try$(_writeInode(ino, inode));
+    try$(_link(dir, name, ino, ext2::DirRegular));
+    return sync();
+}
+
+Res<Rc<Node>> Ext2Fs::open(Path path) {
+    u32 ino = try$(_resolve(path, path.len()));
+
+    // One file per inode, a second one would cache the same pages apart and
+    // write back a stale inode. Each open is still listed, so the file stays
+    // listed until its last close.
+    if (auto file = _opened(ino)) {
+        opened.pushBack(*file);
+        return Ok(*file);
+    }
+
+    auto inode = try$(_readInode(ino));
+
+    if (_isDir(inode)) {
+        auto items = try$(listFiles(path));
+        auto dir   = makeRc<Directory>(Node { _dev, path }, ::move(items));
+        opened.pushBack(dir);
+        return Ok(dir);
+    }
+
+    auto file = makeRc<Ext2File>(*this, ino, inode, path);
+    opened.pushBack(file);
+    return Ok(file);
+}
+
+Res<> Ext2Fs::close(Rc<Node> node) {
+    JournalHandle handle(_journal);
+    if (auto file = node.cast<Ext2File>())
+        try$((*file)->sync());
+    try$(sync());
+
+    for (usize i = 0; i < opened.len(); i++) {
+        if (&*opened[i] == &*node) {
+            opened.removeAt(i);
+            break;
+        }
+    }
+    return Ok();
+}
+
+Res<> Ext2Fs::remove(Path path) {
+    if (not path.len())
+        return Error::invalidArgument("Ext2Fs::remove: empty path");
+
+    JournalHandle handle(_journal);
+    LockScoped    lk(_nsLock);
+    u32           dir   = try$(_resolve(path, path.len() - 1));
+    Str           name  = path.comp[path.len() - 1].str();
+    u32           ino   = try$(_find(dir, name));
+    auto          inode = try$(_readInode(ino));
+    bool          isDir = _isDir(inode);
+
+    if (isDir) {
+        auto items = try$(listFiles(path));
+        if (items.len())
+            return Error::directoryNotEmpty("Ext2Fs::remove: not empty");
+    }
+
+    try$(_unlink(dir, name));
+
+    // A directory holds a link to itself and one from its parent's "..".
+    inode.links = (u16) (isDir ? 0 : inode.links - 1);
+    if (isDir) {
+        auto parent  = try$(_readInode(dir));
+        parent.links = (u16) (parent.links - 1);
+        try$(_writeInode(dir, parent));
+    }
+
+    // An open file keeps its blocks until its last reference goes, its own
+    // copy of the inode is what gets written back meanwhile.
+    Opt<Rc<Ext2File>> file = NONE;
+    if (not isDir)
+        file = _opened(ino);
+
+    if (file) {
+        {
+            LockScoped lk((*file)->_lock);
+            (*file)->_inode.links = inode.links;
+            (*file)->_orphan      = not inode.links;
+            (*file)->_dirty       = true;
+        }
+        try$((*file)->sync());
+    } else if (not inode.links) {
+        try$(_release(ino, inode, isDir));
+    } else {
+        try$(_writeInode(ino, inode));
+    }
+    return sync();
+}
+
+Res<> Ext2Fs::_release(u32 ino, ext2::Inode& inode, bool dir) {
+    JournalHandle handle(_journal);
+    try$(_truncate(inode));
+    inode.whenDelete = 1;
+    try$(_writeInode(ino, inode));
+    try$(_freeInode(ino, dir));
+    return sync();
+}
+
+Opt<Rc<Ext2File>> Ext2Fs::_opened(u32 ino) {
+    for (auto& node : opened) {
+        if (auto file = node.is<Ext2File>(); file and file->_ino == ino)
+            return node.cast<Ext2File>();
+    }
+    return NONE;
+}
+
+Res<Path> Ext2Fs::move(Path src, Path dest) {
+    if (not src.len() or not dest.len())
+        return Error::invalidArgument("Ext2Fs::move: empty path");
+
+    JournalHandle handle(_journal);
+    LockScoped    lk(_nsLock);
+    u32           from  = try$(_resolve(src, src.len() - 1));
+    u32           to    = try$(_resolve(dest, dest.len() - 1));
+    Str           name  = src.comp[src.len() - 1].str();
+    Str           dname = dest.comp[dest.len() - 1].str();
+    if (_find(to, dname))
+        return Error::alreadyExists("Ext2Fs::move: destination exists");
+
+    u32  ino   = try$(_find(from, name));
+    auto inode = try$(_readInode(ino));
+    try$(_link(to, dname, ino, _dirType(inode.mode)));
+    try$(_unlink(from, name));
+
+    // A directory changing parent points its ".." at the new one, always
+    // the second entry.
+    if (_isDir(inode) and from != to) {
+        auto  data   = try$(_readAll(inode));
+        auto& self   = *(ext2::DirEntry*) data.buf();
+        auto& dotdot = *(ext2::DirEntry*) (data.buf() + self.recLen);
+        dotdot.inode = to;
+        try$(_write(try$(_lookup(inode, 0)), slice(data, 0, _blockSize)));
+
+        auto parent  = try$(_readInode(from));
+        parent.links = (u16) (parent.links - 1);
+        try$(_writeInode(from, parent));
+        parent       = try$(_readInode(to));
+        parent.links = (u16) (parent.links + 1);
+        try$(_writeInode(to, parent));
+    }
+
+    try$(sync());
+    return Ok(dest);
+}
+
+Res<Path> Ext2Fs::copy(Path src, Path dest) {
+    u32  ino   = try$(_resolve(src, src.len()));
+    auto inode = try$(_readInode(ino));
+    if ((inode.mode & ext2::TypeMask) != ext2::Regular)
+        return Error::notSupported("Ext2Fs::copy: not a regular file");
+
+    // An open source has its latest data in its own pages, not on disk.
+    auto from = _opened(ino);
+    if (not from)
+        from = makeRc<Ext2File>(*this, ino, inode, src);
+
+    // The new entry and the copy's blocks commit together.
+    JournalHandle handle(_journal);
+    try$(create(dest));
+    u32  destIno   = try$(_resolve(dest, dest.len()));
+    auto destInode = try$(_readInode(destIno));
+
+    // Both sides go through the page cache, the source with read-ahead and
+    // the destination allocated in long runs at write-back.
+    Ext2File       to { *this, destIno, destInode, dest };
+    CacheReadahead ra;
+    Vec<u8>        buf;
+    buf.resize(COPY_CHUNK, 0);
+
+    for (usize pos = 0; pos < (*from)->size;) {
+        usize n = try$(cacheRead((*from)->_mapping, pos, buf, &ra));
+        if (not n)
+            break;
+
+        to.size = pos + n;
+        try$(cacheWrite(to._mapping, pos, slice(buf, 0, n)));
+        pos += n;
+    }
+
+    try$(to.sync());
+    try$(sync());
+    return Ok(dest);
+}
+
+Res<Vec<String>> Ext2Fs::listFiles(Path path) {
+    u32  ino   = try$(_resolve(path, path.len()));
+    auto inode = try$(_readInode(ino));
+    if (not _isDir(inode))
+        return Error::notADirectory("Ext2Fs::listFiles: not a directory");
+
+    Vec<u8> names = try$(_readAll(inode));
+
+    Vec<String> items;
+    for (usize off = 0; off + sizeof(ext2::DirEntry) <= names.len();) {
+        auto& entry = *(ext2::DirEntry*) (names.buf() + off);
+        usize len = _fileType() ? entry.nameLen
+                                : entry.nameLen | (entry.type << 8);
+        if (not _fits(entry, off, len, _blockSize))
+            return Error::invalidData("Ext2Fs::listFiles: corrupted directory");
+        Str   item { entry.name, len };
+        if (entry.inode and item != "." and item != "..")
+            items.pushBack(String { item });
+        off += entry.recLen;
+    }
+    return Ok(::move(items));
+}
+
+} // namespace Realms::Sys::Io
@@ -1,9 +1,324 @@
 #pragma once
 
+#include <ext2/spec.h>
+#include <realms/io/cache.h>
+#include <realms/io/dev.stor.h>
 #include <realms/io/fs.h>
+#include <realms/io/journal.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/radix.h>
+#include <sdk-meta/rc.h>
+#include <sdk-meta/vec.h>
 
 namespace Realms::Sys::Io {
 
-struct Ext2Fs : public Fs { };
+struct Ext2Fs;
+struct Ext2File;
+
+/**
+ * @brief A contiguous range of file blocks, mapped to consecutive blocks on
+ * disk or to a hole when `block` is 0.
+ */
+struct Ext2Run {
+    u64   index; // First file block
+    u32   block;
+    usize count;
+};
+
+/**
+ * @brief Moves the pages of an ext2 file, one request per run of contiguous
+ * blocks. Blocks are allocated when dirty pages are written back, which
+ * lets a file written in small pieces still get long runs.
+ */
+struct Ext2Mapping : public CacheMapping {
+    Ext2File& _file;
+
+    Ext2Mapping(Ext2File& file) : _file(file) { }
+
+    usize size() override;
+
+    usize capacity() override;
+
+    Res<> fill(Slice<CachePage*> pages) override;
+
+    Res<> flush(Slice<CachePage*> pages) override;
+
+    void poll() override;
+};
+
+struct Ext2File : public File {
+    Ext2Fs&     _fs;
+    u32         _ino;
+    ext2::Inode _inode;
+    Ext2Mapping _mapping;
+    Lock        _lock; // Guards `_inode`, the block tree included
+    bool        _dirty  = false;
+    bool        _orphan = false; // Unlinked, freed with the last reference
+
+    Ext2File(Ext2Fs& fs, u32 ino, ext2::Inode const& inode, Path path);
+
+    /**
+     * @brief Write the file back, or free its inode if it was removed.
+     */
+    ~Ext2File();
+
+    /**
+     * @brief Write dirty pages back, then the inode if it changed.
+     */
+    Res<> sync();
+};
+
+struct Ext2Fs : public Fs {
+    static constexpr usize INDIRECT_CACHE = 256; // Blocks
+
+    struct _Group {
+        ext2::BlockGroupDesc desc;
+        Vec<u8>              blockBitmap; // Loaded on first allocation
+        Vec<u8>              inodeBitmap;
+        bool                 dirty = false;
+    };
+
+    Rc<StorDev>    _dev;
+    usize          _offset; // Of the filesystem on the device, in bytes
+    ext2::Superblk _super;
+    usize          _blockSize;
+    usize          _inodeSize;
+    usize          _perBlock; // Block numbers in an indirect block
+    u32            _firstInode;
+    Vec<_Group>    _groups;
+    bool           _dirty = false; // Superblock or descriptors changed
+    Lock           _lock;          // Guards allocation and the caches
+    Lock           _nsLock;        // Serializes directory changes
+
+    Radix<Vec<u32>> _indirect;          // Indirect blocks by block number
+    Vec<u32>        _indirectOrder;
+    Vec<u32>        _indirectDirty;     // Cached, not written back yet
+    Journal*        _journal = nullptr; // Owned, for ext3 metadata
+
+    Ext2Fs(Rc<StorDev> dev, usize offset);
+
+    ~Ext2Fs();
+
+    /**
+     * @brief Read the superblock and group descriptors of the filesystem at
+     * `offset` bytes into `dev`. An ext3 journal is replayed first, then
+     * used for every metadata write.
+     *
+     * @retval Error::invalidData if there is no ext2 superblock.
+     * @retval Error::notSupported for incompatible features, blocks larger
+     *         than a page or a journal that needs a replay it cannot get.
+     */
+    static Res<Rc<Ext2Fs>> mount(Rc<StorDev> dev, usize offset = 0);
+
+    /**
+     * @brief Write the bitmaps, group descriptors and superblock back, as
+     * one transaction when journaled, and commit it.
+     */
+    Res<> sync();
+
+    /**
+     * @brief Write what `sync()` does. Called with `_lock` held.
+     */
+    Res<> _writeGroups();
+
+    /**
+     * @brief Read the superblock and group descriptors, dropping whatever
+     * was cached from before.
+     */
+    Res<> _load();
+
+    Res<> _writeSuper();
+
+    Res<> _openJournal();
+
+    Res<> create(Path path) override;
+
+    Res<Rc<Node>> open(Path path) override;
+
+    Res<> close(Rc<Node> node) override;
+
+    Res<> remove(Path path) override;
+
+    Res<Path> move(Path src, Path dest) override;
+
+    Res<Path> copy(Path src, Path dest) override;
+
+    /**
+     * @brief The names stay valid until the filesystem is dropped.
+     */
+    Res<Vec<String>> listFiles(Path path) override;
+
+    // MARK: - Blocks ----------------------------------------------------------
+
+    u64 _lba(u64 block) const {
+        return (_offset + block * _blockSize) / _dev->_blockSize;
+    }
+
+    /**
+     * @brief Read or write `buf` from `block` on, in as few requests as the
+     * device allows. With a journal, writes are logged and reads see what
+     * was logged.
+     */
+    Res<> _io(u64 block, Bytes buf, bool write);
+
+    Res<> _read(u64 block, Bytes buf) { return _io(block, buf, false); }
+
+    Res<> _write(u64 block, Bytes buf) { return _io(block, buf, true); }
+
+    /**
+     * @brief Build one request per run and device limit. `blocks` holds the
+     * memory of each file block from `first` on; holes get no request.
+     */
+    void _requests(Slice<Ext2Run>   runs,
+                   u64              first,
+                   Slice<Bytes>     blocks,
+                   bool             write,
+                   Vec<BlkRequest>& out);
+
+    // MARK: - Inodes ----------------------------------------------------------
+
+    Res<ext2::Inode> _readInode(u32 ino);
+
+    Res<> _writeInode(u32 ino, ext2::Inode const& inode);
+
+    // MARK: - Block tree ------------------------------------------------------
+
+    /**
+     * @brief The cached entries of indirect block `block`, read on a miss.
+     * Called with the filesystem locked.
+     */
+    Res<Vec<u32>*> _indirectLoad(u32 block);
+
+    Res<u32> _indirectAt(u32 block, usize slot);
+
+    /**
+     * @brief Update the cached entry only, the block is written back by
+     * `_indirectFlush()` or when it leaves the cache.
+     */
+    Res<> _indirectSet(u32 block, usize slot, u32 val);
+
+    /**
+     * @brief Allocate a zeroed indirect block near `goal`, written back
+     * with the other dirty ones.
+     */
+    Res<u32> _indirectNew(u32 goal);
+
+    /**
+     * @brief Make room for one more cached block, writing back the one
+     * evicted if it is dirty. Called with the filesystem locked.
+     */
+    Res<> _indirectEvict();
+
+    /**
+     * @brief Write cached `block` back if it is dirty. Called with the
+     * filesystem locked.
+     */
+    Res<> _indirectWrite(u32 block);
+
+    /**
+     * @brief Write back every dirty indirect block, once each.
+     */
+    Res<> _indirectFlush();
+
+    /**
+     * @brief Forget cached `block` without writing it, it is being freed.
+     * Called with the filesystem locked.
+     */
+    void _indirectDrop(u32 block);
+
+    /**
+     * @brief Slots from the inode down to the data block of file block
+     * `index`: one for direct blocks, up to four through the triple
+     * indirect block.
+     */
+    Res<usize> _path(u64 index, Array<usize, 4>& slots);
+
+    Res<u32> _lookup(ext2::Inode const& inode, u64 index);
+
+    /**
+     * @brief Map `count` file blocks from `index` into runs, joining
+     * neighbours that are contiguous on disk.
+     */
+    Res<> _runs(ext2::Inode const& inode,
+                u64                index,
+                usize              count,
+                Vec<Ext2Run>&      out);
+
+    /**
+     * @brief Point file block `index` at `block`, allocating the indirect
+     * blocks on the way near it. Called with the file locked, indirect
+     * blocks changed stay dirty until `_indirectFlush()`.
+     */
+    Res<> _install(ext2::Inode& inode, u64 index, u32 block);
+
+    /**
+     * @brief Release every block of the inode, indirect blocks included.
+     * Inline data, as in fast symlinks, is only cleared.
+     */
+    Res<> _truncate(ext2::Inode& inode);
+
+    /**
+     * @brief Free `block` and, `depth` levels down, what it points to.
+     */
+    Res<> _freeTree(u32 block, usize depth);
+
+    // MARK: - Allocation ------------------------------------------------------
+
+    Res<_Group*> _group(usize index, bool bitmaps);
+
+    /**
+     * @brief Log the block or inode bitmap of a group and the block of
+     * descriptors holding it, so they commit with what was allocated or
+     * freed. Does nothing without a journal. Called with `_lock` held.
+     */
+    Res<> _logGroup(usize index, bool inodes);
+
+    /**
+     * @brief Allocate up to `count` contiguous blocks, starting at `goal` if
+     * it is free and as close to it as possible otherwise, preferring its
+     * group.
+     *
+     * @return The first block, `count` is updated to the run length.
+     * @retval Error::outOfMemory if the filesystem is full.
+     */
+    Res<u32> _allocBlocks(u32 goal, usize& count);
+
+    Res<> _freeBlocks(u32 block, usize count);
+
+    /**
+     * @brief Allocate an inode, in the parent's group when it has room.
+     */
+    Res<u32> _allocInode(u32 parent, bool dir);
+
+    Res<> _freeInode(u32 ino, bool dir);
+
+    /**
+     * @brief Free the blocks and the inode of a file without links left.
+     */
+    Res<> _release(u32 ino, ext2::Inode& inode, bool dir);
+
+    /**
+     * @brief The open file of inode `ino`, if there is one.
+     */
+    Opt<Rc<Ext2File>> _opened(u32 ino);
+
+    u32 _goal(u32 ino) const;
+
+    // MARK: - Directories -----------------------------------------------------
+
+    bool _fileType() const {
+        return _super.featureIncompat & ext2::FileType;
+    }
+
+    Res<Vec<u8>> _readAll(ext2::Inode const& inode);
+
+    Res<u32> _find(u32 dir, Str name);
+
+    Res<u32> _resolve(Path const& path, usize depth);
+
+    Res<> _link(u32 dir, Str name, u32 ino, u8 type);
+
+    Res<u32> _unlink(u32 dir, Str name);
+};
 
 } // namespace Realms::Sys::Io
@@ -24,7 +24,10 @@ struct Fs {
 
     virtual Res<Path> copy(Path src, Path dest) = 0;
 
-    virtual Res<Vec<Str>> listFiles(Path path) = 0;
+    /**
+     * @brief The names in the directory at `path`, owned by the caller.
+     */
+    virtual Res<Vec<String>> listFiles(Path path) = 0;
 };
 
 } // namespace Realms::Sys::Io
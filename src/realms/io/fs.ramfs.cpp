@@ -0,0 +1,508 @@
+#include <realms/io/fs.ramfs.h>
+#include <realms/mm/mem.h>
+#include <sdk-meta/_embed.h>
+#include <sdk-meta/hash.h>
+#include <sdk-meta/vec.h>
+
+namespace Realms::Sys::Io {
+
+namespace {
+
+static constexpr usize TAR_BLOCK = 512;
+
+// Release every page of a detached tree, returning how many it held.
+usize _release(Radix<RamPage>* pages) {
+    usize count = pages->len();
+    pages->each([](u64, RamPage& page) { RamPage::put(&page); });
+    delete pages;
+    return count;
+}
+
+// A NUL-padded field of a tar header.
+Str _field(byte const* buf, usize max) {
+    usize len = 0;
+    while (len < max and buf[len])
+        len++;
+    return { (char const*) buf, len };
+}
+
+u64 _hash(Str name) {
+    return fnv64((byte const*) name.buf(), name.len());
+}
+
+Res<usize> _octal(byte const* buf, usize max) {
+    usize val = 0;
+    for (usize i = 0; i < max and buf[i] and buf[i] != ' '; i++) {
+        if (buf[i] < '0' or buf[i] > '7')
+            return Error::invalidData("RamFs::unpack: bad number");
+        val = val * 8 + (buf[i] - '0');
+    }
+    return Ok(val);
+}
+
+} // namespace
+
+// MARK: - Pages ---------------------------------------------------------------
+
+Res<RamPage*> RamPage::alloc() {
+    uflat phys = try$(pmm().alloc(PAGE_SIZE, PmmFlags::Kernel)).start();
+    uflat virt = try$(mmapVirtIo(phys));
+    memset((void*) virt, 0, PAGE_SIZE);
+    return Ok(new RamPage { .phys = phys, .virt = virt });
+}
+
+Res<RamPage*> RamPage::zero() {
+    static Lock     lock;
+    static RamPage* page = nullptr;
+
+    LockScoped lk(lock);
+    if (not page)
+        page = try$(alloc());
+    return Ok(page);
+}
+
+void RamPage::put(RamPage* page) {
+    if (page->refs.fetchSub(1) != 1)
+        return;
+
+    (void) pmm().free({ page->phys, PAGE_SIZE });
+    delete page;
+}
+
+// MARK: - File ----------------------------------------------------------------
+
+RamFile::RamFile(RamFs& fs, Rc<Dev> device, Path path)
+    : File(device, path),
+      _fs(fs),
+      _pages(new Radix<RamPage>()) {
+    // From the file's own path, the tree node may go while the file is open.
+    name = this->path.len() ? this->path.comp[this->path.len() - 1].str()
+                            : Str {};
+}
+
+RamFile::~RamFile() {
+    _fs._used.fetchSub(_release(_pages));
+}
+
+Res<usize> RamFile::read(FileHandle& handle, Seek whence, Bytes bytes) {
+    usize pos = whence.apply(handle.offset.offset, size);
+    usize n   = try$(pread(pos, bytes));
+
+    handle.offset = Seek::fromBegin(pos + n);
+    return Ok(n);
+}
+
+Res<usize> RamFile::write(FileHandle& handle, Seek whence, Bytes bytes) {
+    usize pos = whence.apply(handle.offset.offset, size);
+    usize n   = try$(pwrite(pos, bytes));
+
+    handle.offset = Seek::fromBegin(pos + n);
+    return Ok(n);
+}
+
+Res<usize> RamFile::pread(usize pos, Bytes bytes) {
+    LockScoped lk(_lock);
+    if (pos >= size)
+        return Ok(0uz);
+
+    usize len = min(bytes.len(), size - pos);
+    for (usize done = 0; done < len;) {
+        u64   index = (pos + done) / PAGE_SIZE;
+        usize off   = (pos + done) % PAGE_SIZE;
+        usize n     = min(len - done, PAGE_SIZE - off);
+        auto* dst   = (void*) (bytes.buf() + done);
+
+        if (auto* page = _pages->get(index))
+            memcpy(dst, (void const*) (page->virt + off), n);
+        else
+            memset(dst, 0, n);
+        done += n;
+    }
+    return Ok(len);
+}
+
+Res<usize> RamFile::pwrite(usize pos, Bytes bytes) {
+    LockScoped lk(_lock);
+
+    usize done = 0;
+    while (done < bytes.len()) {
+        u64   index = (pos + done) / PAGE_SIZE;
+        usize off   = (pos + done) % PAGE_SIZE;
+        usize n     = min(bytes.len() - done, PAGE_SIZE - off);
+
+        auto page = _own(index);
+        if (not page) {
+            if (done)
+                break;
+            return page.none();
+        }
+
+        memcpy((void*) (page.unwrap()->virt + off), bytes.buf() + done, n);
+        done += n;
+    }
+
+    size = max(size, pos + done);
+    return Ok(done);
+}
+
+Res<usize> RamFile::borrow(usize pos, usize len, Vec<RamPageRef>& out) {
+    LockScoped lk(_lock);
+    if (pos >= size)
+        return Ok(0uz);
+
+    len = min(len, size - pos);
+    for (usize done = 0; done < len;) {
+        u64   index = (pos + done) / PAGE_SIZE;
+        usize off   = (pos + done) % PAGE_SIZE;
+        usize n     = min(len - done, PAGE_SIZE - off);
+
+        auto* page = _pages->get(index);
+        if (not page)
+            page = try$(RamPage::zero());
+        page->refs.inc();
+        out.pushBack(RamPageRef(page, off, n));
+        done += n;
+    }
+    return Ok(len);
+}
+
+Res<> RamFile::truncate(usize newSize) {
+    Radix<RamPage>* detached = nullptr;
+    Vec<RamPage*>   dropped;
+    {
+        LockScoped lk(_lock);
+        if (newSize == 0) {
+            detached = exchange(_pages, new Radix<RamPage>());
+        } else if (newSize < size) {
+            // The cut off part of the last page reads as zeroes if the file
+            // grows back over it.
+            usize off = newSize % PAGE_SIZE;
+            if (off and _pages->get(newSize / PAGE_SIZE)) {
+                auto* page = try$(_own(newSize / PAGE_SIZE));
+                memset((void*) (page->virt + off), 0, PAGE_SIZE - off);
+            }
+
+            u64 index = alignUp(newSize, PAGE_SIZE) / PAGE_SIZE;
+            while (_pages->ceil(index))
+                dropped.pushBack(_pages->remove(index));
+        }
+        size = newSize;
+    }
+
+    // Pages go back to the allocator with the file unlocked.
+    usize count = dropped.len();
+    for (auto* page : dropped)
+        RamPage::put(page);
+    if (detached)
+        count += _release(detached);
+    _fs._used.fetchSub(count);
+    return Ok();
+}
+
+Res<> RamFile::_share(RamFile& other) {
+    LockScoped from(other._lock);
+    LockScoped to(_lock);
+
+    try$(_fs._charge(other._pages->len()));
+    other._pages->each([&](u64 index, RamPage& page) {
+        page.refs.inc();
+        _pages->put(index, &page);
+    });
+    size = other.size;
+    return Ok();
+}
+
+Res<RamPage*> RamFile::_own(u64 index) {
+    auto* page = _pages->get(index);
+    if (page and page->refs.load() == 1)
+        return Ok(page);
+
+    // A page someone else holds is copied, they keep the old content.
+    auto* fresh = try$(RamPage::alloc());
+    if (not page) {
+        if (auto res = _fs._charge(1); not res) {
+            RamPage::put(fresh);
+            return res.none();
+        }
+    } else {
+        memcpy((void*) fresh->virt, (void const*) page->virt, PAGE_SIZE);
+        RamPage::put(page);
+    }
+
+    _pages->put(index, fresh);
+    return Ok(fresh);
+}
+
+// MARK: - Fs ------------------------------------------------------------------
+
+RamFs::RamFs()
+    : _dev(makeRc<Dev>("ramfs"s, "/"s, Dev::Type::VirtualDevice)) {
+    name = "ramfs";
+}
+
+RamFs::~RamFs() {
+    for (auto* child : _root.children)
+        _free(child);
+}
+
+Res<> RamFs::_charge(usize pages) {
+    usize used = _used.fetchAdd(pages) + pages;
+    if (limit and used > limit) {
+        _used.fetchSub(pages);
+        return Error::storageFull("RamFs: size limit reached");
+    }
+    return Ok();
+}
+
+Res<RamFs::_Node*> RamFs::_find(Path const& path, usize depth) {
+    _Node* node = &_root;
+    for (usize i = 0; i < depth; i++) {
+        if (node->file)
+            return Error::notADirectory("RamFs: not a directory");
+
+        node = _child(node, path.comp[i].str());
+        if (not node)
+            return Error::notFound("RamFs: no such entry");
+    }
+    return Ok(node);
+}
+
+Res<RamFs::_Node*> RamFs::_parentOf(Path const& path) {
+    if (not path.len())
+        return Error::invalidArgument("RamFs: empty path");
+
+    auto* dir = try$(_find(path, path.len() - 1));
+    if (dir->file)
+        return Error::notADirectory("RamFs: not a directory");
+    return Ok(dir);
+}
+
+RamFs::_Node* RamFs::_child(_Node* dir, Str name) {
+    u64 hash = _hash(name);
+    for (auto* child : dir->children) {
+        if (child->hash == hash and child->key() == name)
+            return child;
+    }
+    return nullptr;
+}
+
+Res<RamFs::_Node*> RamFs::_make(_Node* dir, Str name, bool isDir, Path path) {
+    if (not name or name.len() > 255)
+        return Error::invalidArgument("RamFs: bad name");
+    if (_child(dir, name))
+        return Error::alreadyExists("RamFs: entry exists");
+
+    auto* node = new _Node();
+    if (not isDir) {
+        auto file  = makeRc<RamFile>(*this, _dev, path);
+        node->file = file;
+    }
+
+    _link(dir, node, name);
+    return Ok(node);
+}
+
+void RamFs::_link(_Node* dir, _Node* node, Str name) {
+    node->name.clear();
+    for (usize i = 0; i < name.len(); i++)
+        node->name.pushBack(name.buf()[i]);
+    node->hash   = _hash(name);
+    node->parent = dir;
+    dir->children.pushBack(node);
+}
+
+void RamFs::_unlink(_Node* node) {
+    auto* dir = node->parent;
+    for (usize i = 0; i < dir->children.len(); i++) {
+        if (dir->children[i] == node) {
+            dir->children.removeAt(i);
+            break;
+        }
+    }
+}
+
+void RamFs::_free(_Node* node) {
+    for (auto* child : node->children)
+        _free(child);
+    delete node;
+}
+
+Vec<String> RamFs::_names(_Node* dir) {
+    Vec<String> items;
+    for (auto* child : dir->children)
+        items.pushBack(String { child->name });
+    return items;
+}
+
+Res<> RamFs::unpack(Bytes archive) {
+    LockScoped lk(_lock);
+
+    for (usize off = 0; off + TAR_BLOCK <= archive.len();) {
+        byte const* head = archive.buf() + off;
+        if (not head[0])
+            break; // Zero blocks end the archive
+
+        if (_field(head + 257, 5) != "ustar")
+            return Error::invalidData("RamFs::unpack: not a ustar archive");
+
+        usize size = try$(_octal(head + 124, 12));
+        u8    type = head[156];
+        usize data = off + TAR_BLOCK;
+        if (data + size > archive.len())
+            return Error::invalidData("RamFs::unpack: truncated archive");
+
+        // Long names are split into a prefix and a name.
+        Vec<char> full;
+        for (auto c : _field(head + 345, 155))
+            full.pushBack(c);
+        if (full.len())
+            full.pushBack('/');
+        for (auto c : _field(head + 0, 100))
+            full.pushBack(c);
+
+        // Walk the components, making the directories on the way.
+        _Node* dir = &_root;
+        Path   path;
+        for (usize at = 0; at < full.len();) {
+            usize end = at;
+            while (end < full.len() and full[end] != '/')
+                end++;
+            Str  name { full.buf() + at, end - at };
+            bool last = end >= full.len() or end + 1 == full.len();
+            at        = end + 1;
+            if (not name or name == ".")
+                continue;
+
+            path.comp.pushBack(String { name });
+            auto* found = _child(dir, name);
+            if (not last or type == '5') {
+                _Node* next = found;
+                if (not next)
+                    next = try$(_make(dir, name, true, path));
+                if (next->file)
+                    return Error::notADirectory("RamFs::unpack: file in path");
+                dir = next;
+                continue;
+            }
+
+            // Links and special files have no place here, skip them.
+            if (type != '0' and type != '\0')
+                break;
+            if (found)
+                return Error::alreadyExists("RamFs::unpack: duplicate entry");
+
+            auto* node = try$(_make(dir, name, false, path));
+            try$((*node->file)->pwrite(0, slice(archive, data, data + size)));
+        }
+
+        off = data + alignUp(size, TAR_BLOCK);
+    }
+    return Ok();
+}
+
+Res<> RamFs::mkdir(Path path) {
+    LockScoped lk(_lock);
+    auto*      dir = try$(_parentOf(path));
+    try$(_make(dir, path.comp[path.len() - 1].str(), true, path));
+    return Ok();
+}
+
+Res<> RamFs::create(Path path) {
+    LockScoped lk(_lock);
+    auto*      dir = try$(_parentOf(path));
+    try$(_make(dir, path.comp[path.len() - 1].str(), false, path));
+    return Ok();
+}
+
+Res<Rc<Node>> RamFs::open(Path path) {
+    LockScoped lk(_lock);
+    auto*      node = try$(_find(path, path.len()));
+
+    if (not node->file) {
+        auto dir = makeRc<Directory>(Node { _dev, path }, _names(node));
+        opened.pushBack(dir);
+        return Ok(dir);
+    }
+
+    auto file = *node->file;
+    opened.pushBack(file);
+    return Ok(file);
+}
+
+Res<> RamFs::close(Rc<Node> node) {
+    LockScoped lk(_lock);
+    for (usize i = 0; i < opened.len(); i++) {
+        if (&*opened[i] == &*node) {
+            opened.removeAt(i);
+            break;
+        }
+    }
+    return Ok();
+}
+
+Res<> RamFs::remove(Path path) {
+    if (not path.len())
+        return Error::invalidArgument("RamFs::remove: empty path");
+
+    LockScoped lk(_lock);
+    auto*      node = try$(_find(path, path.len()));
+    if (node->children.len())
+        return Error::directoryNotEmpty("RamFs::remove: not empty");
+
+    // Open files keep their pages until the last reference goes.
+    _unlink(node);
+    _free(node);
+    return Ok();
+}
+
+Res<Path> RamFs::move(Path src, Path dest) {
+    if (not src.len())
+        return Error::invalidArgument("RamFs::move: empty path");
+
+    LockScoped lk(_lock);
+    auto*      node  = try$(_find(src, src.len()));
+    auto*      dir   = try$(_parentOf(dest));
+    Str        dname = dest.comp[dest.len() - 1].str();
+    for (auto* at = dir; at; at = at->parent) {
+        if (at == node)
+            return Error::invalidArgument("RamFs::move: into itself");
+    }
+    if (_child(dir, dname))
+        return Error::alreadyExists("RamFs::move: destination exists");
+
+    _unlink(node);
+    _link(dir, node, dname);
+
+    if (node->file) {
+        auto& file = **node->file;
+        file.path  = dest;
+        file.name  = file.path.comp[file.path.len() - 1].str();
+    }
+    return Ok(dest);
+}
+
+Res<Path> RamFs::copy(Path src, Path dest) {
+    LockScoped lk(_lock);
+    auto*      from = try$(_find(src, src.len()));
+    if (not from->file)
+        return Error::notSupported("RamFs::copy: not a file");
+
+    auto* dir = try$(_parentOf(dest));
+    auto* to  = try$(_make(dir, dest.comp[dest.len() - 1].str(), false, dest));
+    if (auto res = (*to->file)->_share(**from->file); not res) {
+        _unlink(to);
+        _free(to);
+        return res.none();
+    }
+    return Ok(dest);
+}
+
+Res<Vec<String>> RamFs::listFiles(Path path) {
+    LockScoped lk(_lock);
+    auto*      node = try$(_find(path, path.len()));
+    if (node->file)
+        return Error::notADirectory("RamFs::listFiles: not a directory");
+    return Ok(_names(node));
+}
+
+} // namespace Realms::Sys::Io
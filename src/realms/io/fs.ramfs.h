@@ -1,14 +1,218 @@
 #pragma once
 
 #include <realms/io/fs.h>
-#include <sdk-meta/bits.h>
-#include <sdk-meta/ptr.h>
+#include <sdk-meta/atomic.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/radix.h>
+#include <sdk-meta/rc.h>
+#include <sdk-meta/vec.h>
 
 namespace Realms::Sys::Io {
 
+struct RamFs;
+
+/**
+ * @brief One page of file data, shared by the files holding it and by the
+ * readers it was lent to. Shared pages are copied before being written.
+ */
+struct RamPage {
+    uflat       phys;
+    uflat       virt;
+    Atomic<u32> refs { 1 };
+
+    static Res<RamPage*> alloc();
+
+    /**
+     * @brief The page every hole reads from, never freed.
+     */
+    static Res<RamPage*> zero();
+
+    static void put(RamPage* page);
+};
+
+/**
+ * @brief Part of a page lent out by `RamFile::borrow`. It keeps the data as
+ * it was when lent, through later writes, truncation or removal of the file.
+ */
+struct RamPageRef {
+    RamPage* _page = nullptr;
+    usize    off   = 0;
+    usize    len   = 0;
+
+    RamPageRef() = default;
+
+    RamPageRef(RamPage* page, usize off, usize len)
+        : _page(page),
+          off(off),
+          len(len) { }
+
+    RamPageRef(RamPageRef const&) = delete;
+
+    RamPageRef(RamPageRef&& other)
+        : _page(exchange(other._page, nullptr)),
+          off(other.off),
+          len(other.len) { }
+
+    ~RamPageRef() {
+        if (_page)
+            RamPage::put(_page);
+    }
+
+    RamPageRef& operator=(RamPageRef&& other) {
+        swap(_page, other._page);
+        swap(off, other.off);
+        swap(len, other.len);
+        return *this;
+    }
+
+    Bytes bytes() const { return { (byte const*) (_page->virt + off), len }; }
+
+    uflat phys() const { return _page->phys + off; }
+};
+
+struct RamFile : public File {
+    RamFs&          _fs;
+    Lock            _lock;  // Guards `_pages` and `size`
+    Radix<RamPage>* _pages; // Replaced whole when truncated to nothing
+
+    RamFile(RamFs& fs, Rc<Dev> device, Path path);
+
+    ~RamFile();
+
+    Res<usize> read(FileHandle& handle, Seek whence, Bytes bytes) override;
+
+    Res<usize> write(FileHandle& handle, Seek whence, Bytes bytes) override;
+
+    Res<usize> pread(usize pos, Bytes bytes);
+
+    Res<usize> pwrite(usize pos, Bytes bytes);
+
+    /**
+     * @brief Lend the pages holding up to `len` bytes from `pos` instead of
+     * copying them out, holes lending the zero page.
+     *
+     * @return The number of bytes covered, short at the end of the file.
+     */
+    Res<usize> borrow(usize pos, usize len, Vec<RamPageRef>& out);
+
+    /**
+     * @brief Set the size of the file. Growing leaves a hole, shrinking to
+     * nothing detaches the page tree in constant time and frees it after
+     * the file is unlocked.
+     */
+    Res<> truncate(usize size);
+
+    /**
+     * @brief Make the file share every page of `other`, copied only once
+     * either side writes to them.
+     */
+    Res<> _share(RamFile& other);
+
+    /**
+     * @brief The page at `index`, allocated or copied so that it is the
+     * file's alone. Called with the file locked.
+     */
+    Res<RamPage*> _own(u64 index);
+};
+
+/**
+ * @brief A filesystem in memory, each file a sparse tree of physical pages.
+ *
+ * Directories keep the hash of each entry's name next to it, so a lookup
+ * compares names only on a hash match. Nothing is written anywhere, so
+ * the content is lost with the filesystem.
+ */
 struct RamFs : public Fs {
-    Vec<uflat> blocks;
-    Bits       bits;
+    struct _Node {
+        Vec<char>        name;
+        u64              hash   = 0;
+        _Node*           parent = nullptr;
+        Opt<Rc<RamFile>> file   = NONE; // NONE for directories
+        Vec<_Node*>      children;
+
+        Str key() const { return { name.buf(), name.len() }; }
+    };
+
+    Rc<Dev>       _dev;
+    _Node         _root;
+    Lock          _lock;       // Guards the tree
+    Atomic<usize> _used { 0 }; // Pages held by files
+    usize         limit = 0;   // In pages, 0 for as much as there is
+
+    RamFs();
+
+    ~RamFs();
+
+    /**
+     * @brief Unpack a ustar archive, such as the boot initrd, into the
+     * filesystem.
+     *
+     * @retval Error::invalidData if the archive is malformed.
+     */
+    Res<> unpack(Bytes archive);
+
+    Res<> mkdir(Path path);
+
+    Res<> create(Path path) override;
+
+    Res<Rc<Node>> open(Path path) override;
+
+    Res<> close(Rc<Node> node) override;
+
+    Res<> remove(Path path) override;
+
+    Res<Path> move(Path src, Path dest) override;
+
+    /**
+     * @brief Copy a file without copying its data, the pages are shared
+     * until written.
+     */
+    Res<Path> copy(Path src, Path dest) override;
+
+    /**
+     * @brief The names stay valid until the filesystem is dropped.
+     */
+    Res<Vec<String>> listFiles(Path path) override;
+
+    Res<_Node*> _find(Path const& path, usize depth);
+
+    Res<_Node*> _parentOf(Path const& path);
+
+    /**
+     * @brief The entry called `name` in `dir`, nullptr if there is none.
+     * Called with the tree locked.
+     */
+    _Node* _child(_Node* dir, Str name);
+
+    /**
+     * @brief Add an entry called `name` to `dir`, a file unless `isDir`.
+     * Called with the tree locked.
+     *
+     * @retval Error::alreadyExists if the name is taken.
+     */
+    Res<_Node*> _make(_Node* dir, Str name, bool isDir, Path path);
+
+    /**
+     * @brief Rename `node` to `name` and add it to `dir`. Called with the
+     * tree locked.
+     */
+    void _link(_Node* dir, _Node* node, Str name);
+
+    void _unlink(_Node* node);
+
+    /**
+     * @brief Copies of the names in `dir`. Called with the tree locked.
+     */
+    Vec<String> _names(_Node* dir);
+
+    void _free(_Node* node);
+
+    /**
+     * @brief Count a page against `limit`.
+     *
+     * @retval Error::storageFull past the limit.
+     */
+    Res<> _charge(usize pages);
 };
 
 } // namespace Realms::Sys::Io
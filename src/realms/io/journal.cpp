@@ -0,0 +1,605 @@
+#include <realms/hal/clock.h>
+#include <realms/io/journal.h>
+#include <sdk-logs/logger.h>
+#include <sdk-meta/_embed.h>
+
+namespace Realms::Sys::Io {
+
+namespace {
+
+static constexpr usize REPLAY_BATCH = 64; // Blocks read then written home
+
+/**
+ * @brief A block found in the log: where it goes, or was revoked from.
+ */
+struct _Found {
+    u64  block;
+    u32  index; // In the journal
+    u32  seq;
+    bool escaped;
+};
+
+// Sequence numbers wrap around, compare them by distance.
+bool _after(u32 a, u32 b) {
+    return (i32) (a - b) > 0;
+}
+
+} // namespace
+
+Journal::Journal(Rc<StorDev> dev, usize offset, usize blockSize)
+    : _dev(dev),
+      _offset(offset),
+      _blockSize(blockSize),
+      _super {},
+      _tagSize(8),
+      _limit(BATCH),
+      _seq(0),
+      _head(0),
+      _tail(0) {
+    _timer.fn  = [](Timer&, void* ctx) {
+        static_cast<Journal*>(ctx)->_due.store(true);
+    };
+    _timer.ctx = this;
+}
+
+Journal::~Journal() {
+    cancelTimer(_timer);
+    _running.each([](u64, Vec<u8>& data) { delete &data; });
+    _running.clear();
+    _committed.each([](u64, Vec<u8>& data) { delete &data; });
+    _committed.clear();
+}
+
+Res<Journal*> Journal::open(Rc<StorDev>        dev,
+                            usize              offset,
+                            usize              blockSize,
+                            Vec<JournalExtent> extents) {
+    auto* journal     = new Journal(dev, offset, blockSize);
+    journal->_extents = ::move(extents);
+    if (auto res = journal->_load(); not res) {
+        delete journal;
+        return res.none();
+    }
+    return Ok(journal);
+}
+
+Res<> Journal::_load() {
+    usize total = 0;
+    for (auto& ext : _extents)
+        total += ext.count;
+    if (not total)
+        return Error::invalidData("Journal::open: no blocks");
+
+    Vec<u8> buf;
+    buf.resize(_blockSize, 0);
+    try$(_io(0, buf, BlkRequest::Op::Read));
+    memcpy(&_super, buf.buf(), sizeof(Jbd2::Super));
+
+    auto& super = _super;
+    if (super.header.magic != Jbd2::MAGIC)
+        return Error::invalidData("Journal::open: bad superblock");
+    if (super.header.type != Jbd2::Header::SuperV2)
+        return Error::notSupported("Journal::open: version 1 journal");
+    if (super.blockSize != _blockSize)
+        return Error::notSupported("Journal::open: block size mismatch");
+    if (super.maxLen > total or not super.first or super.first >= super.maxLen)
+        return Error::invalidData("Journal::open: bad geometry");
+
+    // Without checksums a torn asynchronous commit cannot be told from a
+    // good one.
+    u32 incompat = super.featureIncompat;
+    if (incompat & ~(Jbd2::Super::Revokes | Jbd2::Super::Bit64))
+        return Error::notSupported("Journal::open: unsupported features");
+
+    _tagSize = (incompat & Jbd2::Super::Bit64) ? 12 : 8;
+    _limit   = min(BATCH, (usize) (super.maxLen - super.first) / 4);
+    if (not _limit)
+        return Error::invalidData("Journal::open: journal too small");
+
+    try$(_replay());
+
+    // Revoke records are only looked at when the feature says so.
+    super.featureIncompat = incompat | Jbd2::Super::Revokes;
+    try$(_writeSuper());
+    return _flush();
+}
+
+// MARK: - Handles -------------------------------------------------------------
+
+void Journal::begin() {
+    LockScoped lk(_lock);
+    _handles++;
+}
+
+void Journal::end() {
+    LockScoped lk(_lock);
+    if (--_handles or _aborted)
+        return;
+    if (_running.len() < _limit and not _due.load())
+        return;
+
+    if (auto res = _commit(); not res) {
+        logError("Journal::end: commit failed, aborting: {}", res.none().msg());
+        _aborted = true;
+    }
+}
+
+Res<> Journal::write(u64 block, Bytes data) {
+    if (data.len() != _blockSize)
+        return Error::invalidArgument("Journal::write: not one block");
+    if ((block >> 32) and _tagSize < sizeof(Jbd2::Tag))
+        return Error::invalidArgument("Journal::write: block past 32 bits");
+
+    LockScoped lk(_lock);
+    if (_aborted)
+        return Error::invalidState("Journal::write: aborted");
+
+    auto* copy = _running.get(block);
+    if (not copy) {
+        copy = new Vec<u8>();
+        copy->resize(_blockSize, 0);
+        _running.put(block, copy);
+        _arm();
+    }
+    memcpy(copy->buf(), data.buf(), _blockSize);
+
+    // Logged again after being revoked, the newest copy must win.
+    for (usize i = 0; i < _revokes.len(); i++) {
+        if (_revokes[i] == block) {
+            _revokes.removeAt(i);
+            break;
+        }
+    }
+    return Ok();
+}
+
+void Journal::revoke(u64 block) {
+    LockScoped lk(_lock);
+    if (auto* copy = _running.remove(block))
+        delete copy;
+
+    // Only the log can still hold a copy worth revoking.
+    if (auto* copy = _committed.remove(block)) {
+        delete copy;
+        _revokes.pushBack(block);
+    }
+}
+
+bool Journal::read(u64 block, Bytes buf) {
+    LockScoped lk(_lock);
+    auto*      copy = _running.get(block);
+    if (not copy)
+        copy = _committed.get(block);
+    if (not copy)
+        return false;
+
+    memcpy((void*) buf.buf(), copy->buf(), min(buf.len(), copy->len()));
+    return true;
+}
+
+Res<> Journal::commit() {
+    LockScoped lk(_lock);
+    if (_aborted)
+        return Error::invalidState("Journal::commit: aborted");
+    if (_handles) {
+        _due.store(true);
+        return Ok();
+    }
+
+    auto res = _commit();
+    if (not res)
+        _aborted = true;
+    return res;
+}
+
+Res<> Journal::checkpoint() {
+    LockScoped lk(_lock);
+    if (_aborted)
+        return Error::invalidState("Journal::checkpoint: aborted");
+
+    // Blocks of a transaction still open stay in memory.
+    Res<> res = Ok();
+    if (not _handles)
+        res = _commit();
+    if (res)
+        res = _checkpoint();
+    if (not res)
+        _aborted = true;
+    return res;
+}
+
+// MARK: - Log -----------------------------------------------------------------
+
+usize Journal::_free() const {
+    usize size = _super.maxLen - _super.first;
+    usize used = _head >= _tail ? _head - _tail : size - (_tail - _head);
+
+    // One block stays unused so a full log is not mistaken for an empty one.
+    return size - used - 1;
+}
+
+u64 Journal::_map(u32 index) const {
+    for (auto& ext : _extents) {
+        if (index < ext.count)
+            return ext.block + index;
+        index -= ext.count;
+    }
+    return 0; // Past `maxLen`, checked against the extents at open
+}
+
+BlkRequest Journal::_request(u64 block, Bytes buf, BlkRequest::Op op) {
+    BlkRequest req {
+        .dev   = &*_dev,
+        .op    = op,
+        .lba   = _lba(block),
+        .count = buf.len() / _dev->_blockSize,
+        .segs  = {},
+        .fn    = nullptr,
+        .ctx   = nullptr,
+    };
+    if (buf.len())
+        req.segs.pushBack(buf);
+    return req;
+}
+
+Res<> Journal::_io(u32 index, Bytes buf, BlkRequest::Op op) {
+    auto req = _request(_map(index), buf, op);
+    return blkWait(req);
+}
+
+Res<> Journal::_batch(Vec<BlkRequest>& reqs) {
+    struct _Wait {
+        Atomic<usize> pending { 0 };
+        Atomic<bool>  failed { false };
+        Res<>         res = Ok();
+    } wait;
+
+    wait.pending.store(reqs.len());
+    {
+        BlkPlug plug;
+        for (auto& req : reqs) {
+            req.ctx = &wait;
+            req.fn  = [](BlkRequest& req, Res<> res) {
+                auto* wait = static_cast<_Wait*>(req.ctx);
+                if (not res and not wait->failed.xchg(true))
+                    wait->res = res;
+                wait->pending.fetchSub(1, Release);
+            };
+            blkSubmit(req);
+        }
+    }
+
+    while (wait.pending.load(Acquire)) {
+        _dev->poll();
+        _Embed::relaxe();
+    }
+    return wait.res;
+}
+
+Res<> Journal::_flush() {
+    auto req = _request(0, {}, BlkRequest::Op::Flush);
+    return blkWait(req);
+}
+
+Res<> Journal::_writeSuper() {
+    Vec<u8> buf;
+    buf.resize(_blockSize, 0);
+    memcpy(buf.buf(), &_super, sizeof(Jbd2::Super));
+    return _io(0, buf, BlkRequest::Op::Write);
+}
+
+void Journal::_arm() {
+    if (_timer.pending())
+        return;
+    _timer.deadline = Hal::clock() + INTERVAL;
+    (void) addTimer(_timer);
+}
+
+// MARK: - Commit --------------------------------------------------------------
+
+Res<> Journal::_commit() {
+    _due.store(false);
+    cancelTimer(_timer);
+    if (not _running.len() and not _revokes.len())
+        return Ok();
+
+    // The first tag of a descriptor is followed by the journal UUID.
+    usize record    = _tagSize == sizeof(Jbd2::Tag) ? 8 : 4;
+    usize perDesc   = (_blockSize - sizeof(Jbd2::Header) - 16) / _tagSize;
+    usize perRevoke = (_blockSize - sizeof(Jbd2::Revoke)) / record;
+    usize blocks    = _running.len();
+    usize descs     = alignUp(blocks, perDesc) / perDesc;
+    usize revokes   = alignUp(_revokes.len(), perRevoke) / perRevoke;
+    usize needed    = descs + blocks + revokes + 1;
+
+    if (needed > _free())
+        try$(_checkpoint());
+    if (needed > _free())
+        return Error::storageFull("Journal::commit: transaction too large");
+
+    Vec<u64>      homes;
+    Vec<Vec<u8>*> copies;
+    _running.each([&](u64 block, Vec<u8>& data) {
+        homes.pushBack(block);
+        copies.pushBack(&data);
+    });
+
+    // Descriptors, escaped copies, revoke blocks and the commit block,
+    // reserved so that references to them stay valid.
+    Vec<Vec<u8>>    extra;
+    Vec<BlkRequest> reqs;
+    u32             start = _head;
+    u32             index = _head;
+    extra.ensure(needed);
+
+    auto fresh = [&]() -> Vec<u8>& {
+        Vec<u8> buf;
+        buf.resize(_blockSize, 0);
+        extra.pushBack(::move(buf));
+        return extra[extra.len() - 1];
+    };
+
+    auto header = [&](Vec<u8>& buf, Jbd2::Header::Type type) {
+        Jbd2::Header head {
+            .magic    = Jbd2::MAGIC,
+            .type     = type,
+            .sequence = _seq,
+        };
+        memcpy(buf.buf(), &head, sizeof(head));
+    };
+
+    for (usize i = 0; i < homes.len(); i += perDesc) {
+        usize n    = min(homes.len() - i, perDesc);
+        auto& desc = fresh();
+        header(desc, Jbd2::Header::Descriptor);
+        reqs.pushBack(_request(_map(index), desc, BlkRequest::Op::Write));
+        index = _next(index);
+
+        usize off = sizeof(Jbd2::Header);
+        for (usize j = 0; j < n; j++) {
+            Bytes data  = *copies[i + j];
+            u16   flags = 0;
+            if (j)
+                flags |= Jbd2::Tag::SameUuid;
+            if (j + 1 == n)
+                flags |= Jbd2::Tag::Last;
+
+            // A block that looks like a log block header is logged with
+            // its magic zeroed, replay puts it back.
+            u32be magic;
+            memcpy(&magic, data.buf(), sizeof(magic));
+            if (magic == Jbd2::MAGIC) {
+                auto& copy = fresh();
+                memcpy(copy.buf(), data.buf(), _blockSize);
+                memset(copy.buf(), 0, sizeof(magic));
+                data = copy;
+                flags |= Jbd2::Tag::Escape;
+            }
+
+            Jbd2::Tag tag {
+                .blockLo  = (u32) homes[i + j],
+                .checksum = 0,
+                .flags    = flags,
+                .blockHi  = (u32) (homes[i + j] >> 32),
+            };
+            memcpy(desc.buf() + off, &tag, _tagSize);
+            off += _tagSize;
+            if (not j) {
+                memcpy(desc.buf() + off, _super.uuid.buf(), 16);
+                off += 16;
+            }
+
+            reqs.pushBack(_request(_map(index), data, BlkRequest::Op::Write));
+            index = _next(index);
+        }
+    }
+
+    for (usize i = 0; i < _revokes.len(); i += perRevoke) {
+        usize n   = min(_revokes.len() - i, perRevoke);
+        auto& buf = fresh();
+        header(buf, Jbd2::Header::Revoke);
+
+        u32be count = (u32) (sizeof(Jbd2::Revoke) + n * record);
+        memcpy(buf.buf() + sizeof(Jbd2::Header), &count, sizeof(count));
+        for (usize j = 0; j < n; j++) {
+            u8* at = buf.buf() + sizeof(Jbd2::Revoke) + j * record;
+            if (record == 8) {
+                u64be val = _revokes[i + j];
+                memcpy(at, &val, record);
+            } else {
+                u32be val = (u32) _revokes[i + j];
+                memcpy(at, &val, record);
+            }
+        }
+
+        reqs.pushBack(_request(_map(index), buf, BlkRequest::Op::Write));
+        index = _next(index);
+    }
+
+    // An empty log on disk would make replay skip this transaction.
+    if (not _super.start) {
+        _super.start    = start;
+        _super.sequence = _seq;
+        try$(_writeSuper());
+    }
+
+    try$(_batch(reqs));
+
+    // Only once everything before it is stable may the commit block land,
+    // and the transaction only counts once it has.
+    try$(_flush());
+    auto& last = fresh();
+    header(last, Jbd2::Header::Commit);
+    try$(_io(index, last, BlkRequest::Op::Write));
+    try$(_flush());
+
+    _head = _next(index);
+    _running.each([&](u64 block, Vec<u8>& data) {
+        if (auto* old = _committed.put(block, &data))
+            delete old;
+    });
+    _running.clear();
+    _revokes.clear();
+    _seq++;
+    return Ok();
+}
+
+Res<> Journal::_checkpoint() {
+    if (_committed.len()) {
+        Vec<BlkRequest> reqs;
+        _committed.each([&](u64 block, Vec<u8>& data) {
+            reqs.pushBack(_request(block, data, BlkRequest::Op::Write));
+        });
+        try$(_batch(reqs));
+        try$(_flush());
+
+        _committed.each([](u64, Vec<u8>& data) { delete &data; });
+        _committed.clear();
+    }
+
+    if (_super.start) {
+        _super.start    = 0;
+        _super.sequence = _seq;
+        try$(_writeSuper());
+        try$(_flush());
+    }
+    _head = _tail = _super.first;
+    return Ok();
+}
+
+// MARK: - Replay --------------------------------------------------------------
+
+Res<> Journal::_replay() {
+    _head = _tail = _super.first;
+    _seq          = _super.sequence;
+    if (not _super.start)
+        return Ok();
+
+    // What a transaction logs only counts once its commit block is found.
+    Vec<_Found> copies;
+    Vec<_Found> revokes;
+    usize       keptCopies  = 0;
+    usize       keptRevokes = 0;
+    usize       record      = _tagSize == sizeof(Jbd2::Tag) ? 8 : 4;
+
+    Vec<u8> buf;
+    buf.resize(_blockSize, 0);
+    u32   seq     = _super.sequence;
+    u32   index   = _super.start;
+    usize scanned = 0;
+    usize size    = _super.maxLen - _super.first;
+    while (scanned < size) {
+        try$(_io(index, buf, BlkRequest::Op::Read));
+        Jbd2::Header header;
+        memcpy(&header, buf.buf(), sizeof(header));
+        if (header.magic != Jbd2::MAGIC or header.sequence != seq)
+            break;
+        index = _next(index);
+        scanned++;
+
+        if (header.type == Jbd2::Header::Descriptor) {
+            usize off  = sizeof(Jbd2::Header);
+            bool  last = false;
+            while (not last and off + _tagSize <= _blockSize) {
+                Jbd2::Tag tag {};
+                memcpy(&tag, buf.buf() + off, _tagSize);
+                off += _tagSize;
+                if (not(tag.flags & Jbd2::Tag::SameUuid))
+                    off += 16;
+                last = tag.flags & Jbd2::Tag::Last;
+
+                u64 block = tag.blockLo;
+                if (_tagSize == sizeof(Jbd2::Tag))
+                    block |= (u64) (u32) tag.blockHi << 32;
+                copies.pushBack({
+                    .block   = block,
+                    .index   = index,
+                    .seq     = seq,
+                    .escaped = (bool) (tag.flags & Jbd2::Tag::Escape),
+                });
+                index = _next(index);
+                scanned++;
+            }
+        } else if (header.type == Jbd2::Header::Revoke) {
+            Jbd2::Revoke rev;
+            memcpy(&rev, buf.buf(), sizeof(rev));
+            usize end = min((usize) rev.count, _blockSize);
+            for (usize off = sizeof(rev); off + record <= end; off += record) {
+                u64 block;
+                if (record == 8) {
+                    u64be val;
+                    memcpy(&val, buf.buf() + off, record);
+                    block = val;
+                } else {
+                    u32be val;
+                    memcpy(&val, buf.buf() + off, record);
+                    block = val;
+                }
+                revokes.pushBack({ block, 0, seq, false });
+            }
+        } else if (header.type == Jbd2::Header::Commit) {
+            keptCopies  = copies.len();
+            keptRevokes = revokes.len();
+            seq++;
+        } else {
+            break;
+        }
+    }
+
+    // Filled once the vectors are done growing, the newest entry wins.
+    Radix<_Found> revoked;
+    for (usize i = 0; i < keptRevokes; i++) {
+        auto& rev  = revokes[i];
+        auto* prev = revoked.get(rev.block);
+        if (not prev or _after(rev.seq, prev->seq))
+            revoked.put(rev.block, &rev);
+    }
+
+    Radix<_Found> newest;
+    for (usize i = 0; i < keptCopies; i++)
+        newest.put(copies[i].block, &copies[i]);
+
+    Vec<_Found*> picks;
+    newest.each([&](u64 block, _Found& copy) {
+        auto* rev = revoked.get(block);
+        if (not rev or _after(copy.seq, rev->seq))
+            picks.pushBack(&copy);
+    });
+
+    Vec<u8> chunk;
+    chunk.resize(REPLAY_BATCH * _blockSize, 0);
+    for (usize i = 0; i < picks.len(); i += REPLAY_BATCH) {
+        usize n = min(picks.len() - i, REPLAY_BATCH);
+
+        Vec<BlkRequest> reqs;
+        for (usize j = 0; j < n; j++) {
+            Bytes data = slice(chunk, j * _blockSize, (j + 1) * _blockSize);
+            reqs.pushBack(_request(_map(picks[i + j]->index), data,
+                                   BlkRequest::Op::Read));
+        }
+        try$(_batch(reqs));
+
+        reqs.clear();
+        for (usize j = 0; j < n; j++) {
+            Bytes data = slice(chunk, j * _blockSize, (j + 1) * _blockSize);
+            if (picks[i + j]->escaped) {
+                u32be magic = Jbd2::MAGIC;
+                memcpy((void*) data.buf(), &magic, sizeof(magic));
+            }
+            reqs.pushBack(
+                _request(picks[i + j]->block, data, BlkRequest::Op::Write));
+        }
+        try$(_batch(reqs));
+    }
+    try$(_flush());
+
+    logInfo("Journal::open: replayed {} transactions, {} blocks",
+            seq - _super.sequence, picks.len());
+
+    _seq            = seq;
+    _super.start    = 0;
+    _super.sequence = seq;
+    return Ok();
+}
+
+} // namespace Realms::Sys::Io
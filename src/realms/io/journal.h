@@ -0,0 +1,194 @@
+#pragma once
+
+#include <jbd2/spec.h>
+#include <realms/io/blk.h>
+#include <realms/io/dev.stor.h>
+#include <realms/tasks/timer.h>
+#include <sdk-meta/atomic.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/radix.h>
+#include <sdk-meta/rc.h>
+#include <sdk-meta/res.h>
+#include <sdk-meta/traits.h>
+#include <sdk-meta/vec.h>
+
+namespace Realms::Sys::Io {
+
+/**
+ * @brief Consecutive filesystem blocks holding part of a journal.
+ */
+struct JournalExtent {
+    u64   block;
+    usize count;
+};
+
+/**
+ * @brief A write-ahead log of filesystem metadata, in the JBD2 format of
+ * ext3 and ext4.
+ *
+ * Metadata blocks are logged into the running transaction instead of being
+ * written home. A block changed again before the transaction commits is
+ * only logged once. The transaction commits when it grows past a threshold
+ * or a few seconds after its first block, as one sequential write of the
+ * log followed by a commit block; blocks go home later, in block order,
+ * when the log needs the room or the journal is checkpointed.
+ *
+ * Until then the newest copy of a block lives here, so the filesystem must
+ * read metadata through read() before going to the disk.
+ */
+struct Journal : Meta::Pinned {
+    static constexpr usize    BATCH    = 512; // Blocks, at most
+    static constexpr TimeSpan INTERVAL = TimeSpan::ofSeconds(5);
+
+    Rc<StorDev>        _dev;
+    usize              _offset; // Of the filesystem on the device, in bytes
+    usize              _blockSize;
+    Vec<JournalExtent> _extents;
+    Jbd2::Super        _super;
+    usize              _tagSize;
+    usize              _limit; // Blocks a transaction grows to before commit
+
+    Lock           _lock;
+    Radix<Vec<u8>> _running;   // Logged by the running transaction
+    Vec<u64>       _revokes;   // Revoked by the running transaction
+    Radix<Vec<u8>> _committed; // Committed, not written home yet
+    usize          _handles = 0;
+    u32            _seq;  // Of the running transaction
+    u32            _head; // First free block of the log
+    u32            _tail; // First block of the oldest transaction in the log
+    bool           _aborted = false;
+
+    Timer        _timer;
+    Atomic<bool> _due { false }; // Set by the timer, commit on the next end()
+
+    Journal(Rc<StorDev> dev, usize offset, usize blockSize);
+
+    ~Journal();
+
+    /**
+     * @brief Open the journal stored in `extents` and replay every
+     * transaction committed to it but not written home.
+     *
+     * @retval Error::invalidData if there is no journal superblock.
+     * @retval Error::notSupported for checksummed or fast-commit journals,
+     *         or a journal block size other than the filesystem's.
+     */
+    static Res<Journal*> open(Rc<StorDev>        dev,
+                              usize              offset,
+                              usize              blockSize,
+                              Vec<JournalExtent> extents);
+
+    /**
+     * @brief Open a handle on the running transaction. It does not commit
+     * while a handle is open, so what is logged between begin() and end()
+     * reaches the disk as a whole or not at all.
+     */
+    void begin();
+
+    /**
+     * @brief Close a handle, committing when it was the last one and the
+     * transaction is due. A failed commit aborts the journal.
+     */
+    void end();
+
+    /**
+     * @brief Log the new contents of `block`, one block long.
+     *
+     * @retval Error::invalidState if the journal was aborted.
+     */
+    Res<> write(u64 block, Bytes data);
+
+    /**
+     * @brief Forget `block`, freed and maybe reused for file data, so that
+     * neither a checkpoint nor a replay writes an old copy over it.
+     */
+    void revoke(u64 block);
+
+    /**
+     * @brief Copy the newest logged contents of `block` to `buf`.
+     *
+     * @return false if nothing is logged for it.
+     */
+    bool read(u64 block, Bytes buf);
+
+    /**
+     * @brief Commit the running transaction now, or as soon as its last
+     * handle closes.
+     */
+    Res<> commit();
+
+    /**
+     * @brief Commit, write every logged block home and mark the log empty.
+     */
+    Res<> checkpoint();
+
+    /**
+     * @brief Check the superblock against the extents, then replay.
+     */
+    Res<> _load();
+
+    // MARK: - Log -------------------------------------------------------------
+
+    u32 _next(u32 index) const {
+        return index + 1 < _super.maxLen ? index + 1 : (u32) _super.first;
+    }
+
+    usize _free() const;
+
+    u64 _lba(u64 block) const {
+        return (_offset + block * _blockSize) / _dev->_blockSize;
+    }
+
+    /**
+     * @brief The filesystem block holding block `index` of the journal.
+     */
+    u64 _map(u32 index) const;
+
+    BlkRequest _request(u64 block, Bytes buf, BlkRequest::Op op);
+
+    /**
+     * @brief Read or write block `index` of the journal.
+     */
+    Res<> _io(u32 index, Bytes buf, BlkRequest::Op op);
+
+    /**
+     * @brief Submit `reqs` as one plugged batch and wait for all of them.
+     */
+    Res<> _batch(Vec<BlkRequest>& reqs);
+
+    Res<> _flush();
+
+    Res<> _writeSuper();
+
+    Res<> _commit();
+
+    Res<> _checkpoint();
+
+    /**
+     * @brief Scan the log from its start, then write home the newest copy
+     * of every block of a committed transaction that no later revoke
+     * covers.
+     */
+    Res<> _replay();
+
+    void _arm();
+};
+
+/**
+ * @brief Keeps a handle open on `journal`, if there is one, for its scope.
+ */
+struct [[nodiscard]] JournalHandle : Meta::Pinned {
+    Journal* _journal;
+
+    JournalHandle(Journal* journal) : _journal(journal) {
+        if (_journal)
+            _journal->begin();
+    }
+
+    ~JournalHandle() {
+        if (_journal)
+            _journal->end();
+    }
+};
+
+} // namespace Realms::Sys::Io
@@ -0,0 +1,226 @@
+#include <realms/io/mmap.h>
+#include <realms/mm/mem.h>
+#include <sdk-logs/logger.h>
+#include <sdk-meta/_embed.h>
+
+namespace Realms::Sys::Io {
+
+namespace {
+
+Lock          _lock; // Guards `_maps`
+Vec<FileMap*> _maps; // Sorted by address
+
+Flags<VmmFlags> _prot(FileMap const& map, bool write) {
+    Flags<VmmFlags> prot = VmmFlags::READ;
+    if (write)
+        prot |= VmmFlags::WRITE;
+    if (not map.flags[MapFlags::Execute])
+        prot |= VmmFlags::NO_EXECUTE;
+    return prot;
+}
+
+bool _shared(FileMap const& map) {
+    return map.flags[MapFlags::Shared] and map.flags[MapFlags::Write];
+}
+
+// Called with `_lock` held. The fault count keeps the mapping around once
+// the lock is dropped.
+FileMap* _find(uflat addr) {
+    usize lo = 0;
+    usize hi = _maps.len();
+    while (lo < hi) {
+        usize mid = (lo + hi) / 2;
+        auto* map = _maps[mid];
+        if (addr < map->range.start())
+            hi = mid;
+        else if (addr >= map->range.end())
+            lo = mid + 1;
+        else
+            return map;
+    }
+    return nullptr;
+}
+
+Res<> _map(uflat virt, uflat phys, Flags<VmmFlags> prot) {
+    return globalVmm().map({ virt, PAGE_SIZE }, { phys, PAGE_SIZE }, prot);
+}
+
+Res<> _fault(FileMap& map, uflat addr, bool write) {
+    u64         index = (addr - map.range.start()) / PAGE_SIZE;
+    uflat       virt  = map.range.start() + index * PAGE_SIZE;
+    bool        dirty = write and map.flags[MapFlags::Shared];
+    CacheLocked lk(map._lock);
+
+    // Another processor may have served the same fault first.
+    if (auto entry = globalVmm().at(virt)) {
+        auto& mapped = entry.unwrap();
+        if (not write or mapped.flags[VmmFlags::WRITE])
+            return Ok();
+    }
+
+    auto* page = map._pages.get(index);
+    if (not page) {
+        u64 first = map.offset / PAGE_SIZE;
+        page      = try$(cacheGet(*map.file->mapping, first + index));
+        map._pages.put(index, page);
+    }
+
+    if (write and not dirty) {
+        // The copy replaces the cache page in this mapping for good.
+        uflat phys = try$(pmm().alloc(PAGE_SIZE, PmmFlags::Kernel)).start();
+        memcpy((void*) mmapVirtIo(phys).unwrap(), (void const*) page->virt,
+               PAGE_SIZE);
+        if (auto res = _map(virt, phys, _prot(map, true)); not res) {
+            pmm().free({ phys, PAGE_SIZE });
+            return res;
+        }
+        map._copies.pushBack(phys);
+        map._pages.remove(index);
+        cachePut(*page);
+        return Ok();
+    }
+
+    if (dirty)
+        cacheDirty(*page);
+
+    // Pages still dirty from an earlier write need no second fault.
+    bool open = _shared(map) and page->has(CachePage::Dirty);
+    try$(_map(virt, page->phys, _prot(map, open)));
+    if (open)
+        page->writable.inc();
+    return Ok();
+}
+
+// Called with `map._lock` held.
+bool _writable(FileMap& map, u64 index) {
+    auto entry = globalVmm().at(map.range.start() + index * PAGE_SIZE);
+    return entry and entry.unwrap().flags[VmmFlags::WRITE];
+}
+
+} // namespace
+
+Res<FileMap*> mmap(Rc<File>        file,
+                   usize           offset,
+                   usize           len,
+                   Flags<MapFlags> flags,
+                   Opt<VmmRange>   at) {
+    if (not file->mapping)
+        return Error::notSupported("mmap: file is not cached");
+    if (not pageAligned(offset) or not len)
+        return Error::invalidArgument("mmap: bad offset or length");
+
+    usize    size = pageAlignUp(len);
+    VmmRange range;
+    if (at) {
+        if (not pageAligned(at->start()) or at->size() < size)
+            return Error::invalidArgument("mmap: bad address");
+        range = { at->start(), size };
+    } else {
+        range = try$(globalVmm().alloc(NONE, size / PAGE_SIZE, VmmFlags::READ));
+    }
+
+    auto* map       = new FileMap(file, offset, range, flags);
+    map->_ownsRange = not at;
+
+    CacheLocked lk(_lock);
+    usize      i = 0;
+    while (i < _maps.len() and _maps[i]->range.start() < range.start())
+        i++;
+    _maps.insert(i, map);
+    return Ok(map);
+}
+
+Res<> msync(FileMap& map) {
+    if (not _shared(map))
+        return Ok();
+
+    // The write-back closes the pages it takes, see mmapProtect().
+    return cacheSync(*map.file->mapping);
+}
+
+void mmapProtect(CacheMapping& mapping, Slice<CachePage*> pages) {
+    bool any = false;
+    for (auto* page : pages)
+        any = any or page->writable.load();
+    if (not any)
+        return;
+
+    CacheLocked lk(_lock);
+    for (auto* map : _maps) {
+        if (map->file->mapping != &mapping or not _shared(*map))
+            continue;
+
+        CacheLocked mlk(map->_lock);
+        u64         first = map->offset / PAGE_SIZE;
+        u64         count = map->range.size() / PAGE_SIZE;
+        for (auto* page : pages) {
+            if (page->index < first or page->index - first >= count)
+                continue;
+
+            u64 index = page->index - first;
+            if (map->_pages.get(index) != page or not _writable(*map, index))
+                continue;
+
+            uflat virt = map->range.start() + index * PAGE_SIZE;
+            (void) _map(virt, page->phys, _prot(*map, false));
+            page->writable.dec();
+        }
+    }
+}
+
+Res<> munmap(FileMap* map) {
+    {
+        CacheLocked lk(_lock);
+        for (usize i = 0; i < _maps.len(); i++) {
+            if (_maps[i] == map) {
+                _maps.removeAt(i);
+                break;
+            }
+        }
+    }
+
+    // Found before the removal, a fault may still be using it.
+    while (map->_faults.load(Acquire))
+        _Embed::relaxe();
+
+    auto res = msync(*map);
+
+    {
+        CacheLocked lk(map->_lock);
+        map->_pages.each([&](u64 index, CachePage& page) {
+            if (_writable(*map, index))
+                page.writable.dec();
+        });
+    }
+
+    try$(globalVmm().unmap(map->range));
+    map->_pages.each([](u64, CachePage& page) { cachePut(page); });
+    for (auto phys : map->_copies)
+        (void) pmm().free({ phys, PAGE_SIZE });
+    if (map->_ownsRange) {
+        if (auto freed = globalVmm().free(map->range); not freed)
+            logWarn("munmap: range leaked: {}\n", freed.none().msg());
+    }
+
+    delete map;
+    return res;
+}
+
+bool mmapFault(uflat addr, bool write) {
+    FileMap* map;
+    {
+        CacheLocked lk(_lock);
+        map = _find(addr);
+        if (not map)
+            return false;
+        map->_faults.inc();
+    }
+
+    bool ok = not write or map->flags[MapFlags::Write];
+    if (ok)
+        ok = (bool) _fault(*map, addr, write);
+    map->_faults.dec(Release);
+    return ok;
+}
+
+} // namespace Realms::Sys::Io
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <realms/hal/vmm.h>
+#include <realms/io/cache.h>
+#include <realms/io/file.h>
+#include <sdk-meta/atomic.h>
+#include <sdk-meta/flags.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/radix.h>
+#include <sdk-meta/rc.h>
+#include <sdk-meta/vec.h>
+
+namespace Realms::Sys::Io {
+
+enum struct MapFlags : u8 {
+    Read    = (1 << 0),
+    Write   = (1 << 1),
+    Execute = (1 << 2),
+    Shared  = (1 << 3), // Writes reach the file, not only the mapping
+};
+MakeFlags$(MapFlags);
+
+/**
+ * @brief A range of a file mapped into kernel memory, backed by the pages
+ * of its page cache.
+ *
+ * Nothing is mapped up front, each page is looked up on its first access
+ * and stays referenced in the cache until the mapping goes, so every
+ * mapping of a file reads the same physical pages. Pages of a shared
+ * writable mapping are mapped read-only at first: the first write to one
+ * marks it dirty and opens it up, and the write-back closes it again before
+ * cleaning it. Private writable mappings copy a page on its first write.
+ */
+struct FileMap : Meta::Pinned {
+    Rc<File>        file;
+    usize           offset; // In the file, page aligned
+    VmmRange        range;
+    Flags<MapFlags> flags;
+
+    Lock             _lock;             // Guards the pages and their entries
+    Radix<CachePage> _pages;            // By page of the mapping, referenced
+    Vec<uflat>       _copies;           // Private pages, freed with the map
+    Atomic<usize>    _faults { 0 };     // Faults being served
+    bool             _ownsRange = true; // Allocated by `mmap()`
+
+    FileMap(Rc<File> file, usize offset, VmmRange range, Flags<MapFlags> flags)
+        : file(file),
+          offset(offset),
+          range(range),
+          flags(flags) { }
+};
+
+/**
+ * @brief Map `len` bytes of `file` from `offset` at `at`, or wherever the
+ * kernel heap has room.
+ *
+ * @retval Error::notSupported if the file has no page cache.
+ * @retval Error::invalidArgument if `offset` or `at` is not page aligned,
+ * or `at` is too small.
+ */
+Res<FileMap*> mmap(Rc<File>        file,
+                   usize           offset,
+                   usize           len,
+                   Flags<MapFlags> flags,
+                   Opt<VmmRange>   at = NONE);
+
+/**
+ * @brief Write the pages written through `map` back and wait for them.
+ */
+Res<> msync(FileMap& map);
+
+/**
+ * @brief Sync and remove `map`, releasing its pages.
+ */
+Res<> munmap(FileMap* map);
+
+/**
+ * @brief Map `pages` of `mapping` read-only again in every shared mapping
+ * that can write them. Called by the write-back between taking the pages
+ * and writing them.
+ */
+void mmapProtect(CacheMapping& mapping, Slice<CachePage*> pages);
+
+/**
+ * @brief Serve a page fault at `addr`.
+ *
+ * @return false if no mapping covers it or the access is not allowed.
+ */
+bool mmapFault(uflat addr, bool write);
+
+} // namespace Realms::Sys::Io
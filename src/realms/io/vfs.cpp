@@ -0,0 +1,418 @@
+#include <realms/io/vfs.h>
+#include <sdk-meta/hash.h>
+
+namespace Realms::Sys::Io {
+
+namespace {
+
+// Names `[base, end)` of `path`, relative to the filesystem they are in.
+Path _relative(Path const& path, usize base, usize end) {
+    Path rel;
+    for (usize i = base; i < end; i++)
+        rel.comp.pushBack(path.comp[i]);
+    return rel;
+}
+
+void _free(RcuHead& head) {
+    delete static_cast<Dentry*>(&head);
+}
+
+} // namespace
+
+Dentry::Dentry(Dentry* parent, Fs* fs, u64 hash, Str name, Opt<Rc<Node>> node)
+    : _parent(parent),
+      _fs(fs),
+      _hash(hash),
+      node(node) {
+    for (usize i = 0; i < name.len(); i++)
+        _name.pushBack(name.buf()[i]);
+    if (node)
+        _lent.store(&**node, Relaxed);
+}
+
+// MARK: - Mount ---------------------------------------------------------------
+
+VirtualFs::VirtualFs() {
+    name = "vfs";
+}
+
+VirtualFs::~VirtualFs() {
+    // Nothing can be reading any more, free everything right away.
+    for (auto& bucket : _buckets) {
+        for (auto* dentry = bucket.load(); dentry;) {
+            auto* next = dentry->_next.load();
+            delete dentry;
+            dentry = next;
+        }
+    }
+    for (auto& mount : _mounts)
+        delete mount.root;
+}
+
+Res<> VirtualFs::mount(Path at, Rc<Fs> fs) {
+    LockScoped lk(_lock);
+
+    Dentry* target = nullptr;
+    if (_root.load() or at.len()) {
+        target = try$(_resolve(at, at.len())).dentry;
+        if (not target->node)
+            return Error::notFound("VirtualFs::mount: no such directory");
+        if (target->_mounted.load())
+            return Error::resourceBusy("VirtualFs::mount: already mounted");
+    }
+
+    auto  node = try$(fs->open(Path {}));
+    auto* root = new Dentry(nullptr, &*fs, 0, Str {}, node);
+    _mounts.pushBack({ fs, root, target });
+
+    if (target)
+        target->_mounted.store(root, Release);
+    else
+        _root.store(root, Release);
+    return Ok();
+}
+
+// MARK: - Lookup --------------------------------------------------------------
+
+u64 VirtualFs::_hash(Dentry const* parent, Str name) {
+    u64 seed = fnv64((byte const*) name.buf(), name.len());
+    return hash(seed, (uflat) parent);
+}
+
+Dentry* VirtualFs::_cross(Dentry* dentry, usize i, usize& base) {
+    while (auto* root = dentry->_mounted.load(Acquire)) {
+        dentry = root;
+        base   = i;
+    }
+    return dentry;
+}
+
+Dentry* VirtualFs::_lookup(Dentry const* parent, Str name, u64 hash) {
+    auto* dentry = _buckets[hash % BUCKETS].load(Acquire);
+    while (dentry) {
+        if (dentry->_hash == hash and dentry->_parent == parent and
+            dentry->name() == name)
+            return dentry;
+        dentry = dentry->_next.load(Acquire);
+    }
+    return nullptr;
+}
+
+void VirtualFs::_touch(Dentry* dentry) {
+    // Only the first use since the last pass of the trimmer writes.
+    if (not dentry->_referenced.load(Relaxed))
+        dentry->_referenced.store(true, Relaxed);
+}
+
+Dentry* VirtualFs::_walk(Path const& path) {
+    auto* at = _root.load(Acquire);
+    if (not at)
+        return nullptr;
+
+    usize base = 0;
+    for (usize i = 0; i < path.len(); i++) {
+        at = _cross(at, i, base);
+        if (not at->node)
+            return at;
+
+        Str name = path.comp[i].str();
+        at       = _lookup(at, name, _hash(at, name));
+        if (not at)
+            return nullptr;
+        _touch(at);
+    }
+    return _cross(at, path.len(), base);
+}
+
+Res<VirtualFs::_Walk> VirtualFs::_resolve(Path const& path, usize depth) {
+    auto* at = _root.load();
+    if (not at)
+        return Error::notFound("VirtualFs::_resolve: nothing mounted");
+
+    // Before the walk, which must not lose the entries it goes through.
+    if (_count > limit)
+        trim(limit);
+
+    usize base = 0;
+    for (usize i = 0; i < depth; i++) {
+        at = _cross(at, i, base);
+        if (not at->node)
+            return Ok(_Walk { at, base });
+
+        Str   name = path.comp[i].str();
+        u64   hash = _hash(at, name);
+        auto* next = _lookup(at, name, hash);
+        if (next) {
+            _touch(next);
+            at = next;
+            continue;
+        }
+
+        // Ask the filesystem for this name only, a missing one is cached as
+        // such so looking it up again costs nothing.
+        stats.misses.fetchAdd(1, Relaxed);
+        Opt<Rc<Node>> node = NONE;
+        auto          res  = at->_fs->open(_relative(path, base, i + 1));
+        if (res)
+            node = res.unwrap();
+        else if (res.none() != Error::NOT_FOUND)
+            return res.none();
+
+        next = new Dentry(at, at->_fs, hash, name, node);
+        _insert(next);
+        at = next;
+    }
+
+    return Ok(_Walk { _cross(at, depth, base), base });
+}
+
+Res<VirtualFs::_Walk> VirtualFs::_parentOf(Path const& path) {
+    if (not path.len())
+        return Error::invalidArgument("VirtualFs: empty path");
+
+    auto walk = try$(_resolve(path, path.len() - 1));
+    if (not walk.dentry->node)
+        return Error::notFound("VirtualFs: no such directory");
+    return Ok(walk);
+}
+
+// MARK: - Entries -------------------------------------------------------------
+
+void VirtualFs::_insert(Dentry* dentry) {
+    auto* parent     = dentry->_parent;
+    dentry->_sibling = parent->_child;
+    parent->_child   = dentry;
+
+    dentry->_lruPrev = _lruTail;
+    if (_lruTail)
+        _lruTail->_lruNext = dentry;
+    else
+        _lruHead = dentry;
+    _lruTail = dentry;
+    _count++;
+
+    // Fully built before readers can reach it.
+    auto& bucket = _buckets[dentry->_hash % BUCKETS];
+    dentry->_next.store(bucket.load(), Relaxed);
+    bucket.store(dentry, Release);
+}
+
+void VirtualFs::_drop(Dentry* dentry) {
+    while (dentry->_child)
+        _drop(dentry->_child);
+
+    // Readers past this entry keep following its `_next`, which stays valid
+    // until the grace period ends.
+    auto& bucket = _buckets[dentry->_hash % BUCKETS];
+    if (bucket.load() == dentry) {
+        bucket.store(dentry->_next.load(), Release);
+    } else {
+        auto* prev = bucket.load();
+        while (prev->_next.load() != dentry)
+            prev = prev->_next.load();
+        prev->_next.store(dentry->_next.load(), Release);
+    }
+
+    auto** link = &dentry->_parent->_child;
+    while (*link != dentry)
+        link = &(*link)->_sibling;
+    *link = dentry->_sibling;
+
+    _unlist(dentry);
+    _count--;
+
+    // The filesystem lets go of the node now, the entry's own reference
+    // goes with the entry, once nothing can have been lent it.
+    {
+        LockScoped lk(dentry->_nodeLock);
+        dentry->_dropped = true;
+        if (dentry->node)
+            (void) dentry->_fs->close(*dentry->node);
+    }
+
+    callRcu(*dentry, _free);
+}
+
+void VirtualFs::_unlist(Dentry* dentry) {
+    if (dentry->_lruPrev)
+        dentry->_lruPrev->_lruNext = dentry->_lruNext;
+    else
+        _lruHead = dentry->_lruNext;
+
+    if (dentry->_lruNext)
+        dentry->_lruNext->_lruPrev = dentry->_lruPrev;
+    else
+        _lruTail = dentry->_lruPrev;
+}
+
+void VirtualFs::_forget(Dentry* parent, Str name) {
+    if (auto* dentry = _lookup(parent, name, _hash(parent, name)))
+        _drop(dentry);
+}
+
+void VirtualFs::_refresh(Dentry* dir, Path const& rel) {
+    // Left as it was if this fails, the names are only stale.
+    auto res = dir->_fs->open(rel);
+    if (not res)
+        return;
+
+    auto* stale = new Rc<Node>(res.unwrap());
+    {
+        LockScoped lk(dir->_nodeLock);
+        ::swap(*stale, *dir->node);
+        dir->_lent.store(&**dir->node, Release);
+    }
+    (void) dir->_fs->close(*stale);
+    retireRcu(stale);
+}
+
+bool VirtualFs::_busy(Dentry* dentry) {
+    if (dentry->_mounted.load())
+        return true;
+    for (auto* child = dentry->_child; child; child = child->_sibling) {
+        if (_busy(child))
+            return true;
+    }
+    return false;
+}
+
+void VirtualFs::trim(usize keep) {
+    // A clock over the insertion order: used entries get moved to the back
+    // once, directories with cached children and mount points stay.
+    for (usize n = _count * 2; n and _count > keep and _lruHead; n--) {
+        auto* dentry = _lruHead;
+        if (not dentry->_child and not dentry->_mounted.load() and
+            not dentry->_referenced.load(Relaxed)) {
+            _drop(dentry);
+            stats.trimmed.fetchAdd(1, Relaxed);
+            continue;
+        }
+
+        dentry->_referenced.store(false, Relaxed);
+        _unlist(dentry);
+        dentry->_lruPrev = _lruTail;
+        dentry->_lruNext = nullptr;
+        if (_lruTail)
+            _lruTail->_lruNext = dentry;
+        else
+            _lruHead = dentry;
+        _lruTail = dentry;
+    }
+}
+
+// MARK: - Fs ------------------------------------------------------------------
+
+Res<> VirtualFs::create(Path path) {
+    LockScoped lk(_lock);
+    auto       walk = try$(_parentOf(path));
+    auto*      dir  = walk.dentry;
+    try$(dir->_fs->create(_relative(path, walk.base, path.len())));
+    _forget(dir, path.comp[path.len() - 1].str());
+    _refresh(dir, _relative(path, walk.base, path.len() - 1));
+    return Ok();
+}
+
+Res<Rc<Node>> VirtualFs::open(Path path) {
+    {
+        RcuReadScope scope;
+        if (auto* dentry = _walk(path)) {
+            // Reference counts are not atomic, the node is copied under the
+            // entry's lock. The read-side section keeps the entry itself
+            // alive until then.
+            LockScoped lk(dentry->_nodeLock);
+            if (not dentry->_dropped) {
+                stats.hits.fetchAdd(1, Relaxed);
+                if (not dentry->node) {
+                    stats.negative.fetchAdd(1, Relaxed);
+                    return Error::notFound("VirtualFs::open: no such file");
+                }
+                return Ok(*dentry->node);
+            }
+        }
+    }
+
+    LockScoped lk(_lock);
+    auto*      dentry = try$(_resolve(path, path.len())).dentry;
+    if (not dentry->node)
+        return Error::notFound("VirtualFs::open: no such file");
+
+    LockScoped nlk(dentry->_nodeLock);
+    return Ok(*dentry->node);
+}
+
+Node* VirtualFs::lend(Path const& path) {
+    auto* dentry = _walk(path);
+    if (not dentry)
+        return nullptr;
+
+    stats.hits.fetchAdd(1, Relaxed);
+    return dentry->_lent.load(Acquire);
+}
+
+Res<> VirtualFs::close(Rc<Node>) {
+    return Ok();
+}
+
+Res<> VirtualFs::remove(Path path) {
+    LockScoped lk(_lock);
+    auto       walk = try$(_parentOf(path));
+    auto*      dir  = walk.dentry;
+    Str        name = path.comp[path.len() - 1].str();
+
+    auto* dentry = _lookup(dir, name, _hash(dir, name));
+    if (dentry and _busy(dentry))
+        return Error::resourceBusy("VirtualFs::remove: mount point");
+
+    try$(dir->_fs->remove(_relative(path, walk.base, path.len())));
+    _forget(dir, name);
+    _refresh(dir, _relative(path, walk.base, path.len() - 1));
+    return Ok();
+}
+
+Res<Path> VirtualFs::move(Path src, Path dest) {
+    LockScoped lk(_lock);
+    auto       from  = try$(_parentOf(src));
+    auto       to    = try$(_parentOf(dest));
+    Str        name  = src.comp[src.len() - 1].str();
+    Str        dname = dest.comp[dest.len() - 1].str();
+    if (from.dentry->_fs != to.dentry->_fs)
+        return Error::notSupported("VirtualFs::move: across filesystems");
+
+    auto* dentry = _lookup(from.dentry, name, _hash(from.dentry, name));
+    if (dentry and _busy(dentry))
+        return Error::resourceBusy("VirtualFs::move: mount point");
+
+    try$(from.dentry->_fs->move(_relative(src, from.base, src.len()),
+                                _relative(dest, to.base, dest.len())));
+    _forget(from.dentry, name);
+    _forget(to.dentry, dname);
+    _refresh(from.dentry, _relative(src, from.base, src.len() - 1));
+    if (to.dentry != from.dentry)
+        _refresh(to.dentry, _relative(dest, to.base, dest.len() - 1));
+    return Ok(dest);
+}
+
+Res<Path> VirtualFs::copy(Path src, Path dest) {
+    LockScoped lk(_lock);
+    auto       from = try$(_parentOf(src));
+    auto       to   = try$(_parentOf(dest));
+    if (from.dentry->_fs != to.dentry->_fs)
+        return Error::notSupported("VirtualFs::copy: across filesystems");
+
+    try$(from.dentry->_fs->copy(_relative(src, from.base, src.len()),
+                                _relative(dest, to.base, dest.len())));
+    _forget(to.dentry, dest.comp[dest.len() - 1].str());
+    _refresh(to.dentry, _relative(dest, to.base, dest.len() - 1));
+    return Ok(dest);
+}
+
+Res<Vec<String>> VirtualFs::listFiles(Path path) {
+    LockScoped lk(_lock);
+    auto       walk = try$(_resolve(path, path.len()));
+    if (not walk.dentry->node)
+        return Error::notFound("VirtualFs::listFiles: no such directory");
+    return walk.dentry->_fs->listFiles(
+        _relative(path, walk.base, path.len()));
+}
+
+} // namespace Realms::Sys::Io
@@ -1,9 +1,203 @@
 #pragma once
 
 #include <realms/io/fs.h>
+#include <realms/tasks/rcu.h>
+#include <sdk-meta/atomic.h>
+#include <sdk-meta/lock.h>
+#include <sdk-meta/opt.h>
+#include <sdk-meta/vec.h>
 
 namespace Realms::Sys::Io {
 
-struct VirtualFs { };
+/**
+ * @brief A name in a directory, resolved to its node or, when `node` is
+ * NONE, known not to exist.
+ *
+ * Everything but the atomics and `node` is fixed once the entry is
+ * published: a change to the name replaces the entry rather than editing
+ * it, so readers may use it for as long as they stay in their read-side
+ * section. `node` is copied and replaced under `_nodeLock`, and the version
+ * it replaces is only released once no reader can have been lent it.
+ *
+ * The entry owns the filesystem's reference to the node, it is closed when
+ * the entry is dropped.
+ */
+struct Dentry : RcuHead {
+    Atomic<Dentry*> _next { nullptr };     // Hash chain, walked under RCU
+    Atomic<Dentry*> _mounted { nullptr };  // Root of a filesystem mounted here
+    Atomic<bool>    _referenced { false }; // Second chance for trimming
+    Atomic<Node*>   _lent { nullptr };     // `node`, for borrowers under RCU
+
+    Dentry*       _parent; // Null for the root of a filesystem
+    Fs*           _fs;
+    u64           _hash;
+    Vec<char>     _name;
+    Opt<Rc<Node>> node;
+
+    // Guarded by `_nodeLock`, with `node`.
+    Lock _nodeLock;
+    bool _dropped = false; // Closed, look the path up again
+
+    // Guarded by `VirtualFs::_lock`.
+    Dentry* _child   = nullptr;
+    Dentry* _sibling = nullptr;
+    Dentry* _lruPrev = nullptr;
+    Dentry* _lruNext = nullptr;
+
+    Dentry(Dentry* parent, Fs* fs, u64 hash, Str name, Opt<Rc<Node>> node);
+
+    Str name() const { return { _name.buf(), _name.len() }; }
+};
+
+/**
+ * @brief Counters of the dentry cache, updated without ordering.
+ */
+struct DentryStats {
+    Atomic<usize> hits { 0 };     // Paths resolved without the filesystem
+    Atomic<usize> negative { 0 }; // Of which known to be missing
+    Atomic<usize> misses { 0 };   // Names the filesystem was asked for
+    Atomic<usize> trimmed { 0 };
+};
+
+/**
+ * @brief The namespace, filesystems mounted on directories of each other,
+ * with a cache of the names resolved through it.
+ *
+ * Lookups hash (parent, name) into a table walked under RCU, so resolving a
+ * cached path takes no string scan and no shared lock: `open` only locks the
+ * entry it found to copy its reference, and `lend` takes none. Misses
+ * resolve one name at a time with the cache locked, and missing names are
+ * cached as negative entries. Entries nothing has used since the last pass
+ * are trimmed past `limit`, leaves first.
+ */
+struct VirtualFs : public Fs {
+    static constexpr usize BUCKETS = 1024;
+    static constexpr usize LIMIT   = 4096;
+
+    struct _Mount {
+        Rc<Fs>  fs;
+        Dentry* root;
+        Dentry* at; // Null for the root of the namespace
+    };
+
+    // Where a walk ended, and the first component inside the filesystem of
+    // the entry it ended on.
+    struct _Walk {
+        Dentry* dentry;
+        usize   base;
+    };
+
+    Atomic<Dentry*> _buckets[BUCKETS] {};
+    Atomic<Dentry*> _root { nullptr };
+    Lock            _lock; // Serializes misses and every change
+    Vec<_Mount>     _mounts;
+    Dentry*         _lruHead = nullptr; // Least recently added or used
+    Dentry*         _lruTail = nullptr;
+    usize           _count   = 0;
+    usize           limit    = LIMIT;
+    DentryStats     stats;
+
+    VirtualFs();
+
+    ~VirtualFs();
+
+    /**
+     * @brief Mount `fs` on the directory at `at`, or as the root when
+     * nothing is mounted yet and `at` is empty.
+     *
+     * @retval Error::resourceBusy if something is already mounted there.
+     */
+    Res<> mount(Path at, Rc<Fs> fs);
+
+    Res<> create(Path path) override;
+
+    /**
+     * @brief Open the node at `path`, shared by every caller while it stays
+     * cached.
+     */
+    Res<Rc<Node>> open(Path path) override;
+
+    /**
+     * @brief The node at `path` if it is cached, without taking a reference.
+     * Called in a read-side section, the node stays valid until it ends even
+     * if it is removed meanwhile. Null when the path is not cached or does
+     * not exist.
+     */
+    Node* lend(Path const& path);
+
+    /**
+     * @brief The filesystem's reference belongs to the cached entry, only
+     * the caller's goes with `node`.
+     */
+    Res<> close(Rc<Node> node) override;
+
+    Res<> remove(Path path) override;
+
+    /**
+     * @retval Error::notSupported across filesystems.
+     */
+    Res<Path> move(Path src, Path dest) override;
+
+    Res<Path> copy(Path src, Path dest) override;
+
+    Res<Vec<String>> listFiles(Path path) override;
+
+    /**
+     * @brief Drop unused entries until at most `keep` are left.
+     */
+    void trim(usize keep);
+
+    static u64 _hash(Dentry const* parent, Str name);
+
+    static Dentry* _cross(Dentry* dentry, usize i, usize& base);
+
+    Dentry* _lookup(Dentry const* parent, Str name, u64 hash);
+
+    /**
+     * @brief Walk the cached entries of `path`, null as soon as a name is
+     * not cached. Called in a read-side section.
+     */
+    Dentry* _walk(Path const& path);
+
+    /**
+     * @brief Walk the first `depth` names of `path`, asking the filesystems
+     * for the ones not cached. Called with the cache locked.
+     */
+    Res<_Walk> _resolve(Path const& path, usize depth);
+
+    /**
+     * @brief Walk to the directory holding the last name of `path`.
+     */
+    Res<_Walk> _parentOf(Path const& path);
+
+    void _insert(Dentry* dentry);
+
+    /**
+     * @brief Unpublish `dentry` and the entries below it, freed once no
+     * reader can see them.
+     */
+    void _drop(Dentry* dentry);
+
+    /**
+     * @brief Drop the entry of `name` in `parent`, if cached, after the
+     * filesystem changed it.
+     */
+    void _forget(Dentry* parent, Str name);
+
+    /**
+     * @brief Open `dir` again after its content changed, `rel` being its
+     * path inside its filesystem, so it lists the new names.
+     */
+    void _refresh(Dentry* dir, Path const& rel);
+
+    void _unlist(Dentry* dentry);
+
+    /**
+     * @brief Whether a filesystem is mounted on `dentry` or below it.
+     */
+    static bool _busy(Dentry* dentry);
+
+    static void _touch(Dentry* dentry);
+};
 
 } // namespace Realms::Sys::Io
@@ -0,0 +1,345 @@
+#include <ext2/spec.h>
+#include <realms/core/api.io.h>
+#include <realms/core/main.h>
+#include <realms/io/blk.h>
+#include <realms/io/fs.ext2.h>
+#include <realms/io/volume.h>
+#include <sdk-crypto/types.h>
+#include <sdk-meta/_embed.h>
+#include <sdk-meta/atomic.h>
+#include <sdk-meta/lock.h>
+#include <stor/gpt.h>
+#include <stor/mbr.h>
+
+namespace Realms::Sys::Io {
+
+namespace {
+
+static constexpr usize GPT_ARRAY     = 128 * sizeof(Gpt::Entry); // Usual size
+static constexpr usize GPT_LIMIT     = 1024 * 1024; // Largest array accepted
+static constexpr u16   MBR_SIGNATURE = 0xAA55;
+static constexpr u8    MBR_GPT       = Gpt::PROTECTIVE_MASTER_BOOT_RECORD.type;
+
+Lock             _lock; // Guards `_probes`
+Vec<VolumeProbe> _probes;
+
+/**
+ * @brief Blocks from `lba` read into `buf`, as part of a batch.
+ */
+struct _Read {
+    Rc<StorDev>     dev;
+    u64             lba;
+    Vec<u8>         buf;
+    Vec<BlkRequest> _reqs;
+    Atomic<bool>    _failed { false };
+    Atomic<usize>*  _pending = nullptr;
+
+    _Read(Rc<StorDev> dev, u64 lba, usize blocks)
+        : dev(dev),
+          lba(lba) {
+        buf.resize(blocks * dev->_blockSize, 0);
+    }
+};
+
+// Submit every read under one plug and wait for all of them, so reads on
+// different devices overlap.
+void _readAll(Slice<_Read*> reads) {
+    Atomic<usize> pending { 0 };
+
+    for (auto* read : reads) {
+        usize bs    = read->dev->_blockSize;
+        usize limit = max(read->dev->maxBlocks(), 1uz) * bs;
+        for (usize pos = 0; pos < read->buf.len(); pos += limit) {
+            usize      len = min(read->buf.len() - pos, limit);
+            BlkRequest req {
+                .dev   = &*read->dev,
+                .op    = BlkRequest::Op::Read,
+                .lba   = read->lba + pos / bs,
+                .count = len / bs,
+                .segs  = {},
+                .fn    = [](BlkRequest& req, Res<> res) {
+                    auto* read = static_cast<_Read*>(req.ctx);
+                    if (not res)
+                        read->_failed.store(true);
+                    read->_pending->fetchSub(1, Release);
+                },
+                .ctx   = read,
+            };
+            req.segs.pushBack(slice(read->buf, pos, pos + len));
+            read->_reqs.pushBack(::move(req));
+        }
+        read->_pending = &pending;
+        pending.fetchAdd(read->_reqs.len());
+    }
+
+    {
+        BlkPlug plug;
+        for (auto* read : reads) {
+            for (auto& req : read->_reqs)
+                blkSubmit(req);
+        }
+    }
+
+    while (pending.load(Acquire)) {
+        for (auto* read : reads)
+            read->dev->poll();
+        _Embed::relaxe();
+    }
+}
+
+Res<> _read(Rc<StorDev> const& dev, u64 lba, usize blocks, Vec<u8>& out) {
+    _Read  read { dev, lba, blocks };
+    _Read* reads[] = { &read };
+    _readAll({ reads, 1 });
+    if (read._failed.load())
+        return Error::invalidData("scanVolumes: i/o failed");
+
+    out = ::move(read.buf);
+    return Ok();
+}
+
+// Blocks `[lba, lba + blocks)`, from `head` when it has them.
+Res<Bytes> _blocks(Rc<StorDev> const& dev,
+                   Bytes              head,
+                   u64                lba,
+                   usize              blocks,
+                   Vec<u8>&           backing) {
+    usize bs = dev->_blockSize;
+    if ((lba + blocks) * bs <= head.len())
+        return Ok(slice(head, lba * bs, (lba + blocks) * bs));
+
+    try$(_read(dev, lba, blocks, backing));
+    return Ok(Bytes(backing));
+}
+
+// MARK: - Tables --------------------------------------------------------------
+
+bool _gptHeader(Bytes block, u64 lba, Gpt::Table& table) {
+    memcpy(&table, block.buf(), sizeof(Gpt::Table));
+    if (table.signature != Gpt::SIGNATURE or table.lbaTable != lba)
+        return false;
+    if (table.headerSize < 92 or table.headerSize > block.len())
+        return false;
+    if (table.entrySize < sizeof(Gpt::Entry) or table.entrySize % 8)
+        return false;
+    if ((u64) table.entryCount * table.entrySize > GPT_LIMIT)
+        return false;
+
+    // The checksum covers the header with its own field zeroed.
+    Vec<u8> copy = Vec<u8>(slice(block, 0, table.headerSize));
+    memset(copy.buf() + offsetof(Gpt::Table, checksum), 0, sizeof(u32));
+    return Sdk::Crypto::crc32(copy, 0) == table.checksum;
+}
+
+// The GPT whose header is at `lba`, false if there is none or it is damaged.
+bool _gpt(Rc<StorDev> const& dev, Bytes head, u64 lba, Vec<Volume>& out) {
+    usize   bs = dev->_blockSize;
+    Vec<u8> block;
+    auto    hdr = _blocks(dev, head, lba, 1, block);
+    if (not hdr or hdr.unwrap().len() < sizeof(Gpt::Table))
+        return false;
+
+    Gpt::Table table;
+    if (not _gptHeader(hdr.unwrap(), lba, table))
+        return false;
+
+    usize   size = table.entryCount * table.entrySize;
+    Vec<u8> array;
+    auto    res = _blocks(dev, head, table.lbaEntries,
+                          alignUp(size, bs) / bs, array);
+    if (not res)
+        return false;
+    Bytes entries = slice(res.unwrap(), 0, size);
+    if (Sdk::Crypto::crc32(entries, 0) != table.checksumEntries)
+        return false;
+
+    for (usize i = 0; i < table.entryCount; i++) {
+        byte const* raw = entries.buf() + i * table.entrySize;
+
+        // Copied out field by field, nothing binds to the packed entry.
+        Gpt::Entry entry;
+        Uuid       type;
+        Uuid       uid;
+        memcpy(&entry, raw, sizeof(entry));
+        memcpy(&type, raw + offsetof(Gpt::Entry, parId), sizeof(Uuid));
+        memcpy(&uid, raw + offsetof(Gpt::Entry, uid), sizeof(Uuid));
+        if (type == Uuid::none() or entry.lbaEnd < entry.lbaBegin)
+            continue;
+
+        Volume volume {
+            .dev   = dev,
+            .uuid  = uid,
+            ._name = {},
+            .fs    = NONE,
+            .range = { entry.lbaBegin, entry.lbaEnd - entry.lbaBegin + 1 },
+        };
+
+        // Labels are UTF-16, anything past ASCII is dropped.
+        char const* label = (char const*) raw + offsetof(Gpt::Entry, name);
+        for (usize c = 0; c + 1 < sizeof(Gpt::Entry::name); c += 2) {
+            if (not label[c] and not label[c + 1])
+                break;
+            if (not label[c + 1] and label[c] > 0)
+                volume._name.pushBack(label[c]);
+        }
+        out.pushBack(::move(volume));
+    }
+    return true;
+}
+
+bool _mbr(Rc<StorDev> const& dev, Bytes head, Vec<Volume>& out) {
+    Mbr::Table table;
+    if (head.len() < sizeof(table))
+        return false;
+    memcpy(&table, head.buf(), sizeof(table));
+    if (table.signature != MBR_SIGNATURE)
+        return false;
+
+    for (usize i = 0; i < 4; i++) {
+        auto& entry = table.entries[i];
+
+        // Extended partitions and what they chain to are not looked into.
+        bool extended = entry.type == 0x05 or entry.type == 0x0F
+                     or entry.type == 0x85;
+        if (not entry.type or entry.type == MBR_GPT or extended
+            or not entry.lbaLength)
+            continue;
+
+        out.pushBack(Volume {
+            .dev   = dev,
+            .uuid  = Uuid(table.diskIdentifier, 0, 0, 0, i + 1),
+            ._name = {},
+            .fs    = NONE,
+            .range = { entry.lbaBegin, entry.lbaLength },
+        });
+    }
+    return true;
+}
+
+void _table(_Read& read, Vec<Volume>& out) {
+    auto& dev = read.dev;
+    if (_gpt(dev, read.buf, 1, out))
+        return;
+
+    // The backup header sits in the last block, its array right before.
+    if (dev->_blockCount and _gpt(dev, read.buf, dev->_blockCount - 1, out))
+        return;
+
+    _mbr(dev, read.buf, out);
+}
+
+// MARK: - Probes --------------------------------------------------------------
+
+bool _ext2Match(Bytes head) {
+    usize at = ext2::SUPERBLK_OFFSET + offsetof(ext2::Superblk, magic);
+    u16   magic;
+    if (head.len() < at + sizeof(magic))
+        return false;
+    memcpy(&magic, head.buf() + at, sizeof(magic));
+    return magic == ext2::MAGIC;
+}
+
+Res<Rc<Fs>> _ext2Mount(Rc<StorDev> dev, usize offset) {
+    return Ok(Rc<Fs>(try$(Ext2Fs::mount(dev, offset))));
+}
+
+VolumeProbe const BUILTIN[] = {
+    { "ext2", _ext2Match, _ext2Mount },
+};
+
+} // namespace
+
+void volumeProbe(VolumeProbe probe) {
+    LockScoped lk(_lock);
+    _probes.pushBack(probe);
+}
+
+Vec<Volume> scanVolumes(Slice<Rc<StorDev>> disks) {
+    Vec<Volume> volumes;
+
+    // Block 0 through the usual GPT array of every disk in one go, which
+    // is all most of them need.
+    Vec<_Read*> tables;
+    for (auto& dev : disks) {
+        usize bs     = dev->_blockSize;
+        usize blocks = 2 + alignUp(GPT_ARRAY, bs) / bs;
+        if (dev->_blockCount)
+            blocks = min(blocks, dev->_blockCount);
+        if (blocks)
+            tables.pushBack(new _Read(dev, 0, blocks));
+    }
+    _readAll(slice(tables));
+
+    for (auto* read : tables) {
+        if (not read->_failed.load())
+            _table(*read, volumes);
+        delete read;
+    }
+
+    // Then the head of every partition, wherever it is, in another.
+    Vec<_Read*> heads;
+    for (auto& volume : volumes) {
+        usize bs     = volume.dev->_blockSize;
+        usize blocks = alignUp(VolumeProbe::HEAD, bs) / bs;
+        heads.pushBack(new _Read(volume.dev, volume.range.start(),
+                                 min(blocks, volume.range.size())));
+    }
+    _readAll(slice(heads));
+
+    Vec<VolumeProbe> probes;
+    {
+        LockScoped lk(_lock);
+        for (usize i = _probes.len(); i > 0; i--)
+            probes.pushBack(_probes[i - 1]);
+    }
+    for (auto& probe : BUILTIN)
+        probes.pushBack(probe);
+
+    // A driver turning a partition down leaves it to the next one.
+    for (usize i = 0; i < volumes.len(); i++) {
+        auto& volume = volumes[i];
+        auto* head   = heads[i];
+        for (auto& probe : probes) {
+            if (head->_failed.load() or not probe.match(head->buf))
+                continue;
+
+            usize offset = volume.range.start() * volume.dev->_blockSize;
+            if (auto fs = probe.mount(volume.dev, offset)) {
+                volume.fs = fs.unwrap();
+                break;
+            }
+        }
+        delete head;
+    }
+    return volumes;
+}
+
+} // namespace Realms::Sys::Io
+
+namespace Realms::Sys {
+
+namespace {
+
+Vec<Io::Volume> _volumes; // Found at boot, keeps their filesystems mounted
+
+} // namespace
+
+Res<usize> setupVolumes() {
+    auto tree = devtree();
+    if (not tree) {
+        return Error::notFound("setupVolumes: no device tree");
+    }
+
+    // Every storage drive is a StorDev, whichever driver added it. Sharing
+    // the tree's references is safe while the boot processor runs alone.
+    Vec<Rc<Io::StorDev>> disks;
+    auto* entry
+        = tree->_types[(usize) Io::Dev::Type::StorageDrive].load(Acquire);
+    for (; entry; entry = entry->nextOfType)
+        disks.pushBack(Rc<Io::StorDev>(MOVE, entry->dev._cell));
+
+    _volumes = Io::scanVolumes(slice(disks));
+    return Ok(_volumes.len());
+}
+
+} // namespace Realms::Sys
@@ -1,19 +1,61 @@
 #pragma once
 
+#include <realms/io/dev.stor.h>
 #include <realms/io/fs.h>
+#include <sdk-meta/opt.h>
 #include <sdk-meta/range.h>
+#include <sdk-meta/slice.h>
 #include <sdk-meta/types.h>
 #include <sdk-meta/uuid.h>
+#include <sdk-meta/vec.h>
 #include <sdk-text/str.h>
 
 namespace Realms::Sys::Io {
 
+/**
+ * @brief A partition of a disk, with the filesystem found on it.
+ */
 struct Volume {
-    Str    name;
-    Uuid   uuid;
-    Rc<Fs> fs;
+    Rc<StorDev> dev;
+    Uuid        uuid;  // The GPT one, or disk signature and number for MBR
+    Vec<char>   _name; // The GPT label, empty for MBR
+    Opt<Rc<Fs>> fs = NONE;
 
     Range<usize, struct _LbaRangeTag> range;
+
+    Str name() const { return { _name.buf(), _name.len() }; }
+};
+
+/**
+ * @brief A filesystem driver the scanner may hand partitions to.
+ */
+struct VolumeProbe {
+    static constexpr usize HEAD = 4096; // Bytes read from each partition
+
+    Str name;
+
+    /**
+     * @brief Whether `head`, the start of a partition, has the driver's
+     * superblock. Cheap, every probe sees every partition.
+     */
+    bool (*match)(Bytes head);
+
+    Res<Rc<Fs>> (*mount)(Rc<StorDev> dev, usize offset);
 };
 
+/**
+ * @brief Make `probe` available to later scans, before the built-in ones.
+ */
+void volumeProbe(VolumeProbe probe);
+
+/**
+ * @brief Find the partitions of `disks`, from the GPT or else the MBR, and
+ * mount what is on them.
+ *
+ * The partition tables of every disk are read in one batch, then the heads
+ * of every partition in another, so the time spent waiting on the devices
+ * does not grow with their number. Unreadable disks are skipped.
+ */
+Vec<Volume> scanVolumes(Slice<Rc<StorDev>> disks);
+
 } // namespace Realms::Sys::Io
@@ -0,0 +1,205 @@
+#include <realms/hal/arch.h>
+#include <realms/tasks/rcu.h>
+#include <sdk-meta/_embed.h>
+#include <sdk-meta/array.h>
+#include <sdk-meta/lock.h>
+
+namespace Realms::Sys {
+
+namespace {
+
+static constexpr usize MAX_CPUS = 256;
+
+// Each processor only ever writes its own line, readers of the grace period
+// state touch them on the slow path only.
+struct alignas(64) _RcuCpu {
+    u64          nesting = 0;
+    Atomic<u64>  seen { 0 };
+    Atomic<bool> idle { false };
+    Atomic<bool> online { false }; // Halted processors are left out
+};
+
+Array<_RcuCpu, MAX_CPUS> _cpus {};
+
+Atomic<u64> _gp { 0 };        // latest started grace period
+Atomic<u64> _completed { 0 }; // latest completed grace period
+
+Atomic<bool> _started { false }; // A processor went online
+
+Lock     _lock;
+RcuHead* _head  = nullptr;
+RcuHead* _tail  = nullptr;
+RcuHead* _ready = nullptr; // Past their grace period, waiting to run
+RcuHead* _last  = nullptr;
+
+bool _allQuiescent(u64 gp) {
+    for (usize i = 0; i < Hal::cpuCount(); i++) {
+        if (not _cpus[i].online.load(Acquire) or _cpus[i].idle.load(Acquire))
+            continue;
+        if (_cpus[i].seen.load(Acquire) < gp)
+            return false;
+    }
+    return true;
+}
+
+// Called with `_lock` held. Move the callbacks whose grace period has
+// completed to the ready list, and start a new grace period for the
+// remaining ones.
+void _advance() {
+    u64 gp = _gp.load();
+    if (_completed.load() < gp and _allQuiescent(gp))
+        _completed.store(gp);
+
+    u64 done = _completed.load();
+    while (_head and _head->_gp <= done) {
+        RcuHead* n = _head;
+        _head      = n->_next;
+        n->_next   = nullptr;
+
+        if (_last)
+            _last->_next = n;
+        else
+            _ready = n;
+        _last = n;
+    }
+
+    if (_head == nullptr)
+        _tail = nullptr;
+    else if (done == gp)
+        _gp.store(gp + 1);
+}
+
+void _invoke(RcuHead* list) {
+    while (list) {
+        RcuHead* n = list->_next;
+        list->_fn(*list);
+        list = n;
+    }
+}
+
+} // namespace
+
+void rcuReadLock() {
+    auto& cpu = _cpus[Hal::cpuId()];
+
+    // An interrupt taken while idle must not be treated as quiescent.
+    if (cpu.idle.load(Relaxed)) [[unlikely]]
+        cpu.idle.xchg(false);
+
+    cpu.nesting++;
+    signalfence();
+}
+
+void rcuReadUnlock() {
+    signalfence();
+    _cpus[Hal::cpuId()].nesting--;
+}
+
+void rcuQuiescent() {
+    auto& cpu = _cpus[Hal::cpuId()];
+    if (cpu.nesting)
+        return;
+
+    cpu.seen.store(_gp.load(Acquire), Release);
+
+    // Nothing to do unless someone is waiting for a grace period.
+    if (_completed.load(Relaxed) == _gp.load(Relaxed))
+        return;
+
+    // Callbacks free memory and take locks, they are left for
+    // rcuCallbacks() since this may run in an interrupt handler.
+    if (not _lock.tryAcquire())
+        return;
+    _advance();
+    _lock.release();
+}
+
+void rcuCallbacks() {
+    rcuQuiescent();
+
+    RcuHead* ready;
+    {
+        LockScoped lk(_lock);
+        ready  = _ready;
+        _ready = nullptr;
+        _last  = nullptr;
+    }
+    _invoke(ready);
+}
+
+void rcuOnline() {
+    auto& cpu = _cpus[Hal::cpuId()];
+    cpu.seen.store(_gp.load(Acquire), Release);
+    cpu.online.store(true, Release);
+    _started.store(true, Release);
+}
+
+void rcuOffline() {
+    auto& cpu = _cpus[Hal::cpuId()];
+    cpu.seen.store(_gp.load(Acquire), Release);
+    cpu.online.store(false, Release);
+}
+
+void rcuIdleEnter() {
+    auto& cpu = _cpus[Hal::cpuId()];
+    cpu.seen.store(_gp.load(Acquire), Release);
+    cpu.idle.store(true, Release);
+}
+
+void rcuIdleExit() {
+    _cpus[Hal::cpuId()].idle.store(false, Release);
+}
+
+void callRcu(RcuHead& head, void (*fn)(RcuHead& head)) {
+    // Before the first processor comes online, from static constructors,
+    // nothing can be reading yet.
+    if (not _started.load(Acquire)) {
+        fn(head);
+        return;
+    }
+
+    head._fn   = fn;
+    head._next = nullptr;
+
+    {
+        LockScoped lk(_lock);
+
+        // The callback needs a grace period that starts after now. If one
+        // is already running it may have been observed before our unlink,
+        // so wait for the next one.
+        u64 gp = _gp.load();
+        if (_completed.load() == gp)
+            _gp.store(++gp);
+        else
+            gp++;
+        head._gp = gp;
+
+        if (_tail)
+            _tail->_next = &head;
+        else
+            _head = &head;
+        _tail = &head;
+    }
+
+    // Outside a read-side section the caller is quiescent already. Without
+    // clock events this is what moves grace periods along, each retirement
+    // reaping the ones before it.
+    rcuCallbacks();
+}
+
+void synchronizeRcu() {
+    struct _Waiter : RcuHead {
+        Atomic<bool> done { false };
+    } waiter;
+
+    callRcu(waiter, [](RcuHead& head) {
+        static_cast<_Waiter&>(head).done.store(true, Release);
+    });
+
+    while (not waiter.done.load(Acquire)) {
+        rcuCallbacks();
+        _Embed::relaxe();
+    }
+}
+
+} // namespace Realms::Sys
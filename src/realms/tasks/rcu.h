@@ -0,0 +1,137 @@
+#pragma once
+
+#include <sdk-meta/atomic.h>
+#include <sdk-meta/traits.h>
+#include <sdk-meta/types.h>
+
+namespace Realms::Sys {
+
+/**
+ * Read-copy-update, quiescent state based.
+ *
+ * Readers never write shared memory: entering a read-side critical section
+ * only bumps a nesting counter owned by the current processor. Writers
+ * publish a new version with `RcuPtr::publish` and hand the old one to
+ * `callRcu`, which runs once every processor has gone through a quiescent
+ * state, that is a point where it cannot hold any reference obtained inside
+ * a read-side critical section.
+ *
+ * Quiescent states are reported by `rcuQuiescent` from the clock event and
+ * context switch paths, and processors sitting in `rcuIdleEnter` are treated
+ * as quiescent so a tickless idle processor never holds up a grace period.
+ * Only processors between `rcuOnline` and `rcuOffline` are waited for.
+ * Callbacks never run from those paths, which may be interrupt handlers:
+ * `rcuCallbacks` runs them, from `callRcu`, `synchronizeRcu` and the end of
+ * a sleep.
+ */
+
+struct RcuHead {
+    RcuHead* _next = nullptr;
+    u64      _gp   = 0;
+    void (*_fn)(RcuHead& head) = nullptr;
+};
+
+void rcuReadLock();
+
+void rcuReadUnlock();
+
+/**
+ * @brief Report that the current processor holds no RCU reference.
+ *
+ * Also completes the current grace period if this processor was the last
+ * one holding it up, and queues the callbacks that became ready. Safe in
+ * interrupt context.
+ */
+void rcuQuiescent();
+
+/**
+ * @brief Report a quiescent state, then run the callbacks whose grace
+ * period has completed. Must not be called from an interrupt handler or
+ * with a lock a callback may take.
+ */
+void rcuCallbacks();
+
+/**
+ * @brief Make the current processor take part in grace periods, before it
+ * enters its first read-side critical section.
+ */
+void rcuOnline();
+
+/**
+ * @brief Stop waiting for the current processor, which must hold no RCU
+ * reference and enter no read-side section until back online. Called before
+ * it halts for good.
+ */
+void rcuOffline();
+
+void rcuIdleEnter();
+
+void rcuIdleExit();
+
+/**
+ * @brief Run `fn(head)` after a full grace period. `head` must stay valid
+ * until then, it is usually embedded in the object being reclaimed.
+ */
+void callRcu(RcuHead& head, void (*fn)(RcuHead& head));
+
+/**
+ * @brief Wait for a full grace period. Must not be called from a read-side
+ * critical section.
+ */
+void synchronizeRcu();
+
+struct [[nodiscard]] RcuReadScope : Meta::Pinned {
+    [[gnu::always_inline]] RcuReadScope() { rcuReadLock(); }
+
+    [[gnu::always_inline]] ~RcuReadScope() { rcuReadUnlock(); }
+};
+
+/**
+ * @brief A pointer to an RCU protected object.
+ *
+ * `load` is only valid inside a read-side critical section or while holding
+ * the update-side lock of the structure.
+ */
+template <typename T>
+struct RcuPtr {
+    Atomic<T*> _ptr { nullptr };
+
+    RcuPtr() = default;
+
+    RcuPtr(T* ptr) : _ptr(ptr) { }
+
+    [[gnu::always_inline]] T* load() { return _ptr.load(Acquire); }
+
+    [[gnu::always_inline]] T* operator->() { return load(); }
+
+    [[gnu::always_inline]] T& operator*() { return *load(); }
+
+    /**
+     * @brief Make `ptr` visible to readers, returning the previous version.
+     */
+    [[gnu::always_inline]] T* publish(T* ptr) {
+        return _ptr.xchg(ptr, AcquireRelease);
+    }
+};
+
+/**
+ * @brief Delete `ptr` once no reader can still see it.
+ */
+template <typename T>
+void retireRcu(T* ptr) {
+    struct _Retired : RcuHead {
+        T* ptr;
+    };
+
+    if (ptr == nullptr)
+        return;
+
+    auto* retired = new _Retired { {}, ptr };
+    callRcu(*retired, [](RcuHead& head) {
+        auto* r = static_cast<_Retired*>(&head);
+        delete r->ptr;
+        delete r;
+    });
+}
+
+} // namespace Realms::Sys
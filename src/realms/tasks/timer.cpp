@@ -0,0 +1,208 @@
+#include <realms/hal/arch.h>
+#include <realms/hal/clock.h>
+#include <realms/tasks/rcu.h>
+#include <realms/tasks/timer.h>
+#include <sdk-meta/atomic.h>
+#include <sdk-meta/box.h>
+
+namespace Realms::Sys {
+
+namespace {
+
+Vec<Box<TimerQueue>> _queues; // Filled once by setupTimerQueues()
+
+TimerQueue& _queueOf(usize cpu) {
+    return *_queues[cpu];
+}
+
+Res<> _rearm(TimerQueue& queue) {
+    auto* event = try$(Hal::clockEvent());
+    auto  next  = queue.earliest();
+    if (not next)
+        return event->disarm();
+    return event->arm(*next);
+}
+
+} // namespace
+
+// MARK: - TimerQueue
+
+void TimerQueue::_swap(usize i, usize j) {
+    swap(_heap[i], _heap[j]);
+    _heap[i]->_index = i;
+    _heap[j]->_index = j;
+}
+
+void TimerQueue::_up(usize i) {
+    while (i > 0) {
+        usize parent = (i - 1) / 2;
+        if (_heap[parent]->deadline <= _heap[i]->deadline)
+            break;
+        _swap(i, parent);
+        i = parent;
+    }
+}
+
+void TimerQueue::_down(usize i) {
+    while (true) {
+        usize l = i * 2 + 1, r = l + 1, min = i;
+        if (l < _heap.len() and _heap[l]->deadline < _heap[min]->deadline)
+            min = l;
+        if (r < _heap.len() and _heap[r]->deadline < _heap[min]->deadline)
+            min = r;
+        if (min == i)
+            break;
+        _swap(i, min);
+        i = min;
+    }
+}
+
+void TimerQueue::push(Timer& timer) {
+    timer._index = _heap.len();
+    _heap.pushBack(&timer);
+    _up(timer._index);
+}
+
+bool TimerQueue::remove(Timer& timer) {
+    usize i = timer._index;
+    if (i >= _heap.len() or _heap[i] != &timer)
+        return false;
+
+    usize last = _heap.len() - 1;
+    if (i != last) {
+        _swap(i, last);
+    }
+    _heap.popBack();
+    timer._index = Timer::NPOS;
+
+    if (i < _heap.len()) {
+        _up(i);
+        _down(i);
+    }
+    return true;
+}
+
+Opt<Instant> TimerQueue::earliest() const {
+    if (_heap.len() == 0)
+        return NONE;
+    return _heap[0]->deadline;
+}
+
+Opt<Timer&> TimerQueue::pop(Instant now) {
+    if (_heap.len() == 0 or _heap[0]->deadline > now)
+        return NONE;
+
+    Timer& timer = *_heap[0];
+    remove(timer);
+    return timer;
+}
+
+// MARK: - Api
+
+void setupTimerQueues(usize cpus) {
+    for (usize i = 0; i < max(cpus, 1uz); i++)
+        _queues.pushBack(makeBox<TimerQueue>());
+}
+
+Res<> addTimer(Timer& timer, Opt<usize> cpu) {
+    if (timer.pending()) {
+        return Error::invalidState("addTimer: timer already pending");
+    }
+
+    usize target = cpu.unwrapOrElse(Hal::cpuId());
+    auto& queue  = _queueOf(target);
+
+    _Embed::enterCritical();
+    queue._lock.acquire();
+
+    timer._cpu = target;
+    queue.push(timer);
+
+    // Only touch the event device when the new timer became the earliest
+    // one. The device of a remote processor can only be programmed from
+    // there, so it is interrupted to re-arm itself.
+    bool  earliest = queue._heap[0] == &timer;
+    bool  local    = target == Hal::cpuId();
+    Res<> res      = Ok();
+    if (earliest and local)
+        res = _rearm(queue);
+
+    queue._lock.release();
+    _Embed::leaveCritical();
+
+    if (earliest and not local)
+        res = Hal::clockKick(target);
+    return res;
+}
+
+bool cancelTimer(Timer& timer) {
+    if (timer._cpu == Timer::NPOS)
+        return false;
+
+    auto& queue = _queueOf(timer._cpu);
+
+    _Embed::enterCritical();
+    queue._lock.acquire();
+    bool removed = queue.remove(timer);
+    queue._lock.release();
+    _Embed::leaveCritical();
+
+    return removed;
+}
+
+void onClockEvent() {
+    auto& queue = _queueOf(Hal::cpuId());
+
+    queue._lock.acquire();
+    while (auto timer = queue.pop(Hal::clock())) {
+        // Callbacks may re-add themselves, so they must run unlocked.
+        queue._lock.release();
+        timer->fn(*timer, timer->ctx);
+        queue._lock.acquire();
+    }
+    (void) _rearm(queue);
+    queue._lock.release();
+
+    rcuQuiescent();
+}
+
+void delay(TimeSpan span) {
+    Instant end = Hal::clock() + span;
+    while (Hal::clock() < end)
+        _Embed::relaxe();
+}
+
+Res<> sleep(TimeSpan span) {
+    Atomic<bool> fired { false };
+
+    Timer timer {
+        .deadline = Hal::clock() + span,
+        .fn       = [](Timer&, void* ctx) {
+            static_cast<Atomic<bool>*>(ctx)->store(true);
+        },
+        .ctx      = &fired,
+    };
+    try$(addTimer(timer));
+
+    while (true) {
+        // The check runs with interrupts off and idle() enables them in the
+        // same instruction that halts, so the timer cannot fire in between
+        // and leave the processor halted.
+        _Embed::enterCritical();
+        if (fired.load()) {
+            _Embed::leaveCritical();
+            break;
+        }
+
+        rcuIdleEnter();
+        Hal::idle();
+        rcuIdleExit();
+        _Embed::leaveCritical();
+    }
+
+    // The clock interrupt only queues what became ready while asleep.
+    rcuCallbacks();
+    return Ok();
+}
+
+} // namespace Realms::Sys
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <sdk-meta/lock.h>
+#include <sdk-meta/opt.h>
+#include <sdk-meta/res.h>
+#include <sdk-meta/time.h>
+#include <sdk-meta/types.h>
+#include <sdk-meta/vec.h>
+
+namespace Realms::Sys {
+
+struct Timer {
+    static constexpr usize NPOS = ~0uz;
+
+    Instant deadline;
+    void (*fn)(Timer& timer, void* ctx);
+    void* ctx;
+
+    usize _cpu   = NPOS;
+    usize _index = NPOS;
+
+    bool pending() const { return _index != NPOS; }
+};
+
+/**
+ * @brief Pending timers of one processor, kept as a binary min-heap on the
+ * deadline.
+ *
+ * Only the earliest deadline is ever programmed into the clock event device,
+ * so an idle processor with no timers takes no interrupt at all.
+ */
+struct TimerQueue {
+    Lock        _lock;
+    Vec<Timer*> _heap;
+
+    void push(Timer& timer);
+
+    bool remove(Timer& timer);
+
+    Opt<Instant> earliest() const;
+
+    /**
+     * @brief Pop every timer whose deadline is not after `now`.
+     */
+    Opt<Timer&> pop(Instant now);
+
+    void _swap(usize i, usize j);
+
+    void _up(usize i);
+
+    void _down(usize i);
+};
+
+/**
+ * @brief Create the timer queue of each of `cpus` processors, before any
+ * timer is added.
+ */
+void setupTimerQueues(usize cpus);
+
+/**
+ * @brief Queue `timer` on processor `cpu`, or on the caller's processor.
+ *
+ * @retval Error::invalidState if the timer is already pending.
+ */
+Res<> addTimer(Timer& timer, Opt<usize> cpu = NONE);
+
+/**
+ * @return true if the timer was pending and got removed before firing.
+ */
+bool cancelTimer(Timer& timer);
+
+/**
+ * @brief Run expired timers of the current processor and re-arm its clock
+ * event device for the next deadline, called from the timer interrupt.
+ */
+void onClockEvent();
+
+/**
+ * @brief Busy wait, for use before interrupts are available.
+ */
+void delay(TimeSpan span);
+
+/**
+ * @brief Halt the processor until `span` has elapsed.
+ */
+Res<> sleep(TimeSpan span);
+
+} // namespace Realms::Sys